@@ -102,6 +102,9 @@ inline std::wstring ConsoleReadLine()
 inline void PrintProgressBar(size_t done, size_t total, size_t barWidth)
 {
 	std::wcout << "Progress: " << std::setfill(L' ') << std::setw(7) << done << '/' << std::setw(7) << total << ' ';
+	// nothing to do counts as done
+	if (total == 0)
+		done = total = 1;
 	size_t filled = barWidth * done / total;
 	std::wcout << '[';
 	if (filled > 0)std::wcout << std::setfill(L'#') << std::setw(filled) << '#';
@@ -271,3 +271,52 @@ std::vector<std::wstring> Deduplicate(const std::vector<std::wstring>& input, co
 
 	return ret;
 }
+
+std::vector<sfh::FontDatabase::FontFaceElement> DeduplicateFaces(
+	std::vector<sfh::FontDatabase::FontFaceElement>&& faces,
+	const sfh::StringPool& strings,
+	const std::vector<FaceFingerprint>& fingerprints)
+{
+	assert(faces.size() == fingerprints.size());
+
+	std::vector<size_t> order;
+	order.reserve(faces.size());
+	for (size_t idx = 0; idx < faces.size(); ++idx)
+	{
+		if (fingerprints[idx].valid)
+			order.push_back(idx);
+	}
+
+	// group equivalent faces together, the preferred candidate of each group comes first:
+	// fewer faces in the containing file means less memory when GDI loads it
+	std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs)
+	{
+		int cmp = memcmp(fingerprints[lhs].digest, fingerprints[rhs].digest, FaceFingerprint::DIGEST_LENGTH);
+		if (cmp != 0)
+			return cmp < 0;
+		if (fingerprints[lhs].faceCount != fingerprints[rhs].faceCount)
+			return fingerprints[lhs].faceCount < fingerprints[rhs].faceCount;
+		if (faces[lhs].m_directory != faces[rhs].m_directory)
+			return strings.Get(faces[lhs].m_directory) < strings.Get(faces[rhs].m_directory);
+		if (faces[lhs].m_fileName != faces[rhs].m_fileName)
+			return strings.Get(faces[lhs].m_fileName) < strings.Get(faces[rhs].m_fileName);
+		return faces[lhs].m_index < faces[rhs].m_index;
+	});
+
+	std::vector<char> discard(faces.size(), 0);
+	for (size_t i = 1; i < order.size(); ++i)
+	{
+		if (memcmp(fingerprints[order[i - 1]].digest, fingerprints[order[i]].digest,
+		           FaceFingerprint::DIGEST_LENGTH) == 0)
+			discard[order[i]] = 1;
+	}
+
+	std::vector<sfh::FontDatabase::FontFaceElement> ret;
+	ret.reserve(faces.size());
+	for (size_t idx = 0; idx < faces.size(); ++idx)
+	{
+		if (!discard[idx])
+			ret.emplace_back(std::move(faces[idx]));
+	}
+	return ret;
+}
@@ -1,8 +1,24 @@
 #pragma once
 
 #include "Common.h"
+#include "PersistantData.h"
 
 #include <string>
 #include <vector>
 
+struct FaceFingerprint
+{
+	static constexpr size_t DIGEST_LENGTH = 20;
+
+	uint8_t digest[DIGEST_LENGTH];
+	// fonts without outline tables can't be fingerprinted reliably
+	bool valid = false;
+	// number of faces in the containing file, standalone files are preferred when collapsing
+	uint32_t faceCount = 0;
+};
+
 std::vector<std::wstring> Deduplicate(const std::vector<std::wstring>& input, const std::vector<uint64_t>& inputSize, std::atomic<size_t>& progress);
+
+std::vector<sfh::FontDatabase::FontFaceElement> DeduplicateFaces(std::vector<sfh::FontDatabase::FontFaceElement>&& faces,
+                                                                 const sfh::StringPool& strings,
+                                                                 const std::vector<FaceFingerprint>& fingerprints);
@@ -1,5 +1,9 @@
 #include "FontAnalyzer.h"
 #include "Win32Helper.h"
+#include "SfntReader.h"
+
+#include <bcrypt.h>
+#pragma comment(lib, "Bcrypt.lib")
 
 #include <ft2build.h>
 
@@ -8,18 +12,24 @@
 #include FT_TRUETYPE_IDS_H
 #include FT_SFNT_NAMES_H
 #include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
 #include FT_TYPE1_TABLES_H
 
 class FontAnalyzer::Implementation
 {
 private:
 	std::vector<unsigned char> m_buffer;
+	std::vector<unsigned char> m_tableBuffer;
+
+	wil::unique_bcrypt_algorithm m_hashAlg;
+	wil::unique_bcrypt_hash m_hash;
+	std::unique_ptr<uint8_t[]> m_hashObject;
 
-	std::wstring ConvertMBCSName(const FT_SfntName& name)
+	std::wstring ConvertMBCSName(uint16_t encodingId, const uint8_t* string, uint32_t stringLength)
 	{
-		if (name.string_len == 0)return {};
+		if (stringLength == 0)return {};
 		UINT codePage;
-		switch (name.encoding_id)
+		switch (encodingId)
 		{
 		case TT_MS_ID_BIG_5:
 			codePage = 950;
@@ -35,13 +45,13 @@ private:
 		}
 
 		m_buffer.clear();
-		for (FT_UInt i = 0; i < name.string_len - 1; i += 2)
+		for (uint32_t i = 0; i < stringLength - 1; i += 2)
 		{
-			if (name.string[i])
+			if (string[i])
 			{
-				m_buffer.push_back(name.string[i]);
+				m_buffer.push_back(string[i]);
 			}
-			m_buffer.push_back(name.string[i + 1]);
+			m_buffer.push_back(string[i + 1]);
 		}
 
 		int length = MultiByteToWideChar(
@@ -68,47 +78,263 @@ private:
 		return ret;
 	}
 
-	static std::wstring ConvertUtf16BEName(const FT_SfntName& name)
+	static std::wstring ConvertUtf16BEName(const uint8_t* string, uint32_t stringLength)
 	{
-		size_t length = name.string_len / 2;
-		std::wstring ret(length, 0);
-		memcpy(ret.data(), name.string, length * sizeof(wchar_t));
-		// all x86 systems use little endian
-		std::transform(ret.begin(), ret.end(), ret.begin(), _byteswap_ushort);
-		return ret;
+		return sfh::Transcode::Utf16BEToWide(string, stringLength / 2);
 	}
 
-	std::wstring ConvertSfntName(const FT_SfntName& name)
+	std::wstring ConvertSfntName(uint16_t encodingId, const uint8_t* string, uint32_t stringLength)
 	{
-		switch (name.encoding_id)
+		switch (encodingId)
 		{
 		case TT_MS_ID_BIG_5:
 		case TT_MS_ID_GB2312:
 		case TT_MS_ID_WANSUNG:
-			return ConvertMBCSName(name);
+			return ConvertMBCSName(encodingId, string, stringLength);
 		default:
-			return ConvertUtf16BEName(name);
+			return ConvertUtf16BEName(string, stringLength);
 		}
 	}
 
-public:
-	FT_Library m_lib;
+	void AddSfntName(sfh::StringPool& strings, sfh::FontDatabase::FontFaceElement& faceElement, uint16_t platformId,
+	                 uint16_t encodingId, uint16_t nameId, const uint8_t* string, uint32_t stringLength)
+	{
+		// we are only interested following names:
+		//  - Win32FontFamilyName
+		//  - FullName
+		//  - PostScriptName
+		//  - TypographicFamilyName/TypographicSubfamilyName
 
-	Implementation()
+		// filter out non-microsoft names
+		if (platformId != TT_PLATFORM_MICROSOFT)
+			return;
+
+		sfh::FontDatabase::FontFaceElement::NameElement::NameType nameType;
+
+		switch (nameId)
+		{
+		case TT_NAME_ID_FONT_FAMILY:
+			nameType = sfh::FontDatabase::FontFaceElement::NameElement::Win32FamilyName;
+			break;
+		case TT_NAME_ID_FULL_NAME:
+			nameType = sfh::FontDatabase::FontFaceElement::NameElement::FullName;
+			break;
+		case TT_NAME_ID_PS_NAME:
+			nameType = sfh::FontDatabase::FontFaceElement::NameElement::PostScriptName;
+			break;
+		case TT_NAME_ID_TYPOGRAPHIC_FAMILY:
+			nameType = sfh::FontDatabase::FontFaceElement::NameElement::TypographicFamilyName;
+			break;
+		case TT_NAME_ID_TYPOGRAPHIC_SUBFAMILY:
+			nameType = sfh::FontDatabase::FontFaceElement::NameElement::TypographicSubfamilyName;
+			break;
+		default:
+			return;
+		}
+
+		try
+		{
+			faceElement.m_names.emplace_back(nameType,
+			                                 strings.Intern(ConvertSfntName(encodingId, string, stringLength)));
+		}
+		catch (...)
+		{
+			// ignore exception, discarding this name
+		}
+	}
+
+	static void SortNames(const sfh::StringPool& strings, sfh::FontDatabase::FontFaceElement& faceElement)
 	{
-		m_buffer.reserve(1024);
-		FT_Init_FreeType(&m_lib);
+		// order by content rather than id, the stable id depends on it
+		std::sort(faceElement.m_names.begin(), faceElement.m_names.end(), [&](auto& lhs, auto& rhs)
+		{
+			if (lhs.m_type == rhs.m_type)
+				return strings.Get(lhs.m_name) < strings.Get(rhs.m_name);
+			return lhs.m_type < rhs.m_type;
+		});
+		faceElement.m_names.erase(
+			std::unique(faceElement.m_names.begin(), faceElement.m_names.end()),
+			faceElement.m_names.end());
 	}
 
-	~Implementation()
+	// 64-bit FNV-1a over what identifies the face, independent of the file's location
+	static uint64_t CalculateStableId(const sfh::StringPool& strings,
+	                                  const sfh::FontDatabase::FontFaceElement& faceElement)
 	{
-		FT_Done_FreeType(m_lib);
+		uint64_t hash = 0xcbf29ce484222325;
+		auto update = [&](const void* data, size_t length)
+		{
+			auto bytes = static_cast<const uint8_t*>(data);
+			for (size_t i = 0; i < length; ++i)
+			{
+				hash ^= bytes[i];
+				hash *= 0x100000001b3;
+			}
+		};
+		update(&faceElement.m_weight, sizeof(faceElement.m_weight));
+		update(&faceElement.m_width, sizeof(faceElement.m_width));
+		update(&faceElement.m_oblique, sizeof(faceElement.m_oblique));
+		update(&faceElement.m_psOutline, sizeof(faceElement.m_psOutline));
+		for (auto& name : faceElement.m_names)
+		{
+			uint32_t type = static_cast<uint32_t>(name.m_type);
+			update(&type, sizeof(type));
+			auto string = strings.Get(name.m_name);
+			update(string.data(), (string.size() + 1) * sizeof(wchar_t));
+		}
+		// 0 means unknown in the index
+		return hash ? hash : 1;
 	}
 
-	std::vector<sfh::FontDatabase::FontFaceElement> AnalyzeFontFile(const wchar_t* path)
+	void HashData(const void* data, size_t length)
+	{
+		THROW_IF_NTSTATUS_FAILED(BCryptHashData(
+			m_hash.get(),
+			static_cast<PUCHAR>(const_cast<void*>(data)),
+			static_cast<ULONG>(length),
+			0));
+	}
+
+	bool HashSfntTable(uint32_t tag, const void* data, size_t length)
+	{
+		if (data == nullptr || length == 0)
+			return false;
+		HashData(&tag, sizeof(tag));
+		HashData(data, length);
+		return true;
+	}
+
+	bool HashSfntTable(FT_Face face, FT_ULong tag)
+	{
+		FT_ULong length = 0;
+		if (FT_Load_Sfnt_Table(face, tag, 0, nullptr, &length) != 0 || length == 0)
+			return false;
+		m_tableBuffer.resize(length);
+		if (FT_Load_Sfnt_Table(face, tag, 0, m_tableBuffer.data(), &length) != 0)
+			return false;
+		return HashSfntTable(static_cast<uint32_t>(tag), m_tableBuffer.data(), length);
+	}
+
+	// equivalent faces share their outlines and the names we index,
+	// other name records (version, copyright...) are ignored on purpose
+	template <typename HashOutlines>
+	void CalculateFingerprint(HashOutlines&& hashOutlines, const sfh::StringPool& strings,
+	                          const sfh::FontDatabase::FontFaceElement& faceElement, FaceFingerprint& fingerprint)
+	{
+		fingerprint.valid = false;
+		auto doneHash = wil::scope_exit([&]()
+		{
+			// always reset the reusable hash object
+			BCryptFinishHash(m_hash.get(), fingerprint.digest, FaceFingerprint::DIGEST_LENGTH, 0);
+		});
+
+		bool hasOutline = hashOutlines();
+
+		HashData(&faceElement.m_weight, sizeof(faceElement.m_weight));
+		HashData(&faceElement.m_width, sizeof(faceElement.m_width));
+		HashData(&faceElement.m_oblique, sizeof(faceElement.m_oblique));
+		HashData(&faceElement.m_psOutline, sizeof(faceElement.m_psOutline));
+		for (auto& name : faceElement.m_names)
+		{
+			uint32_t type = static_cast<uint32_t>(name.m_type);
+			HashData(&type, sizeof(type));
+			// include the terminator to separate adjacent names
+			auto string = strings.Get(name.m_name);
+			HashData(string.data(), (string.size() + 1) * sizeof(wchar_t));
+		}
+
+		fingerprint.valid = hasOutline;
+	}
+
+	// parse the sfnt container straight from the mapped file, this skips FreeType's
+	// face object construction (charmaps, size machinery) entirely
+	void AnalyzeSfntFile(const SfntReader& reader, const wchar_t* path, sfh::StringPool& strings,
+	                     std::vector<sfh::FontDatabase::FontFaceElement>& ret,
+	                     std::vector<FaceFingerprint>* fingerprints)
+	{
+		uint32_t faceCount = reader.GetFaceCount();
+		ret.reserve(faceCount);
+		std::vector<SfntFace::NameRecord> names;
+		for (uint32_t faceIndex = 0; faceIndex < faceCount; ++faceIndex)
+		{
+			sfh::FontDatabase::FontFaceElement faceElement;
+			sfh::FontDatabase::SetPath(strings, faceElement, path);
+			faceElement.m_index = faceIndex;
+
+			auto face = reader.GetFace(faceIndex);
+			auto glyf = face.FindTable(SfntFace::TAG_GLYF);
+			auto cff = face.FindTable(SfntFace::TAG_CFF);
+			auto cff2 = face.FindTable(SfntFace::TAG_CFF2);
+
+			// style flags follow FreeType's rules, keeping results identical to the fallback path
+			SfntFace::OS2Info os2;
+			SfntFace::HeadInfo head;
+			bool hasOS2 = face.ReadOS2(os2);
+			bool hasOutline = glyf || cff || cff2;
+			bool bold, italic;
+			if (hasOutline && hasOS2)
+			{
+				italic = os2.fsSelection & (1 << 9 | 1 << 0);
+				bold = os2.fsSelection & 1 << 5;
+			}
+			else if (face.ReadHead(head))
+			{
+				italic = head.macStyle & 2;
+				bold = head.macStyle & 1;
+			}
+			else
+			{
+				throw SfntFormatError("missing head table");
+			}
+
+			if (hasOS2 && os2.weightClass)
+				faceElement.m_weight = os2.weightClass;
+			else
+				faceElement.m_weight = bold ? 700 : 300;
+
+			faceElement.m_oblique = italic ? 1 : 0;
+			faceElement.m_psOutline = cff || cff2;
+
+			if (hasOS2)
+			{
+				if (os2.widthClass)
+					faceElement.m_width = os2.widthClass;
+				faceElement.m_codePageRange1 = os2.codePageRange1;
+				faceElement.m_codePageRange2 = os2.codePageRange2;
+			}
+
+			names.clear();
+			face.ReadNames(names);
+			for (auto& name : names)
+			{
+				AddSfntName(strings, faceElement, name.platformId, name.encodingId, name.nameId, name.string, name.length);
+			}
+			SortNames(strings, faceElement);
+			faceElement.m_stableId = CalculateStableId(strings, faceElement);
+
+			if (fingerprints)
+			{
+				auto& fingerprint = fingerprints->emplace_back();
+				fingerprint.faceCount = faceCount;
+				CalculateFingerprint([&]()
+				{
+					bool hashed = false;
+					hashed |= HashSfntTable(SfntFace::TAG_GLYF, glyf.data, glyf.length);
+					hashed |= HashSfntTable(SfntFace::TAG_CFF, cff.data, cff.length);
+					hashed |= HashSfntTable(SfntFace::TAG_CFF2, cff2.data, cff2.length);
+					return hashed;
+				}, strings, faceElement, fingerprint);
+			}
+
+			ret.emplace_back(std::move(faceElement));
+		}
+	}
+
+	// fallback for fonts our sfnt reader doesn't understand
+	void AnalyzeFreeTypeFile(const FileMapping& mapping, const wchar_t* path, sfh::StringPool& strings,
+	                         std::vector<sfh::FontDatabase::FontFaceElement>& ret,
+	                         std::vector<FaceFingerprint>* fingerprints)
 	{
-		std::vector<sfh::FontDatabase::FontFaceElement> ret;
-		FileMapping mapping(path);
 		FT_Face face;
 
 		if (FT_New_Memory_Face(
@@ -126,7 +352,7 @@ public:
 		for (int faceIndex = 0; faceIndex < faceCount; ++faceIndex)
 		{
 			sfh::FontDatabase::FontFaceElement faceElement;
-			faceElement.m_path = path;
+			sfh::FontDatabase::SetPath(strings, faceElement, path);
 			faceElement.m_index = faceIndex;
 
 			if (FT_New_Memory_Face(
@@ -144,6 +370,17 @@ public:
 			else
 				faceElement.m_weight = face->style_flags & FT_STYLE_FLAG_BOLD ? 700 : 300;
 
+			if (os2 && os2->version != 0xffff)
+			{
+				if (os2->usWidthClass)
+					faceElement.m_width = os2->usWidthClass;
+				if (os2->version >= 1)
+				{
+					faceElement.m_codePageRange1 = static_cast<uint32_t>(os2->ulCodePageRange1);
+					faceElement.m_codePageRange2 = static_cast<uint32_t>(os2->ulCodePageRange2);
+				}
+			}
+
 			faceElement.m_oblique = face->style_flags & FT_STYLE_FLAG_ITALIC ? 1 : 0;
 
 			PS_FontInfoRec psInfo;
@@ -152,51 +389,94 @@ public:
 			FT_UInt nameCount = FT_Get_Sfnt_Name_Count(face);
 			for (FT_UInt nameIndex = 0; nameIndex < nameCount; ++nameIndex)
 			{
-				// we are only interested following names:
-				//  - Win32FontFamilyName
-				//  - FullName
-				//  - PostScriptName
 				FT_SfntName name;
 				if (FT_Get_Sfnt_Name(face, nameIndex, &name) != 0)
 					continue;
+				AddSfntName(strings, faceElement, name.platform_id, name.encoding_id, name.name_id, name.string,
+				            name.string_len);
+			}
+			SortNames(strings, faceElement);
+			faceElement.m_stableId = CalculateStableId(strings, faceElement);
 
-				// filter out non-microsoft names
-				if (name.platform_id != TT_PLATFORM_MICROSOFT)
-					continue;
+			if (fingerprints)
+			{
+				auto& fingerprint = fingerprints->emplace_back();
+				fingerprint.faceCount = faceCount;
+				CalculateFingerprint([&]()
+				{
+					bool hashed = false;
+					hashed |= HashSfntTable(face, TTAG_glyf);
+					hashed |= HashSfntTable(face, TTAG_CFF);
+					hashed |= HashSfntTable(face, TTAG_CFF2);
+					return hashed;
+				}, strings, faceElement, fingerprint);
+			}
+
+			ret.emplace_back(std::move(faceElement));
+		}
+	}
 
-				sfh::FontDatabase::FontFaceElement::NameElement::NameType nameType;
+public:
+	FT_Library m_lib;
 
-				switch (name.name_id)
-				{
-				case TT_NAME_ID_FONT_FAMILY:
-					nameType = sfh::FontDatabase::FontFaceElement::NameElement::Win32FamilyName;
-					break;
-				case TT_NAME_ID_FULL_NAME:
-					nameType = sfh::FontDatabase::FontFaceElement::NameElement::FullName;
-					break;
-				case TT_NAME_ID_PS_NAME:
-					nameType = sfh::FontDatabase::FontFaceElement::NameElement::PostScriptName;
-					break;
-				default:
-					continue;
-				}
+	Implementation()
+	{
+		m_buffer.reserve(1024);
+		FT_Init_FreeType(&m_lib);
 
-				try
-				{
-					faceElement.m_names.emplace_back(nameType, ConvertSfntName(name));
-				}
-				catch (...)
-				{
-					// ignore exception, discarding this name
-				}
-			}
+		THROW_IF_NTSTATUS_FAILED(BCryptOpenAlgorithmProvider(
+			m_hashAlg.put(),
+			BCRYPT_SHA1_ALGORITHM,
+			nullptr,
+			BCRYPT_HASH_REUSABLE_FLAG));
+		DWORD hashObjectLength = 0;
+		ULONG result = 0;
+		THROW_IF_NTSTATUS_FAILED(BCryptGetProperty(
+			m_hashAlg.get(),
+			BCRYPT_OBJECT_LENGTH,
+			reinterpret_cast<PUCHAR>(&hashObjectLength),
+			sizeof(hashObjectLength),
+			&result, 0));
+		m_hashObject = std::make_unique<uint8_t[]>(hashObjectLength);
+		THROW_IF_NTSTATUS_FAILED(BCryptCreateHash(
+			m_hashAlg.get(),
+			m_hash.put(),
+			m_hashObject.get(),
+			hashObjectLength,
+			nullptr,
+			0,
+			BCRYPT_HASH_REUSABLE_FLAG));
+	}
 
-			std::sort(faceElement.m_names.begin(), faceElement.m_names.end());
-			faceElement.m_names.erase(
-				std::unique(faceElement.m_names.begin(), faceElement.m_names.end()),
-				faceElement.m_names.end());
+	~Implementation()
+	{
+		FT_Done_FreeType(m_lib);
+	}
 
-			ret.emplace_back(std::move(faceElement));
+	std::vector<sfh::FontDatabase::FontFaceElement> AnalyzeFontFile(const wchar_t* path, sfh::StringPool& strings,
+	                                                                std::vector<FaceFingerprint>* fingerprints)
+	{
+		std::vector<sfh::FontDatabase::FontFaceElement> ret;
+		std::vector<FaceFingerprint> retFingerprints;
+		FileMapping mapping(path);
+
+		try
+		{
+			SfntReader reader(mapping.GetMappedPointer(), mapping.GetFileLength());
+			AnalyzeSfntFile(reader, path, strings, ret, fingerprints ? &retFingerprints : nullptr);
+		}
+		catch (SfntFormatError&)
+		{
+			// not a sfnt container or a malformed one, let FreeType decide
+			ret.clear();
+			retFingerprints.clear();
+			AnalyzeFreeTypeFile(mapping, path, strings, ret, fingerprints ? &retFingerprints : nullptr);
+		}
+
+		if (fingerprints)
+		{
+			// only publish fingerprints when the whole file succeeded, keeping them aligned with faces
+			fingerprints->insert(fingerprints->end(), retFingerprints.begin(), retFingerprints.end());
 		}
 		return ret;
 	}
@@ -209,7 +489,8 @@ FontAnalyzer::FontAnalyzer()
 
 FontAnalyzer::~FontAnalyzer() = default;
 
-std::vector<sfh::FontDatabase::FontFaceElement> FontAnalyzer::AnalyzeFontFile(const wchar_t* path)
+std::vector<sfh::FontDatabase::FontFaceElement> FontAnalyzer::AnalyzeFontFile(const wchar_t* path,
+	sfh::StringPool& strings, std::vector<FaceFingerprint>* fingerprints)
 {
-	return m_impl->AnalyzeFontFile(path);
+	return m_impl->AnalyzeFontFile(path, strings, fingerprints);
 }
@@ -2,6 +2,7 @@
 
 #include "Common.h"
 #include "PersistantData.h"
+#include "FileDeduplicate.h"
 
 class FontAnalyzer
 {
@@ -18,5 +19,8 @@ public:
 	FontAnalyzer& operator=(const FontAnalyzer&) = delete;
 	FontAnalyzer& operator=(FontAnalyzer&&) = delete;
 
-	std::vector<sfh::FontDatabase::FontFaceElement> AnalyzeFontFile(const wchar_t* path);
+	// strings of the returned faces are interned into strings,
+	// fingerprints, if requested, are appended in the same order as the returned faces
+	std::vector<sfh::FontDatabase::FontFaceElement> AnalyzeFontFile(const wchar_t* path, sfh::StringPool& strings,
+	                                                                std::vector<FaceFingerprint>* fingerprints = nullptr);
 };
@@ -3,9 +3,11 @@
 #include "Win32Helper.h"
 #include "FontAnalyzer.h"
 #include "FileDeduplicate.h"
+#include "FontDatabaseWriter.h"
 
 #include <fcntl.h>
 #include <io.h>
+#include <unordered_set>
 
 DWORD g_ProcessorCount = []()
 {
@@ -23,7 +25,8 @@ BOOL WINAPI ControlHandler(DWORD dwCtrlType)
 	return TRUE;
 }
 
-void FindOptions(int argc, wchar_t** argv, std::vector<std::wstring>& input, std::wstring& output, bool& deduplicate)
+void FindOptions(int argc, wchar_t** argv, std::vector<std::wstring>& input, std::wstring& output, bool& deduplicate,
+                 bool& deduplicateFace, std::wstring& deltaBase)
 {
 	for (int i = 1; i < argc; ++i)
 	{
@@ -41,10 +44,26 @@ void FindOptions(int argc, wchar_t** argv, std::vector<std::wstring>& input, std
 					throw std::runtime_error("missing argument for option -output");
 				}
 			}
+			else if (_wcsicmp(argv[i], L"-delta") == 0)
+			{
+				if (i + 1 < argc)
+				{
+					deltaBase = GetFullPathName(argv[i + 1]).get();
+					++i;
+				}
+				else
+				{
+					throw std::runtime_error("missing argument for option -delta");
+				}
+			}
 			else if (_wcsicmp(argv[i], L"-dedup") == 0)
 			{
 				deduplicate = true;
 			}
+			else if (_wcsicmp(argv[i], L"-dedupface") == 0)
+			{
+				deduplicateFace = true;
+			}
 			else if (_wcsicmp(argv[i], L"-worker") == 0)
 			{
 				if (i + 1 < argc)
@@ -75,14 +94,116 @@ void FindOptions(int argc, wchar_t** argv, std::vector<std::wstring>& input, std
 	{
 		throw std::runtime_error("missing input directory");
 	}
+	if (!deltaBase.empty() && deduplicateFace)
+	{
+		throw std::runtime_error("-dedupface can't be used with -delta");
+	}
+}
+
+// paths are compared case insensitively like the file system does
+std::wstring MakePathKey(std::wstring_view path)
+{
+	std::wstring ret(path);
+	std::transform(ret.begin(), ret.end(), ret.begin(), [](wchar_t ch)
+	{
+		return static_cast<wchar_t>(std::towlower(ch));
+	});
+	return ret;
+}
+
+std::wstring MakeFaceKey(const sfh::StringPool& strings, const sfh::FontDatabase::FontFaceElement& face)
+{
+	std::wstring ret = MakePathKey(sfh::FontDatabase::GetPath(strings, face));
+	ret += L'|';
+	ret += std::to_wstring(face.m_index);
+	return ret;
+}
+
+// the daemon may open the target at any time, it sees either the old or the new file
+void CommitFile(const std::wstring& temp, const std::wstring& target)
+{
+	THROW_LAST_ERROR_IF(MoveFileExW(temp.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING) == FALSE);
+}
+
+// writes the updated index to output and what changed to output.delta, which a running daemon
+// applies without reloading, a delta it hasn't claimed yet is merged into the new one
+void WriteDeltaOutput(const std::wstring& output, const sfh::FontDatabase& base, const std::vector<bool>& removed,
+                      const sfh::FontDatabase& added)
+{
+	std::wstring indexTemp = output + L".tmp";
+	{
+		sfh::FontDatabaseWriter writer(indexTemp);
+		for (size_t i = 0; i < base.m_fonts.size(); ++i)
+		{
+			if (!removed[i])
+				writer.WriteFace(base.m_fonts[i], base.m_strings);
+		}
+		for (auto& face : added.m_fonts)
+			writer.WriteFace(face, added.m_strings);
+		writer.Close();
+	}
+
+	std::wstring deltaPath = output + L".delta";
+	std::wstring deltaTemp = deltaPath + L".tmp";
+	// a delta still in place hasn't been claimed by the daemon, take it over to merge it.
+	// once the daemon moved it away it is being applied and none of it may be dropped
+	std::wstring pendingPath = deltaPath + L".merging";
+	bool claimed = MoveFileExW(deltaPath.c_str(), pendingPath.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+	// put an unmerged delta back for the daemon if anything below fails
+	auto restorePending = wil::scope_exit([&]()
+	{
+		if (claimed)
+			MoveFileExW(pendingPath.c_str(), deltaPath.c_str(), 0);
+	});
+	std::unique_ptr<sfh::FontDatabase> pending;
+	if (claimed)
+		pending = sfh::FontDatabase::ReadFromFile(pendingPath);
+	{
+		sfh::FontDatabaseWriter writer(deltaTemp);
+		std::unordered_set<std::wstring> removedKeys;
+		for (size_t i = 0; i < base.m_fonts.size(); ++i)
+		{
+			if (!removed[i])
+				continue;
+			removedKeys.emplace(MakeFaceKey(base.m_strings, base.m_fonts[i]));
+			writer.WriteRemovedFace(base.m_fonts[i], base.m_strings);
+		}
+		if (pending)
+		{
+			for (auto& face : pending->m_removedFonts)
+			{
+				if (!removedKeys.contains(MakeFaceKey(pending->m_strings, face)))
+					writer.WriteRemovedFace(face, pending->m_strings);
+			}
+			// added before and gone again, the daemon never needs to see them
+			for (auto& face : pending->m_fonts)
+			{
+				if (!removedKeys.contains(MakeFaceKey(pending->m_strings, face)))
+					writer.WriteFace(face, pending->m_strings);
+			}
+		}
+		for (auto& face : added.m_fonts)
+			writer.WriteFace(face, added.m_strings);
+		writer.Close();
+	}
+
+	// a delta must never show up before the index containing it, applying one twice is harmless
+	CommitFile(indexTemp, output);
+	CommitFile(deltaTemp, deltaPath);
+	restorePending.release();
+	if (claimed)
+		DeleteFileW(pendingPath.c_str());
 }
 
 void PrintHelp()
 {
 	std::wcout << SetOutputDefault
-		<< "Usage: FontDatabaseBuilder.exe [-output OutputFile] [-dedup] [-worker WorkerCount] Directory... \n"
+		<< "Usage: FontDatabaseBuilder.exe [-output OutputFile] [-delta BaseIndex] [-dedup] [-dedupface] [-worker WorkerCount] Directory... \n"
 		<< "\t-output OutputFile: path to the output\n"
+		<< "\t-delta BaseIndex: only analyze files missing from BaseIndex, write the updated index and the changes\n"
+		<< "\t\tto OutputFile.delta for a running daemon to apply, OutputFile defaults to BaseIndex\n"
 		<< "\t-dedup: enable deduplication of files\n"
+		<< "\t-dedupface: enable deduplication of equivalent font faces across files\n"
 		<< "\t-worker WorkerCount: set work thread count, default is half of your processor count\n"
 		<< "\tDirectory: directories need to build index" << std::endl;
 }
@@ -115,10 +236,12 @@ int wmain(int argc, wchar_t* argv[], wchar_t* envp[])
 		// validate arguments
 		std::vector<std::wstring> input;
 		std::wstring output;
-		bool deduplicate;
+		bool deduplicate = false;
+		bool deduplicateFace = false;
+		std::wstring deltaBase;
 		try
 		{
-			FindOptions(argc, argv, input, output, deduplicate);
+			FindOptions(argc, argv, input, output, deduplicate, deduplicateFace, deltaBase);
 		}
 		catch (std::exception& e)
 		{
@@ -141,6 +264,8 @@ int wmain(int argc, wchar_t* argv[], wchar_t* envp[])
 			std::wcout << "    " << SetOutputYellow << i << std::endl;
 		}
 
+		if (output.empty() && !deltaBase.empty())
+			output = deltaBase;
 		if (output.empty())
 		{
 			std::wcout << SetOutputYellow << "Output file path not specified. Generate path from first input." <<
@@ -190,7 +315,59 @@ int wmain(int argc, wchar_t* argv[], wchar_t* envp[])
 		}
 		std::wcout << "Discovered " << fileSet.size() << " files." << std::endl;
 
-		if (fileSet.empty())
+		std::unique_ptr<sfh::FontDatabase> base;
+		std::vector<bool> removedFromBase;
+		size_t removedCount = 0;
+		if (!deltaBase.empty())
+		{
+			std::wcout << "Compare with base index..." << std::endl;
+			base = sfh::FontDatabase::ReadFromFile(deltaBase);
+			std::unordered_set<std::wstring> scanned;
+			for (auto& path : fileSet)
+				scanned.emplace(MakePathKey(path));
+			std::vector<std::wstring> inputKeys;
+			for (auto& i : input)
+			{
+				inputKeys.emplace_back(MakePathKey(i));
+				if (inputKeys.back().back() != L'\\')
+					inputKeys.back().push_back(L'\\');
+			}
+
+			// faces of files that are gone, files outside the input directories are left alone
+			std::unordered_set<std::wstring> known;
+			removedFromBase.assign(base->m_fonts.size(), false);
+			for (size_t i = 0; i < base->m_fonts.size(); ++i)
+			{
+				auto key = MakePathKey(base->GetPath(base->m_fonts[i]));
+				bool inInput = std::ranges::any_of(inputKeys, [&](const std::wstring& prefix)
+				{
+					return key.starts_with(prefix);
+				});
+				if (inInput && !scanned.contains(key))
+				{
+					removedFromBase[i] = true;
+					++removedCount;
+				}
+				known.emplace(std::move(key));
+			}
+
+			// files already in the base index aren't analyzed again, changes in place go unnoticed
+			size_t kept = 0;
+			for (size_t i = 0; i < fileSet.size(); ++i)
+			{
+				if (known.contains(MakePathKey(fileSet[i])))
+					continue;
+				fileSet[kept] = std::move(fileSet[i]);
+				fileSize[kept] = fileSize[i];
+				++kept;
+			}
+			fileSet.resize(kept);
+			fileSize.resize(kept);
+			std::wcout << "Discovered " << fileSet.size() << " new files, " << removedCount << " removed faces." <<
+				std::endl;
+		}
+
+		if (fileSet.empty() && removedCount == 0)
 		{
 			std::wcout << "Nothing to do." << std::endl;
 			return 0;
@@ -230,7 +407,29 @@ int wmain(int argc, wchar_t* argv[], wchar_t* envp[])
 		auto noFile = fileSet.end();
 
 		sfh::FontDatabase db;
-		db.m_fonts.reserve(fileSet.size()); // reduce reallocation
+		std::vector<FaceFingerprint> fingerprints;
+		// without face deduplication nothing needs the whole database, stream faces to a temporary
+		// file, the output keeps the old index until the new one is complete
+		std::unique_ptr<sfh::FontDatabaseWriter> writer;
+		std::exception_ptr writeError;
+		std::wstring writerTemp = output + L".tmp";
+		// cancelled or failed, the handle must be closed before the file can go
+		auto removeWriterTemp = wil::scope_exit([&]()
+		{
+			if (!writer)
+				return;
+			writer.reset();
+			DeleteFileW(writerTemp.c_str());
+		});
+		if (deduplicateFace)
+		{
+			db.m_fonts.reserve(fileSet.size()); // reduce reallocation
+			fingerprints.reserve(fileSet.size());
+		}
+		else if (!base)
+		{
+			writer = std::make_unique<sfh::FontDatabaseWriter>(writerTemp);
+		}
 
 		std::vector<std::thread> workers;
 		for (size_t i = 0; i < g_WorkerCount; ++i)
@@ -249,12 +448,35 @@ int wmain(int argc, wchar_t* argv[], wchar_t* envp[])
 							path = nextFile;
 							++nextFile;
 						}
-						auto result = analyzer.AnalyzeFontFile(path->c_str());
+						std::vector<FaceFingerprint> resultFingerprints;
+						// per file pool, merged into the database's under the lock
+						sfh::StringPool strings;
+						auto result = analyzer.AnalyzeFontFile(
+							path->c_str(), strings, deduplicateFace ? &resultFingerprints : nullptr);
 						{
 							std::lock_guard lg(resultLock);
-							db.m_fonts.insert(db.m_fonts.end(),
-							                  std::make_move_iterator(result.begin()),
-							                  std::make_move_iterator(result.end()));
+							if (writer)
+							{
+								try
+								{
+									for (auto& face : result)
+										writer->WriteFace(face, strings);
+								}
+								catch (...)
+								{
+									// not the file's fault, stop the build
+									writeError = std::current_exception();
+									g_cancelToken = true;
+								}
+							}
+							else
+							{
+								for (auto& face : result)
+									db.ImportFace(std::move(face), strings);
+								fingerprints.insert(fingerprints.end(),
+								                    resultFingerprints.begin(),
+								                    resultFingerprints.end());
+							}
 						}
 					}
 					catch (std::exception& e)
@@ -290,12 +512,36 @@ int wmain(int argc, wchar_t* argv[], wchar_t* envp[])
 			if (thr.joinable())
 				thr.join();
 		}
+		if (writeError)
+			std::rethrow_exception(writeError);
 		ThrowIfCancelled();
 		std::wcout << std::endl;
 
+		if (deduplicateFace)
+		{
+			std::wcout << "Deduplicate font faces..." << std::endl;
+			size_t faceCount = db.m_fonts.size();
+			db.m_fonts = DeduplicateFaces(std::move(db.m_fonts), db.m_strings, fingerprints);
+			std::wcout << "Collapsed " << faceCount - db.m_fonts.size() << " of " << faceCount << " faces." <<
+				std::endl;
+		}
+
 		std::wcout << "Writing output..." << std::endl;
 
-		sfh::FontDatabase::WriteToFile(output, db);
+		if (writer)
+		{
+			writer->Close();
+			CommitFile(writerTemp, output);
+			removeWriterTemp.release();
+		}
+		else if (base)
+		{
+			WriteDeltaOutput(output, *base, removedFromBase, db);
+		}
+		else
+		{
+			sfh::FontDatabase::WriteToFile(output, db);
+		}
 
 		std::wcout << "Done." << std::endl;
 	}
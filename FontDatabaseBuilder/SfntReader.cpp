@@ -0,0 +1,152 @@
+#include "SfntReader.h"
+
+namespace
+{
+	uint16_t ReadU16(const uint8_t* p)
+	{
+		return static_cast<uint16_t>(p[0] << 8 | p[1]);
+	}
+
+	uint32_t ReadU32(const uint8_t* p)
+	{
+		return static_cast<uint32_t>(p[0]) << 24
+			| static_cast<uint32_t>(p[1]) << 16
+			| static_cast<uint32_t>(p[2]) << 8
+			| static_cast<uint32_t>(p[3]);
+	}
+
+	bool InBounds(size_t length, size_t offset, size_t size)
+	{
+		return offset <= length && size <= length - offset;
+	}
+
+	constexpr uint32_t TAG_TTCF = MakeSfntTag('t', 't', 'c', 'f');
+	constexpr uint32_t TAG_TRUE = MakeSfntTag('t', 'r', 'u', 'e');
+	constexpr uint32_t TAG_OTTO = MakeSfntTag('O', 'T', 'T', 'O');
+	constexpr uint32_t VERSION_TRUETYPE = 0x00010000;
+
+	constexpr size_t OFFSET_TABLE_SIZE = 12;
+	constexpr size_t TABLE_RECORD_SIZE = 16;
+	constexpr size_t NAME_RECORD_SIZE = 12;
+
+	bool IsSfntVersion(uint32_t version)
+	{
+		return version == VERSION_TRUETYPE || version == TAG_OTTO || version == TAG_TRUE;
+	}
+}
+
+SfntFace::SfntFace(const uint8_t* data, size_t length, uint32_t offset)
+	: m_data(data), m_length(length)
+{
+	if (!InBounds(m_length, offset, OFFSET_TABLE_SIZE))
+		throw SfntFormatError("offset table out of bounds");
+	const uint8_t* offsetTable = m_data + offset;
+	if (!IsSfntVersion(ReadU32(offsetTable)))
+		throw SfntFormatError("unknown sfnt version");
+	m_tableCount = ReadU16(offsetTable + 4);
+	if (!InBounds(m_length, offset + OFFSET_TABLE_SIZE, m_tableCount * TABLE_RECORD_SIZE))
+		throw SfntFormatError("table directory out of bounds");
+	m_tableRecords = offsetTable + OFFSET_TABLE_SIZE;
+}
+
+SfntFace::Table SfntFace::FindTable(uint32_t tag) const
+{
+	// tables are supposed to be sorted, but broken fonts exist and the directory is small
+	for (uint16_t i = 0; i < m_tableCount; ++i)
+	{
+		const uint8_t* record = m_tableRecords + i * TABLE_RECORD_SIZE;
+		if (ReadU32(record) != tag)
+			continue;
+		uint32_t offset = ReadU32(record + 8);
+		uint32_t length = ReadU32(record + 12);
+		if (!InBounds(m_length, offset, length))
+			return {};
+		return {m_data + offset, length};
+	}
+	return {};
+}
+
+bool SfntFace::ReadOS2(OS2Info& info) const
+{
+	auto table = FindTable(TAG_OS2);
+	// fsSelection is the last field we need from version 0
+	if (!table || table.length < 64)
+		return false;
+	info.version = ReadU16(table.data);
+	info.weightClass = ReadU16(table.data + 4);
+	info.widthClass = ReadU16(table.data + 6);
+	info.fsSelection = ReadU16(table.data + 62);
+	if (info.version >= 1 && table.length >= 86)
+	{
+		info.codePageRange1 = ReadU32(table.data + 78);
+		info.codePageRange2 = ReadU32(table.data + 82);
+	}
+	else
+	{
+		info.codePageRange1 = 0;
+		info.codePageRange2 = 0;
+	}
+	return true;
+}
+
+bool SfntFace::ReadHead(HeadInfo& info) const
+{
+	auto table = FindTable(TAG_HEAD);
+	if (!table || table.length < 54)
+		return false;
+	info.macStyle = ReadU16(table.data + 44);
+	return true;
+}
+
+void SfntFace::ReadNames(std::vector<NameRecord>& names) const
+{
+	auto table = FindTable(TAG_NAME);
+	if (!table || table.length < 6)
+		return;
+	uint16_t count = ReadU16(table.data + 2);
+	uint16_t stringOffset = ReadU16(table.data + 4);
+	if (!InBounds(table.length, 6, count * NAME_RECORD_SIZE))
+		return;
+	names.reserve(names.size() + count);
+	for (uint16_t i = 0; i < count; ++i)
+	{
+		const uint8_t* record = table.data + 6 + i * NAME_RECORD_SIZE;
+		uint16_t length = ReadU16(record + 8);
+		size_t offset = static_cast<size_t>(stringOffset) + ReadU16(record + 10);
+		if (!InBounds(table.length, offset, length))
+			continue;
+		names.push_back({
+			ReadU16(record),
+			ReadU16(record + 2),
+			ReadU16(record + 4),
+			ReadU16(record + 6),
+			table.data + offset,
+			length
+		});
+	}
+}
+
+SfntReader::SfntReader(const void* data, size_t length)
+	: m_data(static_cast<const uint8_t*>(data)), m_length(length)
+{
+	if (m_length < OFFSET_TABLE_SIZE)
+		throw SfntFormatError("file too small");
+	uint32_t tag = ReadU32(m_data);
+	if (tag == TAG_TTCF)
+	{
+		uint32_t faceCount = ReadU32(m_data + 8);
+		if (!InBounds(m_length, OFFSET_TABLE_SIZE, static_cast<size_t>(faceCount) * sizeof(uint32_t)))
+			throw SfntFormatError("collection header out of bounds");
+		m_faceOffsets.reserve(faceCount);
+		for (uint32_t i = 0; i < faceCount; ++i)
+			m_faceOffsets.push_back(ReadU32(m_data + OFFSET_TABLE_SIZE + i * sizeof(uint32_t)));
+	}
+	else if (IsSfntVersion(tag))
+	{
+		m_faceOffsets.push_back(0);
+	}
+	else
+	{
+		throw SfntFormatError("not a sfnt font");
+	}
+}
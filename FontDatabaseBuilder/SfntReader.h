@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+// minimal reader of sfnt (TrueType/OpenType) containers working directly on mapped bytes,
+// it only understands what FontAnalyzer needs and doesn't depend on any platform API
+
+class SfntFormatError : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+constexpr uint32_t MakeSfntTag(char a, char b, char c, char d)
+{
+	return static_cast<uint32_t>(static_cast<uint8_t>(a)) << 24
+		| static_cast<uint32_t>(static_cast<uint8_t>(b)) << 16
+		| static_cast<uint32_t>(static_cast<uint8_t>(c)) << 8
+		| static_cast<uint32_t>(static_cast<uint8_t>(d));
+}
+
+class SfntFace
+{
+public:
+	struct Table
+	{
+		const uint8_t* data = nullptr;
+		uint32_t length = 0;
+
+		explicit operator bool() const
+		{
+			return data != nullptr;
+		}
+	};
+
+	struct NameRecord
+	{
+		uint16_t platformId;
+		uint16_t encodingId;
+		uint16_t languageId;
+		uint16_t nameId;
+		const uint8_t* string;
+		uint32_t length;
+	};
+
+	struct OS2Info
+	{
+		uint16_t version;
+		uint16_t weightClass;
+		uint16_t widthClass;
+		uint16_t fsSelection;
+		// only valid since version 1
+		uint32_t codePageRange1;
+		uint32_t codePageRange2;
+	};
+
+	struct HeadInfo
+	{
+		uint16_t macStyle;
+	};
+
+	static constexpr uint32_t TAG_OS2 = MakeSfntTag('O', 'S', '/', '2');
+	static constexpr uint32_t TAG_NAME = MakeSfntTag('n', 'a', 'm', 'e');
+	static constexpr uint32_t TAG_HEAD = MakeSfntTag('h', 'e', 'a', 'd');
+	static constexpr uint32_t TAG_GLYF = MakeSfntTag('g', 'l', 'y', 'f');
+	static constexpr uint32_t TAG_CFF = MakeSfntTag('C', 'F', 'F', ' ');
+	static constexpr uint32_t TAG_CFF2 = MakeSfntTag('C', 'F', 'F', '2');
+
+	SfntFace(const uint8_t* data, size_t length, uint32_t offset);
+
+	Table FindTable(uint32_t tag) const;
+
+	bool ReadOS2(OS2Info& info) const;
+	bool ReadHead(HeadInfo& info) const;
+	// records with string out of bounds are skipped
+	void ReadNames(std::vector<NameRecord>& names) const;
+
+private:
+	const uint8_t* m_data;
+	size_t m_length;
+	const uint8_t* m_tableRecords;
+	uint16_t m_tableCount;
+};
+
+class SfntReader
+{
+private:
+	const uint8_t* m_data;
+	size_t m_length;
+	std::vector<uint32_t> m_faceOffsets;
+public:
+	// throws SfntFormatError if data isn't a sfnt font or collection
+	SfntReader(const void* data, size_t length);
+
+	uint32_t GetFaceCount() const
+	{
+		return static_cast<uint32_t>(m_faceOffsets.size());
+	}
+
+	SfntFace GetFace(uint32_t index) const
+	{
+		return SfntFace(m_data, m_length, m_faceOffsets.at(index));
+	}
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Transcode.h"
+
 inline std::unique_ptr<wchar_t[]> GetCurrentDirectory()
 {
 	DWORD length = GetCurrentDirectoryW(0, nullptr);
@@ -20,22 +22,8 @@ inline std::unique_ptr<wchar_t[]> GetFullPathName(const wchar_t* path)
 inline std::wstring Utf8ToWideString(const std::string& str)
 {
 	std::wstring ret;
-	const int length = MultiByteToWideChar(
-		CP_UTF8,
-		MB_ERR_INVALID_CHARS,
-		str.c_str(),
-		static_cast<int>(str.size()),
-		nullptr,
-		0);
-	assert(length != 0 && "utf8 conversion to wide char mustn't fail!");
-	ret.resize(length);
-	MultiByteToWideChar(
-		CP_UTF8,
-		MB_ERR_INVALID_CHARS,
-		str.c_str(),
-		static_cast<int>(str.size()),
-		ret.data(),
-		length);
+	[[maybe_unused]] bool success = sfh::Transcode::Utf8ToWide(str, ret);
+	assert(success && "utf8 conversion to wide char mustn't fail!");
 	return ret;
 }
 
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sfh
+{
+	// how the resolver tells time and waits, tests substitute a clock they advance by hand
+	struct SteadyTimer
+	{
+		using time_point = std::chrono::steady_clock::time_point;
+
+		time_point Now() const
+		{
+			return std::chrono::steady_clock::now();
+		}
+
+		// pred is checked with lock held, returns pred() once woken or at deadline
+		template <typename Pred>
+		bool WaitUntil(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, time_point deadline,
+		               Pred&& pred) const
+		{
+			return cv.wait_until(lock, deadline, std::forward<Pred>(pred));
+		}
+	};
+
+	// runs resolutions on background threads so a hooked call waits only until its deadline,
+	// a resolution outliving the wait still finishes and its results serve later calls.
+	// callers asking for a key already being resolved wait for that resolution instead of
+	// starting another one. threads are joined by later calls and by Shutdown, so none is
+	// left running code of an unloaded module
+	template <typename Timer = SteadyTimer>
+	class BasicAsyncResolver
+	{
+	private:
+		struct Job
+		{
+			std::mutex m_lock;
+			std::condition_variable m_doneCV;
+			bool m_done = false;
+			// set under the resolver lock before the thread can finish
+			std::thread m_thread;
+		};
+
+		Timer m_timer;
+		std::mutex m_lock;
+		std::condition_variable m_idleCV;
+		// resolutions not finished yet by key
+		std::unordered_map<std::wstring, std::shared_ptr<Job>> m_pending;
+		// threads done with their work, waiting to be joined
+		std::vector<std::thread> m_finished;
+		bool m_stopped = false;
+
+	public:
+		explicit BasicAsyncResolver(Timer timer = Timer())
+			: m_timer(std::move(timer))
+		{
+		}
+
+		// threads are killed before static destructors run at process exit, they can't be joined
+		~BasicAsyncResolver()
+		{
+			for (auto& [key, job] : m_pending)
+				job->m_thread.detach();
+			for (auto& thread : m_finished)
+				thread.detach();
+		}
+
+		BasicAsyncResolver(const BasicAsyncResolver&) = delete;
+		BasicAsyncResolver(BasicAsyncResolver&&) = delete;
+
+		BasicAsyncResolver& operator=(const BasicAsyncResolver&) = delete;
+		BasicAsyncResolver& operator=(BasicAsyncResolver&&) = delete;
+
+		// runs work() for key unless it is already running, returns whether it finished
+		// within timeout, exceptions thrown by work are swallowed like a failed query.
+		// returns false without running anything after Shutdown
+		template <typename Fn>
+		bool Resolve(const std::wstring& key, Fn&& work, std::chrono::milliseconds timeout)
+		{
+			auto deadline = m_timer.Now() + timeout;
+			std::shared_ptr<Job> job;
+			std::vector<std::thread> finished;
+			{
+				std::lock_guard lg(m_lock);
+				if (m_stopped)
+					return false;
+				TakeFinished(finished);
+				auto& pending = m_pending[key];
+				if (!pending)
+				{
+					auto newJob = std::make_shared<Job>();
+					try
+					{
+						// the thread can't finish before it is stored, Finish takes the lock
+						newJob->m_thread = std::thread([this, key, newJob, work = std::forward<Fn>(work)]() mutable
+						{
+							try
+							{
+								work();
+							}
+							catch (...)
+							{
+							}
+							Finish(key, *newJob);
+						});
+					}
+					catch (...)
+					{
+						m_pending.erase(key);
+						throw;
+					}
+					pending = std::move(newJob);
+				}
+				job = pending;
+			}
+			for (auto& thread : finished)
+				thread.join();
+
+			std::unique_lock ul(job->m_lock);
+			return m_timer.WaitUntil(job->m_doneCV, ul, deadline, [&]() { return job->m_done; });
+		}
+
+		// waits for every resolution started so far, including those no caller waits for anymore
+		void WaitIdle()
+		{
+			std::unique_lock ul(m_lock);
+			m_idleCV.wait(ul, [&]() { return m_pending.empty(); });
+		}
+
+		// refuses new resolutions, waits for the running ones and joins every thread,
+		// call before the module holding the work is unloaded
+		void Shutdown()
+		{
+			std::vector<std::thread> finished;
+			{
+				std::unique_lock ul(m_lock);
+				m_stopped = true;
+				m_idleCV.wait(ul, [&]() { return m_pending.empty(); });
+				TakeFinished(finished);
+			}
+			for (auto& thread : finished)
+				thread.join();
+		}
+
+	private:
+		// moves out the threads the caller can join, a resolution may call Resolve itself
+		// and can't join its own thread
+		void TakeFinished(std::vector<std::thread>& out)
+		{
+			auto self = std::this_thread::get_id();
+			for (auto iter = m_finished.begin(); iter != m_finished.end();)
+			{
+				if (iter->get_id() == self)
+				{
+					++iter;
+					continue;
+				}
+				out.push_back(std::move(*iter));
+				iter = m_finished.erase(iter);
+			}
+		}
+
+		void Finish(const std::wstring& key, Job& job)
+		{
+			{
+				std::lock_guard lg(m_lock);
+				m_finished.push_back(std::move(job.m_thread));
+				m_pending.erase(key);
+				if (m_pending.empty())
+					m_idleCV.notify_all();
+			}
+			{
+				std::lock_guard lg(job.m_lock);
+				job.m_done = true;
+			}
+			job.m_doneCV.notify_all();
+		}
+	};
+
+	using AsyncResolver = BasicAsyncResolver<>;
+}
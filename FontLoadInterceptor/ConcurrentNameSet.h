@@ -0,0 +1,211 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+
+namespace sfh
+{
+	// set of wide strings for many concurrent readers and rare writers, lookups take
+	// no lock and don't allocate, writers are serialized and bump a sequence number
+	// readers validate against (seqlock), so a lookup racing a write simply retries.
+	// capacity is fixed, memory is never freed or moved while readers may look at it,
+	// a full set forgets everything it held which is fine for a cache
+	class ConcurrentNameSet
+	{
+	private:
+		struct Slot
+		{
+			std::atomic<uint32_t> m_hash{0};
+			std::atomic<uint32_t> m_offset{0};
+			// 0 marks an empty slot, empty keys are never stored
+			std::atomic<uint32_t> m_length{0};
+		};
+
+		const size_t m_slotCount;
+		const size_t m_arenaSize;
+		std::unique_ptr<Slot[]> m_slots;
+		// key characters, atomics only so racing reads are well defined
+		std::unique_ptr<std::atomic<wchar_t>[]> m_arena;
+		// odd while a writer is changing slots or arena
+		std::atomic<uint64_t> m_sequence{0};
+
+		// writer state, the source the shared table is rebuilt from
+		std::mutex m_writeLock;
+		std::unordered_set<std::wstring> m_keys;
+		size_t m_arenaUsed = 0;
+
+		// a key is looked up as two pieces so callers can append a suffix without building a string
+		static uint32_t Hash(std::wstring_view key, std::wstring_view suffix)
+		{
+			uint64_t hash = 0xcbf29ce484222325;
+			for (auto piece : {key, suffix})
+			{
+				for (wchar_t ch : piece)
+				{
+					hash ^= static_cast<uint64_t>(ch);
+					hash *= 0x100000001b3;
+				}
+			}
+			return static_cast<uint32_t>(hash ^ hash >> 32);
+		}
+
+		bool Equals(size_t offset, std::wstring_view key, std::wstring_view suffix) const
+		{
+			for (auto piece : {key, suffix})
+			{
+				for (wchar_t ch : piece)
+				{
+					if (m_arena[offset++].load(std::memory_order_relaxed) != ch)
+						return false;
+				}
+			}
+			return true;
+		}
+
+		bool Probe(std::wstring_view key, std::wstring_view suffix, uint32_t hash) const
+		{
+			size_t length = key.size() + suffix.size();
+			size_t mask = m_slotCount - 1;
+			for (size_t i = hash & mask, probed = 0; probed < m_slotCount; i = (i + 1) & mask, ++probed)
+			{
+				auto& slot = m_slots[i];
+				uint32_t slotLength = slot.m_length.load(std::memory_order_relaxed);
+				if (slotLength == 0)
+					return false;
+				if (slotLength != length || slot.m_hash.load(std::memory_order_relaxed) != hash)
+					continue;
+				// fields torn by a writer may point anywhere, the sequence check discards the result
+				size_t offset = slot.m_offset.load(std::memory_order_relaxed);
+				if (offset > m_arenaSize || length > m_arenaSize - offset)
+					return false;
+				if (Equals(offset, key, suffix))
+					return true;
+			}
+			return false;
+		}
+
+		void BeginWrite()
+		{
+			m_sequence.store(m_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+
+		void EndWrite()
+		{
+			m_sequence.store(m_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		// inside BeginWrite/EndWrite, the caller checked there is room
+		void Place(std::wstring_view key)
+		{
+			uint32_t hash = Hash(key, {});
+			size_t offset = m_arenaUsed;
+			for (wchar_t ch : key)
+				m_arena[m_arenaUsed++].store(ch, std::memory_order_relaxed);
+			size_t mask = m_slotCount - 1;
+			size_t i = hash & mask;
+			while (m_slots[i].m_length.load(std::memory_order_relaxed) != 0)
+				i = (i + 1) & mask;
+			m_slots[i].m_hash.store(hash, std::memory_order_relaxed);
+			m_slots[i].m_offset.store(static_cast<uint32_t>(offset), std::memory_order_relaxed);
+			m_slots[i].m_length.store(static_cast<uint32_t>(key.size()), std::memory_order_relaxed);
+		}
+
+		void Rebuild()
+		{
+			BeginWrite();
+			for (size_t i = 0; i < m_slotCount; ++i)
+				m_slots[i].m_length.store(0, std::memory_order_relaxed);
+			m_arenaUsed = 0;
+			for (auto& key : m_keys)
+				Place(key);
+			EndWrite();
+		}
+
+		bool HasRoomFor(size_t keyCount, size_t arenaUsed) const
+		{
+			// probe sequences stay short below half load
+			return keyCount <= m_slotCount / 2 && arenaUsed <= m_arenaSize;
+		}
+
+	public:
+		// slotCount must be a power of two
+		explicit ConcurrentNameSet(size_t slotCount = 4096, size_t arenaSize = 64 * 1024)
+			: m_slotCount(slotCount), m_arenaSize(arenaSize),
+			  m_slots(std::make_unique<Slot[]>(slotCount)),
+			  m_arena(std::make_unique<std::atomic<wchar_t>[]>(arenaSize))
+		{
+		}
+
+		ConcurrentNameSet(const ConcurrentNameSet&) = delete;
+		ConcurrentNameSet(ConcurrentNameSet&&) = delete;
+
+		ConcurrentNameSet& operator=(const ConcurrentNameSet&) = delete;
+		ConcurrentNameSet& operator=(ConcurrentNameSet&&) = delete;
+
+		// whether key + suffix is in the set, lock free and allocation free
+		bool Contains(std::wstring_view key, std::wstring_view suffix = {}) const
+		{
+			uint32_t hash = Hash(key, suffix);
+			for (;;)
+			{
+				uint64_t sequence = m_sequence.load(std::memory_order_acquire);
+				if (sequence & 1)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				bool found = Probe(key, suffix, hash);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (m_sequence.load(std::memory_order_relaxed) == sequence)
+					return found;
+			}
+		}
+
+		void Insert(std::wstring_view key, std::wstring_view suffix = {})
+		{
+			std::wstring fullKey(key);
+			fullKey += suffix;
+			if (fullKey.empty() || !HasRoomFor(1, fullKey.size()))
+				return;
+			std::lock_guard lg(m_writeLock);
+			if (!m_keys.emplace(fullKey).second)
+				return;
+			if (!HasRoomFor(m_keys.size(), m_arenaUsed + fullKey.size()))
+			{
+				m_keys.clear();
+				m_keys.emplace(std::move(fullKey));
+				Rebuild();
+				return;
+			}
+			BeginWrite();
+			Place(fullKey);
+			EndWrite();
+		}
+
+		// predicate gets each stored key + suffix as a const std::wstring&
+		template <typename Pred>
+		void EraseIf(Pred&& pred)
+		{
+			std::lock_guard lg(m_writeLock);
+			if (std::erase_if(m_keys, pred) != 0)
+				Rebuild();
+		}
+
+		void Clear()
+		{
+			std::lock_guard lg(m_writeLock);
+			if (m_keys.empty())
+				return;
+			m_keys.clear();
+			Rebuild();
+		}
+	};
+}
@@ -3,13 +3,23 @@
 #include "Detour.h"
 #include "RpcClient.h"
 
+namespace
+{
+	template <typename LOGFONTT>
+	sfh::QueryStyle GetQueryStyle(const LOGFONTT* lplf)
+	{
+		return {static_cast<uint32_t>(lplf->lfWeight), lplf->lfItalic != 0, lplf->lfCharSet};
+	}
+}
+
 HFONT WINAPI sfh::Detour::CreateFontA(int cHeight, int cWidth, int cEscapement, int cOrientation, int cWeight,
                                       DWORD bItalic,
                                       DWORD bUnderline, DWORD bStrikeOut, DWORD iCharSet, DWORD iOutPrecision,
                                       DWORD iClipPrecision, DWORD iQuality,
                                       DWORD iPitchAndFamily, LPCSTR pszFaceName)
 {
-	QueryAndLoad(pszFaceName);
+	QueryStyle style{static_cast<uint32_t>(cWeight), bItalic != 0, iCharSet};
+	QueryAndLoad(pszFaceName, &style);
 	return Original::CreateFontA(
 		cHeight,
 		cWidth,
@@ -33,7 +43,8 @@ HFONT WINAPI sfh::Detour::CreateFontW(int cHeight, int cWidth, int cEscapement,
                                       DWORD iClipPrecision, DWORD iQuality,
                                       DWORD iPitchAndFamily, LPCWSTR pszFaceName)
 {
-	QueryAndLoad(pszFaceName);
+	QueryStyle style{static_cast<uint32_t>(cWeight), bItalic != 0, iCharSet};
+	QueryAndLoad(pszFaceName, &style);
 	return Original::CreateFontW(
 		cHeight,
 		cWidth,
@@ -53,28 +64,32 @@ HFONT WINAPI sfh::Detour::CreateFontW(int cHeight, int cWidth, int cEscapement,
 
 HFONT WINAPI sfh::Detour::CreateFontIndirectA(const LOGFONTA* lplf)
 {
-	QueryAndLoad(lplf->lfFaceName);
+	auto style = GetQueryStyle(lplf);
+	QueryAndLoad(lplf->lfFaceName, &style);
 	return Original::CreateFontIndirectA(lplf);
 }
 
 HFONT WINAPI sfh::Detour::CreateFontIndirectW(const LOGFONTW* lplf)
 {
-	QueryAndLoad(lplf->lfFaceName);
+	auto style = GetQueryStyle(lplf);
+	QueryAndLoad(lplf->lfFaceName, &style);
 	return Original::CreateFontIndirectW(lplf);
 }
 
 
 HFONT WINAPI sfh::Detour::CreateFontIndirectExA(const ENUMLOGFONTEXDVA* lpelf)
 {
-	QueryAndLoad(reinterpret_cast<const char*>(lpelf->elfEnumLogfontEx.elfFullName));
-	QueryAndLoad(lpelf->elfEnumLogfontEx.elfLogFont.lfFaceName);
+	auto style = GetQueryStyle(&lpelf->elfEnumLogfontEx.elfLogFont);
+	QueryAndLoad(reinterpret_cast<const char*>(lpelf->elfEnumLogfontEx.elfFullName), &style);
+	QueryAndLoad(lpelf->elfEnumLogfontEx.elfLogFont.lfFaceName, &style);
 	return Original::CreateFontIndirectExA(lpelf);
 }
 
 HFONT WINAPI sfh::Detour::CreateFontIndirectExW(const ENUMLOGFONTEXDVW* lpelf)
 {
-	QueryAndLoad(lpelf->elfEnumLogfontEx.elfFullName);
-	QueryAndLoad(lpelf->elfEnumLogfontEx.elfLogFont.lfFaceName);
+	auto style = GetQueryStyle(&lpelf->elfEnumLogfontEx.elfLogFont);
+	QueryAndLoad(lpelf->elfEnumLogfontEx.elfFullName, &style);
+	QueryAndLoad(lpelf->elfEnumLogfontEx.elfLogFont.lfFaceName, &style);
 	return Original::CreateFontIndirectExW(lpelf);
 }
 
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "CaseFold.h"
+
+namespace sfh
+{
+	// font files this process registered with GDI, a file serving several families or hit
+	// through several names is loaded only once and stays loaded until ReleaseAll.
+	// a file registered from memory can't be enumerated, a request needing enumeration
+	// registers the file itself on top of it.
+	// loading runs outside the lock, threads asking for a file being loaded wait for it
+	class LoadedFontRegistry
+	{
+	private:
+		struct Entry
+		{
+			// true while a requester is loading it
+			bool m_loading = false;
+			// registered from the file, enumerable
+			bool m_file = false;
+			// handle of a registration from memory, 0 if none
+			uintptr_t m_memoryToken = 0;
+			// as first requested, handed to unload
+			std::wstring m_path;
+
+			bool IsLoaded() const
+			{
+				return m_file || m_memoryToken != 0;
+			}
+		};
+
+		std::mutex m_lock;
+		std::condition_variable m_loadCV;
+		// keyed by folded path, file names are case insensitive
+		std::unordered_map<std::wstring, Entry> m_entries;
+
+		static std::wstring MakeKey(std::wstring_view path)
+		{
+			return FoldCase(path);
+		}
+
+	public:
+		LoadedFontRegistry() = default;
+
+		LoadedFontRegistry(const LoadedFontRegistry&) = delete;
+		LoadedFontRegistry(LoadedFontRegistry&&) = delete;
+
+		LoadedFontRegistry& operator=(const LoadedFontRegistry&) = delete;
+		LoadedFontRegistry& operator=(LoadedFontRegistry&&) = delete;
+
+		// calls load(path, uintptr_t& token) -> bool unless path is loaded in a way that serves
+		// the request, load sets token to the handle of a memory registration or leaves it 0
+		// for a file registration, and must register the file when needEnumerable is set.
+		// returns whether the request is served, failed loads are retried by the next request
+		template <typename Load>
+		bool Acquire(const std::wstring& path, bool needEnumerable, Load&& load)
+		{
+			auto key = MakeKey(path);
+			std::unique_lock ul(m_lock);
+			for (;;)
+			{
+				auto [iter, inserted] = m_entries.try_emplace(key);
+				// node references survive rehashing and nobody else erases an entry being loaded
+				Entry& entry = iter->second;
+				if (entry.m_loading)
+				{
+					// the entry may be gone afterwards, look it up again
+					m_loadCV.wait(ul);
+					continue;
+				}
+				if (entry.m_file || (!needEnumerable && entry.m_memoryToken != 0))
+					return true;
+
+				// new, or only in memory and the request needs the file
+				entry.m_loading = true;
+				ul.unlock();
+				bool loaded = false;
+				uintptr_t token = 0;
+				try
+				{
+					loaded = load(path, token);
+				}
+				catch (...)
+				{
+					ul.lock();
+					entry.m_loading = false;
+					if (!entry.IsLoaded())
+						m_entries.erase(key);
+					m_loadCV.notify_all();
+					throw;
+				}
+				ul.lock();
+				entry.m_loading = false;
+				if (loaded)
+				{
+					if (token != 0)
+						entry.m_memoryToken = token;
+					else
+						entry.m_file = true;
+					if (entry.m_path.empty())
+						entry.m_path = path;
+				}
+				else if (!entry.IsLoaded())
+				{
+					m_entries.erase(key);
+				}
+				m_loadCV.notify_all();
+				return loaded && (token == 0 || !needEnumerable);
+			}
+		}
+
+		// calls unload(path, token) for every registration, token is 0 for a file registration
+		// and the handle for one from memory, files still being loaded are left to their loaders
+		template <typename Unload>
+		void ReleaseAll(Unload&& unload)
+		{
+			std::lock_guard lg(m_lock);
+			for (auto iter = m_entries.begin(); iter != m_entries.end();)
+			{
+				auto& entry = iter->second;
+				if (entry.m_loading)
+				{
+					++iter;
+					continue;
+				}
+				if (entry.m_memoryToken != 0)
+					unload(entry.m_path, entry.m_memoryToken);
+				if (entry.m_file)
+					unload(entry.m_path, uintptr_t{0});
+				iter = m_entries.erase(iter);
+			}
+		}
+	};
+}
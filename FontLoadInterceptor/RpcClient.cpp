@@ -2,19 +2,34 @@
 
 #include "RpcClient.h"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
 #include <cstring>
 #include <string>
 #include <cwchar>
+#include <limits>
+#include <optional>
 #include <sddl.h>
 #include <unordered_set>
 #include <sstream>
+#include <thread>
 
 #include <wil/resource.h>
 
 #undef max
 
+#include "AsyncResolver.h"
+#include "CaseFold.h"
+#include "ConcurrentNameSet.h"
+#include "FontBlobCache.h"
 #include "EventLog.h"
+#include "InvalidationRing.h"
+#include "LoadedFontRegistry.h"
+#include "Transcode.h"
 #include "Detour.h"
 
 #include "FontQuery.pb.h"
@@ -55,38 +70,34 @@ namespace sfh
 	class QueryCache
 	{
 	private:
-		wil::unique_handle m_version;
-		wil::unique_mapview_ptr<uint32_t> m_versionMem;
-		uint32_t m_lastKnownVersion = std::numeric_limits<uint32_t>::max();
+		std::unique_ptr<InvalidationRing> m_ring;
+		std::atomic<uint32_t> m_lastKnownVersion = 0;
+		// ring entries before this one are applied, guarded by m_versionLock
+		uint64_t m_ringPosition = 0;
 		bool m_good = false;
 
-		std::unordered_set<std::wstring> m_cache;
-		std::mutex m_lock;
+		// read on every hooked call from any thread, without locking
+		ConcurrentNameSet m_cache;
+		// serializes applying ring entries
+		std::mutex m_versionLock;
+
+		// appended to the name for style specific entries, the nul can't appear in a query
+		using StyleSuffix = std::array<wchar_t, 4>;
 
 		QueryCache()
 		{
 			try
 			{
-				std::wstring versionShmName = L"SubtitleFontAutoLoaderSHM-";
-				versionShmName += GetCurrentProcessUserSid();
-				m_version.reset(CreateFileMappingW(
-					INVALID_HANDLE_VALUE,
-					nullptr,
-					PAGE_READWRITE,
-					0, 4,
-					versionShmName.c_str()));
-				THROW_LAST_ERROR_IF(!m_version.is_valid());
-				m_versionMem.reset(static_cast<uint32_t*>(MapViewOfFile(
-					m_version.get(),
-					FILE_MAP_WRITE,
-					0, 0,
-					sizeof(uint32_t))));
-				THROW_LAST_ERROR_IF(m_versionMem.get() == nullptr);
+				m_ring = std::make_unique<InvalidationRing>(
+					L"SubtitleFontAutoLoaderSHM-" + GetCurrentProcessUserSid(), false);
+				// the cache starts empty, earlier changes don't matter
+				m_lastKnownVersion = m_ring->GetVersion();
+				m_ringPosition = m_ring->GetHead();
+				m_good = true;
 			}
 			catch (...)
 			{
 			}
-			m_good = true;
 		}
 
 	public:
@@ -98,30 +109,92 @@ namespace sfh
 
 		void CheckNewVerison()
 		{
-			uint32_t newVerison = InterlockedCompareExchange(m_versionMem.get(), 0, 0);
-			if (newVerison != m_lastKnownVersion)
+			// the common case is a single atomic load
+			if (m_ring->GetVersion() == m_lastKnownVersion.load(std::memory_order_acquire))
+				return;
+			std::lock_guard lg(m_versionLock);
+			uint32_t newVerison = m_ring->GetVersion();
+			if (newVerison == m_lastKnownVersion.load(std::memory_order_relaxed))
+				return;
+			// a delta touches few names, keep the rest of the cache
+			std::unordered_set<std::wstring> names;
+			std::vector<std::wstring> prefixes;
+			bool complete = m_ring->ReadSince(m_ringPosition, [&](std::wstring_view name, bool isPrefix)
+			{
+				if (isPrefix)
+					prefixes.emplace_back(name);
+				else
+					names.emplace(name);
+			});
+			if (!complete)
 			{
-				m_lastKnownVersion = newVerison;
-				m_cache.clear();
+				m_cache.Clear();
 			}
+			else
+			{
+				m_cache.EraseIf([&](const std::wstring& key)
+				{
+					auto name = NormalizeKey(key);
+					return names.contains(name) || std::ranges::any_of(prefixes, [&](const std::wstring& prefix)
+					{
+						return name.starts_with(prefix);
+					});
+				});
+			}
+			m_lastKnownVersion.store(newVerison, std::memory_order_release);
+		}
+
+		// the name part of a cache key folded the way the daemon normalizes names
+		static std::wstring NormalizeKey(const std::wstring& key)
+		{
+			return FoldCase(std::wstring_view(key.c_str()));
 		}
 
-		bool IsQueryNeeded(const wchar_t* str)
+		static StyleSuffix MakeStyleSuffix(const QueryStyle& style)
+		{
+			// weights and charsets fit a code unit
+			return {
+				L'\0', static_cast<wchar_t>(style.weight), style.italic ? L'i' : L'n',
+				static_cast<wchar_t>(style.charset)
+			};
+		}
+
+		// hot path of every hooked call, doesn't lock or allocate on a hit
+		bool IsQueryNeeded(const wchar_t* str, const QueryStyle* style)
 		{
 			if (!m_good)return true;
-			std::lock_guard lg(m_lock);
 			CheckNewVerison();
-			if (m_cache.find(str) != m_cache.end())
+			std::wstring_view name(str);
+			// a whole family loaded before covers every style
+			if (m_cache.Contains(name))
 				return false;
+			if (style)
+			{
+				auto suffix = MakeStyleSuffix(*style);
+				if (m_cache.Contains(name, std::wstring_view(suffix.data(), suffix.size())))
+					return false;
+			}
 			return true;
 		}
 
-		void AddToCache(const wchar_t* str)
+		uint32_t GetResolveTimeout() const
+		{
+			return m_good ? m_ring->GetResolveTimeout() : 0;
+		}
+
+		void AddToCache(const wchar_t* str, const QueryStyle* style)
 		{
 			if (!m_good)return;
-			std::lock_guard lg(m_lock);
 			CheckNewVerison();
-			m_cache.emplace(str);
+			if (style)
+			{
+				auto suffix = MakeStyleSuffix(*style);
+				m_cache.Insert(str, std::wstring_view(suffix.data(), suffix.size()));
+			}
+			else
+			{
+				m_cache.Insert(str);
+			}
 		}
 	};
 
@@ -169,50 +242,16 @@ namespace sfh
 	std::string WideToUtf8String(const std::wstring& wStr)
 	{
 		std::string ret;
-		const int length = WideCharToMultiByte(
-			CP_UTF8,
-			WC_ERR_INVALID_CHARS,
-			wStr.c_str(),
-			static_cast<int>(wStr.size()),
-			nullptr,
-			0,
-			nullptr,
-			nullptr);
-		if (length <= 0)
-			throw std::runtime_error("WideCharToMultiByte failed");
-		ret.resize(length);
-		WideCharToMultiByte(
-			CP_UTF8,
-			WC_ERR_INVALID_CHARS,
-			wStr.c_str(),
-			static_cast<int>(wStr.size()),
-			ret.data(),
-			length,
-			nullptr,
-			nullptr);
+		if (!Transcode::WideToUtf8(wStr, ret))
+			throw std::runtime_error("invalid utf-16 string");
 		return ret;
 	}
 
 	std::wstring Utf8ToWideString(const std::string& str)
 	{
 		std::wstring ret;
-		const int length = MultiByteToWideChar(
-			CP_UTF8,
-			MB_ERR_INVALID_CHARS,
-			str.c_str(),
-			static_cast<int>(str.size()),
-			nullptr,
-			0);
-		if (length <= 0)
-			throw std::runtime_error("MultiByteToWideChar failed");
-		ret.resize(length);
-		MultiByteToWideChar(
-			CP_UTF8,
-			MB_ERR_INVALID_CHARS,
-			str.c_str(),
-			static_cast<int>(str.size()),
-			ret.data(),
-			length);
+		if (!Transcode::Utf8ToWide(str, ret))
+			throw std::runtime_error("invalid utf-8 string");
 		return ret;
 	}
 
@@ -348,11 +387,18 @@ namespace sfh
 		}
 	}
 
-	FontQueryResponse QueryFont(const wchar_t* str)
+	FontQueryResponse QueryFont(const wchar_t* str, const QueryStyle* style)
 	{
 		FontQueryRequest request;
 		request.set_version(1);
 		request.set_querystring(WideToUtf8String(str));
+		if (style)
+		{
+			auto requestStyle = request.mutable_style();
+			requestStyle->set_weight(style->weight);
+			requestStyle->set_italic(style->italic);
+			requestStyle->set_charset(style->charset);
+		}
 
 		return MakeRequest<FontQueryResponse>(request);
 	}
@@ -368,84 +414,158 @@ namespace sfh
 		auto _ = request.release_feedbackdata();
 	}
 
-	void SendFeedbackAsync(FontLoadFeedback&& feedback)
+	// sends feedback on one background thread so hooked calls don't wait for the daemon,
+	// Shutdown joins it
+	class FeedbackQueue
 	{
-		std::thread([fb = std::move(feedback)]()mutable
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_queueCV;
+		std::deque<FontLoadFeedback> m_queue;
+		bool m_stopped = false;
+		std::thread m_thread;
+
+		FeedbackQueue()
 		{
-			SendFeedback(fb);
-		}).detach();
-	}
+		}
 
-	void TryLoad(const wchar_t* query, const FontQueryResponse& response)
-	{
-		struct EnumInfo
+		void Run()
 		{
-			const FontQueryResponse* response;
-			std::vector<char> maskedFace;
-		};
+			for (;;)
+			{
+				FontLoadFeedback feedback;
+				{
+					std::unique_lock ul(m_mutex);
+					m_queueCV.wait(ul, [&]() { return m_stopped || !m_queue.empty(); });
+					if (m_stopped)
+						return;
+					feedback = std::move(m_queue.front());
+					m_queue.pop_front();
+				}
+				try
+				{
+					SendFeedback(feedback);
+				}
+				catch (...)
+				{
+					// feedback is best effort
+				}
+			}
+		}
+
+	public:
+		static FeedbackQueue& GetInstance()
+		{
+			static FeedbackQueue instance;
+			return instance;
+		}
 
-		wil::unique_hdc_window hDC = wil::GetWindowDC(HWND_DESKTOP);
-		LOGFONTW lf{};
-		wcscpy_s(lf.lfFaceName, LF_FACESIZE, query);
+		// the thread is killed before static destructors run at process exit
+		~FeedbackQueue()
+		{
+			if (m_thread.joinable())
+				m_thread.detach();
+		}
 
-		EnumInfo enumInfo;
-		enumInfo.response = &response;
-		enumInfo.maskedFace.assign(response.fonts_size(), 0);
+		void Push(FontLoadFeedback&& feedback)
+		{
+			{
+				std::lock_guard lg(m_mutex);
+				if (m_stopped)
+					return;
+				if (!m_thread.joinable())
+					m_thread = std::thread([this]() { Run(); });
+				m_queue.emplace_back(std::move(feedback));
+			}
+			m_queueCV.notify_one();
+		}
 
-		Detour::Original::EnumFontFamiliesExW(
-			hDC.get(), &lf, [](const LOGFONT* lpelfe, const TEXTMETRIC* lpntme, DWORD dwFontType, LPARAM lParam)-> int
+		// drops what wasn't sent yet and joins the thread
+		void Shutdown()
+		{
 			{
-				EnumInfo& info = *reinterpret_cast<EnumInfo*>(lParam);
-				auto faceName = WideToUtf8String(lpelfe->lfFaceName);
-				for (int i = 0; i < info.response->fonts_size(); ++i)
-				{
-					if (info.maskedFace[i])continue;
-					auto& face = info.response->fonts()[i];
-					if ((std::ranges::find(face.familyname(), faceName) != face.familyname().end()
-							|| face.ispsoutline()
-							&& std::ranges::find(face.postscriptname(), faceName) != face.postscriptname().end()
-							|| std::ranges::find(face.gdifullname(), faceName) != face.
-							gdifullname().end())
-						&& (!!face.oblique() == !!lpelfe->lfItalic && face.weight() == lpelfe->lfWeight)
-					)
-					{
-						info.maskedFace[i] = 1;
-					}
-				}
-				return TRUE;
-			}, reinterpret_cast<LPARAM>(&enumInfo), 0);
+				std::lock_guard lg(m_mutex);
+				m_stopped = true;
+				m_queue.clear();
+			}
+			m_queueCV.notify_one();
+			if (m_thread.joinable())
+				m_thread.join();
+		}
+	};
+
+	void SendFeedbackAsync(FontLoadFeedback&& feedback)
+	{
+		FeedbackQueue::GetInstance().Push(std::move(feedback));
+	}
+
+	// font files this process got through us
+	LoadedFontRegistry& GetLoadedFonts()
+	{
+		static LoadedFontRegistry instance;
+		return instance;
+	}
+
+	// registers a font file the daemon keeps in shared memory, nullptr if the blob is gone
+	HANDLE AddFontFromBlob(const FontFace& face)
+	{
+		if (face.blobname().empty() || face.blobsize() > std::numeric_limits<DWORD>::max())
+			return nullptr;
+		auto blob = SharedBlob::Open(Utf8ToWideString(face.blobname()), static_cast<size_t>(face.blobsize()));
+		if (!blob)
+			return nullptr;
+		DWORD fontCount = 0;
+		// GDI keeps a copy, the view can go right away
+		return AddFontMemResourceEx(const_cast<void*>(blob->GetData()), static_cast<DWORD>(blob->GetSize()),
+		                            nullptr, &fontCount);
+	}
 
+	// fonts registered from memory can't be enumerated, enumeration queries load files
+	void TryLoad(const FontQueryResponse& response, bool allowMemory)
+	{
 		FontLoadFeedback feedback;
 
 		for (int i = 0; i < response.fonts_size(); ++i)
 		{
-			if (enumInfo.maskedFace[i])continue;
-			auto path = Utf8ToWideString(response.fonts()[i].path());
-			feedback.add_path(response.fonts()[i].path());
-
-			AddFontResourceExW(path.c_str(), FR_PRIVATE, nullptr);
-
-			EventLog::GetInstance().LogDllLoadFont(GetCurrentProcessId(), GetCurrentThreadId(), path.c_str());
+			auto& face = response.fonts()[i];
+			// the daemon knows which faces GDI maps already, no need to enumerate here
+			if (face.installed())continue;
+			auto path = Utf8ToWideString(face.path());
+			feedback.add_path(face.path());
+
+			// GDI would open and parse the file again for every face it holds, a file registered
+			// from memory by an earlier query is registered again from disk for enumeration
+			GetLoadedFonts().Acquire(path, !allowMemory, [&](const std::wstring& fontPath, uintptr_t& token)
+			{
+				HANDLE memoryFont = allowMemory ? AddFontFromBlob(face) : nullptr;
+				if (memoryFont)
+					token = reinterpret_cast<uintptr_t>(memoryFont);
+				else if (AddFontResourceExW(fontPath.c_str(), FR_PRIVATE, nullptr) == 0)
+					return false;
+				EventLog::GetInstance().LogDllLoadFont(GetCurrentProcessId(), GetCurrentThreadId(), fontPath.c_str());
+				return true;
+			});
 		}
 
 		SendFeedbackAsync(std::move(feedback));
 	}
 
-	void QueryAndLoad(const wchar_t* query)
+	// set by Shutdown, hooked calls still in flight stop querying
+	std::atomic<bool> g_shutdown = false;
+
+	// resolutions hooked calls stopped waiting for
+	AsyncResolver& GetResolver()
+	{
+		static AsyncResolver instance;
+		return instance;
+	}
+
+	// queries and loads, the part that may outlive the hooked call
+	void ResolveNow(const wchar_t* query, const QueryStyle* style)
 	{
 		try
 		{
-			if (query == nullptr)
-				return;
-			// strip GDI added prefix '@'
-			if (*query == L'@')
-				++query;
-			// skip empty string
-			if (*query == L'\0')
-				return;
-			if (!QueryCache::GetInstance().IsQueryNeeded(query))
-				return;
-			auto response = QueryFont(query);
+			auto response = QueryFont(query, style);
 
 			std::vector<std::wstring> paths;
 			for (int i = 0; i < response.fonts_size(); ++i)
@@ -454,7 +574,7 @@ namespace sfh
 				auto path = Utf8ToWideString(font.path());
 				paths.emplace_back(std::move(path));
 			}
-			QueryCache::GetInstance().AddToCache(query);
+			QueryCache::GetInstance().AddToCache(query, response.stylespecific() ? style : nullptr);
 			std::vector<const wchar_t*> logData;
 			for (auto& s : paths)
 			{
@@ -469,7 +589,7 @@ namespace sfh
 				EventLog::GetInstance().LogDllQuerySuccess(GetCurrentProcessId(), GetCurrentThreadId(), query, logData);
 			}
 
-			TryLoad(query, response);
+			TryLoad(response, style != nullptr);
 		}
 		catch (std::exception& e)
 		{
@@ -479,7 +599,62 @@ namespace sfh
 		}
 	}
 
-	void QueryAndLoad(const char* query)
+	void QueryAndLoad(const wchar_t* query, const QueryStyle* style)
+	{
+		try
+		{
+			if (query == nullptr || g_shutdown)
+				return;
+			// strip GDI added prefix '@'
+			if (*query == L'@')
+				++query;
+			// skip empty string
+			if (*query == L'\0')
+				return;
+			if (!QueryCache::GetInstance().IsQueryNeeded(query, style))
+				return;
+			uint32_t timeout = QueryCache::GetInstance().GetResolveTimeout();
+			if (timeout == 0)
+			{
+				ResolveNow(query, style);
+				return;
+			}
+			// the caller's strings are gone once it stops waiting
+			std::wstring key(query);
+			std::optional<QueryStyle> styleCopy;
+			if (style)
+			{
+				auto suffix = QueryCache::MakeStyleSuffix(*style);
+				key.append(suffix.data(), suffix.size());
+				styleCopy = *style;
+			}
+			// a late result is cached and loaded all the same, the next call finds it
+			GetResolver().Resolve(key, [name = std::wstring(query), styleCopy]()
+			{
+				ResolveNow(name.c_str(), styleCopy ? &*styleCopy : nullptr);
+			}, std::chrono::milliseconds(timeout));
+		}
+		catch (...)
+		{
+			// ignore exceptions
+		}
+	}
+
+	void Shutdown()
+	{
+		g_shutdown = true;
+		GetResolver().Shutdown();
+		FeedbackQueue::GetInstance().Shutdown();
+		GetLoadedFonts().ReleaseAll([](const std::wstring& path, uintptr_t token)
+		{
+			if (token != 0)
+				RemoveFontMemResourceEx(reinterpret_cast<HANDLE>(token));
+			else
+				RemoveFontResourceExW(path.c_str(), FR_PRIVATE, nullptr);
+		});
+	}
+
+	void QueryAndLoad(const char* query, const QueryStyle* style)
 	{
 		if (query == nullptr)
 			return;
@@ -488,7 +663,7 @@ namespace sfh
 		try
 		{
 			auto wstr = AnsiStringToWideString(query);
-			QueryAndLoad(wstr.c_str());
+			QueryAndLoad(wstr.c_str(), style);
 		}
 		catch (...)
 		{
@@ -1,7 +1,20 @@
 #pragma once
 
+#include <cstdint>
+
 namespace sfh
 {
-	void QueryAndLoad(const wchar_t* query);
-	void QueryAndLoad(const char* query);
+	// style requested by font creation, enumeration queries don't have one
+	struct QueryStyle
+	{
+		uint32_t weight;
+		bool italic;
+		uint32_t charset;
+	};
+
+	void QueryAndLoad(const wchar_t* query, const QueryStyle* style = nullptr);
+	void QueryAndLoad(const char* query, const QueryStyle* style = nullptr);
+	// stops and joins the background threads and removes the fonts QueryAndLoad added,
+	// for an unload before process exit, not under the loader lock
+	void Shutdown();
 }
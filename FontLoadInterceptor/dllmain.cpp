@@ -2,8 +2,10 @@
 #include "pch.h"
 
 #include "AttachDetour.h"
+#include "RpcClient.h"
 #include "EventLog.h"
 
+#include <atomic>
 #include <clocale>
 
 #include <wil/win32_helpers.h>
@@ -14,6 +16,8 @@
 DWORD WINAPI DelayedAttach(LPVOID lpThreadParameter);
 
 DWORD attachThreadId = 0;
+// set by PrepareUnload, which already took the detours off
+std::atomic<bool> unloadPrepared = false;
 
 HMODULE LoadDll(const char* name)
 {
@@ -79,10 +83,9 @@ BOOL APIENTRY DllMain(HMODULE hModule,
 		case DLL_THREAD_DETACH:
 			break;
 		case DLL_PROCESS_DETACH:
-			if (sfh::IsDetourNeeded())
-			{
+			// fonts and threads are handled by PrepareUnload, the loader lock is held here
+			if (sfh::IsDetourNeeded() && !unloadPrepared)
 				sfh::DetachDetour();
-			}
 			break;
 		}
 		return TRUE;
@@ -146,6 +149,30 @@ extern "C" {
 #else
 #pragma comment(linker, "/export:InjectProcess=_InjectProcess@16")
 #endif
+	// whoever unloads the dll while the process keeps running calls this first, e.g. through
+	// CreateRemoteThread, at exit GDI removes the fonts itself
+#ifdef _WIN64
+#pragma comment(linker, "/export:PrepareUnload=PrepareUnload")
+#else
+#pragma comment(linker, "/export:PrepareUnload=_PrepareUnload@4")
+#endif
+	DWORD WINAPI PrepareUnload(LPVOID lpThreadParameter)
+	{
+		if (!sfh::IsDetourNeeded() || unloadPrepared.exchange(true))
+			return 0;
+		try
+		{
+			// no new hooked calls, then wait for the work they started
+			sfh::DetachDetour();
+			sfh::Shutdown();
+			return 0;
+		}
+		catch (...)
+		{
+			return 1;
+		}
+	}
+
 	void CALLBACK InjectProcess(HWND hWnd, HINSTANCE hInst, LPSTR lpszCmdLine, int nCmdShow)
 	{
 		_configthreadlocale(_ENABLE_PER_THREAD_LOCALE);
@@ -0,0 +1,152 @@
+#include "PersistantData.h"
+#include "FontDatabaseWriter.h"
+#include "Transcode.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// read only view of a whole file
+	class MappedFile
+	{
+	private:
+		const char* m_data = nullptr;
+		size_t m_length = 0;
+	public:
+		explicit MappedFile(const std::wstring& path)
+		{
+#ifdef _WIN32
+			HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			                          FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				throw std::runtime_error("cannot open font database");
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file, &size))
+			{
+				CloseHandle(file);
+				throw std::runtime_error("cannot open font database");
+			}
+			m_length = static_cast<size_t>(size.QuadPart);
+			// mapping an empty file fails, the parser rejects it anyway
+			if (m_length != 0)
+			{
+				HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping)
+				{
+					m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+					CloseHandle(mapping);
+				}
+			}
+			CloseHandle(file);
+#else
+			std::string utf8Path;
+			if (!sfh::Transcode::WideToUtf8(path, utf8Path))
+				throw std::runtime_error("cannot open font database");
+			int file = open(utf8Path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (file == -1)
+				throw std::runtime_error("cannot open font database");
+			struct stat info;
+			if (fstat(file, &info) != 0)
+			{
+				close(file);
+				throw std::runtime_error("cannot open font database");
+			}
+			m_length = static_cast<size_t>(info.st_size);
+			if (m_length != 0)
+			{
+				void* data = mmap(nullptr, m_length, PROT_READ, MAP_PRIVATE, file, 0);
+				if (data != MAP_FAILED)
+				{
+					madvise(data, m_length, MADV_SEQUENTIAL);
+					m_data = static_cast<const char*>(data);
+				}
+			}
+			close(file);
+#endif
+			if (m_length != 0 && !m_data)
+				throw std::runtime_error("cannot map font database");
+		}
+
+		~MappedFile()
+		{
+			if (!m_data)
+				return;
+#ifdef _WIN32
+			UnmapViewOfFile(m_data);
+#else
+			munmap(const_cast<char*>(m_data), m_length);
+#endif
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const char* GetData() const
+		{
+			return m_data;
+		}
+
+		size_t GetLength() const
+		{
+			return m_length;
+		}
+	};
+}
+
+std::wstring sfh::FontDatabase::GetPath(const StringPool& strings, const FontFaceElement& face)
+{
+	std::wstring ret(strings.Get(face.m_directory));
+	ret += strings.Get(face.m_fileName);
+	return ret;
+}
+
+void sfh::FontDatabase::SetPath(StringPool& strings, FontFaceElement& face, std::wstring_view path)
+{
+	size_t split = path.find_last_of(L"\\/");
+	split = split == std::wstring_view::npos ? 0 : split + 1;
+	face.m_directory = strings.Intern(path.substr(0, split));
+	face.m_fileName = strings.Intern(path.substr(split));
+}
+
+void sfh::FontDatabase::ImportFace(FontFaceElement&& face, const StringPool& strings)
+{
+	face.m_directory = m_strings.Intern(strings.Get(face.m_directory));
+	face.m_fileName = m_strings.Intern(strings.Get(face.m_fileName));
+	for (auto& name : face.m_names)
+		name.m_name = m_strings.Intern(strings.Get(name.m_name));
+	m_fonts.emplace_back(std::move(face));
+}
+
+std::unique_ptr<sfh::FontDatabase> sfh::FontDatabase::ReadFromFile(const std::wstring& path)
+{
+	MappedFile file(path);
+	try
+	{
+		return ReadFromMemory(file.GetData(), file.GetLength());
+	}
+	catch (std::runtime_error& e)
+	{
+		std::string utf8Path;
+		Transcode::WideToUtf8(path, utf8Path);
+		throw std::runtime_error(std::string(e.what()) + " in " + utf8Path);
+	}
+}
+
+void sfh::FontDatabase::WriteToFile(const std::wstring& path, const FontDatabase& db)
+{
+	FontDatabaseWriter writer(path);
+	for (auto& font : db.m_removedFonts)
+		writer.WriteRemovedFace(font, db.m_strings);
+	for (auto& font : db.m_fonts)
+		writer.WriteFace(font, db.m_strings);
+	writer.Close();
+}
@@ -0,0 +1,463 @@
+#include "PersistantData.h"
+#include "Transcode.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+	using FontFaceElement = sfh::FontDatabase::FontFaceElement;
+	using NameElement = FontFaceElement::NameElement;
+
+	// pull parser for the font database schema, working in place on the utf-8 document.
+	// only what the schema needs is supported: no DTD, no CDATA, ascii element and attribute names
+	class FontDatabaseParser
+	{
+	private:
+		struct Attribute
+		{
+			std::string_view m_name;
+			// raw, still escaped
+			std::string_view m_value;
+		};
+
+		const char* m_begin;
+		const char* m_pos;
+		const char* m_end;
+		sfh::FontDatabase& m_db;
+
+		std::vector<Attribute> m_attributes;
+		// string ids of Directory elements, in document order
+		std::vector<uint32_t> m_directories;
+		std::string m_unescaped;
+		std::wstring m_wide;
+
+		[[noreturn]] void Fail(const char* what) const
+		{
+			throw std::runtime_error(std::string("bad font database: ") + what + " at offset " +
+				std::to_string(m_pos - m_begin));
+		}
+
+		static bool IsWhitespace(char ch)
+		{
+			return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+		}
+
+		static bool IsNameChar(char ch)
+		{
+			return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9')
+				|| ch == '_' || ch == ':' || ch == '-' || ch == '.';
+		}
+
+		bool StartsWith(std::string_view prefix) const
+		{
+			return static_cast<size_t>(m_end - m_pos) >= prefix.size()
+				&& std::string_view(m_pos, prefix.size()) == prefix;
+		}
+
+		void Expect(std::string_view token)
+		{
+			if (!StartsWith(token))
+				Fail("unexpected token");
+			m_pos += token.size();
+		}
+
+		void SkipWhitespace()
+		{
+			while (m_pos != m_end && IsWhitespace(*m_pos))
+				++m_pos;
+		}
+
+		void SkipPast(std::string_view terminator)
+		{
+			auto found = std::string_view(m_pos, m_end - m_pos).find(terminator);
+			if (found == std::string_view::npos)
+				Fail("unterminated markup");
+			m_pos += found + terminator.size();
+		}
+
+		// whitespace, comments and processing instructions between elements
+		void SkipMisc()
+		{
+			for (;;)
+			{
+				SkipWhitespace();
+				if (StartsWith("<!--"))
+					SkipPast("-->");
+				else if (StartsWith("<?"))
+					SkipPast("?>");
+				else if (StartsWith("<!"))
+					Fail("unsupported markup declaration");
+				else
+					return;
+			}
+		}
+
+		std::string_view ReadName()
+		{
+			const char* start = m_pos;
+			while (m_pos != m_end && IsNameChar(*m_pos))
+				++m_pos;
+			if (start == m_pos)
+				Fail("expected a name");
+			return {start, static_cast<size_t>(m_pos - start)};
+		}
+
+		// reads "<name attr=...", returns true for an empty element tag
+		bool ReadStartTag(std::string_view& name)
+		{
+			Expect("<");
+			name = ReadName();
+			m_attributes.clear();
+			for (;;)
+			{
+				SkipWhitespace();
+				if (m_pos == m_end)
+					Fail("unterminated tag");
+				if (*m_pos == '>')
+				{
+					++m_pos;
+					return false;
+				}
+				if (StartsWith("/>"))
+				{
+					m_pos += 2;
+					return true;
+				}
+				auto& attribute = m_attributes.emplace_back();
+				attribute.m_name = ReadName();
+				SkipWhitespace();
+				Expect("=");
+				SkipWhitespace();
+				if (m_pos == m_end || (*m_pos != '"' && *m_pos != '\''))
+					Fail("expected a quoted value");
+				char quote = *m_pos++;
+				const char* start = m_pos;
+				while (m_pos != m_end && *m_pos != quote)
+				{
+					if (*m_pos == '<')
+						Fail("'<' in attribute value");
+					++m_pos;
+				}
+				if (m_pos == m_end)
+					Fail("unterminated attribute value");
+				attribute.m_value = {start, static_cast<size_t>(m_pos - start)};
+				++m_pos;
+			}
+		}
+
+		void ReadEndTag(std::string_view name)
+		{
+			Expect("</");
+			if (ReadName() != name)
+				Fail("mismatched end tag");
+			SkipWhitespace();
+			Expect(">");
+		}
+
+		// raw character data up to the next markup
+		std::string_view ReadText()
+		{
+			const char* start = m_pos;
+			while (m_pos != m_end && *m_pos != '<')
+				++m_pos;
+			return {start, static_cast<size_t>(m_pos - start)};
+		}
+
+		const Attribute* FindAttribute(std::string_view name) const
+		{
+			for (auto& attribute : m_attributes)
+			{
+				if (attribute.m_name == name)
+					return &attribute;
+			}
+			return nullptr;
+		}
+
+		void AppendReference(std::string_view& raw)
+		{
+			auto end = raw.find(';');
+			if (end == std::string_view::npos)
+				Fail("unterminated reference");
+			auto entity = raw.substr(1, end - 1);
+			raw.remove_prefix(end + 1);
+			if (entity == "lt")
+				m_unescaped += '<';
+			else if (entity == "gt")
+				m_unescaped += '>';
+			else if (entity == "amp")
+				m_unescaped += '&';
+			else if (entity == "quot")
+				m_unescaped += '"';
+			else if (entity == "apos")
+				m_unescaped += '\'';
+			else if (entity.size() > 1 && entity[0] == '#')
+			{
+				bool hex = entity[1] == 'x';
+				auto digits = entity.substr(hex ? 2 : 1);
+				if (digits.empty() || digits.size() > 8)
+					Fail("bad character reference");
+				char32_t cp = 0;
+				for (char ch : digits)
+				{
+					uint32_t digit;
+					if (ch >= '0' && ch <= '9')
+						digit = ch - '0';
+					else if (hex && ch >= 'a' && ch <= 'f')
+						digit = ch - 'a' + 10;
+					else if (hex && ch >= 'A' && ch <= 'F')
+						digit = ch - 'A' + 10;
+					else
+						Fail("bad character reference");
+					cp = cp * (hex ? 16 : 10) + digit;
+				}
+				if (cp == 0 || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+					Fail("bad character reference");
+				char buffer[4];
+				m_unescaped.append(buffer, sfh::Transcode::Detail::EncodeUtf8(cp, buffer));
+			}
+			else
+			{
+				Fail("unknown entity");
+			}
+		}
+
+		// resolve references and normalize line ends, attribute values also get whitespace normalized
+		std::string_view Unescape(std::string_view raw, bool attribute)
+		{
+			if (raw.find_first_of("&\r\t\n") == std::string_view::npos)
+				return raw;
+			m_unescaped.clear();
+			while (!raw.empty())
+			{
+				char ch = raw.front();
+				if (ch == '&')
+				{
+					AppendReference(raw);
+					continue;
+				}
+				raw.remove_prefix(1);
+				if (ch == '\r')
+				{
+					if (!raw.empty() && raw.front() == '\n')
+						raw.remove_prefix(1);
+					ch = '\n';
+				}
+				if (attribute && (ch == '\n' || ch == '\t'))
+					ch = ' ';
+				m_unescaped += ch;
+			}
+			return m_unescaped;
+		}
+
+		uint32_t Intern(std::string_view raw, bool attribute)
+		{
+			if (!sfh::Transcode::Utf8ToWide(Unescape(raw, attribute), m_wide))
+				Fail("invalid utf-8");
+			return m_db.m_strings.Intern(m_wide);
+		}
+
+		template <typename T>
+		T ParseNumber(std::string_view raw)
+		{
+			if (raw.empty())
+				Fail("empty number");
+			T ret = 0;
+			for (char ch : raw)
+			{
+				if (ch < '0' || ch > '9')
+					Fail("unexpected character in number");
+				T digit = ch - '0';
+				if (ret > (std::numeric_limits<T>::max() - digit) / 10)
+					Fail("number too large");
+				ret = ret * 10 + digit;
+			}
+			return ret;
+		}
+
+		void ParseDirectory(bool isEmpty)
+		{
+			auto id = FindAttribute("id");
+			// ids are assigned in document order
+			if (!id || ParseNumber<uint32_t>(id->m_value) != m_directories.size())
+				Fail("bad directory id");
+			std::string_view text;
+			if (!isEmpty)
+			{
+				text = ReadText();
+				ReadEndTag("Directory");
+			}
+			m_directories.push_back(Intern(text, false));
+		}
+
+		// path and index attributes, shared by FontFace and RemovedFontFace
+		bool ParseLocation(FontFaceElement& face, std::string_view name, std::string_view value,
+		                   bool& hasFile, bool& hasDirectory, bool& hasIndex)
+		{
+			if (name == "path")
+			{
+				// index files written before directories were pooled
+				if (!sfh::Transcode::Utf8ToWide(Unescape(value, true), m_wide))
+					Fail("invalid utf-8");
+				sfh::FontDatabase::SetPath(m_db.m_strings, face, m_wide);
+				hasFile = hasDirectory = true;
+			}
+			else if (name == "directory")
+			{
+				auto directory = ParseNumber<uint32_t>(value);
+				if (directory >= m_directories.size())
+					Fail("undefined directory");
+				face.m_directory = m_directories[directory];
+				hasDirectory = true;
+			}
+			else if (name == "file")
+			{
+				face.m_fileName = Intern(value, true);
+				hasFile = true;
+			}
+			else if (name == "index")
+			{
+				face.m_index = ParseNumber<uint32_t>(value);
+				hasIndex = true;
+			}
+			else
+			{
+				return false;
+			}
+			return true;
+		}
+
+		void ParseRemovedFontFace(bool isEmpty)
+		{
+			auto& face = m_db.m_removedFonts.emplace_back();
+			bool hasFile = false, hasDirectory = false, hasIndex = false;
+			for (auto& [name, value] : m_attributes)
+				ParseLocation(face, name, value, hasFile, hasDirectory, hasIndex);
+			if (!(hasFile && hasDirectory && hasIndex))
+				Fail("missing removed font face attribute");
+			if (!isEmpty)
+			{
+				SkipMisc();
+				ReadEndTag("RemovedFontFace");
+			}
+		}
+
+		void ParseFontFace(bool isEmpty)
+		{
+			auto& face = m_db.m_fonts.emplace_back();
+			bool hasFile = false, hasDirectory = false;
+			bool hasIndex = false, hasWeight = false, hasOblique = false, hasPsOutline = false;
+			for (auto& [name, value] : m_attributes)
+			{
+				if (ParseLocation(face, name, value, hasFile, hasDirectory, hasIndex))
+					continue;
+				if (name == "weight")
+				{
+					face.m_weight = ParseNumber<uint32_t>(value);
+					hasWeight = true;
+				}
+				else if (name == "oblique")
+				{
+					face.m_oblique = ParseNumber<uint32_t>(value);
+					hasOblique = true;
+				}
+				else if (name == "psOutline")
+				{
+					face.m_psOutline = ParseNumber<uint32_t>(value);
+					hasPsOutline = true;
+				}
+				else if (name == "width")
+					face.m_width = ParseNumber<uint32_t>(value);
+				else if (name == "codePageRange1")
+					face.m_codePageRange1 = ParseNumber<uint32_t>(value);
+				else if (name == "codePageRange2")
+					face.m_codePageRange2 = ParseNumber<uint32_t>(value);
+				else if (name == "stableId")
+					face.m_stableId = ParseNumber<uint64_t>(value);
+				// unknown attributes are ignored
+			}
+			if (!(hasFile && hasDirectory && hasIndex && hasWeight && hasOblique && hasPsOutline))
+				Fail("missing font face attribute");
+			if (isEmpty)
+				return;
+
+			for (;;)
+			{
+				SkipMisc();
+				if (StartsWith("</"))
+					break;
+				std::string_view element;
+				bool isEmptyName = ReadStartTag(element);
+				size_t type = 0;
+				for (; type < std::extent_v<decltype(NameElement::TYPEMAP)>; ++type)
+				{
+					std::wstring_view expected = NameElement::TYPEMAP[type];
+					if (std::equal(element.begin(), element.end(), expected.begin(), expected.end()))
+						break;
+				}
+				if (type == std::extent_v<decltype(NameElement::TYPEMAP)>)
+					Fail("unknown name element");
+				std::string_view text;
+				if (!isEmptyName)
+				{
+					text = ReadText();
+					ReadEndTag(element);
+				}
+				face.m_names.emplace_back(static_cast<NameElement::NameType>(type), Intern(text, false));
+			}
+			ReadEndTag("FontFace");
+		}
+
+	public:
+		FontDatabaseParser(const char* data, size_t length, sfh::FontDatabase& db)
+			: m_begin(data), m_pos(data), m_end(data + length), m_db(db)
+		{
+		}
+
+		void Parse()
+		{
+			// utf-8 byte order mark
+			if (StartsWith("\xef\xbb\xbf"))
+				m_pos += 3;
+			SkipMisc();
+			std::string_view element;
+			bool isEmpty = ReadStartTag(element);
+			if (element != "FontDatabase")
+				Fail("unexpected root element");
+			while (!isEmpty)
+			{
+				SkipMisc();
+				if (StartsWith("</"))
+				{
+					ReadEndTag("FontDatabase");
+					break;
+				}
+				bool isEmptyChild = ReadStartTag(element);
+				if (element == "Directory")
+					ParseDirectory(isEmptyChild);
+				else if (element == "FontFace")
+					ParseFontFace(isEmptyChild);
+				else if (element == "RemovedFontFace")
+					ParseRemovedFontFace(isEmptyChild);
+				else
+					Fail("unexpected element");
+			}
+			SkipMisc();
+			if (m_pos != m_end)
+				Fail("content after root element");
+		}
+	};
+}
+
+std::unique_ptr<sfh::FontDatabase> sfh::FontDatabase::ReadFromMemory(const char* data, size_t length)
+{
+	auto ret = std::make_unique<FontDatabase>();
+	FontDatabaseParser(data, length, *ret).Parse();
+	return ret;
+}
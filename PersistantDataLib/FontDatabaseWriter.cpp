@@ -0,0 +1,185 @@
+#include "FontDatabaseWriter.h"
+#include "Transcode.h"
+
+#include <cassert>
+#include <stdexcept>
+#include <type_traits>
+
+namespace
+{
+	// flush threshold of the output buffer
+	constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+	std::FILE* OpenForWrite(const std::wstring& path)
+	{
+#ifdef _WIN32
+		return _wfopen(path.c_str(), L"wb");
+#else
+		std::string utf8Path;
+		if (!sfh::Transcode::WideToUtf8(path, utf8Path))
+			return nullptr;
+		return std::fopen(utf8Path.c_str(), "wb");
+#endif
+	}
+}
+
+sfh::FontDatabaseWriter::FontDatabaseWriter(const std::wstring& path)
+{
+	m_file = OpenForWrite(path);
+	if (!m_file)
+		throw std::runtime_error("cannot open font database for writing");
+	m_buffer.reserve(BUFFER_SIZE * 2);
+	m_buffer += "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\r\n<FontDatabase>\r\n";
+}
+
+sfh::FontDatabaseWriter::~FontDatabaseWriter()
+{
+	if (m_file)
+		std::fclose(m_file);
+}
+
+void sfh::FontDatabaseWriter::Flush()
+{
+	if (!m_buffer.empty() && std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size())
+		throw std::runtime_error("failed to write font database");
+	m_buffer.clear();
+}
+
+void sfh::FontDatabaseWriter::AppendEscaped(std::wstring_view str, bool attribute)
+{
+	if (!Transcode::WideToUtf8(str, m_scratch))
+		throw std::runtime_error("unpaired surrogate in font database string");
+	for (char ch : m_scratch)
+	{
+		switch (ch)
+		{
+		case '&':
+			m_buffer += "&amp;";
+			break;
+		case '<':
+			m_buffer += "&lt;";
+			break;
+		case '>':
+			m_buffer += "&gt;";
+			break;
+		case '"':
+			m_buffer += attribute ? "&quot;" : "\"";
+			break;
+		case '\t':
+		case '\n':
+		case '\r':
+			// attribute values are whitespace normalized unless written as references
+			if (attribute || ch == '\r')
+			{
+				m_buffer += "&#";
+				m_buffer += std::to_string(static_cast<int>(ch));
+				m_buffer += ';';
+			}
+			else
+			{
+				m_buffer += ch;
+			}
+			break;
+		default:
+			// other control characters can't be represented in XML 1.0 at all
+			if (static_cast<unsigned char>(ch) >= 0x20)
+				m_buffer += ch;
+			break;
+		}
+	}
+}
+
+void sfh::FontDatabaseWriter::AppendAttribute(const char* name, std::wstring_view value)
+{
+	m_buffer += ' ';
+	m_buffer += name;
+	m_buffer += "=\"";
+	AppendEscaped(value, true);
+	m_buffer += '"';
+}
+
+void sfh::FontDatabaseWriter::AppendAttribute(const char* name, uint64_t value)
+{
+	m_buffer += ' ';
+	m_buffer += name;
+	m_buffer += "=\"";
+	m_buffer += std::to_string(value);
+	m_buffer += '"';
+}
+
+uint32_t sfh::FontDatabaseWriter::AppendDirectory(std::wstring_view directory)
+{
+	auto iter = m_directories.find(std::wstring(directory));
+	if (iter == m_directories.end())
+	{
+		iter = m_directories.emplace(directory, static_cast<uint32_t>(m_directories.size())).first;
+		m_buffer += "\t<Directory";
+		AppendAttribute("id", iter->second);
+		m_buffer += '>';
+		AppendEscaped(directory, false);
+		m_buffer += "</Directory>\r\n";
+	}
+	return iter->second;
+}
+
+void sfh::FontDatabaseWriter::WriteFace(const FontDatabase::FontFaceElement& face, const StringPool& strings)
+{
+	assert(m_file != nullptr);
+	using NameElement = FontDatabase::FontFaceElement::NameElement;
+
+	uint32_t directory = AppendDirectory(strings.Get(face.m_directory));
+	m_buffer += "\t<FontFace";
+	AppendAttribute("directory", directory);
+	AppendAttribute("file", strings.Get(face.m_fileName));
+	AppendAttribute("index", face.m_index);
+	AppendAttribute("weight", face.m_weight);
+	AppendAttribute("oblique", face.m_oblique);
+	AppendAttribute("psOutline", face.m_psOutline);
+	AppendAttribute("width", face.m_width);
+	AppendAttribute("codePageRange1", face.m_codePageRange1);
+	AppendAttribute("codePageRange2", face.m_codePageRange2);
+	AppendAttribute("stableId", face.m_stableId);
+	m_buffer += ">\r\n";
+	for (auto& name : face.m_names)
+	{
+		assert(name.m_type < std::extent_v<decltype(NameElement::TYPEMAP)>);
+		std::wstring_view element = NameElement::TYPEMAP[name.m_type];
+		m_buffer += "\t\t<";
+		// element names are ASCII
+		m_buffer.append(element.begin(), element.end());
+		m_buffer += '>';
+		AppendEscaped(strings.Get(name.m_name), false);
+		m_buffer += "</";
+		m_buffer.append(element.begin(), element.end());
+		m_buffer += ">\r\n";
+	}
+	m_buffer += "\t</FontFace>\r\n";
+
+	if (m_buffer.size() >= BUFFER_SIZE)
+		Flush();
+}
+
+void sfh::FontDatabaseWriter::WriteRemovedFace(const FontDatabase::FontFaceElement& face, const StringPool& strings)
+{
+	assert(m_file != nullptr);
+	uint32_t directory = AppendDirectory(strings.Get(face.m_directory));
+	m_buffer += "\t<RemovedFontFace";
+	AppendAttribute("directory", directory);
+	AppendAttribute("file", strings.Get(face.m_fileName));
+	AppendAttribute("index", face.m_index);
+	m_buffer += "/>\r\n";
+
+	if (m_buffer.size() >= BUFFER_SIZE)
+		Flush();
+}
+
+void sfh::FontDatabaseWriter::Close()
+{
+	assert(m_file != nullptr);
+	m_buffer += "</FontDatabase>\r\n";
+	Flush();
+	int result = std::fclose(m_file);
+	m_file = nullptr;
+	if (result != 0)
+		throw std::runtime_error("failed to write font database");
+}
@@ -7,6 +7,7 @@
 #include <cwctype>
 #include <memory>
 #include <variant>
+#include <type_traits>
 
 #include <Windows.h>
 #undef max
@@ -37,6 +38,11 @@ namespace
 		return static_cast<uint32_t>(ret);
 	}
 
+	bool IsElementName(const wchar_t* name, int length, const wchar_t* expected)
+	{
+		return wcsncmp(name, expected, length) == 0 && expected[length] == 0;
+	}
+
 	class SimpleSAXContentHandler : public ISAXContentHandler
 	{
 	private:
@@ -193,6 +199,14 @@ namespace
 
 					DEFINE_XML_ATTRIBUTE(wmiPollInterval);
 					DEFINE_XML_ATTRIBUTE(lruSize);
+					DEFINE_XML_ATTRIBUTE(matchPolicy);
+					DEFINE_XML_ATTRIBUTE(resolveTimeout);
+					DEFINE_XML_ATTRIBUTE(blobCacheSize);
+					DEFINE_XML_ATTRIBUTE(localCacheDirectory);
+					DEFINE_XML_ATTRIBUTE(localCacheSize);
+					DEFINE_XML_ATTRIBUTE(localCacheBandwidth);
+					DEFINE_XML_ATTRIBUTE(prefetchSize);
+					DEFINE_XML_ATTRIBUTE(warmUpBandwidth);
 
 #undef DEFINE_XML_ATTRIBUTE
 					if (SUCCEEDED(
@@ -222,6 +236,116 @@ namespace
 							return E_FAIL;
 						}
 					}
+					if (SUCCEEDED(
+						pAttributes->getValueFromName(L"", 0, matchPolicy, matchPolicyCch, &attrValue, &attrLength)))
+					{
+						size_t policy = 0;
+						for (; policy < std::extent_v<decltype(sfh::ConfigFile::MATCHPOLICYMAP)>; ++policy)
+						{
+							if (IsElementName(attrValue, attrLength, sfh::ConfigFile::MATCHPOLICYMAP[policy]))
+								break;
+						}
+						if (policy == std::extent_v<decltype(sfh::ConfigFile::MATCHPOLICYMAP)>)
+							return E_FAIL;
+						m_config->matchPolicy = static_cast<sfh::ConfigFile::MatchPolicy>(policy);
+					}
+					if (SUCCEEDED(
+						pAttributes->getValueFromName(L"", 0, resolveTimeout, resolveTimeoutCch, &attrValue, &
+							attrLength)))
+					{
+						try
+						{
+							m_config->resolveTimeout = wcstou32(attrValue, attrLength);
+						}
+						catch (...)
+						{
+							// don't let exceptions travel across dll
+							return E_FAIL;
+						}
+					}
+					if (SUCCEEDED(
+						pAttributes->getValueFromName(L"", 0, blobCacheSize, blobCacheSizeCch, &attrValue, &
+							attrLength)))
+					{
+						try
+						{
+							m_config->blobCacheSize = wcstou32(attrValue, attrLength);
+						}
+						catch (...)
+						{
+							// don't let exceptions travel across dll
+							return E_FAIL;
+						}
+					}
+					if (SUCCEEDED(
+						pAttributes->getValueFromName(L"", 0, localCacheDirectory, localCacheDirectoryCch, &attrValue, &
+							attrLength)))
+					{
+						try
+						{
+							m_config->localCacheDirectory.assign(attrValue, attrLength);
+						}
+						catch (...)
+						{
+							// don't let exceptions travel across dll
+							return E_FAIL;
+						}
+					}
+					if (SUCCEEDED(
+						pAttributes->getValueFromName(L"", 0, localCacheSize, localCacheSizeCch, &attrValue, &
+							attrLength)))
+					{
+						try
+						{
+							m_config->localCacheSize = wcstou32(attrValue, attrLength);
+						}
+						catch (...)
+						{
+							// don't let exceptions travel across dll
+							return E_FAIL;
+						}
+					}
+					if (SUCCEEDED(
+						pAttributes->getValueFromName(L"", 0, localCacheBandwidth, localCacheBandwidthCch, &attrValue, &
+							attrLength)))
+					{
+						try
+						{
+							m_config->localCacheBandwidth = wcstou32(attrValue, attrLength);
+						}
+						catch (...)
+						{
+							// don't let exceptions travel across dll
+							return E_FAIL;
+						}
+					}
+					if (SUCCEEDED(
+						pAttributes->getValueFromName(L"", 0, prefetchSize, prefetchSizeCch, &attrValue, &attrLength)))
+					{
+						try
+						{
+							m_config->prefetchSize = wcstou32(attrValue, attrLength);
+						}
+						catch (...)
+						{
+							// don't let exceptions travel across dll
+							return E_FAIL;
+						}
+					}
+					if (SUCCEEDED(
+						pAttributes->getValueFromName(L"", 0, warmUpBandwidth, warmUpBandwidthCch, &attrValue, &
+							attrLength)))
+					{
+						try
+						{
+							m_config->warmUpBandwidth = wcstou32(attrValue, attrLength);
+						}
+						catch (...)
+						{
+							// don't let exceptions travel across dll
+							return E_FAIL;
+						}
+					}
 				}
 				else
 				{
@@ -322,239 +446,6 @@ namespace
 			return std::move(m_config);
 		}
 	};
-
-	class FontDatabaseSAXContentHandler : public SimpleSAXContentHandler
-	{
-	private:
-		enum class ElementType :size_t
-		{
-			Document = 0,
-			RootElement,
-			FontFaceElement,
-			Win32FamilyNameElement,
-			FullNameElement,
-			PostScriptNameElement
-		};
-
-		std::unique_ptr<sfh::FontDatabase> m_db;
-		std::vector<ElementType> m_status;
-
-	public:
-		HRESULT STDMETHODCALLTYPE startDocument() override
-		{
-			m_db = std::make_unique<sfh::FontDatabase>();
-			m_status.clear();
-			m_status.emplace_back(ElementType::Document);
-			return S_OK;
-		}
-
-		HRESULT STDMETHODCALLTYPE endDocument() override
-		{
-			if (!m_status.empty() && m_status.back() == ElementType::Document)
-				m_status.pop_back();
-			if (m_status.empty())
-				return S_OK;
-			return E_FAIL;
-		}
-
-		template <typename T, size_t N>
-		HRESULT RetrieveAttribute(ISAXAttributes* pAttributes, T& ptr, std::wstring T::* mptr, const wchar_t (&name)[N])
-		{
-			const wchar_t* attrValue;
-			int attrLength;
-			assert(mptr != nullptr);
-			assert(pAttributes != nullptr);
-			RETURN_HR_IF(E_FAIL, FAILED(pAttributes->getValueFromName(L"", 0, name, N - 1, &attrValue, &attrLength)));
-			(ptr.*mptr).assign(attrValue, attrLength);
-			return S_OK;
-		}
-
-		template <typename T, size_t N>
-		HRESULT RetrieveAttribute(ISAXAttributes* pAttributes, T& ptr, uint32_t T::* mptr, const wchar_t (&name)[N])
-		{
-			const wchar_t* attrValue;
-			int attrLength;
-			assert(mptr != nullptr);
-			assert(pAttributes != nullptr);
-			RETURN_HR_IF(E_FAIL, FAILED(pAttributes->getValueFromName(L"", 0, name, N - 1, &attrValue, &attrLength)));
-			try
-			{
-				ptr.*mptr = wcstou32(attrValue, attrLength);
-			}
-			catch (...)
-			{
-				return E_FAIL;
-			}
-			return S_OK;
-		}
-
-		HRESULT STDMETHODCALLTYPE startElement(const wchar_t* pwchNamespaceUri, int cchNamespaceUri,
-		                                       const wchar_t* pwchLocalName,
-		                                       int cchLocalName, const wchar_t* pwchQName, int cchQName,
-		                                       ISAXAttributes* pAttributes) override
-		{
-			if (m_status.empty())
-				return E_FAIL;
-			switch (m_status.back())
-			{
-			case ElementType::Document:
-				if (wcsncmp(pwchLocalName, L"FontDatabase", cchLocalName) == 0)
-				{
-					m_status.emplace_back(ElementType::RootElement);
-				}
-				else
-				{
-					return E_FAIL;
-				}
-				break;
-			case ElementType::RootElement:
-				if (wcsncmp(pwchLocalName, L"FontFace", cchLocalName) == 0)
-				{
-					m_db->m_fonts.emplace_back();
-					m_status.emplace_back(ElementType::FontFaceElement);
-					RETURN_IF_FAILED(
-						RetrieveAttribute(pAttributes, m_db->m_fonts.back(), &sfh::FontDatabase::FontFaceElement::m_path
-							,
-							L"path"));
-					RETURN_IF_FAILED(
-						RetrieveAttribute(pAttributes, m_db->m_fonts.back(), &sfh::FontDatabase::FontFaceElement::
-							m_index,
-							L"index"));
-					RETURN_IF_FAILED(
-						RetrieveAttribute(pAttributes, m_db->m_fonts.back(), &sfh::FontDatabase::FontFaceElement::
-							m_weight,
-							L"weight"));
-					RETURN_IF_FAILED(
-						RetrieveAttribute(pAttributes, m_db->m_fonts.back(), &sfh::FontDatabase::FontFaceElement::
-							m_oblique,
-							L"oblique"));
-					RETURN_IF_FAILED(
-						RetrieveAttribute(pAttributes, m_db->m_fonts.back(), &sfh::FontDatabase::FontFaceElement::
-							m_psOutline,
-							L"psOutline"));
-				}
-				else
-				{
-					return E_FAIL;
-				}
-				break;
-			case ElementType::FontFaceElement:
-				if (wcsncmp(pwchLocalName, L"Win32FamilyName", cchLocalName) == 0)
-				{
-					m_status.emplace_back(ElementType::Win32FamilyNameElement);
-					m_db->m_fonts.back().m_names.emplace_back();
-					m_db->m_fonts.back().m_names.back().m_type =
-						sfh::FontDatabase::FontFaceElement::NameElement::Win32FamilyName;
-				}
-				else if (wcsncmp(pwchLocalName, L"FullName", cchLocalName) == 0)
-				{
-					m_status.emplace_back(ElementType::FullNameElement);
-					m_db->m_fonts.back().m_names.emplace_back();
-					m_db->m_fonts.back().m_names.back().m_type =
-						sfh::FontDatabase::FontFaceElement::NameElement::FullName;
-				}
-				else if (wcsncmp(pwchLocalName, L"PostScriptName", cchLocalName) == 0)
-				{
-					m_status.emplace_back(ElementType::PostScriptNameElement);
-					m_db->m_fonts.back().m_names.emplace_back();
-					m_db->m_fonts.back().m_names.back().m_type =
-						sfh::FontDatabase::FontFaceElement::NameElement::PostScriptName;
-				}
-				else
-				{
-					return E_FAIL;
-				}
-				break;
-			default:
-				return E_FAIL;
-			}
-			return S_OK;
-		}
-
-		HRESULT STDMETHODCALLTYPE endElement(const wchar_t* pwchNamespaceUri, int cchNamespaceUri,
-		                                     const wchar_t* pwchLocalName,
-		                                     int cchLocalName, const wchar_t* pwchQName, int cchQName) override
-		{
-			if (m_status.empty())
-				return E_FAIL;
-			switch (m_status.back())
-			{
-			case ElementType::RootElement:
-				if (wcsncmp(pwchLocalName, L"FontDatabase", cchLocalName) == 0)
-				{
-					m_status.pop_back();
-				}
-				else
-				{
-					return E_FAIL;
-				}
-				break;
-			case ElementType::FontFaceElement:
-				if (wcsncmp(pwchLocalName, L"FontFace", cchLocalName) == 0)
-				{
-					m_status.pop_back();
-				}
-				else
-				{
-					return E_FAIL;
-				}
-				break;
-			case ElementType::Win32FamilyNameElement:
-				if (wcsncmp(pwchLocalName, L"Win32FamilyName", cchLocalName) == 0)
-				{
-					m_status.pop_back();
-				}
-				else
-				{
-					return E_FAIL;
-				}
-				break;
-			case ElementType::FullNameElement:
-				if (wcsncmp(pwchLocalName, L"FullName", cchLocalName) == 0)
-				{
-					m_status.pop_back();
-				}
-				else
-				{
-					return E_FAIL;
-				}
-				break;
-			case ElementType::PostScriptNameElement:
-				if (wcsncmp(pwchLocalName, L"PostScriptName", cchLocalName) == 0)
-				{
-					m_status.pop_back();
-				}
-				else
-				{
-					return E_FAIL;
-				}
-				break;
-			default:
-				return E_FAIL;
-			}
-			return S_OK;
-		}
-
-		HRESULT STDMETHODCALLTYPE characters(const wchar_t* pwchChars, int cchChars) override
-		{
-			if (m_status.empty())
-				return E_FAIL;
-			switch (m_status.back())
-			{
-			case ElementType::Win32FamilyNameElement:
-			case ElementType::FullNameElement:
-			case ElementType::PostScriptNameElement:
-				m_db->m_fonts.back().m_names.back().m_name.assign(pwchChars, cchChars);
-			}
-			// ignore unexpected characters
-			return S_OK;
-		}
-
-		std::unique_ptr<sfh::FontDatabase> GetFontDatabase()
-		{
-			return std::move(m_db);
-		}
-	};
 }
 
 std::unique_ptr<sfh::ConfigFile> sfh::ConfigFile::ReadFromFile(const std::wstring& path)
@@ -581,30 +472,6 @@ std::unique_ptr<sfh::ConfigFile> sfh::ConfigFile::ReadFromFile(const std::wstrin
 	return handler->GetConfigFile();
 }
 
-std::unique_ptr<sfh::FontDatabase> sfh::FontDatabase::ReadFromFile(const std::wstring& path)
-{
-	auto com = wil::CoInitializeEx();
-
-	wil::unique_variant pathVariant;
-	wil::com_ptr<IStream> stream;
-	THROW_IF_FAILED_MSG(
-		SHCreateStreamOnFileEx(
-			path.c_str(),
-			STGM_FAILIFTHERE | STGM_READ | STGM_SHARE_EXCLUSIVE,
-			FILE_ATTRIBUTE_NORMAL,
-			FALSE,
-			nullptr,
-			stream.put()), "CANNOT OPEN FONTDATABASE: %ws", path.c_str());
-	InitVariantFromUnknown(stream.query<IUnknown>().get(), pathVariant.addressof());
-
-	auto saxReader = wil::CoCreateInstance<ISAXXMLReader>(CLSID_SAXXMLReader30);
-	wil::com_ptr<FontDatabaseSAXContentHandler> handler(new FontDatabaseSAXContentHandler);
-	THROW_IF_FAILED(saxReader->putContentHandler(handler.get()));
-	THROW_IF_FAILED_MSG(saxReader->parse(pathVariant), "BAD FONTDATABASE: %ws", path.c_str());
-
-	return handler->GetFontDatabase();
-}
-
 namespace sfh
 {
 	void WriteDocumentToFile(wil::com_ptr<IStream> stream, wil::com_ptr<IXMLDOMDocument> document)
@@ -640,6 +507,26 @@ namespace sfh
 		THROW_IF_FAILED(rootElement->setAttribute(wil::make_bstr(L"wmiPollInterval").get(), value));
 		InitVariantFromString(std::to_wstring(config.lruSize).c_str(), value.addressof());
 		THROW_IF_FAILED(rootElement->setAttribute(wil::make_bstr(L"lruSize").get(), value));
+		InitVariantFromString(ConfigFile::MATCHPOLICYMAP[static_cast<size_t>(config.matchPolicy)],
+		                      value.reset_and_addressof());
+		THROW_IF_FAILED(rootElement->setAttribute(wil::make_bstr(L"matchPolicy").get(), value));
+		InitVariantFromString(std::to_wstring(config.resolveTimeout).c_str(), value.reset_and_addressof());
+		THROW_IF_FAILED(rootElement->setAttribute(wil::make_bstr(L"resolveTimeout").get(), value));
+		InitVariantFromString(std::to_wstring(config.blobCacheSize).c_str(), value.reset_and_addressof());
+		THROW_IF_FAILED(rootElement->setAttribute(wil::make_bstr(L"blobCacheSize").get(), value));
+		if (!config.localCacheDirectory.empty())
+		{
+			InitVariantFromString(config.localCacheDirectory.c_str(), value.reset_and_addressof());
+			THROW_IF_FAILED(rootElement->setAttribute(wil::make_bstr(L"localCacheDirectory").get(), value));
+		}
+		InitVariantFromString(std::to_wstring(config.localCacheSize).c_str(), value.reset_and_addressof());
+		THROW_IF_FAILED(rootElement->setAttribute(wil::make_bstr(L"localCacheSize").get(), value));
+		InitVariantFromString(std::to_wstring(config.localCacheBandwidth).c_str(), value.reset_and_addressof());
+		THROW_IF_FAILED(rootElement->setAttribute(wil::make_bstr(L"localCacheBandwidth").get(), value));
+		InitVariantFromString(std::to_wstring(config.prefetchSize).c_str(), value.reset_and_addressof());
+		THROW_IF_FAILED(rootElement->setAttribute(wil::make_bstr(L"prefetchSize").get(), value));
+		InitVariantFromString(std::to_wstring(config.warmUpBandwidth).c_str(), value.reset_and_addressof());
+		THROW_IF_FAILED(rootElement->setAttribute(wil::make_bstr(L"warmUpBandwidth").get(), value));
 		for (auto& indexFile : config.m_indexFile)
 		{
 			wil::com_ptr<IXMLDOMElement> indexFileElement;
@@ -662,48 +549,6 @@ namespace sfh
 
 		return document;
 	}
-
-	wil::com_ptr<IXMLDOMDocument> FontDatabaseToDocument(const FontDatabase& db)
-	{
-		auto document = wil::CoCreateInstance<IXMLDOMDocument>(CLSID_DOMDocument30);
-
-		wil::com_ptr<IXMLDOMElement> rootElement;
-		THROW_IF_FAILED(document->createElement(wil::make_bstr(L"FontDatabase").get(), rootElement.put()));
-
-		for (auto& font : db.m_fonts)
-		{
-			wil::com_ptr<IXMLDOMElement> fontfaceElement;
-			THROW_IF_FAILED(document->createElement(wil::make_bstr(L"FontFace").get(), fontfaceElement.put()));
-
-			wil::unique_variant value;
-
-			InitVariantFromString(font.m_path.c_str(), value.reset_and_addressof());
-			THROW_IF_FAILED(fontfaceElement->setAttribute(wil::make_bstr(L"path").get(), value));
-			InitVariantFromString(std::to_wstring(font.m_index).c_str(), value.reset_and_addressof());
-			THROW_IF_FAILED(fontfaceElement->setAttribute(wil::make_bstr(L"index").get(), value));
-			InitVariantFromString(std::to_wstring(font.m_weight).c_str(), value.reset_and_addressof());
-			THROW_IF_FAILED(fontfaceElement->setAttribute(wil::make_bstr(L"weight").get(), value));
-			InitVariantFromString(std::to_wstring(font.m_oblique).c_str(), value.reset_and_addressof());
-			THROW_IF_FAILED(fontfaceElement->setAttribute(wil::make_bstr(L"oblique").get(), value));
-			InitVariantFromString(std::to_wstring(font.m_psOutline).c_str(), value.reset_and_addressof());
-			THROW_IF_FAILED(fontfaceElement->setAttribute(wil::make_bstr(L"psOutline").get(), value));
-
-			for (auto& name : font.m_names)
-			{
-				wil::com_ptr<IXMLDOMElement> nameElement;
-				assert(name.m_type < std::extent_v<decltype(FontDatabase::FontFaceElement::NameElement::TYPEMAP)>);
-				THROW_IF_FAILED(
-					document->createElement(wil::make_bstr(FontDatabase::FontFaceElement::NameElement::TYPEMAP[name
-						.m_type]).get(), nameElement.put()));
-				THROW_IF_FAILED(nameElement->put_text(wil::make_bstr(name.m_name.c_str()).get()));
-				THROW_IF_FAILED(fontfaceElement->appendChild(nameElement.get(), nullptr));
-			}
-			THROW_IF_FAILED(rootElement->appendChild(fontfaceElement.get(), nullptr));
-		}
-		THROW_IF_FAILED(document->putref_documentElement(rootElement.get()));
-
-		return document;
-	}
 }
 
 void sfh::ConfigFile::WriteToFile(const std::wstring& path, const ConfigFile& config)
@@ -723,21 +568,3 @@ void sfh::ConfigFile::WriteToFile(const std::wstring& path, const ConfigFile& co
 	auto document = ConfigFileToDocument(config);
 	WriteDocumentToFile(stream, document);
 }
-
-void sfh::FontDatabase::WriteToFile(const std::wstring& path, const FontDatabase& db)
-{
-	auto com = wil::CoInitializeEx();
-
-	wil::com_ptr<IStream> stream;
-	THROW_IF_FAILED(
-		SHCreateStreamOnFileEx(
-			path.c_str(),
-			STGM_CREATE | STGM_READWRITE | STGM_SHARE_EXCLUSIVE,
-			FILE_ATTRIBUTE_NORMAL,
-			TRUE,
-			nullptr,
-			stream.put()));
-
-	auto document = FontDatabaseToDocument(db);
-	WriteDocumentToFile(stream, document);
-}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// case folding for face names and paths shared by the daemon and the interceptor.
+// std::towlower depends on the C locale of whichever process runs it, so the same name
+// could fold differently on the two sides. this table is fixed: ascii, latin-1,
+// latin extended-a, greek, cyrillic and fullwidth latin, everything else is kept
+
+namespace sfh
+{
+	constexpr wchar_t FoldCase(wchar_t ch)
+	{
+		auto cp = static_cast<uint32_t>(ch);
+		if (cp < 0x80)
+			return cp >= 'A' && cp <= 'Z' ? static_cast<wchar_t>(cp + 0x20) : ch;
+		// latin-1, the multiplication sign sits among the capitals
+		if (cp >= 0xc0 && cp <= 0xde && cp != 0xd7)
+			return static_cast<wchar_t>(cp + 0x20);
+		// latin extended-a alternates capital and small, dotted I and dotless i are left alone
+		if ((cp >= 0x100 && cp <= 0x12f) || (cp >= 0x132 && cp <= 0x137) || (cp >= 0x14a && cp <= 0x177))
+			return static_cast<wchar_t>(cp | 1);
+		if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17e))
+			return cp & 1 ? static_cast<wchar_t>(cp + 1) : ch;
+		if (cp == 0x178)
+			return static_cast<wchar_t>(0xff);
+		// greek
+		if (cp >= 0x391 && cp <= 0x3ab && cp != 0x3a2)
+			return static_cast<wchar_t>(cp + 0x20);
+		if (cp == 0x386)
+			return static_cast<wchar_t>(0x3ac);
+		if (cp >= 0x388 && cp <= 0x38a)
+			return static_cast<wchar_t>(cp + 0x25);
+		if (cp == 0x38c)
+			return static_cast<wchar_t>(0x3cc);
+		if (cp == 0x38e || cp == 0x38f)
+			return static_cast<wchar_t>(cp + 0x3f);
+		// cyrillic
+		if (cp >= 0x400 && cp <= 0x40f)
+			return static_cast<wchar_t>(cp + 0x50);
+		if (cp >= 0x410 && cp <= 0x42f)
+			return static_cast<wchar_t>(cp + 0x20);
+		if ((cp >= 0x460 && cp <= 0x481) || (cp >= 0x48a && cp <= 0x4bf))
+			return static_cast<wchar_t>(cp | 1);
+		// fullwidth latin
+		if (cp >= 0xff21 && cp <= 0xff3a)
+			return static_cast<wchar_t>(cp + 0x20);
+		return ch;
+	}
+
+	inline void FoldCase(std::wstring_view str, std::wstring& out)
+	{
+		out.resize(str.size());
+		std::transform(str.begin(), str.end(), out.begin(), [](wchar_t ch) { return FoldCase(ch); });
+	}
+
+	inline std::wstring FoldCase(std::wstring_view str)
+	{
+		std::wstring ret;
+		FoldCase(str, ret);
+		return ret;
+	}
+}
@@ -0,0 +1,327 @@
+#pragma once
+
+#include "Transcode.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace sfh
+{
+	// a read only copy of a file in shared memory other processes of the user can map,
+	// a named section on windows, a memfd other processes open through /proc elsewhere
+	class SharedBlob
+	{
+	private:
+		// what Open takes in another process
+		std::wstring m_name;
+		size_t m_size = 0;
+		void* m_data = nullptr;
+#ifdef _WIN32
+		HANDLE m_mapping = nullptr;
+#else
+		int m_file = -1;
+#endif
+
+		SharedBlob() = default;
+
+	public:
+		~SharedBlob()
+		{
+#ifdef _WIN32
+			if (m_data)
+				UnmapViewOfFile(m_data);
+			if (m_mapping)
+				CloseHandle(m_mapping);
+#else
+			if (m_data)
+				munmap(m_data, m_size);
+			if (m_file != -1)
+				close(m_file);
+#endif
+		}
+
+		SharedBlob(const SharedBlob&) = delete;
+		SharedBlob(SharedBlob&&) = delete;
+
+		SharedBlob& operator=(const SharedBlob&) = delete;
+		SharedBlob& operator=(SharedBlob&&) = delete;
+
+		// copies data into a new blob, name must be unique, throws std::runtime_error
+		static std::unique_ptr<SharedBlob> Create(const std::wstring& name, const void* data, size_t size)
+		{
+			if (size == 0)
+				throw std::runtime_error("empty blob");
+			std::unique_ptr<SharedBlob> ret(new SharedBlob);
+			ret->m_size = size;
+#ifdef _WIN32
+			ret->m_name = name;
+			ret->m_mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			                                    static_cast<DWORD>(static_cast<uint64_t>(size) >> 32),
+			                                    static_cast<DWORD>(size), name.c_str());
+			// a section left over by an earlier daemon still held open by a client
+			if (ret->m_mapping && GetLastError() == ERROR_ALREADY_EXISTS)
+				throw std::runtime_error("blob name in use");
+			if (!ret->m_mapping)
+				throw std::runtime_error("cannot create blob");
+			ret->m_data = MapViewOfFile(ret->m_mapping, FILE_MAP_WRITE, 0, 0, size);
+#else
+			std::string utf8Name;
+			if (!Transcode::WideToUtf8(name, utf8Name))
+				throw std::runtime_error("cannot create blob");
+			ret->m_file = memfd_create(utf8Name.c_str(), MFD_CLOEXEC);
+			if (ret->m_file == -1 || ftruncate(ret->m_file, static_cast<off_t>(size)) != 0)
+				throw std::runtime_error("cannot create blob");
+			ret->m_name = L"/proc/" + std::to_wstring(getpid()) + L"/fd/" + std::to_wstring(ret->m_file);
+			ret->m_data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, ret->m_file, 0);
+			if (ret->m_data == MAP_FAILED)
+				ret->m_data = nullptr;
+#endif
+			if (!ret->m_data)
+				throw std::runtime_error("cannot map blob");
+			memcpy(ret->m_data, data, size);
+			return ret;
+		}
+
+		// maps a blob created by another process, nullptr if it is gone or smaller than size
+		static std::unique_ptr<SharedBlob> Open(const std::wstring& name, size_t size)
+		{
+			if (size == 0)
+				return nullptr;
+			std::unique_ptr<SharedBlob> ret(new SharedBlob);
+			ret->m_name = name;
+			ret->m_size = size;
+#ifdef _WIN32
+			ret->m_mapping = OpenFileMappingW(FILE_MAP_READ, FALSE, name.c_str());
+			if (!ret->m_mapping)
+				return nullptr;
+			ret->m_data = MapViewOfFile(ret->m_mapping, FILE_MAP_READ, 0, 0, size);
+#else
+			std::string utf8Name;
+			if (!Transcode::WideToUtf8(name, utf8Name))
+				return nullptr;
+			ret->m_file = open(utf8Name.c_str(), O_RDONLY | O_CLOEXEC);
+			if (ret->m_file == -1 || lseek(ret->m_file, 0, SEEK_END) < static_cast<off_t>(size))
+				return nullptr;
+			ret->m_data = mmap(nullptr, size, PROT_READ, MAP_SHARED, ret->m_file, 0);
+			if (ret->m_data == MAP_FAILED)
+				ret->m_data = nullptr;
+#endif
+			if (!ret->m_data)
+				return nullptr;
+			return ret;
+		}
+
+		const std::wstring& GetName() const
+		{
+			return m_name;
+		}
+
+		size_t GetSize() const
+		{
+			return m_size;
+		}
+
+		const void* GetData() const
+		{
+			return m_data;
+		}
+	};
+
+	// hot font files kept in shared blobs within a byte budget, least recently used go first.
+	// files are read on a background thread, lookups never wait for the disk
+	class FontBlobCache
+	{
+	public:
+		struct BlobInfo
+		{
+			std::wstring m_name;
+			uint64_t m_size;
+		};
+
+	private:
+		struct Item
+		{
+			std::wstring m_path;
+			std::unique_ptr<SharedBlob> m_blob;
+		};
+
+		std::mutex m_lock;
+		// most recently used first
+		std::list<Item> m_items;
+		std::unordered_map<std::wstring, std::list<Item>::iterator> m_index;
+		uint64_t m_budget;
+		uint64_t m_used = 0;
+
+		const std::wstring m_namePrefix;
+		uint64_t m_nextId = 0;
+
+		// files waiting to be read, guarded by m_lock
+		std::deque<std::wstring> m_queue;
+		std::unordered_set<std::wstring> m_queued;
+		std::condition_variable m_queueCV;
+		bool m_exit = false;
+		std::thread m_worker;
+
+		// under m_lock
+		void EvictUntil(uint64_t budget)
+		{
+			while (m_used > budget)
+			{
+				auto& item = m_items.back();
+				m_used -= item.m_blob->GetSize();
+				m_index.erase(item.m_path);
+				// clients that mapped it keep their view, the section goes with the last one
+				m_items.pop_back();
+			}
+		}
+
+		static bool ReadWholeFile(const std::wstring& path, uint64_t limit, std::vector<char>& content)
+		{
+			std::error_code ec;
+			std::filesystem::path filePath(path);
+			auto size = std::filesystem::file_size(filePath, ec);
+			if (ec || size == 0 || size > limit)
+				return false;
+			std::ifstream input(filePath, std::ios::binary);
+			if (!input.is_open())
+				return false;
+			content.resize(static_cast<size_t>(size));
+			input.read(content.data(), static_cast<std::streamsize>(size));
+			return static_cast<uint64_t>(input.gcount()) == size;
+		}
+
+		void WorkerMain()
+		{
+			std::vector<char> content;
+			std::unique_lock ul(m_lock);
+			for (;;)
+			{
+				m_queueCV.wait(ul, [&]() { return m_exit || !m_queue.empty(); });
+				if (m_exit)
+					return;
+				auto path = std::move(m_queue.front());
+				m_queue.pop_front();
+				m_queued.erase(path);
+				uint64_t budget = m_budget;
+				ul.unlock();
+				try
+				{
+					if (ReadWholeFile(path, budget, content))
+						Insert(path, content.data(), content.size());
+				}
+				catch (...)
+				{
+					// the file is served from disk as before
+				}
+				ul.lock();
+			}
+		}
+
+	public:
+		// blob names start with namePrefix, a budget of 0 disables the cache
+		FontBlobCache(std::wstring namePrefix, uint64_t budget)
+			: m_budget(budget), m_namePrefix(std::move(namePrefix))
+		{
+			m_worker = std::thread([this]() { WorkerMain(); });
+		}
+
+		~FontBlobCache()
+		{
+			{
+				std::lock_guard lg(m_lock);
+				m_exit = true;
+			}
+			m_queueCV.notify_all();
+			m_worker.join();
+		}
+
+		FontBlobCache(const FontBlobCache&) = delete;
+		FontBlobCache(FontBlobCache&&) = delete;
+
+		FontBlobCache& operator=(const FontBlobCache&) = delete;
+		FontBlobCache& operator=(FontBlobCache&&) = delete;
+
+		void SetBudget(uint64_t budget)
+		{
+			std::lock_guard lg(m_lock);
+			m_budget = budget;
+			EvictUntil(budget);
+		}
+
+		// the blob holding path, counts as a use
+		std::optional<BlobInfo> Find(const std::wstring& path)
+		{
+			std::lock_guard lg(m_lock);
+			auto iter = m_index.find(path);
+			if (iter == m_index.end())
+				return std::nullopt;
+			m_items.splice(m_items.begin(), m_items, iter->second);
+			auto& blob = *iter->second->m_blob;
+			return BlobInfo{blob.GetName(), blob.GetSize()};
+		}
+
+		// queues path to be read into a blob unless it is there already
+		void Admit(const std::wstring& path)
+		{
+			{
+				std::lock_guard lg(m_lock);
+				if (m_budget == 0 || m_index.contains(path) || !m_queued.emplace(path).second)
+					return;
+				m_queue.push_back(path);
+			}
+			m_queueCV.notify_one();
+		}
+
+		// copies content into a blob for path right away, throws std::runtime_error
+		void Insert(const std::wstring& path, const void* data, size_t size)
+		{
+			std::wstring name;
+			{
+				std::lock_guard lg(m_lock);
+				if (size == 0 || size > m_budget || m_index.contains(path))
+					return;
+				name = m_namePrefix + std::to_wstring(m_nextId++);
+			}
+			// copying runs unlocked, lookups go on meanwhile
+			auto blob = SharedBlob::Create(name, data, size);
+
+			std::lock_guard lg(m_lock);
+			if (size > m_budget || m_index.contains(path))
+				return;
+			m_used += size;
+			m_items.push_front(Item{path, std::move(blob)});
+			m_index.emplace(path, m_items.begin());
+			// never evicts the new blob, it fits the budget on its own
+			EvictUntil(m_budget);
+		}
+
+		uint64_t GetUsed()
+		{
+			std::lock_guard lg(m_lock);
+			return m_used;
+		}
+	};
+}
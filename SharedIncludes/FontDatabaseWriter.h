@@ -0,0 +1,46 @@
+#pragma once
+
+#include "PersistantData.h"
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace sfh
+{
+	// writes a font database as UTF-8 XML one face at a time, memory use doesn't grow with
+	// the number of faces (only with the number of distinct directories),
+	// throws std::runtime_error on failure
+	class FontDatabaseWriter
+	{
+	private:
+		std::FILE* m_file = nullptr;
+		std::string m_buffer;
+		std::string m_scratch;
+		// directory to Directory element id
+		std::unordered_map<std::wstring, uint32_t> m_directories;
+
+		void AppendEscaped(std::wstring_view str, bool attribute);
+		void AppendAttribute(const char* name, std::wstring_view value);
+		void AppendAttribute(const char* name, uint64_t value);
+		// writes the Directory element on first use, returns its id
+		uint32_t AppendDirectory(std::wstring_view directory);
+		void Flush();
+	public:
+		explicit FontDatabaseWriter(const std::wstring& path);
+		~FontDatabaseWriter();
+
+		FontDatabaseWriter(const FontDatabaseWriter&) = delete;
+		FontDatabaseWriter(FontDatabaseWriter&&) = delete;
+
+		FontDatabaseWriter& operator=(const FontDatabaseWriter&) = delete;
+		FontDatabaseWriter& operator=(FontDatabaseWriter&&) = delete;
+
+		void WriteFace(const FontDatabase::FontFaceElement& face, const StringPool& strings);
+		// only the path and index of face are written
+		void WriteRemovedFace(const FontDatabase::FontFaceElement& face, const StringPool& strings);
+		// finishes the document, the file is incomplete if this is never called
+		void Close();
+	};
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include "Transcode.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace sfh
+{
+	// shared memory the daemon publishes index changes through, the version counter
+	// is followed by a ring of the normalized names each version changed, so injected
+	// processes evict only those and drop everything only after falling behind the ring.
+	// one writer, any number of readers, entries are guarded by per slot sequence numbers
+	class InvalidationRing
+	{
+	public:
+		static constexpr uint32_t CAPACITY = 4096;
+		// longer names are stored as a prefix, readers evict everything starting with it
+		static constexpr uint32_t NAME_CAPACITY = 62;
+	private:
+		static constexpr uint32_t MAGIC = 0x32494653; // "SFI2"
+
+		enum EntryFlags : uint16_t
+		{
+			// everything changed, a reload or an index file joining
+			FLAG_FLUSH = 1,
+			FLAG_PREFIX = 2
+		};
+
+		struct Header
+		{
+			// bumped after the entries of a version are complete
+			std::atomic<uint32_t> m_version;
+			std::atomic<uint32_t> m_magic;
+			// count of entries ever appended
+			alignas(8) std::atomic<uint64_t> m_head;
+			// milliseconds a hooked call waits for its query, 0 waits until it is done
+			std::atomic<uint32_t> m_resolveTimeout;
+			uint32_t m_reserved;
+		};
+
+		struct Entry
+		{
+			// 2n + 2 once entry n is complete, odd while it is being written
+			alignas(8) std::atomic<uint64_t> m_sequence;
+			uint32_t m_version;
+			uint16_t m_length;
+			uint16_t m_flags;
+			wchar_t m_name[NAME_CAPACITY];
+		};
+
+		static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring is shared between processes");
+		// 32 and 64-bit processes map the same ring
+		static_assert(sizeof(Header) == 24 && sizeof(Entry) % 8 == 0);
+
+	public:
+		static constexpr size_t SIZE = sizeof(Header) + sizeof(Entry) * CAPACITY;
+
+	private:
+		Header* m_header = nullptr;
+		Entry* m_entries = nullptr;
+#ifdef _WIN32
+		HANDLE m_mapping = nullptr;
+#endif
+
+		void Unmap()
+		{
+			if (!m_header)
+				return;
+#ifdef _WIN32
+			UnmapViewOfFile(m_header);
+			CloseHandle(m_mapping);
+#else
+			munmap(m_header, SIZE);
+#endif
+		}
+
+	public:
+		// maps the named shared memory, creating it if needed, throws std::runtime_error,
+		// on posix name becomes a shm_open name and outlives the processes
+		InvalidationRing(const std::wstring& name, bool writer)
+		{
+			void* view = nullptr;
+#ifdef _WIN32
+			m_mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+			                               static_cast<DWORD>(SIZE), name.c_str());
+			if (!m_mapping)
+				throw std::runtime_error("cannot create invalidation ring");
+			// fails if an older build created a smaller mapping
+			view = MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, SIZE);
+			if (!view)
+			{
+				CloseHandle(m_mapping);
+				throw std::runtime_error("cannot map invalidation ring");
+			}
+#else
+			std::string shmName = "/";
+			std::string utf8Name;
+			if (!Transcode::WideToUtf8(name, utf8Name))
+				throw std::runtime_error("cannot create invalidation ring");
+			shmName += utf8Name;
+			int file = shm_open(shmName.c_str(), O_RDWR | O_CREAT, 0600);
+			if (file == -1)
+				throw std::runtime_error("cannot create invalidation ring");
+			struct stat info;
+			// a new object is empty, growing it fills zeros
+			if (fstat(file, &info) != 0 || (info.st_size < static_cast<off_t>(SIZE)
+				&& ftruncate(file, static_cast<off_t>(SIZE)) != 0))
+			{
+				close(file);
+				throw std::runtime_error("cannot create invalidation ring");
+			}
+			view = mmap(nullptr, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+			close(file);
+			if (view == MAP_FAILED)
+				throw std::runtime_error("cannot map invalidation ring");
+#endif
+			m_header = static_cast<Header*>(view);
+			m_entries = reinterpret_cast<Entry*>(m_header + 1);
+			// new memory is zeroed, readers treat a ring without magic as always behind
+			if (writer && m_header->m_magic.load(std::memory_order_acquire) != MAGIC)
+				m_header->m_magic.store(MAGIC, std::memory_order_release);
+		}
+
+		~InvalidationRing()
+		{
+			Unmap();
+		}
+
+		InvalidationRing(const InvalidationRing&) = delete;
+		InvalidationRing(InvalidationRing&&) = delete;
+
+		InvalidationRing& operator=(const InvalidationRing&) = delete;
+		InvalidationRing& operator=(InvalidationRing&&) = delete;
+
+		uint32_t GetVersion() const
+		{
+			return m_header->m_version.load(std::memory_order_acquire);
+		}
+
+		uint64_t GetHead() const
+		{
+			return m_header->m_head.load(std::memory_order_acquire);
+		}
+
+		// writer only, entries become visible to readers polling the version with BumpVersion
+		void Append(uint32_t version, std::wstring_view name)
+		{
+			uint16_t flags = 0;
+			if (name.size() > NAME_CAPACITY)
+			{
+				name = name.substr(0, NAME_CAPACITY);
+				flags |= FLAG_PREFIX;
+			}
+			AppendEntry(version, name, flags);
+		}
+
+		void AppendFlush(uint32_t version)
+		{
+			AppendEntry(version, {}, FLAG_FLUSH);
+		}
+
+		// writer only, returns the new version
+		uint32_t BumpVersion()
+		{
+			return m_header->m_version.fetch_add(1, std::memory_order_acq_rel) + 1;
+		}
+
+		// a daemon setting, it travels along since every injected process maps the ring anyway
+		uint32_t GetResolveTimeout() const
+		{
+			return m_header->m_resolveTimeout.load(std::memory_order_relaxed);
+		}
+
+		// writer only
+		void SetResolveTimeout(uint32_t milliseconds)
+		{
+			m_header->m_resolveTimeout.store(milliseconds, std::memory_order_relaxed);
+		}
+
+		// reads the entries appended since position and advances it, onName(name, isPrefix)
+		// is called for each changed name, returns false when the reader must drop everything
+		template <typename Fn>
+		bool ReadSince(uint64_t& position, Fn&& onName) const
+		{
+			uint64_t head = GetHead();
+			if (m_header->m_magic.load(std::memory_order_acquire) != MAGIC || head - position > CAPACITY)
+			{
+				position = head;
+				return false;
+			}
+			wchar_t name[NAME_CAPACITY];
+			for (; position < head; ++position)
+			{
+				const Entry& entry = m_entries[position % CAPACITY];
+				uint64_t sequence = entry.m_sequence.load(std::memory_order_acquire);
+				// overwritten by a writer that went round the ring meanwhile
+				if (sequence != position * 2 + 2)
+					break;
+				uint16_t flags = entry.m_flags;
+				uint16_t length = entry.m_length;
+				if (length > NAME_CAPACITY)
+					length = NAME_CAPACITY;
+				memcpy(name, entry.m_name, length * sizeof(wchar_t));
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (entry.m_sequence.load(std::memory_order_relaxed) != sequence || flags & FLAG_FLUSH)
+					break;
+				onName(std::wstring_view(name, length), (flags & FLAG_PREFIX) != 0);
+			}
+			if (position == head)
+				return true;
+			position = head;
+			return false;
+		}
+
+	private:
+		void AppendEntry(uint32_t version, std::wstring_view name, uint16_t flags)
+		{
+			uint64_t position = m_header->m_head.load(std::memory_order_relaxed);
+			Entry& entry = m_entries[position % CAPACITY];
+			entry.m_sequence.store(position * 2 + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			entry.m_version = version;
+			entry.m_length = static_cast<uint16_t>(name.size());
+			entry.m_flags = flags;
+			memcpy(entry.m_name, name.data(), name.size() * sizeof(wchar_t));
+			entry.m_sequence.store(position * 2 + 2, std::memory_order_release);
+			m_header->m_head.store(position + 1, std::memory_order_release);
+		}
+	};
+}
@@ -4,6 +4,9 @@
 #include <vector>
 #include <cstdint>
 #include <memory>
+#include <string_view>
+
+#include "StringPool.h"
 
 namespace sfh
 {
@@ -21,8 +24,43 @@ namespace sfh
 			std::wstring m_name;
 		};
 
+		// how many faces are returned for a query carrying LOGFONT style
+		enum class MatchPolicy : size_t
+		{
+			// faces ranking best for the requested style
+			TopMatches = 0,
+			// every face of the family, ignoring style
+			Family,
+			// a single face ranking best
+			BestFace
+		};
+
+		static constexpr const wchar_t* MATCHPOLICYMAP[] = {
+			L"TopMatches",
+			L"Family",
+			L"BestFace"
+		};
+
 		uint32_t wmiPollInterval = 500;
+		// entries of the prefetch history loaded on start
 		uint32_t lruSize = 100;
+		// megabytes of fonts the prefetch keeps registered
+		uint32_t prefetchSize = 256;
+		// megabytes per second of fonts the prefetch loads back after start, 0 doesn't throttle
+		uint32_t warmUpBandwidth = 16;
+		MatchPolicy matchPolicy = MatchPolicy::TopMatches;
+		// milliseconds a hooked GDI call waits for its query, the query finishes in the
+		// background after that, 0 always waits
+		uint32_t resolveTimeout = 0;
+		// megabytes of hot font files the daemon keeps in shared memory, 0 disables it
+		uint32_t blobCacheSize = 0;
+		// hot font files from network shares and hard disks are copied here, empty means
+		// LocalCache next to the daemon
+		std::wstring localCacheDirectory;
+		// megabytes the local copies may take, 0 disables them
+		uint32_t localCacheSize = 0;
+		// megabytes per second read from the origin while copying, 0 doesn't throttle
+		uint32_t localCacheBandwidth = 16;
 
 		// content
 		std::vector<IndexFileElement> m_indexFile;
@@ -44,52 +82,82 @@ namespace sfh
 				{
 					Win32FamilyName = 0,
 					FullName,
-					PostScriptName
+					PostScriptName,
+					// name id 16/17, not used for lookup but helps picking a face
+					TypographicFamilyName,
+					TypographicSubfamilyName
 				} m_type;
 
 				static constexpr const wchar_t* TYPEMAP[] = {
 					L"Win32FamilyName",
 					L"FullName",
-					L"PostScriptName"
+					L"PostScriptName",
+					L"TypographicFamilyName",
+					L"TypographicSubfamilyName"
 				};
 
-				// content
-				std::wstring m_name;
+				// content, id in the owning database's string pool
+				uint32_t m_name = 0;
 
 				// help functions
 				NameElement() = default;
 
-				NameElement(NameType nameType, std::wstring&& name)
+				NameElement(NameType nameType, uint32_t name)
 					: m_type(nameType), m_name(name)
 				{
 				}
 
-				bool operator<(const NameElement& rhs) const
-				{
-					if (this->m_type == rhs.m_type)
-						return this->m_name < rhs.m_name;
-					return this->m_type < rhs.m_type;
-				}
-
 				bool operator==(const NameElement& rhs) const
 				{
 					return this->m_type == rhs.m_type && this->m_name == rhs.m_name;
 				}
 			};
 
-			// attribute
-			std::wstring m_path;
+			// attribute, the path is m_directory + m_fileName, both ids in the string pool
+			uint32_t m_directory = 0;
+			uint32_t m_fileName = 0;
 			uint32_t m_index = std::numeric_limits<uint32_t>::max();
 			uint32_t m_weight;
 			uint32_t m_oblique;
 			uint32_t m_psOutline;
+			// optional attribute, absent in older index files
+			uint32_t m_width = 5;
+			uint32_t m_codePageRange1 = 0;
+			uint32_t m_codePageRange2 = 0;
+			// identifies the face regardless of where the file lives, 0 if unknown
+			uint64_t m_stableId = 0;
 			// content
 			std::vector<NameElement> m_names;
 		};
 
+		// shared by paths and names of every face
+		StringPool m_strings;
 		std::vector<FontFaceElement> m_fonts;
+		// a delta database also lists faces taken away from the index it updates,
+		// only their path and index are meaningful
+		std::vector<FontFaceElement> m_removedFonts;
+
+		std::wstring_view GetString(uint32_t id) const
+		{
+			return m_strings.Get(id);
+		}
+
+		std::wstring GetPath(const FontFaceElement& face) const
+		{
+			return GetPath(m_strings, face);
+		}
+
+		// the directory keeps its trailing separator so joining is plain concatenation
+		static std::wstring GetPath(const StringPool& strings, const FontFaceElement& face);
+		static void SetPath(StringPool& strings, FontFaceElement& face, std::wstring_view path);
+
+		// adds a face whose strings live in another pool
+		void ImportFace(FontFaceElement&& face, const StringPool& strings);
 
+		// both throw std::runtime_error, reading a font database doesn't need COM
 		static std::unique_ptr<FontDatabase> ReadFromFile(const std::wstring& path);
+		// data is a whole utf-8 document
+		static std::unique_ptr<FontDatabase> ReadFromMemory(const char* data, size_t length);
 		static void WriteToFile(const std::wstring& path, const FontDatabase& db);
 	};
 }
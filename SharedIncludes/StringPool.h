@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+namespace sfh
+{
+	// interned wide strings addressed by dense 32-bit ids, each string is stored once
+	// and null-terminated so a view's data() can be handed to C APIs,
+	// id 0 is always the empty string
+	class StringPool
+	{
+	private:
+		static constexpr uint32_t EMPTY_SLOT = std::numeric_limits<uint32_t>::max();
+
+		std::vector<wchar_t> m_buffer;
+		// start of string id in m_buffer, one extra entry marks the end
+		std::vector<uint32_t> m_offsets;
+		// open addressing table of ids, power of two sized
+		std::vector<uint32_t> m_slots;
+
+		static uint64_t Hash(std::wstring_view str)
+		{
+			uint64_t hash = 0xcbf29ce484222325;
+			for (wchar_t ch : str)
+			{
+				hash ^= static_cast<uint64_t>(ch);
+				hash *= 0x100000001b3;
+			}
+			return hash ^ hash >> 32;
+		}
+
+		void Rehash(size_t slotCount)
+		{
+			m_slots.assign(slotCount, EMPTY_SLOT);
+			for (uint32_t id = 0; id < GetCount(); ++id)
+			{
+				size_t slot = Hash(Get(id)) & (slotCount - 1);
+				while (m_slots[slot] != EMPTY_SLOT)
+					slot = (slot + 1) & (slotCount - 1);
+				m_slots[slot] = id;
+			}
+		}
+
+	public:
+		StringPool()
+		{
+			m_buffer.push_back(0);
+			m_offsets.push_back(0);
+			m_offsets.push_back(1);
+			Rehash(16);
+		}
+
+		uint32_t Intern(std::wstring_view str)
+		{
+			size_t mask = m_slots.size() - 1;
+			size_t slot = Hash(str) & mask;
+			for (; m_slots[slot] != EMPTY_SLOT; slot = (slot + 1) & mask)
+			{
+				if (Get(m_slots[slot]) == str)
+					return m_slots[slot];
+			}
+
+			auto id = static_cast<uint32_t>(GetCount());
+			m_buffer.insert(m_buffer.end(), str.begin(), str.end());
+			m_buffer.push_back(0);
+			m_offsets.push_back(static_cast<uint32_t>(m_buffer.size()));
+			m_slots[slot] = id;
+			// keep the load factor under 1/2
+			if (GetCount() * 2 > m_slots.size())
+				Rehash(m_slots.size() * 2);
+			return id;
+		}
+
+		std::wstring_view Get(uint32_t id) const
+		{
+			return {m_buffer.data() + m_offsets[id], m_offsets[id + 1] - m_offsets[id] - 1};
+		}
+
+		size_t GetCount() const
+		{
+			return m_offsets.size() - 1;
+		}
+
+		size_t GetMemoryUsage() const
+		{
+			return m_buffer.capacity() * sizeof(wchar_t)
+				+ m_offsets.capacity() * sizeof(uint32_t)
+				+ m_slots.capacity() * sizeof(uint32_t);
+		}
+	};
+}
@@ -0,0 +1,416 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <bit>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SFH_TRANSCODE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SFH_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define SFH_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define SFH_TRANSCODE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// utf-16/utf-8 transcoding shared by the builder, the daemon and the interceptor,
+// vectorized for the ascii-heavy runs found in font names and paths.
+// kernels work on raw utf-16 code units, the wide string helpers at the bottom
+// adapt them to wchar_t of either width.
+
+namespace sfh::Transcode
+{
+	namespace Detail
+	{
+#ifdef SFH_TRANSCODE_X86
+		inline bool HasAvx2()
+		{
+			static const bool result = []()
+			{
+#ifdef _MSC_VER
+				int info[4];
+				__cpuid(info, 0);
+				if (info[0] < 7)
+					return false;
+				__cpuid(info, 1);
+				// osxsave and avx
+				if ((info[2] & (1 << 27 | 1 << 28)) != (1 << 27 | 1 << 28))
+					return false;
+				if ((_xgetbv(0) & 6) != 6)
+					return false;
+				__cpuidex(info, 7, 0);
+				return (info[1] & 1 << 5) != 0;
+#else
+				return __builtin_cpu_supports("avx2") != 0;
+#endif
+			}();
+			return result;
+		}
+
+		SFH_TARGET_AVX2 inline size_t ByteSwapAvx2(const uint8_t* src, size_t count, uint16_t* dst)
+		{
+			size_t i = 0;
+			for (; i + 16 <= count; i += 16)
+			{
+				__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2));
+				v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), v);
+			}
+			return i;
+		}
+
+		SFH_TARGET_AVX2 inline size_t AsciiUtf16ToUtf8Avx2(const uint16_t* src, size_t length, char* dst)
+		{
+			size_t i = 0;
+			const __m256i mask = _mm256_set1_epi16(static_cast<short>(0xff80));
+			for (; i + 16 <= length; i += 16)
+			{
+				__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+				if (!_mm256_testz_si256(v, mask))
+					break;
+				__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(packed));
+			}
+			return i;
+		}
+
+		SFH_TARGET_AVX2 inline size_t AsciiUtf8ToUtf16Avx2(const char* src, size_t length, uint16_t* dst)
+		{
+			size_t i = 0;
+			for (; i + 32 <= length; i += 32)
+			{
+				__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+				if (_mm256_movemask_epi8(v) != 0)
+					break;
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+				                    _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 16),
+				                    _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+			}
+			return i;
+		}
+#endif
+
+		// each returns how many code units it handled, the caller finishes the tail
+		inline size_t ByteSwapVector(const uint8_t* src, size_t count, uint16_t* dst)
+		{
+			size_t i = 0;
+#if defined(SFH_TRANSCODE_X86)
+			if (HasAvx2())
+				i = ByteSwapAvx2(src, count, dst);
+			for (; i + 8 <= count; i += 8)
+			{
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+				v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+			}
+#elif defined(SFH_TRANSCODE_NEON)
+			for (; i + 8 <= count; i += 8)
+			{
+				uint8x16_t v = vld1q_u8(src + i * 2);
+				vst1q_u16(dst + i, vreinterpretq_u16_u8(vrev16q_u8(v)));
+			}
+#endif
+			return i;
+		}
+
+		inline size_t AsciiUtf16ToUtf8Vector(const uint16_t* src, size_t length, char* dst)
+		{
+			size_t i = 0;
+#if defined(SFH_TRANSCODE_X86)
+			if (HasAvx2())
+				i = AsciiUtf16ToUtf8Avx2(src, length, dst);
+			const __m128i mask = _mm_set1_epi16(static_cast<short>(0xff80));
+			for (; i + 8 <= length; i += 8)
+			{
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, mask), _mm_setzero_si128())) != 0xffff)
+					break;
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(v, v));
+			}
+#elif defined(SFH_TRANSCODE_NEON)
+			for (; i + 8 <= length; i += 8)
+			{
+				uint16x8_t v = vld1q_u16(src + i);
+				if (vmaxvq_u16(v) >= 0x80)
+					break;
+				vst1_u8(reinterpret_cast<uint8_t*>(dst + i), vmovn_u16(v));
+			}
+#endif
+			return i;
+		}
+
+		inline size_t AsciiUtf8ToUtf16Vector(const char* src, size_t length, uint16_t* dst)
+		{
+			size_t i = 0;
+#if defined(SFH_TRANSCODE_X86)
+			if (HasAvx2())
+				i = AsciiUtf8ToUtf16Avx2(src, length, dst);
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 16 <= length; i += 16)
+			{
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				if (_mm_movemask_epi8(v) != 0)
+					break;
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(v, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+			}
+#elif defined(SFH_TRANSCODE_NEON)
+			for (; i + 16 <= length; i += 16)
+			{
+				uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(src + i));
+				if (vmaxvq_u8(v) >= 0x80)
+					break;
+				vst1q_u16(dst + i, vmovl_u8(vget_low_u8(v)));
+				vst1q_u16(dst + i + 8, vmovl_u8(vget_high_u8(v)));
+			}
+#endif
+			return i;
+		}
+
+		// decode one code point, returns consumed bytes or 0 if the sequence is invalid
+		inline size_t DecodeUtf8(const uint8_t* src, size_t length, char32_t& cp)
+		{
+			uint8_t lead = src[0];
+			size_t size;
+			char32_t minimum;
+			if (lead < 0x80)
+			{
+				cp = lead;
+				return 1;
+			}
+			if ((lead & 0xe0) == 0xc0)
+			{
+				size = 2;
+				cp = lead & 0x1f;
+				minimum = 0x80;
+			}
+			else if ((lead & 0xf0) == 0xe0)
+			{
+				size = 3;
+				cp = lead & 0x0f;
+				minimum = 0x800;
+			}
+			else if ((lead & 0xf8) == 0xf0)
+			{
+				size = 4;
+				cp = lead & 0x07;
+				minimum = 0x10000;
+			}
+			else
+			{
+				return 0;
+			}
+			if (size > length)
+				return 0;
+			for (size_t i = 1; i < size; ++i)
+			{
+				if ((src[i] & 0xc0) != 0x80)
+					return 0;
+				cp = cp << 6 | (src[i] & 0x3f);
+			}
+			// reject overlong forms, surrogates and out of range values
+			if (cp < minimum || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+				return 0;
+			return size;
+		}
+
+		inline size_t EncodeUtf8(char32_t cp, char* dst)
+		{
+			if (cp < 0x80)
+			{
+				dst[0] = static_cast<char>(cp);
+				return 1;
+			}
+			if (cp < 0x800)
+			{
+				dst[0] = static_cast<char>(0xc0 | cp >> 6);
+				dst[1] = static_cast<char>(0x80 | (cp & 0x3f));
+				return 2;
+			}
+			if (cp < 0x10000)
+			{
+				dst[0] = static_cast<char>(0xe0 | cp >> 12);
+				dst[1] = static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+				dst[2] = static_cast<char>(0x80 | (cp & 0x3f));
+				return 3;
+			}
+			dst[0] = static_cast<char>(0xf0 | cp >> 18);
+			dst[1] = static_cast<char>(0x80 | (cp >> 12 & 0x3f));
+			dst[2] = static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+			dst[3] = static_cast<char>(0x80 | (cp & 0x3f));
+			return 4;
+		}
+	}
+
+	// convert big endian utf-16 bytes (as stored in sfnt name tables) to native code units
+	inline void Utf16BEToUtf16(const uint8_t* src, size_t count, uint16_t* dst)
+	{
+		size_t i = 0;
+		if constexpr (std::endian::native == std::endian::little)
+			i = Detail::ByteSwapVector(src, count, dst);
+		for (; i < count; ++i)
+			dst[i] = static_cast<uint16_t>(src[i * 2] << 8 | src[i * 2 + 1]);
+	}
+
+	// returns false on unpaired surrogates, out is left empty then
+	inline bool Utf16ToUtf8(const uint16_t* src, size_t length, std::string& out)
+	{
+		out.resize(length * 3);
+		char* dst = out.data();
+		size_t i = 0;
+		while (i < length)
+		{
+			size_t ascii = Detail::AsciiUtf16ToUtf8Vector(src + i, length - i, dst);
+			i += ascii;
+			dst += ascii;
+			// handle up to the next vector boundary in scalar code
+			size_t stop = i + 16 < length ? i + 16 : length;
+			while (i < stop)
+			{
+				char32_t cp = src[i];
+				if (cp >= 0xd800 && cp <= 0xdbff)
+				{
+					if (i + 1 >= length || src[i + 1] < 0xdc00 || src[i + 1] > 0xdfff)
+					{
+						out.clear();
+						return false;
+					}
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (src[i + 1] - 0xdc00);
+					++i;
+				}
+				else if (cp >= 0xdc00 && cp <= 0xdfff)
+				{
+					out.clear();
+					return false;
+				}
+				dst += Detail::EncodeUtf8(cp, dst);
+				++i;
+			}
+		}
+		out.resize(dst - out.data());
+		return true;
+	}
+
+	// out receives code units, returns false on malformed input and leaves out empty
+	template <typename Char16>
+	bool Utf8ToUtf16(const char* src, size_t length, std::basic_string<Char16>& out)
+	{
+		static_assert(sizeof(Char16) == sizeof(uint16_t));
+		out.resize(length);
+		auto dst = reinterpret_cast<uint16_t*>(out.data());
+		auto bytes = reinterpret_cast<const uint8_t*>(src);
+		size_t i = 0;
+		while (i < length)
+		{
+			size_t ascii = Detail::AsciiUtf8ToUtf16Vector(src + i, length - i, dst);
+			i += ascii;
+			dst += ascii;
+			size_t stop = i + 32 < length ? i + 32 : length;
+			while (i < stop)
+			{
+				char32_t cp;
+				size_t consumed = Detail::DecodeUtf8(bytes + i, length - i, cp);
+				if (consumed == 0)
+				{
+					out.clear();
+					return false;
+				}
+				if (cp >= 0x10000)
+				{
+					cp -= 0x10000;
+					*dst++ = static_cast<uint16_t>(0xd800 + (cp >> 10));
+					*dst++ = static_cast<uint16_t>(0xdc00 + (cp & 0x3ff));
+				}
+				else
+				{
+					*dst++ = static_cast<uint16_t>(cp);
+				}
+				i += consumed;
+			}
+		}
+		out.resize(dst - reinterpret_cast<uint16_t*>(out.data()));
+		return true;
+	}
+
+	// wide string helpers, wchar_t is utf-16 on windows and utf-32 elsewhere
+
+	inline bool WideToUtf8(std::wstring_view str, std::string& out)
+	{
+		if constexpr (sizeof(wchar_t) == sizeof(uint16_t))
+		{
+			return Utf16ToUtf8(reinterpret_cast<const uint16_t*>(str.data()), str.size(), out);
+		}
+		else
+		{
+			out.resize(str.size() * 4);
+			char* dst = out.data();
+			for (wchar_t c : str)
+			{
+				auto cp = static_cast<char32_t>(c);
+				if (cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+				{
+					out.clear();
+					return false;
+				}
+				dst += Detail::EncodeUtf8(cp, dst);
+			}
+			out.resize(dst - out.data());
+			return true;
+		}
+	}
+
+	inline bool Utf8ToWide(std::string_view str, std::wstring& out)
+	{
+		if constexpr (sizeof(wchar_t) == sizeof(uint16_t))
+		{
+			return Utf8ToUtf16(str.data(), str.size(), out);
+		}
+		else
+		{
+			out.resize(str.size());
+			auto bytes = reinterpret_cast<const uint8_t*>(str.data());
+			size_t length = 0;
+			for (size_t i = 0; i < str.size();)
+			{
+				char32_t cp;
+				size_t consumed = Detail::DecodeUtf8(bytes + i, str.size() - i, cp);
+				if (consumed == 0)
+				{
+					out.clear();
+					return false;
+				}
+				out[length++] = static_cast<wchar_t>(cp);
+				i += consumed;
+			}
+			out.resize(length);
+			return true;
+		}
+	}
+
+	// count is in code units, i.e. half of the byte length
+	inline std::wstring Utf16BEToWide(const uint8_t* src, size_t count)
+	{
+		std::wstring ret(count, 0);
+		if constexpr (sizeof(wchar_t) == sizeof(uint16_t))
+		{
+			Utf16BEToUtf16(src, count, reinterpret_cast<uint16_t*>(ret.data()));
+		}
+		else
+		{
+			// keep surrogate pairs as is, names only need to round trip
+			for (size_t i = 0; i < count; ++i)
+				ret[i] = static_cast<wchar_t>(src[i * 2] << 8 | src[i * 2 + 1]);
+		}
+		return ret;
+	}
+}
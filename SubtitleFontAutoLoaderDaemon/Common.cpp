@@ -1,6 +1,7 @@
 #include "pch.h"
 
 #include "Common.h"
+#include "Transcode.h"
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
@@ -9,51 +10,19 @@
 
 #undef min
 
-std::string sfh::WideToUtf8String(const std::wstring& wStr)
+std::string sfh::WideToUtf8String(std::wstring_view wStr)
 {
 	std::string ret;
-	const int length = WideCharToMultiByte(
-		CP_UTF8,
-		WC_ERR_INVALID_CHARS,
-		wStr.c_str(),
-		static_cast<int>(wStr.size()),
-		nullptr,
-		0,
-		nullptr,
-		nullptr);
-	assert(length != 0 && "wide char conversion to utf8 mustn't fail!");
-	ret.resize(length);
-	WideCharToMultiByte(
-		CP_UTF8,
-		WC_ERR_INVALID_CHARS,
-		wStr.c_str(),
-		static_cast<int>(wStr.size()),
-		ret.data(),
-		length,
-		nullptr,
-		nullptr);
+	[[maybe_unused]] bool success = Transcode::WideToUtf8(wStr, ret);
+	assert(success && "wide char conversion to utf8 mustn't fail!");
 	return ret;
 }
 
 std::wstring sfh::Utf8ToWideString(const std::string& str)
 {
 	std::wstring ret;
-	const int length = MultiByteToWideChar(
-		CP_UTF8,
-		MB_ERR_INVALID_CHARS,
-		str.c_str(),
-		static_cast<int>(str.size()),
-		nullptr,
-		0);
-	assert(length != 0 && "utf8 conversion to wide char mustn't fail!");
-	ret.resize(length);
-	MultiByteToWideChar(
-		CP_UTF8,
-		MB_ERR_INVALID_CHARS,
-		str.c_str(),
-		static_cast<int>(str.size()),
-		ret.data(),
-		length);
+	[[maybe_unused]] bool success = Transcode::Utf8ToWide(str, ret);
+	assert(success && "utf8 conversion to wide char mustn't fail!");
 	return ret;
 }
 
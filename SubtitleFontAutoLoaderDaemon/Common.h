@@ -4,7 +4,7 @@
 
 namespace sfh
 {
-	std::string WideToUtf8String(const std::wstring& wStr);
+	std::string WideToUtf8String(std::wstring_view wStr);
 	std::wstring Utf8ToWideString(const std::string& str);
 
 	void ErrorMessageBox(const std::wstring& text, const std::wstring& caption, long hResult);
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace sfh
+{
+	// learns which keys are asked for together within a session, a client process here.
+	// a subtitle loads the fonts of its release group as a set, once a key of a known set
+	// shows up the others can be got ready before they are asked for.
+	// every key keeps a short list of companions with the number of sessions they shared,
+	// the model stays small however many sessions it sees
+	template <typename Key, typename Hash = std::hash<Key>, typename Clock = std::chrono::steady_clock>
+	class BasicCooccurrenceModel
+	{
+	public:
+		using Companions = std::vector<std::pair<Key, uint32_t>>;
+
+	private:
+		static constexpr size_t MAX_COMPANIONS = 16;
+		// sessions counts are halved past this so old habits fade
+		static constexpr uint32_t MAX_COUNT = 255;
+		// a session this large is a player going through unrelated files, start over
+		static constexpr size_t MAX_SESSION_KEYS = 64;
+		static constexpr size_t MAX_PREDICTIONS = 8;
+		static constexpr uint32_t MIN_SESSIONS = 2;
+		// a companion shared by at least this share of sessions is predicted
+		static constexpr uint32_t MIN_CONFIDENCE_PERCENT = 50;
+		static constexpr std::chrono::minutes SESSION_IDLE{30};
+		static constexpr size_t MAX_SESSIONS = 256;
+
+		struct Node
+		{
+			// sessions that asked for the key
+			uint32_t m_sessions = 0;
+			Companions m_companions;
+			uint64_t m_lastSeen = 0;
+		};
+
+		struct Session
+		{
+			std::vector<Key> m_keys;
+			// keys predicted so far, each only once
+			std::unordered_set<Key, Hash> m_predicted;
+			typename Clock::time_point m_lastActivity;
+		};
+
+		std::mutex m_lock;
+		std::unordered_map<Key, Node, Hash> m_nodes;
+		std::unordered_map<uint32_t, Session> m_sessions;
+		size_t m_maxKeys;
+		uint64_t m_tick = 0;
+
+		static void AddCompanion(Node& node, const Key& key)
+		{
+			auto iter = std::find_if(node.m_companions.begin(), node.m_companions.end(),
+			                         [&](auto& companion) { return companion.first == key; });
+			if (iter != node.m_companions.end())
+			{
+				iter->second = std::min(iter->second + 1, MAX_COUNT);
+				return;
+			}
+			if (node.m_companions.size() == MAX_COMPANIONS)
+			{
+				// make room by aging, companions seen once are dropped
+				for (auto& companion : node.m_companions)
+					companion.second /= 2;
+				std::erase_if(node.m_companions, [](auto& companion) { return companion.second == 0; });
+				if (node.m_companions.size() == MAX_COMPANIONS)
+					return;
+			}
+			node.m_companions.emplace_back(key, 1);
+		}
+
+		static void Age(Node& node)
+		{
+			node.m_sessions /= 2;
+			for (auto& companion : node.m_companions)
+				companion.second /= 2;
+			std::erase_if(node.m_companions, [](auto& companion) { return companion.second == 0; });
+		}
+
+		// drops the keys seen longest ago once there are too many
+		void Trim()
+		{
+			if (m_nodes.size() <= m_maxKeys + m_maxKeys / 8)
+				return;
+			std::vector<uint64_t> lastSeen;
+			lastSeen.reserve(m_nodes.size());
+			for (auto& [key, node] : m_nodes)
+				lastSeen.push_back(node.m_lastSeen);
+			auto cut = lastSeen.begin() + static_cast<ptrdiff_t>(m_nodes.size() - m_maxKeys);
+			std::nth_element(lastSeen.begin(), cut, lastSeen.end());
+			std::erase_if(m_nodes, [&](auto& item) { return item.second.m_lastSeen < *cut; });
+			// companions pointing at dropped keys go when their lists age
+		}
+
+		void ExpireSessions(typename Clock::time_point now)
+		{
+			std::erase_if(m_sessions, [&](auto& item) { return now - item.second.m_lastActivity > SESSION_IDLE; });
+			if (m_sessions.size() < MAX_SESSIONS)
+				return;
+			m_sessions.erase(std::min_element(m_sessions.begin(), m_sessions.end(), [](auto& lhs, auto& rhs)
+			{
+				return lhs.second.m_lastActivity < rhs.second.m_lastActivity;
+			}));
+		}
+
+	public:
+		explicit BasicCooccurrenceModel(size_t maxKeys)
+			: m_maxKeys(std::max<size_t>(maxKeys, 1))
+		{
+		}
+
+		BasicCooccurrenceModel(const BasicCooccurrenceModel&) = delete;
+		BasicCooccurrenceModel(BasicCooccurrenceModel&&) = delete;
+
+		BasicCooccurrenceModel& operator=(const BasicCooccurrenceModel&) = delete;
+		BasicCooccurrenceModel& operator=(BasicCooccurrenceModel&&) = delete;
+
+		// records that session asked for key, returns the companions worth getting ready,
+		// none if the session saw key before
+		std::vector<Key> Record(uint32_t sessionId, const Key& key)
+		{
+			auto now = Clock::now();
+			std::lock_guard lg(m_lock);
+			ExpireSessions(now);
+			auto& session = m_sessions[sessionId];
+			session.m_lastActivity = now;
+			if (std::find(session.m_keys.begin(), session.m_keys.end(), key) != session.m_keys.end())
+				return {};
+			if (session.m_keys.size() == MAX_SESSION_KEYS)
+			{
+				session.m_keys.clear();
+				session.m_predicted.clear();
+			}
+
+			auto& node = m_nodes[key];
+			node.m_lastSeen = ++m_tick;
+			if (++node.m_sessions > MAX_COUNT)
+				Age(node);
+			for (auto& other : session.m_keys)
+			{
+				auto iter = m_nodes.find(other);
+				if (iter == m_nodes.end())
+					continue;
+				AddCompanion(node, other);
+				AddCompanion(iter->second, key);
+			}
+			session.m_keys.push_back(key);
+			session.m_predicted.insert(key);
+
+			std::vector<Key> ret;
+			if (node.m_sessions >= MIN_SESSIONS)
+			{
+				auto companions = node.m_companions;
+				std::sort(companions.begin(), companions.end(),
+				          [](auto& lhs, auto& rhs) { return lhs.second > rhs.second; });
+				for (auto& [companion, count] : companions)
+				{
+					if (ret.size() == MAX_PREDICTIONS
+						|| count * 100 < node.m_sessions * MIN_CONFIDENCE_PERCENT)
+						break;
+					if (session.m_predicted.insert(companion).second)
+						ret.push_back(companion);
+				}
+			}
+			Trim();
+			return ret;
+		}
+
+		// fn(key, sessions, companions) for every key, to save the model
+		template <typename Fn>
+		void Visit(Fn&& fn)
+		{
+			std::lock_guard lg(m_lock);
+			for (auto& [key, node] : m_nodes)
+				fn(key, node.m_sessions, node.m_companions);
+		}
+
+		// puts back a key saved through Visit
+		void Restore(const Key& key, uint32_t sessions, Companions companions)
+		{
+			std::lock_guard lg(m_lock);
+			auto& node = m_nodes[key];
+			node.m_sessions = std::min(sessions, MAX_COUNT);
+			if (companions.size() > MAX_COMPANIONS)
+				companions.resize(MAX_COMPANIONS);
+			node.m_companions = std::move(companions);
+			node.m_lastSeen = ++m_tick;
+			Trim();
+		}
+	};
+
+	template <typename Key, typename Hash = std::hash<Key>>
+	using CooccurrenceModel = BasicCooccurrenceModel<Key, Hash>;
+}
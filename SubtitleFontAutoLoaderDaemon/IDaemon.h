@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <exception>
 
 namespace sfh
@@ -11,5 +12,9 @@ namespace sfh
 		virtual void NotifyException(std::exception_ptr exception) = 0;
 		virtual void NotifyExit() = 0;
 		virtual void NotifyReload() = 0;
+		virtual void NotifyApplyUpdates() = 0;
+		virtual void NotifyFontChange() = 0;
+		// done of total prefetch history entries loaded after start
+		virtual void NotifyWarmUpProgress(size_t done, size_t total) = 0;
 	};
 }
@@ -0,0 +1,74 @@
+#include "pch.h"
+
+#include "InstalledFonts.h"
+#include "NameIndex.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <wil/resource.h>
+#include <wil/result.h>
+
+#include <set>
+
+std::wstring sfh::InstalledFontSet::MakeKey(std::wstring_view name, uint32_t weight, bool italic)
+{
+	std::wstring key;
+	NormalizeName(name, key);
+	key.push_back(L'\0');
+	key.append(std::to_wstring(weight));
+	key.push_back(italic ? L'i' : L'n');
+	return key;
+}
+
+std::shared_ptr<const sfh::InstalledFontSet> sfh::InstalledFontSet::Enumerate()
+{
+	struct EnumContext
+	{
+		InstalledFontSet* fontSet;
+		std::set<std::wstring> families;
+	};
+
+	auto ret = std::make_shared<InstalledFontSet>();
+	wil::unique_hdc_window hDC = wil::GetWindowDC(HWND_DESKTOP);
+	THROW_LAST_ERROR_IF_NULL(hDC.get());
+
+	EnumContext context{ret.get()};
+	LOGFONTW lf{};
+	lf.lfCharSet = DEFAULT_CHARSET;
+	// an empty face name lists one entry per family
+	EnumFontFamiliesExW(hDC.get(), &lf, [](const LOGFONTW* lpelfe, const TEXTMETRICW*, DWORD, LPARAM lParam)-> int
+	{
+		auto& context = *reinterpret_cast<EnumContext*>(lParam);
+		// vertical variants, queries have the '@' stripped
+		if (lpelfe->lfFaceName[0] != L'@')
+			context.families.emplace(lpelfe->lfFaceName);
+		return TRUE;
+	}, reinterpret_cast<LPARAM>(&context), 0);
+
+	// a face name lists every style of the family
+	for (auto& family : context.families)
+	{
+		wcscpy_s(lf.lfFaceName, LF_FACESIZE, family.c_str());
+		EnumFontFamiliesExW(hDC.get(), &lf, [](const LOGFONTW* lpelfe, const TEXTMETRICW*, DWORD, LPARAM lParam)-> int
+		{
+			auto& context = *reinterpret_cast<EnumContext*>(lParam);
+			auto& elfe = *reinterpret_cast<const ENUMLOGFONTEXW*>(lpelfe);
+			uint32_t weight = static_cast<uint32_t>(lpelfe->lfWeight);
+			bool italic = !!lpelfe->lfItalic;
+			context.fontSet->m_keys.emplace(MakeKey(lpelfe->lfFaceName, weight, italic));
+			context.fontSet->m_keys.emplace(MakeKey(elfe.elfFullName, weight, italic));
+			return TRUE;
+		}, reinterpret_cast<LPARAM>(&context), 0);
+	}
+	return ret;
+}
+
+bool sfh::InstalledFontSet::Contains(std::wstring_view name, uint32_t weight, bool italic) const
+{
+	return m_keys.contains(MakeKey(name, weight, italic));
+}
+
+size_t sfh::InstalledFontSet::GetSize() const
+{
+	return m_keys.size();
+}
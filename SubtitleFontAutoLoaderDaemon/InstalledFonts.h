@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace sfh
+{
+	// faces GDI maps without our help, fonts installed for the system or the current user.
+	// the daemon isn't injected, so fonts clients loaded privately don't show up here
+	class InstalledFontSet
+	{
+	private:
+		// normalized name, then weight and italic after a NUL
+		std::unordered_set<std::wstring> m_keys;
+
+		static std::wstring MakeKey(std::wstring_view name, uint32_t weight, bool italic);
+	public:
+		// enumerates every family and style through GDI, throws on failure
+		static std::shared_ptr<const InstalledFontSet> Enumerate();
+
+		// name is any face name GDI would match, family or full name
+		bool Contains(std::wstring_view name, uint32_t weight, bool italic) const;
+		size_t GetSize() const;
+	};
+}
@@ -0,0 +1,520 @@
+#pragma once
+
+#include "Transcode.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace sfh
+{
+	// copies of hot font files from slow volumes in a local directory within a byte budget,
+	// least recently used go first. copies are made on a background thread with throttled
+	// reads and are only used once their content hash matches the origin's.
+	// a manifest in the directory keeps the copies across restarts. origins are rechecked on
+	// the worker now and then and when asked, copies of changed origins are dropped there
+	class LocalFontCache
+	{
+	private:
+		static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+		static constexpr uint64_t HASH_SEED = 0xcbf29ce484222325;
+
+		struct Item
+		{
+			std::wstring m_origin;
+			// file name inside the cache directory
+			std::wstring m_fileName;
+			uint64_t m_size;
+			// of the origin when copied, a changed origin drops the copy
+			int64_t m_originTime;
+			uint64_t m_hash;
+		};
+
+		const std::filesystem::path m_directory;
+
+		std::mutex m_lock;
+		// most recently used first
+		std::list<Item> m_items;
+		std::unordered_map<std::wstring, std::list<Item>::iterator> m_index;
+		// local path to origin, for mapping feedback back
+		std::unordered_map<std::wstring, std::wstring> m_origins;
+		uint64_t m_budget;
+		uint64_t m_used = 0;
+		// bytes read per second while copying, 0 doesn't throttle
+		uint64_t m_bandwidth;
+		// the manifest was read, saving before would lose it
+		bool m_loaded = false;
+
+		// origins waiting to be copied, guarded by m_lock
+		std::deque<std::wstring> m_queue;
+		std::unordered_set<std::wstring> m_queued;
+		std::condition_variable m_queueCV;
+		// origins to check for changes before the next copy, guarded by m_lock
+		std::unordered_set<std::wstring> m_recheck;
+		const std::chrono::steady_clock::duration m_recheckInterval;
+		bool m_exit = false;
+		std::thread m_worker;
+
+		// FNV-1a, only guards against torn or corrupted copies
+		static uint64_t Hash(uint64_t hash, const char* data, size_t size)
+		{
+			for (size_t i = 0; i < size; ++i)
+			{
+				hash ^= static_cast<unsigned char>(data[i]);
+				hash *= 0x100000001b3;
+			}
+			return hash;
+		}
+
+		static std::wstring ToHex(uint64_t value)
+		{
+			wchar_t buffer[17];
+			for (int i = 15; i >= 0; --i, value >>= 4)
+				buffer[i] = L"0123456789abcdef"[value & 0xf];
+			buffer[16] = L'\0';
+			return buffer;
+		}
+
+		static bool IsHex(std::wstring_view str)
+		{
+			return str.size() == 16 && str.find_first_not_of(L"0123456789abcdef") == std::wstring_view::npos;
+		}
+
+		// names Copy gives files, "<hash>-<origin hash>.ext" and "<origin hash>.tmp", and the
+		// manifest's temporary file, the directory may be shared with other files
+		static bool IsCacheFileName(std::wstring_view name)
+		{
+			if (name == L"manifest.txt.tmp")
+				return true;
+			if (name.size() == 20 && name.ends_with(L".tmp"))
+				return IsHex(name.substr(0, 16));
+			if (name.size() < 33 || name[16] != L'-' || !IsHex(name.substr(0, 16)) || !IsHex(name.substr(17, 16)))
+				return false;
+			auto extension = name.substr(33);
+			return extension.empty() || (extension[0] == L'.' && extension.find(L'.', 1) == std::wstring_view::npos);
+		}
+
+		static std::optional<int64_t> GetWriteTime(const std::filesystem::path& path)
+		{
+			std::error_code ec;
+			auto time = std::filesystem::last_write_time(path, ec);
+			if (ec)
+				return std::nullopt;
+			return static_cast<int64_t>(time.time_since_epoch().count());
+		}
+
+		std::filesystem::path GetManifestPath() const
+		{
+			return m_directory / L"manifest.txt";
+		}
+
+		std::wstring GetLocalPath(const Item& item) const
+		{
+			return (m_directory / item.m_fileName).wstring();
+		}
+
+		// under m_lock
+		void Insert(Item&& item)
+		{
+			m_used += item.m_size;
+			m_items.push_front(std::move(item));
+			m_index.emplace(m_items.front().m_origin, m_items.begin());
+			m_origins.emplace(GetLocalPath(m_items.front()), m_items.front().m_origin);
+		}
+
+		// under m_lock
+		void Erase(std::list<Item>::iterator iter)
+		{
+			std::error_code ec;
+			// a client may still have the copy loaded, the next start removes it then
+			std::filesystem::remove(m_directory / iter->m_fileName, ec);
+			m_used -= iter->m_size;
+			m_origins.erase(GetLocalPath(*iter));
+			m_index.erase(iter->m_origin);
+			m_items.erase(iter);
+		}
+
+		// under m_lock
+		void EvictUntil(uint64_t budget)
+		{
+			while (m_used > budget)
+				Erase(std::prev(m_items.end()));
+		}
+
+		// under m_lock
+		void SaveManifest()
+		{
+			if (!m_loaded)
+				return;
+			std::ostringstream output;
+			// oldest first so loading restores the order
+			for (auto iter = m_items.rbegin(); iter != m_items.rend(); ++iter)
+			{
+				std::string fileName, origin;
+				if (!Transcode::WideToUtf8(iter->m_fileName, fileName) || !Transcode::WideToUtf8(iter->m_origin, origin))
+					continue;
+				output << fileName << '\t' << iter->m_size << '\t' << iter->m_originTime << '\t' << iter->m_hash
+					<< '\t' << origin << '\n';
+			}
+			auto tempPath = GetManifestPath();
+			tempPath += L".tmp";
+			{
+				std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+				if (!file.is_open())
+					return;
+				file << output.str();
+				if (!file.good())
+					return;
+			}
+			std::error_code ec;
+			std::filesystem::rename(tempPath, GetManifestPath(), ec);
+		}
+
+		// runs on the worker before anything else, checks origins on the slow volume.
+		// a disabled cache leaves the directory alone
+		void LoadManifest()
+		{
+			{
+				std::lock_guard lg(m_lock);
+				if (m_budget == 0)
+					return;
+			}
+			std::vector<Item> items;
+			std::ifstream file(GetManifestPath(), std::ios::binary);
+			std::string line;
+			while (std::getline(file, line))
+			{
+				std::istringstream fields(line);
+				std::string fileName, origin;
+				Item item;
+				if (!std::getline(fields, fileName, '\t') || !(fields >> item.m_size >> item.m_originTime >> item.m_hash)
+					|| fields.get() != '\t' || !std::getline(fields, origin))
+					continue;
+				if (!Transcode::Utf8ToWide(fileName, item.m_fileName) || !Transcode::Utf8ToWide(origin, item.m_origin))
+					continue;
+				std::error_code ec;
+				if (std::filesystem::file_size(m_directory / item.m_fileName, ec) != item.m_size || ec)
+					continue;
+				if (GetWriteTime(item.m_origin) != item.m_originTime)
+					continue;
+				items.push_back(std::move(item));
+			}
+
+			std::lock_guard lg(m_lock);
+			m_loaded = true;
+			std::unordered_set<std::wstring> fileNames;
+			for (auto& item : items)
+			{
+				if (m_index.contains(item.m_origin))
+					continue;
+				fileNames.insert(item.m_fileName);
+				Insert(std::move(item));
+			}
+			EvictUntil(m_budget);
+			// copies evicted while loaded, interrupted copies and unlisted copies,
+			// files not named like ours are someone else's
+			std::error_code ec;
+			for (auto& entry : std::filesystem::directory_iterator(m_directory, ec))
+			{
+				auto name = entry.path().filename().wstring();
+				if (IsCacheFileName(name) && !fileNames.contains(name))
+					std::filesystem::remove(entry.path(), ec);
+			}
+			SaveManifest();
+		}
+
+		// false if the copy failed or was interrupted
+		bool Copy(const std::wstring& origin, uint64_t bandwidth, Item& item)
+		{
+			std::error_code ec;
+			auto size = std::filesystem::file_size(origin, ec);
+			auto originTime = GetWriteTime(origin);
+			if (ec || size == 0 || !originTime)
+				return false;
+			{
+				std::lock_guard lg(m_lock);
+				if (size > m_budget)
+					return false;
+			}
+			auto tempPath = m_directory / (ToHex(Hash(HASH_SEED, reinterpret_cast<const char*>(origin.data()),
+			                                          origin.size() * sizeof(wchar_t))) + L".tmp");
+			uint64_t hash = HASH_SEED;
+			{
+				std::ifstream input(std::filesystem::path(origin), std::ios::binary);
+				std::ofstream output(tempPath, std::ios::binary | std::ios::trunc);
+				if (!input.is_open() || !output.is_open())
+					return false;
+				std::vector<char> buffer(CHUNK_SIZE);
+				auto start = std::chrono::steady_clock::now();
+				uint64_t copied = 0;
+				while (copied < size)
+				{
+					input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+					auto count = static_cast<size_t>(input.gcount());
+					if (count == 0)
+						break;
+					hash = Hash(hash, buffer.data(), count);
+					output.write(buffer.data(), static_cast<std::streamsize>(count));
+					copied += count;
+					std::unique_lock ul(m_lock);
+					// keeps the slow volume responsive for players reading from it meanwhile
+					auto due = bandwidth == 0
+						           ? start
+						           : start + std::chrono::milliseconds(copied * 1000 / bandwidth);
+					if (m_queueCV.wait_until(ul, due, [&]() { return m_exit; }))
+						break;
+				}
+				output.close();
+				if (copied != size || !output.good())
+				{
+					std::filesystem::remove(tempPath, ec);
+					return false;
+				}
+			}
+
+			// read back what landed on disk
+			uint64_t localHash = HASH_SEED;
+			{
+				std::ifstream local(tempPath, std::ios::binary);
+				std::vector<char> buffer(CHUNK_SIZE);
+				while (local.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || local.gcount() > 0)
+					localHash = Hash(localHash, buffer.data(), static_cast<size_t>(local.gcount()));
+			}
+			// the origin changed while it was copied
+			if (localHash != hash || GetWriteTime(origin) != originTime)
+			{
+				std::filesystem::remove(tempPath, ec);
+				return false;
+			}
+
+			item.m_origin = origin;
+			// distinct per origin, copies of identical files don't share a name
+			item.m_fileName = ToHex(hash) + L"-" + tempPath.stem().wstring() + std::filesystem::path(origin).
+				extension().wstring();
+			item.m_size = size;
+			item.m_originTime = *originTime;
+			item.m_hash = hash;
+			std::filesystem::rename(tempPath, m_directory / item.m_fileName, ec);
+			if (ec)
+			{
+				std::filesystem::remove(tempPath, ec);
+				return false;
+			}
+			return true;
+		}
+
+		// on the worker without m_lock, stats each origin on the slow volume and drops the
+		// copies whose origin changed since they were made
+		void RecheckOrigins(std::vector<std::wstring> origins)
+		{
+			std::vector<std::pair<std::wstring, int64_t>> stale;
+			for (auto& origin : origins)
+			{
+				std::optional<int64_t> originTime;
+				{
+					std::lock_guard lg(m_lock);
+					if (m_exit)
+						return;
+					auto iter = m_index.find(origin);
+					if (iter == m_index.end())
+						continue;
+					originTime = iter->second->m_originTime;
+				}
+				if (GetWriteTime(origin) != originTime)
+					stale.emplace_back(std::move(origin), *originTime);
+			}
+			if (stale.empty())
+				return;
+			std::lock_guard lg(m_lock);
+			for (auto& [origin, originTime] : stale)
+			{
+				// copied afresh meanwhile
+				auto iter = m_index.find(origin);
+				if (iter != m_index.end() && iter->second->m_originTime == originTime)
+					Erase(iter->second);
+			}
+			SaveManifest();
+		}
+
+		void WorkerMain()
+		{
+			try
+			{
+				LoadManifest();
+			}
+			catch (...)
+			{
+				// starts empty
+			}
+			std::unique_lock ul(m_lock);
+			m_loaded = true;
+			auto nextRecheck = std::chrono::steady_clock::now() + m_recheckInterval;
+			for (;;)
+			{
+				m_queueCV.wait_until(ul, nextRecheck, [&]()
+				{
+					return m_exit || !m_queue.empty() || !m_recheck.empty();
+				});
+				if (m_exit)
+					return;
+				std::vector<std::wstring> recheck;
+				if (std::chrono::steady_clock::now() >= nextRecheck)
+				{
+					for (auto& item : m_items)
+						recheck.push_back(item.m_origin);
+					m_recheck.clear();
+					nextRecheck = std::chrono::steady_clock::now() + m_recheckInterval;
+				}
+				else
+				{
+					recheck.assign(m_recheck.begin(), m_recheck.end());
+					m_recheck.clear();
+				}
+				if (!recheck.empty())
+				{
+					ul.unlock();
+					RecheckOrigins(std::move(recheck));
+					ul.lock();
+					continue;
+				}
+				if (m_queue.empty())
+					continue;
+				auto origin = std::move(m_queue.front());
+				m_queue.pop_front();
+				uint64_t bandwidth = m_bandwidth;
+				ul.unlock();
+				Item item;
+				bool copied = false;
+				try
+				{
+					copied = Copy(origin, bandwidth, item);
+				}
+				catch (...)
+				{
+					// served from the origin as before
+				}
+				ul.lock();
+				m_queued.erase(origin);
+				if (!copied)
+					continue;
+				if (item.m_size > m_budget || m_index.contains(origin))
+				{
+					std::error_code ec;
+					std::filesystem::remove(m_directory / item.m_fileName, ec);
+					continue;
+				}
+				Insert(std::move(item));
+				EvictUntil(m_budget);
+				SaveManifest();
+			}
+		}
+
+	public:
+		// budget in bytes, a budget of 0 disables the cache, throws if directory can't be created.
+		// every copy's origin is rechecked once per recheckInterval
+		LocalFontCache(std::filesystem::path directory, uint64_t budget, uint64_t bandwidth,
+		               std::chrono::steady_clock::duration recheckInterval = std::chrono::minutes(10))
+			: m_directory(std::move(directory)), m_budget(budget), m_bandwidth(bandwidth),
+			  m_recheckInterval(recheckInterval)
+		{
+			if (m_budget != 0)
+				std::filesystem::create_directories(m_directory);
+			m_worker = std::thread([this]() { WorkerMain(); });
+		}
+
+		~LocalFontCache()
+		{
+			{
+				std::lock_guard lg(m_lock);
+				m_exit = true;
+			}
+			m_queueCV.notify_all();
+			m_worker.join();
+		}
+
+		LocalFontCache(const LocalFontCache&) = delete;
+		LocalFontCache(LocalFontCache&&) = delete;
+
+		LocalFontCache& operator=(const LocalFontCache&) = delete;
+		LocalFontCache& operator=(LocalFontCache&&) = delete;
+
+		void SetLimits(uint64_t budget, uint64_t bandwidth)
+		{
+			std::lock_guard lg(m_lock);
+			if (budget != 0 && m_budget == 0)
+			{
+				std::error_code ec;
+				std::filesystem::create_directories(m_directory, ec);
+			}
+			m_budget = budget;
+			m_bandwidth = bandwidth;
+			EvictUntil(budget);
+			SaveManifest();
+		}
+
+		// the local copy of origin, counts as a use. only looks at the index, the origin
+		// isn't touched, a changed origin is served from the copy until it is rechecked
+		std::optional<std::wstring> Find(const std::wstring& origin)
+		{
+			std::lock_guard lg(m_lock);
+			auto iter = m_index.find(origin);
+			if (iter == m_index.end())
+				return std::nullopt;
+			m_items.splice(m_items.begin(), m_items, iter->second);
+			return GetLocalPath(*iter->second);
+		}
+
+		// the origin path was handed out as local, or path itself
+		std::wstring GetOrigin(const std::wstring& path)
+		{
+			std::lock_guard lg(m_lock);
+			auto iter = m_origins.find(path);
+			return iter == m_origins.end() ? path : iter->second;
+		}
+
+		// queues origin to be copied unless it is there already
+		void Admit(const std::wstring& origin)
+		{
+			{
+				std::lock_guard lg(m_lock);
+				if (m_budget == 0 || m_index.contains(origin) || !m_queued.emplace(origin).second)
+					return;
+				m_queue.push_back(origin);
+			}
+			m_queueCV.notify_one();
+		}
+
+		// checks origin for changes on the worker ahead of the next periodic recheck
+		void Recheck(const std::wstring& origin)
+		{
+			{
+				std::lock_guard lg(m_lock);
+				if (!m_index.contains(origin) || !m_recheck.emplace(origin).second)
+					return;
+			}
+			m_queueCV.notify_one();
+		}
+
+		uint64_t GetUsed()
+		{
+			std::lock_guard lg(m_lock);
+			return m_used;
+		}
+	};
+}
@@ -8,6 +8,8 @@
 #include "RpcServer.h"
 #include "ProcessMonitor.h"
 #include "Prefetch.h"
+#include "InstalledFonts.h"
+#include "EventLog.h"
 
 #include <queue>
 #include <variant>
@@ -53,7 +55,10 @@ namespace sfh
 			Init = 0,
 			Exception,
 			Exit,
-			Reload
+			Reload,
+			ApplyUpdates,
+			FontChange,
+			WarmUpProgress
 		};
 
 		struct Message
@@ -71,6 +76,9 @@ namespace sfh
 
 		struct Service
 		{
+			// used by the query service and prefetch, go last
+			std::unique_ptr<LocalFontCache> m_localCache;
+			std::unique_ptr<FontBlobCache> m_blobCache;
 			std::unique_ptr<SystemTray> m_systemTray;
 			std::unique_ptr<QueryService> m_queryService;
 			std::unique_ptr<RpcServer> m_rpcServer;
@@ -79,6 +87,20 @@ namespace sfh
 		};
 
 		std::unique_ptr<Service> m_service;
+		// builds the new index on reload, queries are served from the old one meanwhile
+		std::thread m_reloadThread;
+		// asks the load on m_reloadThread to stop before its next index file
+		std::atomic<bool> m_cancelLoad = false;
+		// m_reloadThread is still loading, updates wait for it
+		std::atomic<bool> m_loading = false;
+		// index files of the current config, a delta applies to the one at the same position
+		std::vector<ConfigFile::IndexFileElement> m_indexFiles;
+		// installing a batch of fonts broadcasts once per font, enumerate once for all of them
+		std::atomic<bool> m_fontChangePending = false;
+		// latest warm-up progress, the tray shows whatever is newest when it gets to it
+		std::atomic<bool> m_warmUpProgressPending = false;
+		std::atomic<size_t> m_warmUpDone = 0;
+		std::atomic<size_t> m_warmUpTotal = 0;
 
 		void NotifyException(std::exception_ptr exception) override
 		{
@@ -101,7 +123,39 @@ namespace sfh
 			m_queueCV.notify_one();
 		}
 
+		void NotifyApplyUpdates() override
+		{
+			std::unique_lock ul(m_queueLock);
+			m_msgQueue.emplace(MessageType::ApplyUpdates, std::nullopt);
+			m_queueCV.notify_one();
+		}
+
+		void NotifyFontChange() override
+		{
+			if (m_fontChangePending.exchange(true))
+				return;
+			std::unique_lock ul(m_queueLock);
+			m_msgQueue.emplace(MessageType::FontChange, std::nullopt);
+			m_queueCV.notify_one();
+		}
+
+		void NotifyWarmUpProgress(size_t done, size_t total) override
+		{
+			m_warmUpTotal = total;
+			m_warmUpDone = done;
+			if (m_warmUpProgressPending.exchange(true))
+				return;
+			std::unique_lock ul(m_queueLock);
+			m_msgQueue.emplace(MessageType::WarmUpProgress, std::nullopt);
+			m_queueCV.notify_one();
+		}
+
 	public:
+		~Daemon()
+		{
+			CancelLoad();
+		}
+
 		int DaemonMain(const std::vector<std::wstring>& cmdline)
 		{
 			std::unique_lock ul(m_queueLock);
@@ -122,7 +176,16 @@ namespace sfh
 				case MessageType::Exit:
 					return 0;
 				case MessageType::Reload:
-					OnInit(cmdline);
+					OnReload(cmdline);
+					break;
+				case MessageType::ApplyUpdates:
+					OnApplyUpdates();
+					break;
+				case MessageType::FontChange:
+					OnFontChange();
+					break;
+				case MessageType::WarmUpProgress:
+					OnWarmUpProgress();
 					break;
 				default:
 					MarkUnreachable();
@@ -140,42 +203,258 @@ namespace sfh
 		}
 
 	private:
+		static std::wstring GetDeltaPath(const ConfigFile::IndexFileElement& indexFile)
+		{
+			return indexFile.m_path + L".delta";
+		}
+
+		// a delta being applied is renamed to this first
+		static std::wstring GetClaimPath(const ConfigFile::IndexFileElement& indexFile)
+		{
+			return GetDeltaPath(indexFile) + L".applying";
+		}
+
+		// index files usually live on different disks, read and index them concurrently.
+		// false if cancel was set before every file was read
+		static bool LoadIndexFiles(const std::vector<ConfigFile::IndexFileElement>& indexFiles,
+		                           QueryService& queryService, const std::atomic<bool>& cancel)
+		{
+			size_t workerCount = std::thread::hardware_concurrency();
+			if (workerCount == 0 || workerCount > indexFiles.size())
+				workerCount = indexFiles.size();
+			std::atomic<size_t> next = 0;
+			std::mutex errorLock;
+			std::exception_ptr error;
+			std::vector<std::thread> workers;
+			for (size_t i = 0; i < workerCount; ++i)
+			{
+				workers.emplace_back([&]()
+				{
+					for (size_t order = next++; order < indexFiles.size(); order = next++)
+					{
+						if (cancel)
+							break;
+						try
+						{
+							// the builder replaces the index before writing a delta, a delta present
+							// now, or one left claimed by a failed apply, is contained in the index read next
+							DeleteFileW(GetDeltaPath(indexFiles[order]).c_str());
+							DeleteFileW(GetClaimPath(indexFiles[order]).c_str());
+							queryService.AddDatabase(order, FontDatabase::ReadFromFile(indexFiles[order].m_path));
+						}
+						catch (...)
+						{
+							std::lock_guard lg(errorLock);
+							if (!error)
+								error = std::current_exception();
+						}
+					}
+				});
+			}
+			for (auto& worker : workers)
+				worker.join();
+			if (cancel)
+				return false;
+			if (error)
+				std::rethrow_exception(error);
+			queryService.SetComplete();
+			return true;
+		}
+
+		// reads indexFiles into the query service off the message thread, the previous load was joined
+		void StartLoad(std::vector<ConfigFile::IndexFileElement> indexFiles)
+		{
+			m_loading = true;
+			m_reloadThread = std::thread([this, indexFiles = std::move(indexFiles)]()
+			{
+				bool loaded = false;
+				try
+				{
+					loaded = LoadIndexFiles(indexFiles, *m_service->m_queryService, m_cancelLoad);
+					if (loaded)
+						m_service->m_systemTray->NotifyFinishLoad();
+				}
+				catch (...)
+				{
+					NotifyException(std::current_exception());
+				}
+				m_loading = false;
+				// deltas written while loading were left for now
+				if (loaded)
+					NotifyApplyUpdates();
+			});
+		}
+
+		// stops a running load at its next index file and waits for it, the message
+		// thread is held up by one file at most
+		void CancelLoad()
+		{
+			if (!m_reloadThread.joinable())
+				return;
+			m_cancelLoad = true;
+			m_reloadThread.join();
+			m_cancelLoad = false;
+		}
+
+		static std::filesystem::path GetSelfDirectory()
+		{
+			std::filesystem::path selfPath{wil::GetModuleFileNameW<wil::unique_hlocal_string>().get()};
+			selfPath.remove_filename();
+			return selfPath;
+		}
+
+		static std::vector<std::wstring> GetMonitorList(const ConfigFile& cfg)
+		{
+			std::vector<std::wstring> monitorProcess;
+			for (auto& process : cfg.m_monitorProcess)
+			{
+				monitorProcess.emplace_back(process.m_name);
+			}
+			return monitorProcess;
+		}
+
+		static uint64_t MegabytesToBytes(uint32_t megabytes)
+		{
+			return static_cast<uint64_t>(megabytes) * 1024 * 1024;
+		}
+
 		void OnInit(const std::vector<std::wstring>& cmdline)
 		{
+			CancelLoad();
 			{
 				std::unique_lock lg(m_queueLock);
 				while (!m_msgQueue.empty())
 					m_msgQueue.pop();
 			}
 			m_service = std::make_unique<Service>();
-			std::filesystem::path selfPath{wil::GetModuleFileNameW<wil::unique_hlocal_string>().get()};
-			selfPath.remove_filename();
+			auto selfPath = GetSelfDirectory();
 			auto configPath = selfPath / L"SubtitleFontHelper.xml";
 			auto lruCachePath = selfPath / L"lruCache.txt";
+			auto cooccurrencePath = selfPath / L"cooccurrence.txt";
 			auto cfg = ConfigFile::ReadFromFile(configPath);
+			m_indexFiles = cfg->m_indexFile;
 
+			m_service->m_blobCache = std::make_unique<FontBlobCache>(
+				L"SubtitleFontAutoLoaderBlob-" + GetCurrentProcessUserSid() + L"-" +
+				std::to_wstring(GetCurrentProcessId()) + L"-",
+				MegabytesToBytes(cfg->blobCacheSize));
+			// the directory is only read on start
+			auto localCachePath = cfg->localCacheDirectory.empty()
+				                      ? selfPath / L"LocalCache"
+				                      : std::filesystem::path(cfg->localCacheDirectory);
+			m_service->m_localCache = std::make_unique<LocalFontCache>(
+				localCachePath,
+				MegabytesToBytes(cfg->localCacheSize),
+				MegabytesToBytes(cfg->localCacheBandwidth));
 			m_service->m_systemTray = std::make_unique<SystemTray>(this);
-			std::vector<std::unique_ptr<FontDatabase>> dbs;
-			for (auto& indexFile : cfg->m_indexFile)
-			{
-				dbs.emplace_back(FontDatabase::ReadFromFile(indexFile.m_path));
-			}
-			m_service->m_prefetch = std::make_unique<Prefetch>(this, cfg->lruSize, lruCachePath);
-			m_service->m_queryService = std::make_unique<QueryService>(this);
+			m_service->m_prefetch = std::make_unique<Prefetch>(
+				this, cfg->lruSize, MegabytesToBytes(cfg->prefetchSize), MegabytesToBytes(cfg->warmUpBandwidth),
+				lruCachePath, cooccurrencePath, m_service->m_blobCache.get(), m_service->m_localCache.get());
+			m_service->m_queryService = std::make_unique<QueryService>(
+				this, cfg->matchPolicy, m_service->m_blobCache.get(), m_service->m_localCache.get());
+			m_service->m_queryService->SetResolveTimeout(cfg->resolveTimeout);
+			RefreshInstalledFonts();
+			// serve queries from whatever is loaded while the rest is still loading
 			m_service->m_rpcServer = std::make_unique<RpcServer>(
 				this,
 				m_service->m_queryService->GetRpcRequestHandler(),
 				m_service->m_prefetch->GetRpcFeedbackHandler());
-			m_service->m_queryService->Load(std::move(dbs));
+			// players started while the index loads still get the hook
 			m_service->m_processMonitor = std::make_unique<ProcessMonitor>(
 				this, std::chrono::milliseconds(cfg->wmiPollInterval));
-			std::vector<std::wstring> monitorProcess;
-			for (auto& process : cfg->m_monitorProcess)
+			m_service->m_processMonitor->SetMonitorList(GetMonitorList(*cfg));
+			// load off the message thread like a reload, so exit and tray requests aren't held up
+			StartLoad(std::move(cfg->m_indexFile));
+		}
+
+		// rereads config and index files only, rpc connections, client caches,
+		// prefetch history and the process monitor stay as they are
+		void OnReload(const std::vector<std::wstring>& cmdline)
+		{
+			if (!m_service)
 			{
-				monitorProcess.emplace_back(process.m_name);
+				OnInit(cmdline);
+				return;
+			}
+			// a reload requested while one is running starts over
+			CancelLoad();
+
+			auto cfg = ConfigFile::ReadFromFile(GetSelfDirectory() / L"SubtitleFontHelper.xml");
+			m_indexFiles = cfg->m_indexFile;
+			m_service->m_queryService->SetMatchPolicy(cfg->matchPolicy);
+			m_service->m_queryService->SetResolveTimeout(cfg->resolveTimeout);
+			m_service->m_blobCache->SetBudget(MegabytesToBytes(cfg->blobCacheSize));
+			m_service->m_localCache->SetLimits(MegabytesToBytes(cfg->localCacheSize),
+			                                   MegabytesToBytes(cfg->localCacheBandwidth));
+			m_service->m_prefetch->SetBudget(MegabytesToBytes(cfg->prefetchSize));
+			m_service->m_processMonitor->SetMonitorList(GetMonitorList(*cfg));
+			RefreshInstalledFonts();
+			m_service->m_systemTray->NotifyStartLoad();
+			m_service->m_queryService->BeginReload();
+			StartLoad(std::move(cfg->m_indexFile));
+		}
+
+		// applies deltas the builder left next to the index files
+		void OnApplyUpdates()
+		{
+			if (!m_service)
+				return;
+			// a load in progress reads the deltas as part of the index files, the ones written
+			// meanwhile are applied when it posts this again on completion
+			if (m_loading)
+				return;
+			// done loading, at most posting
+			if (m_reloadThread.joinable())
+				m_reloadThread.join();
+			for (size_t order = 0; order < m_indexFiles.size(); ++order)
+			{
+				// claim the delta before reading it, the builder merges a delta still in place into
+				// its next one and must not drop what we are applying
+				auto deltaPath = GetDeltaPath(m_indexFiles[order]);
+				auto claimPath = GetClaimPath(m_indexFiles[order]);
+				if (!MoveFileExW(deltaPath.c_str(), claimPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+					continue;
+				try
+				{
+					m_service->m_queryService->ApplyDelta(order, FontDatabase::ReadFromFile(claimPath));
+				}
+				catch (std::exception& e)
+				{
+					// the index file already contains the delta, reading the index files again
+					// catches up and removes the claim, queries use the current index meanwhile
+					EventLog::GetInstance().LogDebugMessage(L"applying %s failed, reloading index files: %hs",
+					                                        claimPath.c_str(), e.what());
+					m_service->m_systemTray->NotifyStartLoad();
+					m_service->m_queryService->BeginReload();
+					StartLoad(m_indexFiles);
+					return;
+				}
+				DeleteFileW(claimPath.c_str());
 			}
-			m_service->m_processMonitor->SetMonitorList(std::move(monitorProcess));
-			m_service->m_systemTray->NotifyFinishLoad();
+		}
+
+		void RefreshInstalledFonts()
+		{
+			auto installedFonts = InstalledFontSet::Enumerate();
+			EventLog::GetInstance().LogDebugMessage(L"installed fonts enumerated: %zu names",
+			                                        installedFonts->GetSize());
+			m_service->m_queryService->SetInstalledFonts(std::move(installedFonts));
+		}
+
+		// fonts were installed or removed system wide, results already cached by clients
+		// keep their installed flags which only costs a redundant private load
+		void OnFontChange()
+		{
+			m_fontChangePending = false;
+			if (m_service && m_service->m_queryService)
+				RefreshInstalledFonts();
+		}
+
+		void OnWarmUpProgress()
+		{
+			m_warmUpProgressPending = false;
+			if (m_service && m_service->m_systemTray)
+				m_service->m_systemTray->NotifyWarmUpProgress(m_warmUpDone, m_warmUpTotal);
 		}
 
 		void OnException(std::exception_ptr exception)
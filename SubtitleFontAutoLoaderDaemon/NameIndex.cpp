@@ -0,0 +1,278 @@
+#include "NameIndex.h"
+#include "CaseFold.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+	uint64_t Mix(uint64_t x)
+	{
+		// splitmix64 finalizer
+		x ^= x >> 30;
+		x *= 0xbf58476d1ce4e5b9;
+		x ^= x >> 27;
+		x *= 0x94d049bb133111eb;
+		x ^= x >> 31;
+		return x;
+	}
+
+	constexpr uint32_t SERIALIZE_MAGIC = 0x494e4653; // "SFNI"
+	constexpr uint32_t SERIALIZE_VERSION = 2;
+
+	struct SerializeHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t wcharSize;
+		uint32_t namespaceCount;
+		uint32_t seedCount;
+		uint32_t entryCount;
+		uint32_t keyLength;
+		uint32_t boundCount;
+		uint32_t idCount;
+	};
+
+	template <typename T>
+	void AppendArray(std::string& out, const std::vector<T>& data)
+	{
+		out.append(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(T));
+	}
+
+	template <typename T>
+	void ReadArray(const char*& data, size_t& length, std::vector<T>& out, size_t count)
+	{
+		if (count > length / sizeof(T))
+			throw std::runtime_error("name index truncated");
+		out.resize(count);
+		memcpy(out.data(), data, count * sizeof(T));
+		data += count * sizeof(T);
+		length -= count * sizeof(T);
+	}
+}
+
+void sfh::NormalizeName(std::wstring_view name, std::wstring& out)
+{
+	FoldCase(name, out);
+}
+
+uint64_t sfh::NameIndex::Hash(std::wstring_view key)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	for (wchar_t ch : key)
+	{
+		hash ^= static_cast<uint64_t>(ch);
+		hash *= 0x100000001b3;
+	}
+	return Mix(hash);
+}
+
+size_t sfh::NameIndex::GetSlot(uint64_t hash, uint32_t seed, size_t slotCount)
+{
+	return Mix(hash ^ seed * 0x9e3779b97f4a7c15) % slotCount;
+}
+
+sfh::NameIndex::Builder::Builder(uint32_t namespaceCount, uint64_t duplicateMask)
+	: m_namespaceCount(namespaceCount), m_duplicateMask(duplicateMask)
+{
+	assert(namespaceCount <= 64);
+}
+
+bool sfh::NameIndex::Builder::Add(std::wstring_view name, uint32_t ns, uint32_t faceId)
+{
+	assert(ns < m_namespaceCount);
+	NormalizeName(name, m_buffer);
+	if (m_buffer.empty())
+		return false;
+	auto [iter, inserted] = m_keys.try_emplace(m_buffer);
+	if (inserted)
+	{
+		m_order.push_back(&iter->first);
+	}
+	else if (!(m_duplicateMask & 1ull << ns))
+	{
+		auto& ids = iter->second;
+		if (std::find_if(ids.begin(), ids.end(), [&](auto& item) { return item.first == ns; }) != ids.end())
+			return false;
+	}
+	iter->second.emplace_back(ns, faceId);
+	return true;
+}
+
+sfh::NameIndex sfh::NameIndex::Builder::Build()
+{
+	NameIndex ret;
+	ret.m_namespaceCount = m_namespaceCount;
+	size_t keyCount = m_order.size();
+	if (keyCount == 0)
+		return ret;
+
+	// ~4 keys per bucket keeps the seed search short while the table stays minimal
+	size_t bucketCount = (keyCount + 3) / 4;
+	std::vector<uint64_t> hashes(keyCount);
+	std::vector<std::vector<uint32_t>> buckets(bucketCount);
+	for (size_t i = 0; i < keyCount; ++i)
+	{
+		hashes[i] = Hash(*m_order[i]);
+		buckets[hashes[i] % bucketCount].push_back(static_cast<uint32_t>(i));
+	}
+
+	// place large buckets first while the table is still empty
+	std::vector<uint32_t> bucketOrder(bucketCount);
+	std::iota(bucketOrder.begin(), bucketOrder.end(), 0);
+	std::stable_sort(bucketOrder.begin(), bucketOrder.end(), [&](uint32_t lhs, uint32_t rhs)
+	{
+		return buckets[lhs].size() > buckets[rhs].size();
+	});
+
+	std::vector<char> occupied(keyCount, 0);
+	std::vector<size_t> slotOfKey(keyCount);
+	std::vector<size_t> slots;
+	ret.m_seeds.assign(bucketCount, 0);
+	for (auto bucketIndex : bucketOrder)
+	{
+		auto& bucket = buckets[bucketIndex];
+		if (bucket.empty())
+			break;
+		for (size_t i = 0; i < bucket.size(); ++i)
+		{
+			for (size_t j = i + 1; j < bucket.size(); ++j)
+			{
+				// no seed can separate these, practically unreachable with 64-bit hashes
+				if (hashes[bucket[i]] == hashes[bucket[j]])
+					throw std::runtime_error("name hash collision");
+			}
+		}
+		for (uint32_t seed = 0;; ++seed)
+		{
+			slots.clear();
+			for (auto key : bucket)
+			{
+				size_t slot = GetSlot(hashes[key], seed, keyCount);
+				if (occupied[slot] || std::find(slots.begin(), slots.end(), slot) != slots.end())
+					break;
+				slots.push_back(slot);
+			}
+			if (slots.size() != bucket.size())
+				continue;
+			for (size_t i = 0; i < bucket.size(); ++i)
+			{
+				occupied[slots[i]] = 1;
+				slotOfKey[bucket[i]] = slots[i];
+			}
+			ret.m_seeds[bucketIndex] = seed;
+			break;
+		}
+	}
+
+	ret.m_entries.resize(keyCount);
+	for (size_t i = 0; i < keyCount; ++i)
+	{
+		auto& key = *m_order[i];
+		auto& ids = m_keys[key];
+		// group by namespace, keeping insertion order inside each
+		std::stable_sort(ids.begin(), ids.end(), [](auto& lhs, auto& rhs) { return lhs.first < rhs.first; });
+		auto& entry = ret.m_entries[slotOfKey[i]];
+		entry.m_keyOffset = static_cast<uint32_t>(ret.m_keys.size());
+		entry.m_keyLength = static_cast<uint32_t>(key.size());
+		entry.m_boundOffset = static_cast<uint32_t>(ret.m_bounds.size());
+		ret.m_keys.insert(ret.m_keys.end(), key.begin(), key.end());
+		auto iter = ids.begin();
+		for (uint32_t ns = 0; ns < m_namespaceCount; ++ns)
+		{
+			ret.m_bounds.push_back(static_cast<uint32_t>(ret.m_ids.size()));
+			for (; iter != ids.end() && iter->first == ns; ++iter)
+				ret.m_ids.push_back(iter->second);
+		}
+		ret.m_bounds.push_back(static_cast<uint32_t>(ret.m_ids.size()));
+	}
+
+	m_keys.clear();
+	m_order.clear();
+	return ret;
+}
+
+sfh::NameIndex::Match sfh::NameIndex::Find(std::wstring_view name) const
+{
+	if (m_entries.empty())
+		return {};
+	uint64_t hash = Hash(name);
+	uint32_t seed = m_seeds[hash % m_seeds.size()];
+	auto& entry = m_entries[GetSlot(hash, seed, m_entries.size())];
+	// the hash is only perfect for names in the set
+	if (name != std::wstring_view(m_keys.data() + entry.m_keyOffset, entry.m_keyLength))
+		return {};
+	return {m_ids.data(), m_bounds.data() + entry.m_boundOffset};
+}
+
+void sfh::NameIndex::Serialize(std::string& out) const
+{
+	SerializeHeader header{
+		SERIALIZE_MAGIC,
+		SERIALIZE_VERSION,
+		sizeof(wchar_t),
+		m_namespaceCount,
+		static_cast<uint32_t>(m_seeds.size()),
+		static_cast<uint32_t>(m_entries.size()),
+		static_cast<uint32_t>(m_keys.size()),
+		static_cast<uint32_t>(m_bounds.size()),
+		static_cast<uint32_t>(m_ids.size())
+	};
+	out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+	AppendArray(out, m_seeds);
+	AppendArray(out, m_entries);
+	AppendArray(out, m_keys);
+	AppendArray(out, m_bounds);
+	AppendArray(out, m_ids);
+}
+
+sfh::NameIndex sfh::NameIndex::Deserialize(const void* data, size_t length)
+{
+	SerializeHeader header;
+	if (length < sizeof(header))
+		throw std::runtime_error("name index truncated");
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != SERIALIZE_MAGIC || header.version != SERIALIZE_VERSION || header.wcharSize != sizeof(wchar_t))
+		throw std::runtime_error("unsupported name index");
+	// every bucket holds a key and every key a bucket, Find divides by both counts
+	if (header.namespaceCount == 0 || header.namespaceCount > 64
+		|| (header.entryCount == 0) != (header.seedCount == 0) || header.seedCount > header.entryCount
+		|| header.boundCount != static_cast<uint64_t>(header.entryCount) * (header.namespaceCount + 1))
+		throw std::runtime_error("bad name index");
+
+	auto pointer = static_cast<const char*>(data) + sizeof(header);
+	length -= sizeof(header);
+	NameIndex ret;
+	ret.m_namespaceCount = header.namespaceCount;
+	ReadArray(pointer, length, ret.m_seeds, header.seedCount);
+	ReadArray(pointer, length, ret.m_entries, header.entryCount);
+	ReadArray(pointer, length, ret.m_keys, header.keyLength);
+	ReadArray(pointer, length, ret.m_bounds, header.boundCount);
+	ReadArray(pointer, length, ret.m_ids, header.idCount);
+
+	for (auto& entry : ret.m_entries)
+	{
+		if (entry.m_keyOffset > ret.m_keys.size() || entry.m_keyLength > ret.m_keys.size() - entry.m_keyOffset
+			|| entry.m_boundOffset > ret.m_bounds.size() - (ret.m_namespaceCount + 1))
+			throw std::runtime_error("bad name index");
+		auto bounds = ret.m_bounds.data() + entry.m_boundOffset;
+		for (uint32_t ns = 0; ns < ret.m_namespaceCount; ++ns)
+		{
+			if (bounds[ns] > bounds[ns + 1] || bounds[ns + 1] > ret.m_ids.size())
+				throw std::runtime_error("bad name index");
+		}
+	}
+	return ret;
+}
+
+size_t sfh::NameIndex::GetMemoryUsage() const
+{
+	return m_seeds.capacity() * sizeof(uint32_t)
+		+ m_entries.capacity() * sizeof(Entry)
+		+ m_keys.capacity() * sizeof(wchar_t)
+		+ m_bounds.capacity() * sizeof(uint32_t)
+		+ m_ids.capacity() * sizeof(uint32_t);
+}
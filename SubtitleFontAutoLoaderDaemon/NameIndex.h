@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sfh
+{
+	// GDI matches face names case insensitively, folded with FoldCase so the interceptor agrees
+	void NormalizeName(std::wstring_view name, std::wstring& out);
+
+	// exact match index from normalized names to face id lists, one list per namespace
+	// (name type) so a single probe answers every kind of name,
+	// slots are placed by a minimal perfect hash (hash and displace)
+	class NameIndex
+	{
+	private:
+		struct Entry
+		{
+			uint32_t m_keyOffset;
+			uint32_t m_keyLength;
+			// namespace i owns m_ids[m_bounds[m_boundOffset + i], m_bounds[m_boundOffset + i + 1])
+			uint32_t m_boundOffset;
+		};
+
+		uint32_t m_namespaceCount = 0;
+		// displacement seed per bucket
+		std::vector<uint32_t> m_seeds;
+		// one per key, addressed by the perfect hash
+		std::vector<Entry> m_entries;
+		std::vector<wchar_t> m_keys;
+		std::vector<uint32_t> m_bounds;
+		std::vector<uint32_t> m_ids;
+
+		static uint64_t Hash(std::wstring_view key);
+		static size_t GetSlot(uint64_t hash, uint32_t seed, size_t slotCount);
+	public:
+		class Match
+		{
+		private:
+			const uint32_t* m_ids = nullptr;
+			const uint32_t* m_bounds = nullptr;
+		public:
+			Match() = default;
+
+			Match(const uint32_t* ids, const uint32_t* bounds)
+				: m_ids(ids), m_bounds(bounds)
+			{
+			}
+
+			explicit operator bool() const
+			{
+				return m_bounds != nullptr;
+			}
+
+			std::span<const uint32_t> operator[](size_t ns) const
+			{
+				if (!m_bounds)
+					return {};
+				return {m_ids + m_bounds[ns], m_ids + m_bounds[ns + 1]};
+			}
+		};
+
+		class Builder
+		{
+		private:
+			// (namespace, face id) in insertion order
+			std::unordered_map<std::wstring, std::vector<std::pair<uint32_t, uint32_t>>> m_keys;
+			std::vector<const std::wstring*> m_order;
+			uint32_t m_namespaceCount;
+			uint64_t m_duplicateMask;
+			std::wstring m_buffer;
+		public:
+			// bit i of duplicateMask allows namespace i to hold several faces per name,
+			// otherwise only the first face added for a name is kept
+			Builder(uint32_t namespaceCount, uint64_t duplicateMask);
+
+			// returns false if the face was dropped as a duplicate
+			bool Add(std::wstring_view name, uint32_t ns, uint32_t faceId);
+			NameIndex Build();
+		};
+
+		// name must be normalized, returns an empty match if not found
+		Match Find(std::wstring_view name) const;
+
+		size_t GetKeyCount() const
+		{
+			return m_entries.size();
+		}
+
+		// bytes held by the tables
+		size_t GetMemoryUsage() const;
+
+		// the tables as they are in memory, for the index dump and storing next to the index
+		void Serialize(std::string& out) const;
+		// throws std::runtime_error on malformed data, a loaded index never reads out of bounds
+		static NameIndex Deserialize(const void* data, size_t length);
+	};
+}
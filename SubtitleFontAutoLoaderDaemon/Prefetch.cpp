@@ -4,167 +4,248 @@
 
 #include "Prefetch.h"
 #include "Common.h"
+#include "TinyLfuCache.h"
+#include "CooccurrenceModel.h"
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <winioctl.h>
+#include <wil/resource.h>
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
 
-template <typename T>
-class SimpleLRU
+// network shares and disks that seek, copying from an ssd gains nothing
+static bool IsSlowVolume(const std::wstring& volumeName)
 {
-private:
-	struct Node
-	{
-		Node* m_prev;
-		Node* m_next;
+	std::wstring volumeRoot = volumeName;
+	if (GetDriveTypeW(volumeRoot.c_str()) == DRIVE_REMOTE)
+		return true;
+	// the device is opened without the trailing backslash
+	volumeRoot.pop_back();
+	wil::unique_hfile volume(CreateFileW(volumeRoot.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+	                                     OPEN_EXISTING, 0, nullptr));
+	if (!volume.is_valid())
+		return false;
+	STORAGE_PROPERTY_QUERY query{};
+	query.PropertyId = StorageDeviceSeekPenaltyProperty;
+	query.QueryType = PropertyStandardQuery;
+	DEVICE_SEEK_PENALTY_DESCRIPTOR descriptor{};
+	DWORD returnLength;
+	if (DeviceIoControl(volume.get(), IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &descriptor,
+	                    sizeof(descriptor), &returnLength, nullptr) == FALSE)
+		return false;
+	return descriptor.IncursSeekPenalty != FALSE;
+}
 
-		T m_data;
+class sfh::Prefetch::Implementation : public sfh::IRpcFeedbackHandler
+{
+	IDaemon* m_daemon;
+	// fonts kept registered with this process so their files stay in the file cache
+	TinyLfuCache<std::wstring> m_lru;
+	// entries saved and loaded on the next start at most
+	size_t m_prefetchCount;
+	FontBlobCache* m_blobCache;
+	LocalFontCache* m_localCache;
 
-		// detach a node from chain, return next node
-		static Node& Detach(Node& node)
-		{
-			if (node.m_prev)
-			{
-				node.m_prev->m_next = node.m_next;
-			}
-			node.m_next->m_prev = node.m_prev;
-			return *node.m_next;
-		}
+	// IsSlowVolume of each volume seen so far
+	std::mutex m_volumeLock;
+	std::unordered_map<std::wstring, bool> m_slowVolumes;
 
-		// attach node before 'pos',return the attached node
-		static Node& Attach(Node& node, Node& pos)
-		{
-			node.m_next = &pos;
-			node.m_prev = pos.m_prev;
-			pos.m_prev = &node;
-			if (node.m_prev)
-				node.m_prev->m_next = &node;
-			return node;
-		}
-	};
+	std::wstring m_cachePath;
 
-	Node m_end{nullptr, nullptr};
-	std::vector<Node> m_nodes;
-	Node* m_head = &m_end;
+	// fonts clients load together, companions of a font being loaded are got ready early
+	static constexpr size_t MODEL_KEYS = 1024;
+	CooccurrenceModel<std::wstring> m_model;
+	std::wstring m_modelPath;
 
-	std::unordered_map<T, Node*> m_hashmap;
+	// predicted files read through once so the client finds them in the file cache
+	static constexpr size_t MAX_WARM_QUEUE = 64;
+	static constexpr DWORD WARM_CHUNK_SIZE = 1024 * 1024;
+	std::mutex m_warmLock;
+	std::condition_variable m_warmCV;
+	std::deque<std::wstring> m_warmQueue;
+	std::atomic<bool> m_exit = false;
+	std::thread m_warmThread;
 
-	size_t m_capacity;
+	// history of the last run loaded in the background, most valuable first
+	std::vector<std::wstring> m_warmUpPaths;
+	// entries of m_warmUpPaths handled so far
+	std::atomic<size_t> m_warmUpNext = 0;
+	// bytes per second of fonts loaded, 0 doesn't throttle
+	uint64_t m_warmUpBandwidth;
+	std::thread m_warmUpThread;
 
-	std::mutex m_lock;
+public:
+	Implementation(IDaemon* daemon, size_t prefetchCount, uint64_t prefetchBudget, uint64_t warmUpBandwidth,
+	               const std::wstring& lruPath, const std::wstring& modelPath, FontBlobCache* blobCache,
+	               LocalFontCache* localCache)
+		: m_daemon(daemon), m_lru(prefetchBudget, prefetchCount, [](const std::wstring& path)
+		  {
+			  RemoveFontResourceExW(path.c_str(), FR_PRIVATE | FR_NOT_ENUM, nullptr);
+		  }),
+		  m_prefetchCount(prefetchCount), m_blobCache(blobCache), m_localCache(localCache), m_cachePath(lruPath),
+		  m_model(MODEL_KEYS), m_modelPath(modelPath), m_warmUpBandwidth(warmUpBandwidth)
+	{
+		m_warmUpPaths = LoadLruCache(m_cachePath);
+		LoadModel(m_modelPath);
+		m_warmThread = std::thread([this]() { WarmMain(); });
+		// the daemon serves queries meanwhile
+		m_warmUpThread = std::thread([this]() { WarmUpMain(); });
+	}
 
-	void AdjustToHead(Node& node, bool inList)
+	~Implementation()
 	{
-		if (inList)
 		{
-			if (&node == m_head)
-				return;
-			Node::Detach(node);
+			std::lock_guard lg(m_warmLock);
+			m_exit = true;
 		}
-		Node::Attach(node, *m_head);
-		m_head = &node;
+		m_warmCV.notify_all();
+		m_warmThread.join();
+		m_warmUpThread.join();
+		SaveLruCache(m_cachePath);
+		SaveModel(m_modelPath);
 	}
 
-public:
-	SimpleLRU(size_t initialSize)
-		: m_capacity(initialSize)
+	void Load(const std::wstring& path)
 	{
-		m_nodes.reserve(initialSize);
+		// a file loaded again is still hot, keep it in shared memory
+		Offer(path);
+		std::error_code ec;
+		auto size = std::filesystem::file_size(path, ec);
+		if (ec)
+			return;
+		m_lru.Access(path, size, [](const std::wstring& fontPath)
+		{
+			AddFontResourceExW(fontPath.c_str(), FR_PRIVATE | FR_NOT_ENUM, nullptr);
+		});
 	}
 
-	bool Put(T&& value)
+	void SetBudget(uint64_t budget)
 	{
-		std::lock_guard lg(m_lock);
-		auto findResult = m_hashmap.find(value);
-		if (m_hashmap.end() == findResult)
-		{
-			// not found
-			if (m_nodes.size() == m_capacity)
-			{
-				// full
-				auto lastNode = m_end.m_prev;
-				m_hashmap.erase(lastNode->m_data);
-				m_hashmap.insert({value, lastNode});
-				lastNode->m_data = std::move(value);
-				AdjustToHead(*lastNode, true);
-			}
-			else
-			{
-				m_nodes.emplace_back();
-				auto node = &m_nodes.back();
-				m_hashmap.insert({value, node});
-				node->m_data = std::move(value);
-				AdjustToHead(*node, false);
-			}
-			return true;
-		}
-		else
-		{
-			AdjustToHead(*findResult->second, true);
-			return false;
-		}
+		m_lru.SetBudget(budget);
 	}
 
-	bool Put(const T& value)
+private:
+	void Offer(const std::wstring& path)
 	{
-		T v = value;
-		return Put(std::move(v));
+		m_blobCache->Admit(path);
+		if (IsOnSlowVolume(path))
+			m_localCache->Admit(path);
 	}
 
-	std::vector<T> GetVector()
+	// gets a file a client will likely ask for soon ready without registering it
+	void Warm(const std::wstring& path)
 	{
-		std::lock_guard lg(m_lock);
-		std::vector<T> ret;
-		for (Node* node = m_head; node != &m_end; node = node->m_next)
+		Offer(path);
+		// the client is handed the local copy if there is one
+		auto readPath = m_localCache->Find(path).value_or(path);
 		{
-			ret.emplace_back(node->m_data);
+			std::lock_guard lg(m_warmLock);
+			if (m_warmQueue.size() == MAX_WARM_QUEUE
+				|| std::find(m_warmQueue.begin(), m_warmQueue.end(), readPath) != m_warmQueue.end())
+				return;
+			m_warmQueue.push_back(std::move(readPath));
 		}
-		return ret;
+		m_warmCV.notify_one();
 	}
-};
-
-class sfh::Prefetch::Implementation : public sfh::IRpcFeedbackHandler
-{
-	IDaemon* m_daemon;
-	SimpleLRU<std::wstring> m_lru;
 
-	std::wstring m_cachePath;
+	void WarmMain()
+	{
+		std::vector<char> buffer(WARM_CHUNK_SIZE);
+		std::unique_lock ul(m_warmLock);
+		for (;;)
+		{
+			m_warmCV.wait(ul, [&]() { return m_exit || !m_warmQueue.empty(); });
+			if (m_exit)
+				return;
+			auto path = std::move(m_warmQueue.front());
+			m_warmQueue.pop_front();
+			ul.unlock();
+			wil::unique_hfile file(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+			                                   nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+			DWORD readBytes = 0;
+			while (file.is_valid() && !m_exit
+				&& ReadFile(file.get(), buffer.data(), WARM_CHUNK_SIZE, &readBytes, nullptr) != FALSE
+				&& readBytes != 0)
+			{
+			}
+			ul.lock();
+		}
+	}
 
-public:
-	Implementation(IDaemon* daemon, size_t prefetchCount, const std::wstring& lruPath)
-		: m_lru(prefetchCount), m_cachePath(lruPath)
+	// loads a history entry behind the fonts already kept, returns the bytes loaded
+	uint64_t Restore(const std::wstring& path)
 	{
-		LoadLruCache(m_cachePath);
+		Offer(path);
+		std::error_code ec;
+		auto size = std::filesystem::file_size(path, ec);
+		if (ec)
+			return 0;
+		bool loaded = m_lru.Restore(path, size, [](const std::wstring& fontPath)
+		{
+			return AddFontResourceExW(fontPath.c_str(), FR_PRIVATE | FR_NOT_ENUM, nullptr) != 0;
+		});
+		return loaded ? size : 0;
 	}
 
-	~Implementation()
+	void WarmUpMain()
 	{
-		SaveLruCache(m_cachePath);
+		// lowers cpu, i/o and memory priority, clients and whatever else runs after login go first
+		SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+		auto start = std::chrono::steady_clock::now();
+		uint64_t loadedBytes = 0;
+		for (auto& path : m_warmUpPaths)
+		{
+			loadedBytes += Restore(path);
+			m_daemon->NotifyWarmUpProgress(++m_warmUpNext, m_warmUpPaths.size());
+			auto next = start;
+			if (m_warmUpBandwidth != 0)
+				next += std::chrono::milliseconds(loadedBytes * 1000 / m_warmUpBandwidth);
+			std::unique_lock ul(m_warmLock);
+			if (m_warmCV.wait_until(ul, next, [&]() { return m_exit.load(); }))
+				return;
+		}
 	}
 
-	void Load(const std::wstring& path)
+	bool IsOnSlowVolume(const std::wstring& path)
 	{
-		if (m_lru.Put(path))
+		wchar_t mountPoint[MAX_PATH];
+		wchar_t volumeName[MAX_PATH];
+		if (GetVolumePathNameW(path.c_str(), mountPoint, MAX_PATH) == FALSE
+			|| GetVolumeNameForVolumeMountPointW(mountPoint, volumeName, MAX_PATH) == FALSE)
 		{
-			AddFontResourceExW(path.c_str(), FR_PRIVATE | FR_NOT_ENUM, nullptr);
+			// network shares have no volume name, their mount point tells
+			return GetVolumePathNameW(path.c_str(), mountPoint, MAX_PATH) != FALSE
+				&& GetDriveTypeW(mountPoint) == DRIVE_REMOTE;
 		}
+		std::lock_guard lg(m_volumeLock);
+		auto iter = m_slowVolumes.find(volumeName);
+		if (iter == m_slowVolumes.end())
+			iter = m_slowVolumes.emplace(volumeName, IsSlowVolume(volumeName)).first;
+		return iter->second;
 	}
 
-private:
-	void LoadLruCache(const std::filesystem::path& path)
+	// the history, most valuable first
+	static std::vector<std::wstring> LoadLruCache(const std::filesystem::path& path)
 	{
+		std::vector<std::wstring> ret;
 		std::ifstream input(path);
 		if (!input.is_open())
-			return;
+			return ret;
 		std::string line;
 		while (!input.eof())
 		{
 			std::getline(input, line);
 			if (line.empty())
 				continue;
-			auto wideLine = Utf8ToWideString(line);
-			Load(wideLine);
+			ret.push_back(Utf8ToWideString(line));
 		}
+		std::reverse(ret.begin(), ret.end());
+		return ret;
 	}
 
 	void SaveLruCache(const std::filesystem::path& path)
@@ -172,7 +253,14 @@ private:
 		std::ofstream output(path, std::ios::out);
 		if (!output.is_open())
 			return;
-		auto snapshot = m_lru.GetVector();
+		auto snapshot = m_lru.GetVector(m_prefetchCount);
+		// a warm-up cut short by exit keeps the rest of the history
+		for (size_t i = m_warmUpNext; i < m_warmUpPaths.size() && snapshot.size() < m_prefetchCount; ++i)
+		{
+			if (std::find(snapshot.begin(), snapshot.end(), m_warmUpPaths[i]) == snapshot.end())
+				snapshot.push_back(m_warmUpPaths[i]);
+		}
+		// most valuable last as the history always was
 		for (auto iter = snapshot.rbegin(); iter != snapshot.rend(); ++iter)
 		{
 			auto line = WideToUtf8String(*iter);
@@ -180,14 +268,88 @@ private:
 		}
 	}
 
+	static bool ParseCount(std::string_view str, uint32_t& count)
+	{
+		auto result = std::from_chars(str.data(), str.data() + str.size(), count);
+		return result.ec == std::errc() && result.ptr == str.data() + str.size();
+	}
+
+	// a line of sessions and path per font, each followed by lines of a tab, count and path
+	// per companion
+	void LoadModel(const std::filesystem::path& path)
+	{
+		std::ifstream input(path);
+		if (!input.is_open())
+			return;
+		std::wstring key;
+		uint32_t sessions = 0;
+		CooccurrenceModel<std::wstring>::Companions companions;
+		auto flush = [&]()
+		{
+			if (!key.empty())
+				m_model.Restore(key, sessions, std::move(companions));
+			key.clear();
+			companions.clear();
+		};
+		std::string line;
+		while (std::getline(input, line))
+		{
+			bool isCompanion = !line.empty() && line.front() == '\t';
+			std::string_view rest(line);
+			if (isCompanion)
+				rest.remove_prefix(1);
+			auto tab = rest.find('\t');
+			uint32_t count;
+			if (tab == std::string_view::npos || !ParseCount(rest.substr(0, tab), count))
+			{
+				// companions of a broken line have nobody to go to
+				if (!isCompanion)
+					flush();
+				continue;
+			}
+			auto name = Utf8ToWideString(std::string(rest.substr(tab + 1)));
+			if (isCompanion)
+			{
+				if (!key.empty())
+					companions.emplace_back(std::move(name), count);
+				continue;
+			}
+			flush();
+			key = std::move(name);
+			sessions = count;
+		}
+		flush();
+	}
+
+	void SaveModel(const std::filesystem::path& path)
+	{
+		std::ofstream output(path, std::ios::out);
+		if (!output.is_open())
+			return;
+		m_model.Visit([&](const std::wstring& key, uint32_t sessions,
+		                  const CooccurrenceModel<std::wstring>::Companions& companions)
+		{
+			output << sessions << '\t' << WideToUtf8String(key) << '\n';
+			for (auto& [companion, count] : companions)
+				output << '\t' << count << '\t' << WideToUtf8String(companion) << '\n';
+		});
+	}
+
 public:
-	void HandleFeedback(const FontQueryRequest& request) override
+	void HandleFeedback(const FontQueryRequest& request, uint32_t clientProcessId) override
 	{
 		const auto& data = request.feedbackdata();
 		for (const auto& item : data.path())
 		{
-			auto path = Utf8ToWideString(item);
+			// clients report the local copy they were given
+			auto path = m_localCache->GetOrigin(Utf8ToWideString(item));
+			// the copy just loaded may be stale, the worker checks it off this thread
+			m_localCache->Recheck(path);
 			Load(path);
+			if (clientProcessId == 0)
+				continue;
+			for (auto& companion : m_model.Record(clientProcessId, path))
+				Warm(companion);
 		}
 	}
 
@@ -197,13 +359,21 @@ public:
 	}
 };
 
-sfh::Prefetch::Prefetch(IDaemon* daemon, size_t prefetchCount, const std::wstring& lruPath)
-	: m_impl(std::make_unique<Implementation>(daemon, prefetchCount, lruPath))
+sfh::Prefetch::Prefetch(IDaemon* daemon, size_t prefetchCount, uint64_t prefetchBudget, uint64_t warmUpBandwidth,
+                        const std::wstring& lruPath, const std::wstring& modelPath, FontBlobCache* blobCache,
+                        LocalFontCache* localCache)
+	: m_impl(std::make_unique<Implementation>(daemon, prefetchCount, prefetchBudget, warmUpBandwidth, lruPath,
+	                                          modelPath, blobCache, localCache))
 {
 }
 
 sfh::Prefetch::~Prefetch() = default;
 
+void sfh::Prefetch::SetBudget(uint64_t budget)
+{
+	m_impl->SetBudget(budget);
+}
+
 sfh::IRpcFeedbackHandler* sfh::Prefetch::GetRpcFeedbackHandler()
 {
 	return m_impl->GetRpcFeedbackHandler();
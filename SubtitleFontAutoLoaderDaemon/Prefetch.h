@@ -3,6 +3,8 @@
 #include "IDaemon.h"
 #include "PersistantData.h"
 #include "RpcServer.h"
+#include "FontBlobCache.h"
+#include "LocalFontCache.h"
 
 namespace sfh
 {
@@ -12,7 +14,14 @@ namespace sfh
 		class Implementation;
 		std::unique_ptr<Implementation> m_impl;
 	public:
-		Prefetch(IDaemon* daemon, size_t prefetchCount, const std::wstring& lruPath);
+		// keeps files clients load registered within prefetchBudget bytes, the prefetchCount most
+		// valuable are loaded again on the next start, in the background at warmUpBandwidth bytes
+		// per second. files are also offered to blobCache and, if they live on a slow volume,
+		// localCache. fonts loaded together by a client are learned and saved to modelPath,
+		// their companions are read ahead when one shows up
+		Prefetch(IDaemon* daemon, size_t prefetchCount, uint64_t prefetchBudget, uint64_t warmUpBandwidth,
+		         const std::wstring& lruPath, const std::wstring& modelPath, FontBlobCache* blobCache,
+		         LocalFontCache* localCache);
 		~Prefetch();
 
 		Prefetch(const Prefetch&) = delete;
@@ -21,7 +30,9 @@ namespace sfh
 		Prefetch& operator=(const Prefetch&) = delete;
 		Prefetch& operator=(Prefetch&&) = delete;
 
+		void SetBudget(uint64_t budget);
+
 		IRpcFeedbackHandler* GetRpcFeedbackHandler();
-		
+
 	};
 }
@@ -3,420 +3,616 @@
 #include "Common.h"
 #include "QueryService.h"
 #include "RpcServer.h"
+#include "NameIndex.h"
 #include "EventLog.h"
+#include "InvalidationRing.h"
+#include "InstalledFonts.h"
 
 #include <wil/resource.h>
 #include <wil/win32_helpers.h>
 
+#include <array>
+#include <atomic>
+#include <numeric>
+#include <set>
+#include <tuple>
+#include <unordered_set>
+
 namespace
 {
-	template <typename T, bool AllowDuplicate = true>
-	class QueryTrie
+	// GDI LOGFONT::lfFaceName holds at most 31 wchar_t
+	constexpr size_t TRUNCATED_NAME_LENGTH = LF_FACESIZE - 1;
+
+	using NameElement = sfh::FontDatabase::FontFaceElement::NameElement;
+
+	// faces a namespace accepts when collecting results
+	enum class OutlineFilter
 	{
-	private:
-		struct TrieNode
-		{
-			std::vector<std::pair<std::wstring, std::unique_ptr<TrieNode>>> m_branch;
-			std::vector<T*> m_data;
+		Any,
+		PostScriptOnly,
+		NonPostScriptOnly
+	};
 
-			void CollectData(std::vector<T*>& ret)
-			{
-				ret.insert(ret.end(), m_data.begin(), m_data.end());
-				for (auto& branch : m_branch)
-				{
-					branch.second->CollectData(ret);
-				}
-			}
+	struct NameNamespace
+	{
+		NameElement::NameType m_type;
+		bool m_allowDuplicate;
+		OutlineFilter m_filter;
+	};
 
-			void SortList()
-			{
-				std::sort(m_branch.begin(), m_branch.end());
-			}
+	// name types taking part in lookups, in the order they are consulted
+	constexpr NameNamespace NAMESPACES[] = {
+		{NameElement::Win32FamilyName, true, OutlineFilter::Any},
+		// GDI matches PostScript names of CFF fonts and full names of the others
+		{NameElement::PostScriptName, false, OutlineFilter::PostScriptOnly},
+		{NameElement::FullName, false, OutlineFilter::NonPostScriptOnly}
+	};
+	constexpr uint32_t NAMESPACE_COUNT = static_cast<uint32_t>(std::extent_v<decltype(NAMESPACES)>);
+	// a family match shadows all other namespaces
+	constexpr uint32_t FAMILY_NAMESPACE = 0;
+	constexpr uint32_t NOT_INDEXED = std::numeric_limits<uint32_t>::max();
 
-			std::pair<std::wstring, std::unique_ptr<TrieNode>>* SearchPrefix(wchar_t leading)
-			{
-				auto left = m_branch.begin();
-				auto right = m_branch.end();
-				auto mid = left + (right - left) / 2;
-				auto result = right;
-				while (left != right)
-				{
-					assert(!mid->first.empty());
-					if (mid->first[0] == leading)
-					{
-						result = mid;
-						break;
-					}
-					else if (mid->first[0] > leading)
-					{
-						right = mid;
-					}
-					else
-					{
-						left = mid + 1;
-					}
-					mid = left + (right - left) / 2;
-				}
-				if (result == m_branch.end())
-					return nullptr;
-				return &(*result);
-			}
-		};
+	constexpr auto NAMESPACE_OF_TYPE = []()
+	{
+		std::array<uint32_t, std::extent_v<decltype(NameElement::TYPEMAP)>> ret{};
+		ret.fill(NOT_INDEXED);
+		for (uint32_t i = 0; i < NAMESPACE_COUNT; ++i)
+			ret[NAMESPACES[i].m_type] = i;
+		return ret;
+	}();
 
-		TrieNode m_rootNode;
-	public:
-		void AddEntry(const wchar_t* key, T* value)
+	constexpr uint64_t DUPLICATE_MASK = []()
+	{
+		uint64_t ret = 0;
+		for (uint32_t i = 0; i < NAMESPACE_COUNT; ++i)
 		{
-			if (*key == 0)
-			{
-				// empty key is not allowed
-				return;
-			}
-			const wchar_t* keyPointer = key;
-			TrieNode* node = &m_rootNode;
-			// find an arc in list with common prefix of key
-			// just search first character
-			while (node)
-			{
-				assert(*keyPointer != 0);
-				auto result = node->SearchPrefix(*keyPointer);
-				if (result == nullptr)
-				{
-					// not found in current list
-					// create new node in list
-					auto newNode = std::make_unique<TrieNode>();
-					newNode->m_data.push_back(value);
-					node->m_branch.emplace_back(keyPointer, std::move(newNode));
-					node->SortList();
-					return;
-				}
-				else
-				{
-					// found an arc with common prefix
-					// advance keyPointer
-					auto arcPointer = result->first.c_str();
-					while (*keyPointer && *arcPointer && *keyPointer == *arcPointer)
-					{
-						++arcPointer;
-						++keyPointer;
-					}
-					if (*arcPointer == 0 && *keyPointer == 0)
-					{
-						// duplicate entry
-						if constexpr (AllowDuplicate)
-						{
-							// append entry
-							result->second->m_data.push_back(value);
-						}
-						return;
-					}
-					else if (*arcPointer == 0)
-					{
-						// found key is a prefix of new key
-						node = result->second.get();
-					}
-					else if (*keyPointer == 0)
-					{
-						// new key is a prefix of found key
-						// split arc
-						auto keyLength = arcPointer - result->first.c_str();
-						auto newNode = std::make_unique<TrieNode>();
-						newNode->m_data.push_back(value);
-						newNode->m_branch.emplace_back(arcPointer, std::move(result->second));
-						result->first.resize(keyLength);
-						result->second = std::move(newNode);
-						node->SortList();
-						return;
-					}
-					else
-					{
-						// found key and new key has common part but not equal
-						// split arc
-						auto keyLength = arcPointer - result->first.c_str();
-						auto intermediateNode = std::make_unique<TrieNode>();
-						auto newNode = std::make_unique<TrieNode>();
-						newNode->m_data.push_back(value);
-						intermediateNode->m_branch.emplace_back(arcPointer, std::move(result->second));
-						intermediateNode->m_branch.emplace_back(keyPointer, std::move(newNode));
-						intermediateNode->SortList();
-						result->first.resize(keyLength);
-						result->second = std::move(intermediateNode);
-						node->SortList();
-						return;
-					}
-				}
-			}
+			if (NAMESPACES[i].m_allowDuplicate)
+				ret |= 1ull << i;
 		}
+		return ret;
+	}();
 
-		std::vector<T*> QueryEntry(const wchar_t* key, bool truncated)
+	static_assert(NAMESPACES[FAMILY_NAMESPACE].m_type == NameElement::Win32FamilyName);
+
+	bool IsAccepted(OutlineFilter filter, const sfh::FontDatabase::FontFaceElement& face)
+	{
+		switch (filter)
 		{
-			if (*key == 0)
-			{
-				// empty key is not allowed
-				return {};
-			}
-			std::vector<T*> ret;
-			const wchar_t* keyPointer = key;
-			TrieNode* node = &m_rootNode;
-			// find an arc in list with common prefix of key
-			// just search first character
-			while (node)
-			{
-				assert(*keyPointer != 0);
-				auto result = node->SearchPrefix(*keyPointer);
-				if (result == nullptr)
-				{
-					// not found
-					return ret;
-				}
-				else
-				{
-					auto arcPointer = result->first.c_str();
-					while (*keyPointer && *arcPointer && *keyPointer == *arcPointer)
-					{
-						++arcPointer;
-						++keyPointer;
-					}
-					if (*arcPointer == 0 && *keyPointer == 0)
-					{
-						// exact match
-						if (truncated)
-						{
-							result->second->CollectData(ret);
-						}
-						else
-						{
-							ret.insert(ret.end(), result->second->m_data.begin(), result->second->m_data.end());
-						}
-						return ret;
-					}
-					else if (*arcPointer == 0)
-					{
-						// found key is a prefix of new key
-						node = result->second.get();
-					}
-					else if (*keyPointer == 0)
-					{
-						// not found, we ran out of key
-						if (truncated)
-						{
-							result->second->CollectData(ret);
-						}
-						return ret;
-					}
-					else
-					{
-						// not found
-						return ret;
-					}
-				}
-			}
-			return ret;
+		case OutlineFilter::PostScriptOnly:
+			return face.m_psOutline == 1;
+		case OutlineFilter::NonPostScriptOnly:
+			return face.m_psOutline != 1;
+		default:
+			return true;
 		}
+	}
+
+	// one index file with name indexes over its own faces, face ids in the indexes are
+	// local and offset by m_firstFaceId when the segment joins the service
+	struct IndexSegment
+	{
+		// position of the index file in the config, earlier files win duplicate names
+		size_t m_order;
+		std::unique_ptr<sfh::FontDatabase> m_db;
+		sfh::NameIndex m_nameIndex;
+		// keyed by the first 31 units of names at least that long
+		sfh::NameIndex m_truncatedNameIndex;
+		uint32_t m_firstFaceId = 0;
+	};
+
+	// what queries are answered from, never modified once published
+	struct IndexSnapshot
+	{
+		// sorted by m_order
+		std::vector<std::shared_ptr<const IndexSegment>> m_segments;
+		// indexed by face id
+		std::vector<const sfh::FontDatabase::FontFaceElement*> m_faces;
+		// string pool of the database owning each face
+		std::vector<const sfh::StringPool*> m_faceStrings;
+		// faces listed by several index files share the id of their first occurrence
+		std::vector<uint32_t> m_canonicalIds;
+		// taken away by a delta, their segment still holds them
+		std::vector<bool> m_removed;
+	};
 
-		void Dump(std::wostream& stream)
+	// per thread scratch space, assembling a response reuses it instead of allocating
+	struct QueryScratch
+	{
+		// probe result of each segment
+		std::vector<sfh::NameIndex::Match> m_matches;
+		std::vector<uint32_t> m_candidates;
+		std::vector<uint32_t> m_penalties;
+		// m_seen[id] == m_epoch marks a face already collected by the current query
+		std::vector<uint32_t> m_seen;
+		uint32_t m_epoch = 0;
+
+		void BeginQuery(size_t faceCount)
 		{
-			struct Hierarchy
-			{
-				const TrieNode* node;
-				size_t nextArc = 0;
-			};
-			std::vector<Hierarchy> iterateStack;
-			iterateStack.emplace_back(&m_rootNode, 0);
-			std::wstring prefix;
-			if (!m_rootNode.m_branch.empty() || !m_rootNode.m_data.empty())
-				stream << L"\"\"\n";
-			while (!iterateStack.empty())
+			m_candidates.clear();
+			if (m_seen.size() < faceCount)
+				m_seen.resize(faceCount, 0);
+			if (++m_epoch == 0)
 			{
-				auto& top = iterateStack.back();
-				if (top.nextArc == 0)
-				{
-					// first reach
-					for (size_t i = 0; i < top.node->m_data.size(); ++i)
-					{
-						wchar_t head = (i == top.node->m_data.size() - 1 && top.node->m_branch.empty()) ? L'└' : L'├';
-						stream << prefix << head << L" [" << top.node->m_data[i]->m_path << L"]\n";
-					}
-				}
-				if (top.nextArc == top.node->m_branch.size())
-				{
-					iterateStack.pop_back();
-					prefix.resize(prefix.size() >= 5 ? prefix.size() - 5 : 0);
-					continue;
-				}
-				wchar_t head = top.nextArc == top.node->m_branch.size() - 1 ? L'└' : L'├';
-				stream << prefix << head << L"── \"" << top.node->m_branch[top.nextArc].first << L"\"\n";
-				if (head == L'└')
-					prefix += L"     ";
-				else
-					prefix += L"│    ";
-				auto child = top.node->m_branch[top.nextArc].second.get();
-				++top.nextArc;
-				if (child)
-				{
-					iterateStack.emplace_back(child, 0);
-				}
+				std::fill(m_seen.begin(), m_seen.end(), 0);
+				m_epoch = 1;
 			}
 		}
 
-		void DumpToFile(const std::wstring& path)
+		bool MarkSeen(uint32_t id)
 		{
-			std::wostringstream oss;
-			Dump(oss);
-			sfh::SetFileContent(path, sfh::WideToUtf8String(oss.str()));
+			if (m_seen[id] == m_epoch)
+				return false;
+			m_seen[id] = m_epoch;
+			return true;
 		}
 	};
+
+	void DumpNameIndex(const std::filesystem::path& path, const sfh::NameIndex& index)
+	{
+		std::string buffer;
+		index.Serialize(buffer);
+		sfh::SetFileContent(path, buffer);
+	}
+
+	// OS/2 ulCodePageRange1 bit of a LOGFONT charset, -1 if it doesn't constrain the face
+	int CharsetToCodePageBit(uint32_t charset)
+	{
+		switch (charset)
+		{
+		case ANSI_CHARSET: return 0;
+		case EASTEUROPE_CHARSET: return 1;
+		case RUSSIAN_CHARSET: return 2;
+		case GREEK_CHARSET: return 3;
+		case TURKISH_CHARSET: return 4;
+		case HEBREW_CHARSET: return 5;
+		case ARABIC_CHARSET: return 6;
+		case BALTIC_CHARSET: return 7;
+		case VIETNAMESE_CHARSET: return 8;
+		case THAI_CHARSET: return 16;
+		case SHIFTJIS_CHARSET: return 17;
+		case GB2312_CHARSET: return 18;
+		case HANGUL_CHARSET: return 19;
+		case CHINESEBIG5_CHARSET: return 20;
+		case JOHAB_CHARSET: return 21;
+		case SYMBOL_CHARSET: return 31;
+		default: return -1;
+		}
+	}
+
+	// penalties follow the GDI font mapper, a charset mismatch outweighs everything else
+	uint32_t CalculateMatchPenalty(const sfh::FontDatabase::FontFaceElement& face, const sfh::FontStyle& style)
+	{
+		constexpr uint32_t CHARSET_PENALTY = 65000;
+		constexpr uint32_t ITALIC_PENALTY = 4;
+		constexpr uint32_t WEIGHT_PENALTY = 3;
+
+		uint32_t penalty = 0;
+		int codePageBit = CharsetToCodePageBit(style.charset());
+		// faces without code page info (OS/2 version 0) are never rejected
+		if (codePageBit >= 0 && face.m_codePageRange1 != 0 && !(face.m_codePageRange1 & 1u << codePageBit))
+			penalty += CHARSET_PENALTY;
+		if (!!face.m_oblique != style.italic())
+			penalty += ITALIC_PENALTY;
+		int weight = style.weight() == FW_DONTCARE ? FW_NORMAL : static_cast<int>(style.weight());
+		penalty += std::abs(static_cast<int>(face.m_weight) - weight) / 10 * WEIGHT_PENALTY;
+		return penalty;
+	}
 }
 
 class sfh::QueryService::Implementation : public sfh::IRpcRequestHandler
 {
 private:
+	// guards m_snapshot and m_installedFonts only, queries copy the pointers and run unlocked
 	std::mutex m_accessLock;
-
-	QueryTrie<FontDatabase::FontFaceElement, false> m_fullName;
-	QueryTrie<FontDatabase::FontFaceElement, false> m_postScriptName;
-	QueryTrie<FontDatabase::FontFaceElement, true> m_win32FamilyName;
-	std::vector<std::unique_ptr<FontDatabase>> m_dbs;
+	std::shared_ptr<const IndexSnapshot> m_snapshot = std::make_shared<IndexSnapshot>();
+	std::shared_ptr<const InstalledFontSet> m_installedFonts = std::make_shared<InstalledFontSet>();
+	// serializes segments joining and reloads, queries keep running meanwhile
+	std::mutex m_attachLock;
+	// built by a reload while m_snapshot keeps serving, published on completion
+	std::shared_ptr<const IndexSnapshot> m_staging;
 
 	IDaemon* m_daemon;
+	std::atomic<ConfigFile::MatchPolicy> m_matchPolicy;
+	FontBlobCache* m_blobCache;
+	LocalFontCache* m_localCache;
 
-	wil::unique_handle m_version;
-	wil::unique_mapview_ptr<uint32_t> m_versionMem;
+	// names changed by each version, written under m_attachLock so it has a single writer
+	InvalidationRing m_ring;
 public:
-	Implementation(IDaemon* daemon)
-		: m_daemon(daemon)
-	{
-		std::wstring versionShmName = L"SubtitleFontAutoLoaderSHM-";
-		versionShmName += GetCurrentProcessUserSid();
-		m_version.reset(CreateFileMappingW(
-			INVALID_HANDLE_VALUE,
-			nullptr,
-			PAGE_READWRITE,
-			0, 4,
-			versionShmName.c_str()));
-		THROW_LAST_ERROR_IF(!m_version.is_valid());
-		m_versionMem.reset(static_cast<uint32_t*>(MapViewOfFile(
-			m_version.get(),
-			FILE_MAP_WRITE,
-			0, 0,
-			sizeof(uint32_t))));
-		THROW_LAST_ERROR_IF(m_versionMem.get() == nullptr);
+	Implementation(IDaemon* daemon, ConfigFile::MatchPolicy matchPolicy, FontBlobCache* blobCache,
+	               LocalFontCache* localCache)
+		: m_daemon(daemon), m_matchPolicy(matchPolicy), m_blobCache(blobCache), m_localCache(localCache),
+		  m_ring(L"SubtitleFontAutoLoaderSHM-" + GetCurrentProcessUserSid(), true)
+	{
 	}
 
 	void UpdateVerison()
 	{
-		auto newValue = InterlockedIncrement(m_versionMem.get());
+		auto newValue = m_ring.BumpVersion();
 		EventLog::GetInstance().LogDaemonBumpVersion(newValue - 1, newValue);
 	}
 
-	void Load(std::vector<std::unique_ptr<FontDatabase>>&& dbs)
+	static std::unique_ptr<IndexSegment> BuildSegment(size_t order, std::unique_ptr<FontDatabase>&& db)
 	{
-		QueryTrie<FontDatabase::FontFaceElement, true> win32FamilyName;
-		QueryTrie<FontDatabase::FontFaceElement, false> fullName;
-		QueryTrie<FontDatabase::FontFaceElement, false> postScriptName;
-		for (auto& db : dbs)
+		NameIndex::Builder nameIndexBuilder(NAMESPACE_COUNT, DUPLICATE_MASK);
+		NameIndex::Builder truncatedNameIndexBuilder(NAMESPACE_COUNT, std::numeric_limits<uint64_t>::max());
+		for (uint32_t faceId = 0; faceId < db->m_fonts.size(); ++faceId)
 		{
-			for (auto& font : db->m_fonts)
+			for (auto& name : db->m_fonts[faceId].m_names)
 			{
-				for (auto& name : font.m_names)
+				uint32_t ns = NAMESPACE_OF_TYPE[name.m_type];
+				if (ns == NOT_INDEXED)
+					continue;
+				auto string = db->GetString(name.m_name);
+				// a distinct name dropped as duplicate doesn't show up truncated either
+				if (nameIndexBuilder.Add(string, ns, faceId) && string.size() >= TRUNCATED_NAME_LENGTH)
 				{
-					if (name.m_type == name.Win32FamilyName)
-					{
-						win32FamilyName.AddEntry(name.m_name.c_str(), &font);
-					}
-					else if (name.m_type == name.FullName)
-					{
-						fullName.AddEntry(name.m_name.c_str(), &font);
-					}
-					else if (name.m_type == name.PostScriptName)
-					{
-						postScriptName.AddEntry(name.m_name.c_str(), &font);
-					}
+					truncatedNameIndexBuilder.Add(string.substr(0, TRUNCATED_NAME_LENGTH), ns, faceId);
 				}
 			}
 		}
 
+		auto segment = std::make_unique<IndexSegment>();
+		segment->m_order = order;
+		segment->m_db = std::move(db);
+		segment->m_nameIndex = nameIndexBuilder.Build();
+		segment->m_truncatedNameIndex = truncatedNameIndexBuilder.Build();
+
 		if (g_debugOutputEnabled)
 		{
 			std::filesystem::path exePath{wil::GetModuleFileNameW<wil::unique_process_heap_string>().get()};
 			exePath.remove_filename();
-			win32FamilyName.DumpToFile(exePath / L"win32FamilyName.trie.txt");
-			fullName.DumpToFile(exePath / L"fullName.trie.txt");
-			postScriptName.DumpToFile(exePath / L"postScriptName.trie.txt");
+			auto suffix = std::to_wstring(order) + L".index";
+			DumpNameIndex(exePath / (L"name." + suffix), segment->m_nameIndex);
+			DumpNameIndex(exePath / (L"truncatedName." + suffix), segment->m_truncatedNameIndex);
 		}
+		return segment;
+	}
 
-		std::lock_guard lg(m_accessLock);
-		m_dbs = std::move(dbs);
-		m_win32FamilyName = std::move(win32FamilyName);
-		m_fullName = std::move(fullName);
-		m_postScriptName = std::move(postScriptName);
+	// face ids are positions in the snapshot, keys compare the strings since pools are per database
+	static auto GetFaceKey(const IndexSnapshot& snapshot, uint32_t id)
+	{
+		auto& strings = *snapshot.m_faceStrings[id];
+		auto& face = *snapshot.m_faces[id];
+		return std::make_tuple(strings.Get(face.m_directory), strings.Get(face.m_fileName), face.m_index);
+	}
+
+	static void UpdateCanonicalIds(IndexSnapshot& snapshot)
+	{
+		std::vector<uint32_t> sorted(snapshot.m_faces.size());
+		std::iota(sorted.begin(), sorted.end(), 0);
+		// a face still present heads its group even if a removed copy comes first
+		std::sort(sorted.begin(), sorted.end(), [&](uint32_t lhs, uint32_t rhs)
+		{
+			auto lhsKey = GetFaceKey(snapshot, lhs), rhsKey = GetFaceKey(snapshot, rhs);
+			if (lhsKey != rhsKey)
+				return lhsKey < rhsKey;
+			if (snapshot.m_removed[lhs] != snapshot.m_removed[rhs])
+				return snapshot.m_removed[rhs];
+			return lhs < rhs;
+		});
+		auto& canonicalIds = snapshot.m_canonicalIds;
+		canonicalIds.resize(snapshot.m_faces.size());
+		for (size_t i = 0; i < sorted.size(); ++i)
+		{
+			bool sameFace = i != 0 && GetFaceKey(snapshot, sorted[i]) == GetFaceKey(snapshot, sorted[i - 1]);
+			canonicalIds[sorted[i]] = sameFace ? canonicalIds[sorted[i - 1]] : sorted[i];
+		}
+	}
+
+	static void AppendSegment(IndexSnapshot& snapshot, std::unique_ptr<IndexSegment>&& segment)
+	{
+		segment->m_firstFaceId = static_cast<uint32_t>(snapshot.m_faces.size());
+		for (auto& font : segment->m_db->m_fonts)
+		{
+			snapshot.m_faces.push_back(&font);
+			snapshot.m_faceStrings.push_back(&segment->m_db->m_strings);
+		}
+		snapshot.m_removed.resize(snapshot.m_faces.size(), false);
+
+		auto& segments = snapshot.m_segments;
+		auto position = std::upper_bound(segments.begin(), segments.end(), segment->m_order,
+		                                 [](size_t value, auto& item) { return value < item->m_order; });
+		segments.insert(position, std::move(segment));
+	}
+
+	// the snapshot the next change builds on, only valid while holding m_attachLock
+	std::shared_ptr<IndexSnapshot> CopyCurrentSnapshot()
+	{
+		// snapshots only change while holding m_attachLock, reading without m_accessLock is safe
+		return std::make_shared<IndexSnapshot>(m_staging ? *m_staging : *m_snapshot);
+	}
+
+	// changedNames lists the normalized names whose results differ, nullptr if it could be any
+	void Publish(std::shared_ptr<const IndexSnapshot>&& next, const std::unordered_set<std::wstring>* changedNames)
+	{
+		if (m_staging)
+		{
+			// the reload flushes everything once it completes
+			m_staging = std::move(next);
+			return;
+		}
+		{
+			std::lock_guard lg(m_accessLock);
+			m_snapshot = std::move(next);
+		}
+		// queries already see the new snapshot when clients learn what to evict
+		uint32_t version = m_ring.GetVersion() + 1;
+		if (changedNames)
+		{
+			for (auto& name : *changedNames)
+				m_ring.Append(version, name);
+		}
+		else
+		{
+			m_ring.AppendFlush(version);
+		}
 		UpdateVerison();
 	}
 
-	static void AppendFontFace(FontQueryResponse& response, const std::vector<FontDatabase::FontFaceElement*>& faces,
-	                           std::vector<std::pair<const wchar_t*, uint32_t>>& dedup)
+	static void CollectChangedNames(const FontDatabase::FontFaceElement& face, const StringPool& strings,
+	                                std::unordered_set<std::wstring>& changedNames)
+	{
+		std::wstring normalized;
+		for (auto& name : face.m_names)
+		{
+			if (NAMESPACE_OF_TYPE[name.m_type] == NOT_INDEXED)
+				continue;
+			NormalizeName(strings.Get(name.m_name), normalized);
+			// clients cache truncated queries under the truncated name
+			if (normalized.size() > TRUNCATED_NAME_LENGTH)
+				changedNames.emplace(normalized, 0, TRUNCATED_NAME_LENGTH);
+			changedNames.emplace(std::move(normalized));
+		}
+	}
+
+	void AddDatabase(size_t order, std::unique_ptr<FontDatabase>&& db)
+	{
+		// the expensive part runs on the caller's thread, several files build at once
+		auto segment = BuildSegment(order, std::move(db));
+
+		std::lock_guard attachLock(m_attachLock);
+		auto next = CopyCurrentSnapshot();
+		AppendSegment(*next, std::move(segment));
+		UpdateCanonicalIds(*next);
+		// clients drop what they cached from the smaller index
+		Publish(std::move(next), nullptr);
+	}
+
+	void ApplyDelta(size_t order, std::unique_ptr<FontDatabase>&& delta)
+	{
+		std::unordered_set<std::wstring> changedNames;
+		for (auto& face : delta->m_fonts)
+			CollectChangedNames(face, delta->m_strings, changedNames);
+		std::set<std::tuple<std::wstring_view, std::wstring_view, uint32_t>> removedKeys;
+		for (auto& face : delta->m_removedFonts)
+			removedKeys.emplace(delta->GetString(face.m_directory), delta->GetString(face.m_fileName), face.m_index);
+		size_t addedCount = delta->m_fonts.size();
+		// added faces become a segment of their own behind the index file's others
+		auto segment = BuildSegment(order, std::move(delta));
+
+		std::lock_guard attachLock(m_attachLock);
+		auto next = CopyCurrentSnapshot();
+		size_t removedCount = 0;
+		for (auto& existing : next->m_segments)
+		{
+			if (existing->m_order != order)
+				continue;
+			for (uint32_t localId = 0; localId < existing->m_db->m_fonts.size(); ++localId)
+			{
+				uint32_t faceId = existing->m_firstFaceId + localId;
+				if (next->m_removed[faceId] || !removedKeys.contains(GetFaceKey(*next, faceId)))
+					continue;
+				next->m_removed[faceId] = true;
+				CollectChangedNames(*next->m_faces[faceId], *next->m_faceStrings[faceId], changedNames);
+				++removedCount;
+			}
+		}
+		AppendSegment(*next, std::move(segment));
+		UpdateCanonicalIds(*next);
+		Publish(std::move(next), &changedNames);
+		EventLog::GetInstance().LogDebugMessage(L"index delta applied: %zu faces added, %zu removed, %zu names changed",
+		                                        addedCount, removedCount, changedNames.size());
+	}
+
+	void BeginReload()
+	{
+		std::lock_guard attachLock(m_attachLock);
+		m_staging = std::make_shared<IndexSnapshot>();
+	}
+
+	void SetComplete()
+	{
+		std::lock_guard attachLock(m_attachLock);
+		if (m_staging)
+		{
+			// the old snapshot, and the databases only it references, go away with its last query
+			// moving leaves m_staging empty, Publish goes live
+			auto next = std::move(m_staging);
+			Publish(std::move(next), nullptr);
+		}
+		EventLog::GetInstance().LogDebugMessage(L"query service complete: %zu index files, %zu faces",
+		                                        m_snapshot->m_segments.size(), m_snapshot->m_faces.size());
+	}
+
+	void SetMatchPolicy(ConfigFile::MatchPolicy matchPolicy)
+	{
+		m_matchPolicy = matchPolicy;
+	}
+
+	void SetResolveTimeout(uint32_t milliseconds)
+	{
+		m_ring.SetResolveTimeout(milliseconds);
+	}
+
+	void SetInstalledFonts(std::shared_ptr<const InstalledFontSet> installedFonts)
+	{
+		std::lock_guard lg(m_accessLock);
+		m_installedFonts = std::move(installedFonts);
+	}
+
+	// same names GDI matches a request against, see NAMESPACES
+	static bool IsInstalled(const InstalledFontSet& installedFonts, const FontDatabase::FontFaceElement& face,
+	                        const StringPool& strings)
 	{
-		for (auto face : faces)
+		for (auto& name : face.m_names)
 		{
-			auto unique = std::make_pair(face->m_path.c_str(), face->m_index);
-			if (std::find(dedup.begin(), dedup.end(), unique) != dedup.end())
+			uint32_t ns = NAMESPACE_OF_TYPE[name.m_type];
+			if (ns == NOT_INDEXED || !IsAccepted(NAMESPACES[ns].m_filter, face))
 				continue;
-			dedup.push_back(unique);
+			if (installedFonts.Contains(strings.Get(name.m_name), face.m_weight, !!face.m_oblique))
+				return true;
+		}
+		return false;
+	}
+
+	static void AppendFontFace(const IndexSnapshot& snapshot, const InstalledFontSet& installedFonts,
+	                           FontBlobCache& blobCache, LocalFontCache& localCache,
+	                           FontQueryResponse& response, const std::vector<uint32_t>& faceIds)
+	{
+		for (auto faceId : faceIds)
+		{
+			auto face = snapshot.m_faces[faceId];
+			auto& strings = *snapshot.m_faceStrings[faceId];
 			auto font = response.add_fonts();
-			for (auto name : face->m_names)
+			for (auto& name : face->m_names)
 			{
 				switch (name.m_type)
 				{
 				case FontDatabase::FontFaceElement::NameElement::Win32FamilyName:
-					font->add_familyname(WideToUtf8String(name.m_name));
+					font->add_familyname(WideToUtf8String(strings.Get(name.m_name)));
 					break;
 				case FontDatabase::FontFaceElement::NameElement::FullName:
-					font->add_gdifullname(WideToUtf8String(name.m_name));
+					font->add_gdifullname(WideToUtf8String(strings.Get(name.m_name)));
 					break;
 				case FontDatabase::FontFaceElement::NameElement::PostScriptName:
-					font->add_postscriptname(WideToUtf8String(name.m_name));
+					font->add_postscriptname(WideToUtf8String(strings.Get(name.m_name)));
+					break;
+				case FontDatabase::FontFaceElement::NameElement::TypographicFamilyName:
+					font->add_typographicfamilyname(WideToUtf8String(strings.Get(name.m_name)));
+					break;
+				case FontDatabase::FontFaceElement::NameElement::TypographicSubfamilyName:
+					font->add_typographicsubfamilyname(WideToUtf8String(strings.Get(name.m_name)));
 					break;
 				}
 			}
-			font->set_path(WideToUtf8String(face->m_path));
+			std::wstring path(strings.Get(face->m_directory));
+			path.append(strings.Get(face->m_fileName));
+			// feedback comes back with the local path, Prefetch maps it to the origin
+			auto localPath = localCache.Find(path);
+			font->set_path(WideToUtf8String(localPath ? *localPath : path));
+			if (auto blob = blobCache.Find(path))
+			{
+				font->set_blobname(WideToUtf8String(blob->m_name));
+				font->set_blobsize(blob->m_size);
+			}
 			font->set_weight(face->m_weight);
 			font->set_oblique(face->m_oblique);
 			font->set_ispsoutline(face->m_psOutline);
+			font->set_width(face->m_width);
+			font->set_codepagerange1(face->m_codePageRange1);
+			font->set_codepagerange2(face->m_codePageRange2);
+			font->set_stableid(face->m_stableId);
+			// clients skip loading these instead of enumerating fonts themselves
+			font->set_installed(IsInstalled(installedFonts, *face, strings));
+		}
+	}
+
+	// keep only the faces GDI would pick for the requested style
+	static void SelectBestMatches(const IndexSnapshot& snapshot, ConfigFile::MatchPolicy matchPolicy,
+	                              std::vector<uint32_t>& faces, std::vector<uint32_t>& penalties,
+	                              const FontStyle& style)
+	{
+		if (faces.empty())
+			return;
+		penalties.clear();
+		for (auto faceId : faces)
+			penalties.push_back(CalculateMatchPenalty(*snapshot.m_faces[faceId], style));
+		uint32_t best = *std::min_element(penalties.begin(), penalties.end());
+
+		size_t kept = 0;
+		for (size_t i = 0; i < faces.size(); ++i)
+		{
+			if (penalties[i] != best)
+				continue;
+			faces[kept++] = faces[i];
+			if (matchPolicy == ConfigFile::MatchPolicy::BestFace)
+				break;
 		}
+		faces.resize(kept);
 	}
 
 	FontQueryResponse HandleRequest(const FontQueryRequest& request) override
 	{
-		std::lock_guard lg(m_accessLock);
+		std::shared_ptr<const IndexSnapshot> snapshotHolder;
+		std::shared_ptr<const InstalledFontSet> installedFonts;
+		{
+			std::lock_guard lg(m_accessLock);
+			snapshotHolder = m_snapshot;
+			installedFonts = m_installedFonts;
+		}
+		auto& snapshot = *snapshotHolder;
+		auto matchPolicy = m_matchPolicy.load();
 		FontQueryResponse ret;
 		std::wstring queryString = Utf8ToWideString(request.querystring());
 		bool doTruncated = false;
 		// enable truncated query for GDI LOGFONT::lfFaceName's 31 wchar_t limit
-		if (queryString.size() == 31)
+		if (queryString.size() == TRUNCATED_NAME_LENGTH)
 			doTruncated = true;
-		std::vector<std::pair<const wchar_t*, uint32_t>> dedup;
 
 		ret.set_version(1);
 
-		auto family = m_win32FamilyName.QueryEntry(queryString.c_str(), doTruncated);
-		if (!family.empty())
+		std::wstring normalizedQuery;
+		NormalizeName(queryString, normalizedQuery);
+		static thread_local QueryScratch scratch;
+		scratch.BeginQuery(snapshot.m_faces.size());
+		// one probe per segment answers every namespace
+		auto& matches = scratch.m_matches;
+		matches.clear();
+		for (auto& segment : snapshot.m_segments)
+			matches.push_back((doTruncated ? segment->m_truncatedNameIndex : segment->m_nameIndex).Find(normalizedQuery));
+		auto& candidates = scratch.m_candidates;
+		auto collect = [&](uint32_t ns)
 		{
-			// if it's a valid family name, return the list
-			AppendFontFace(ret, family, dedup);
-			return ret;
-		}
-		auto postscript = m_postScriptName.QueryEntry(queryString.c_str(), doTruncated);
-		std::erase_if(postscript, [](FontDatabase::FontFaceElement* element)
+			for (size_t i = 0; i < snapshot.m_segments.size(); ++i)
+			{
+				// faces of this segment now among the candidates, some may have been added earlier
+				bool owned = false;
+				for (auto localId : matches[i][ns])
+				{
+					uint32_t faceId = snapshot.m_segments[i]->m_firstFaceId + localId;
+					uint32_t canonicalId = snapshot.m_canonicalIds[faceId];
+					if (snapshot.m_removed[faceId] || !IsAccepted(NAMESPACES[ns].m_filter, *snapshot.m_faces[faceId]))
+						continue;
+					owned = true;
+					if (scratch.MarkSeen(canonicalId))
+						candidates.push_back(canonicalId);
+				}
+				// like inside a segment, the first file listing a unique name owns it,
+				// removed or filtered faces leave the name to later segments.
+				// a truncated name is a prefix many files can share so it owns nothing
+				if (!doTruncated && owned && !NAMESPACES[ns].m_allowDuplicate)
+					break;
+			}
+		};
+
+		// if it's a valid family name, use the list
+		collect(FAMILY_NAMESPACE);
+		if (candidates.empty())
 		{
-			return element->m_psOutline != 1;
-		});
-		auto fullname = m_fullName.QueryEntry(queryString.c_str(), doTruncated);
-		std::erase_if(fullname, [](FontDatabase::FontFaceElement* element)
+			for (uint32_t ns = 0; ns < NAMESPACE_COUNT; ++ns)
+			{
+				if (ns != FAMILY_NAMESPACE)
+					collect(ns);
+			}
+		}
+		// enumeration requests carry no style and always get the whole family
+		if (request.has_style() && matchPolicy != ConfigFile::MatchPolicy::Family)
 		{
-			return element->m_psOutline == 1;
-		});
-		AppendFontFace(ret, postscript, dedup);
-		AppendFontFace(ret, fullname, dedup);
+			SelectBestMatches(snapshot, matchPolicy, candidates, scratch.m_penalties, request.style());
+			ret.set_stylespecific(true);
+		}
+		AppendFontFace(snapshot, *installedFonts, *m_blobCache, *m_localCache, ret, candidates);
 		return ret;
 	}
 
@@ -426,16 +622,47 @@ public:
 	}
 };
 
-sfh::QueryService::QueryService(IDaemon* daemon)
-	: m_impl(std::make_unique<Implementation>(daemon))
+sfh::QueryService::QueryService(IDaemon* daemon, ConfigFile::MatchPolicy matchPolicy, FontBlobCache* blobCache,
+                                LocalFontCache* localCache)
+	: m_impl(std::make_unique<Implementation>(daemon, matchPolicy, blobCache, localCache))
 {
 }
 
 sfh::QueryService::~QueryService() = default;
 
-void sfh::QueryService::Load(std::vector<std::unique_ptr<FontDatabase>>&& dbs)
+void sfh::QueryService::AddDatabase(size_t order, std::unique_ptr<FontDatabase>&& db)
+{
+	m_impl->AddDatabase(order, std::move(db));
+}
+
+void sfh::QueryService::ApplyDelta(size_t order, std::unique_ptr<FontDatabase>&& delta)
+{
+	m_impl->ApplyDelta(order, std::move(delta));
+}
+
+void sfh::QueryService::BeginReload()
+{
+	m_impl->BeginReload();
+}
+
+void sfh::QueryService::SetComplete()
+{
+	m_impl->SetComplete();
+}
+
+void sfh::QueryService::SetMatchPolicy(ConfigFile::MatchPolicy matchPolicy)
+{
+	m_impl->SetMatchPolicy(matchPolicy);
+}
+
+void sfh::QueryService::SetResolveTimeout(uint32_t milliseconds)
+{
+	m_impl->SetResolveTimeout(milliseconds);
+}
+
+void sfh::QueryService::SetInstalledFonts(std::shared_ptr<const InstalledFontSet> installedFonts)
 {
-	m_impl->Load(std::move(dbs));
+	m_impl->SetInstalledFonts(std::move(installedFonts));
 }
 
 sfh::IRpcRequestHandler* sfh::QueryService::GetRpcRequestHandler()
@@ -2,10 +2,13 @@
 
 #include "IDaemon.h"
 #include "PersistantData.h"
+#include "FontBlobCache.h"
+#include "LocalFontCache.h"
 
 namespace sfh
 {
 	class IRpcRequestHandler;
+	class InstalledFontSet;
 
 	class QueryService
 	{
@@ -13,7 +16,9 @@ namespace sfh
 		class Implementation;
 		std::unique_ptr<Implementation> m_impl;
 	public:
-		QueryService(IDaemon* daemon);
+		// responses name the blobs of files found in blobCache and the copies in localCache
+		QueryService(IDaemon* daemon, ConfigFile::MatchPolicy matchPolicy, FontBlobCache* blobCache,
+		             LocalFontCache* localCache);
 		~QueryService();
 
 		QueryService(const QueryService&) = delete;
@@ -22,7 +27,22 @@ namespace sfh
 		QueryService& operator=(const QueryService&) = delete;
 		QueryService& operator=(QueryService&&) = delete;
 
-		void Load(std::vector<std::unique_ptr<FontDatabase>>&& dbs);
+		// thread safe, queries are answered from the databases added so far,
+		// order is the index file's position in the config
+		void AddDatabase(size_t order, std::unique_ptr<FontDatabase>&& db);
+		// applies a delta written by the builder for the index file at order, clients only
+		// drop cached results of the names it touches
+		void ApplyDelta(size_t order, std::unique_ptr<FontDatabase>&& delta);
+		// databases added from now on build a new index, the current one keeps
+		// answering queries until SetComplete replaces it
+		void BeginReload();
+		// every index file has been added
+		void SetComplete();
+		void SetMatchPolicy(ConfigFile::MatchPolicy matchPolicy);
+		// published to injected processes along with index changes
+		void SetResolveTimeout(uint32_t milliseconds);
+		// faces in it are marked installed in responses from now on
+		void SetInstalledFonts(std::shared_ptr<const InstalledFontSet> installedFonts);
 
 		IRpcRequestHandler* GetRpcRequestHandler();
 	};
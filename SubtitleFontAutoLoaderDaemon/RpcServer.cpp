@@ -343,7 +343,9 @@ private:
 
 	bool ProcessFeedback(ConnectionBlock& connection, const FontQueryRequest& request)
 	{
-		m_feedbackHandler->HandleFeedback(request);
+		ULONG clientProcessId = 0;
+		GetNamedPipeClientProcessId(connection.m_pipe.get(), &clientProcessId);
+		m_feedbackHandler->HandleFeedback(request, clientProcessId);
 		return BeginReadLengthPrefix(connection);
 	}
 
@@ -17,7 +17,8 @@ namespace sfh
 	class IRpcFeedbackHandler
 	{
 	public:
-		virtual void HandleFeedback(const FontQueryRequest& request) = 0;
+		// clientProcessId tells which fonts one client loaded together, 0 if unknown
+		virtual void HandleFeedback(const FontQueryRequest& request, uint32_t clientProcessId) = 0;
 	};
 
 	class RpcServer
@@ -0,0 +1,396 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace sfh
+{
+	// approximate access counts of recent keys, 4 bit counters in 4 rows (count-min sketch),
+	// all counters are halved after a sample period so old popularity fades
+	class FrequencySketch
+	{
+	private:
+		static constexpr uint32_t DEPTH = 4;
+		static constexpr uint8_t MAX_COUNT = 15;
+
+		std::vector<uint8_t> m_counters;
+		size_t m_mask = 0;
+		uint32_t m_additions = 0;
+		uint32_t m_samplePeriod = 0;
+
+		size_t GetIndex(uint64_t hash, uint32_t row) const
+		{
+			// a different odd multiplier per row, each row picks its own counter
+			static constexpr uint64_t SEEDS[DEPTH] = {
+				0x9e3779b97f4a7c15, 0xc2b2ae3d27d4eb4f, 0x165667b19e3779f9, 0xd6e8feb86659fd93
+			};
+			uint64_t mixed = (hash + SEEDS[row]) * SEEDS[row];
+			return static_cast<size_t>(mixed ^ mixed >> 32) & m_mask;
+		}
+
+	public:
+		// expectedKeys is the number of keys the cache holds at most
+		explicit FrequencySketch(size_t expectedKeys)
+		{
+			size_t width = 64;
+			while (width < expectedKeys * 4)
+				width *= 2;
+			m_counters.assign(width * DEPTH, 0);
+			m_mask = width - 1;
+			m_samplePeriod = static_cast<uint32_t>(std::min<size_t>(width * 10, UINT32_MAX));
+		}
+
+		void Increment(uint64_t hash)
+		{
+			bool added = false;
+			for (uint32_t row = 0; row < DEPTH; ++row)
+			{
+				auto& counter = m_counters[row * (m_mask + 1) + GetIndex(hash, row)];
+				if (counter < MAX_COUNT)
+				{
+					++counter;
+					added = true;
+				}
+			}
+			if (added && ++m_additions == m_samplePeriod)
+			{
+				for (auto& counter : m_counters)
+					counter /= 2;
+				m_additions /= 2;
+			}
+		}
+
+		uint32_t Estimate(uint64_t hash) const
+		{
+			uint32_t ret = MAX_COUNT;
+			for (uint32_t row = 0; row < DEPTH; ++row)
+				ret = std::min<uint32_t>(ret, m_counters[row * (m_mask + 1) + GetIndex(hash, row)]);
+			return ret;
+		}
+	};
+
+	// a byte budgeted cache admitting by frequency (W-TinyLFU): new keys enter an lru window,
+	// keys leaving the window only replace main cache entries if the sketch saw them more
+	// often than every entry they would push out, so a single large file asked for once
+	// can't flush several popular ones. the main cache is a segmented lru where keys hit
+	// again move from probation to protected. the window share is tuned by hill climbing
+	// on the hit ratio, recency heavy workloads get a large window, frequency heavy a small one
+	template <typename Key, typename Hash = std::hash<Key>>
+	class TinyLfuCache
+	{
+	public:
+		using EvictCallback = std::function<void(const Key&)>;
+
+	private:
+		enum class Segment
+		{
+			Window,
+			Probation,
+			Protected
+		};
+
+		struct Entry
+		{
+			Key m_key;
+			uint64_t m_size;
+			Segment m_segment;
+			// onLoad ran, only then does leaving the cache call onEvict
+			bool m_loaded;
+			// tells a Restore its own entry from one put in while it was loading, 0 for Access
+			uint64_t m_reservation;
+		};
+
+		using EntryList = std::list<Entry>;
+
+		static constexpr uint32_t MIN_WINDOW_PERCENT = 1;
+		static constexpr uint32_t MAX_WINDOW_PERCENT = 80;
+		static constexpr uint32_t CLIMB_STEP_PERCENT = 5;
+		static constexpr uint64_t PROTECTED_PERCENT = 80;
+
+		std::mutex m_lock;
+		Hash m_hash;
+		FrequencySketch m_sketch;
+		EvictCallback m_onEvict;
+
+		uint64_t m_budget;
+		uint32_t m_windowPercent = 10;
+		// hill climbing state, accesses and hits of the current sample
+		int32_t m_climbStep = CLIMB_STEP_PERCENT;
+		uint32_t m_sampleSize;
+		uint32_t m_sampleAccesses = 0;
+		uint32_t m_sampleHits = 0;
+		double m_previousHitRatio = 0;
+		// most recently used first in each list
+		EntryList m_window;
+		EntryList m_probation;
+		EntryList m_protected;
+		uint64_t m_windowUsed = 0;
+		uint64_t m_probationUsed = 0;
+		uint64_t m_protectedUsed = 0;
+		std::unordered_map<Key, typename EntryList::iterator, Hash> m_index;
+		uint64_t m_lastReservation = 0;
+
+		uint64_t GetWindowBudget() const
+		{
+			return m_budget * m_windowPercent / 100;
+		}
+
+		uint64_t GetMainBudget() const
+		{
+			return m_budget - GetWindowBudget();
+		}
+
+		uint64_t GetProtectedBudget() const
+		{
+			return GetMainBudget() * PROTECTED_PERCENT / 100;
+		}
+
+		EntryList& GetList(Segment segment)
+		{
+			switch (segment)
+			{
+			case Segment::Window:
+				return m_window;
+			case Segment::Probation:
+				return m_probation;
+			default:
+				return m_protected;
+			}
+		}
+
+		uint64_t& GetUsed(Segment segment)
+		{
+			switch (segment)
+			{
+			case Segment::Window:
+				return m_windowUsed;
+			case Segment::Probation:
+				return m_probationUsed;
+			default:
+				return m_protectedUsed;
+			}
+		}
+
+		void MoveTo(typename EntryList::iterator entry, Segment segment)
+		{
+			GetUsed(entry->m_segment) -= entry->m_size;
+			GetUsed(segment) += entry->m_size;
+			GetList(segment).splice(GetList(segment).begin(), GetList(entry->m_segment), entry);
+			entry->m_segment = segment;
+		}
+
+		void Evict(typename EntryList::iterator entry)
+		{
+			GetUsed(entry->m_segment) -= entry->m_size;
+			Key key = std::move(entry->m_key);
+			bool loaded = entry->m_loaded;
+			m_index.erase(key);
+			GetList(entry->m_segment).erase(entry);
+			if (loaded)
+				m_onEvict(key);
+		}
+
+		// protected entries over budget drop back to probation
+		void DemoteProtected()
+		{
+			while (m_protectedUsed > GetProtectedBudget() && !m_protected.empty())
+				MoveTo(std::prev(m_protected.end()), Segment::Probation);
+		}
+
+		// the window's oldest entry either replaces main entries or goes away
+		void AdmitFromWindow()
+		{
+			auto candidate = std::prev(m_window.end());
+			uint64_t needed = candidate->m_size;
+			uint64_t mainBudget = GetMainBudget();
+			if (needed > mainBudget)
+			{
+				Evict(candidate);
+				return;
+			}
+			uint32_t candidateFrequency = m_sketch.Estimate(m_hash(candidate->m_key));
+			// victims come from the cold end of probation, then of protected
+			std::vector<typename EntryList::iterator> victims;
+			uint64_t freed = 0;
+			uint64_t mainUsed = m_probationUsed + m_protectedUsed;
+			auto probationIter = m_probation.end();
+			auto protectedIter = m_protected.end();
+			while (mainUsed - freed + needed > mainBudget)
+			{
+				typename EntryList::iterator victim;
+				if (probationIter != m_probation.begin())
+					victim = --probationIter;
+				else
+					victim = --protectedIter;
+				if (m_sketch.Estimate(m_hash(victim->m_key)) >= candidateFrequency)
+				{
+					Evict(candidate);
+					return;
+				}
+				victims.push_back(victim);
+				freed += victim->m_size;
+			}
+			for (auto victim : victims)
+				Evict(victim);
+			MoveTo(candidate, Segment::Probation);
+		}
+
+		// moves the window share a step towards a better hit ratio once per sample
+		void Climb(bool hit)
+		{
+			m_sampleHits += hit;
+			if (++m_sampleAccesses < m_sampleSize)
+				return;
+			double hitRatio = static_cast<double>(m_sampleHits) / m_sampleAccesses;
+			// keep going while it helps, turn around when it doesn't
+			if (hitRatio < m_previousHitRatio)
+				m_climbStep = -m_climbStep;
+			m_previousHitRatio = hitRatio;
+			m_sampleAccesses = 0;
+			m_sampleHits = 0;
+			int32_t next = static_cast<int32_t>(m_windowPercent) + m_climbStep;
+			m_windowPercent = static_cast<uint32_t>(std::clamp<int32_t>(
+				next, MIN_WINDOW_PERCENT, MAX_WINDOW_PERCENT));
+			Shrink();
+		}
+
+		void Shrink()
+		{
+			while (m_windowUsed > GetWindowBudget() && !m_window.empty())
+				AdmitFromWindow();
+			// a lowered budget
+			while (m_probationUsed + m_protectedUsed > GetMainBudget())
+				Evict(m_probation.empty() ? std::prev(m_protected.end()) : std::prev(m_probation.end()));
+			DemoteProtected();
+		}
+
+	public:
+		// onEvict is called for every loaded key leaving the cache, with the lock held
+		// except for a key Restore loaded after it had already been evicted
+		TinyLfuCache(uint64_t budget, size_t expectedKeys, EvictCallback onEvict)
+			: m_sketch(expectedKeys), m_onEvict(std::move(onEvict)), m_budget(budget),
+			  m_sampleSize(static_cast<uint32_t>(std::max<size_t>(expectedKeys, 100)))
+		{
+		}
+
+		TinyLfuCache(const TinyLfuCache&) = delete;
+		TinyLfuCache(TinyLfuCache&&) = delete;
+
+		TinyLfuCache& operator=(const TinyLfuCache&) = delete;
+		TinyLfuCache& operator=(TinyLfuCache&&) = delete;
+
+		// records a request for key, returns true if key is new to the cache and the caller
+		// should bring it in, onLoad(key) runs under the lock so it can't race the eviction
+		template <typename Load>
+		bool Access(const Key& key, uint64_t size, Load&& onLoad)
+		{
+			std::lock_guard lg(m_lock);
+			m_sketch.Increment(m_hash(key));
+			auto iter = m_index.find(key);
+			if (iter != m_index.end())
+			{
+				auto entry = iter->second;
+				MoveTo(entry, entry->m_segment == Segment::Window ? Segment::Window : Segment::Protected);
+				DemoteProtected();
+				Climb(true);
+				return false;
+			}
+			Climb(false);
+			if (m_budget == 0)
+				return false;
+			m_window.push_front(Entry{key, size, Segment::Window, false, 0});
+			m_windowUsed += size;
+			m_index.emplace(key, m_window.begin());
+			Shrink();
+			// too large for the window, it went without being loaded
+			auto inserted = m_index.find(key);
+			if (inserted == m_index.end())
+				return false;
+			onLoad(key);
+			inserted->second->m_loaded = true;
+			return true;
+		}
+
+		// puts back a key from an earlier run behind everything in the main cache, so keys
+		// restored most valuable first keep their order, returns false once the budget is
+		// full, key is there already or onLoad(key) returned false.
+		// the entry is reserved first and onLoad runs without the lock, a slow load on a
+		// low priority thread doesn't hold up Access
+		template <typename Load>
+		bool Restore(const Key& key, uint64_t size, Load&& onLoad)
+		{
+			uint64_t reservation;
+			{
+				std::lock_guard lg(m_lock);
+				if (m_index.contains(key) || m_probationUsed + m_protectedUsed + size > GetMainBudget())
+					return false;
+				m_sketch.Increment(m_hash(key));
+				reservation = ++m_lastReservation;
+				m_probation.push_back(Entry{key, size, Segment::Probation, false, reservation});
+				m_probationUsed += size;
+				m_index.emplace(key, std::prev(m_probation.end()));
+			}
+			bool loaded = onLoad(key);
+			{
+				std::lock_guard lg(m_lock);
+				auto iter = m_index.find(key);
+				if (iter != m_index.end() && iter->second->m_reservation == reservation)
+				{
+					auto entry = iter->second;
+					if (loaded)
+					{
+						entry->m_loaded = true;
+						entry->m_reservation = 0;
+						return true;
+					}
+					// nobody loaded it, take the reservation back
+					GetUsed(entry->m_segment) -= entry->m_size;
+					GetList(entry->m_segment).erase(entry);
+					m_index.erase(iter);
+					return false;
+				}
+				if (!loaded)
+					return false;
+			}
+			// evicted while loading, what was loaded goes again
+			m_onEvict(key);
+			return false;
+		}
+
+		void SetBudget(uint64_t budget)
+		{
+			std::lock_guard lg(m_lock);
+			m_budget = budget;
+			Shrink();
+		}
+
+		// keys in the cache, most valuable first, at most count of them
+		std::vector<Key> GetVector(size_t count)
+		{
+			std::lock_guard lg(m_lock);
+			std::vector<Key> ret;
+			for (auto list : {&m_protected, &m_probation, &m_window})
+			{
+				for (auto& entry : *list)
+				{
+					if (ret.size() == count)
+						return ret;
+					ret.push_back(entry.m_key);
+				}
+			}
+			return ret;
+		}
+
+		uint64_t GetUsed()
+		{
+			std::lock_guard lg(m_lock);
+			return m_windowUsed + m_probationUsed + m_protectedUsed;
+		}
+	};
+}
@@ -22,6 +22,8 @@ private:
 	std::atomic<size_t> m_checkPoint = 0;
 
 	std::atomic<bool> m_loading = true;
+	std::atomic<size_t> m_warmUpDone = 0;
+	std::atomic<size_t> m_warmUpTotal = 0;
 public:
 	Implementation(IDaemon* daemon)
 		: m_daemon(daemon)
@@ -53,12 +55,25 @@ public:
 		}
 	}
 
+	void NotifyStartLoad()
+	{
+		m_loading = true;
+		PostMessageW(m_hWnd, WM_UPDATE_TRAY_ICON_MESSAGE, 0, 0);
+	}
+
 	void NotifyFinishLoad()
 	{
 		m_loading = false;
 		PostMessageW(m_hWnd, WM_UPDATE_TRAY_ICON_MESSAGE, 0, 0);
 	}
 
+	void NotifyWarmUpProgress(size_t done, size_t total)
+	{
+		m_warmUpTotal = total;
+		m_warmUpDone = done;
+		PostMessageW(m_hWnd, WM_UPDATE_TRAY_ICON_MESSAGE, 0, 0);
+	}
+
 private:
 	void SetupMessageWindow()
 	{
@@ -105,6 +120,12 @@ private:
 			wcscpy_s(m_iconData.szTip, L"SubtitleFontAutoLoaderDaemon - Loading");
 			m_iconData.hIcon = LoadIconW(wil::GetModuleInstanceHandle(), MAKEINTRESOURCEW(IDI_TRAYICONLOADING));
 		}
+		else if (m_warmUpDone < m_warmUpTotal)
+		{
+			swprintf_s(m_iconData.szTip, L"SubtitleFontAutoLoaderDaemon - Prefetching %zu/%zu",
+			           m_warmUpDone.load(), m_warmUpTotal.load());
+			m_iconData.hIcon = LoadIconW(wil::GetModuleInstanceHandle(), MAKEINTRESOURCEW(IDI_TRAYICON));
+		}
 		else
 		{
 			wcscpy_s(m_iconData.szTip, L"SubtitleFontAutoLoaderDaemon");
@@ -139,6 +160,9 @@ private:
 		case WM_ENDSESSION:
 			m_daemon->NotifyExit();
 			break;
+		case WM_FONTCHANGE:
+			m_daemon->NotifyFontChange();
+			return 0;
 		case WM_CLOSE:
 			DestroyTrayIcon();
 			DestroyWindow(hWnd);
@@ -163,6 +187,9 @@ private:
 			case ID_TRAYICONMENU_RELOAD:
 				m_daemon->NotifyReload();
 				break;
+			case ID_TRAYICONMENU_APPLYUPDATES:
+				m_daemon->NotifyApplyUpdates();
+				break;
 			}
 			return 0;
 		default:
@@ -216,7 +243,17 @@ sfh::SystemTray::SystemTray(IDaemon* daemon)
 
 sfh::SystemTray::~SystemTray() = default;
 
+void sfh::SystemTray::NotifyStartLoad()
+{
+	m_impl->NotifyStartLoad();
+}
+
 void sfh::SystemTray::NotifyFinishLoad()
 {
 	m_impl->NotifyFinishLoad();
 }
+
+void sfh::SystemTray::NotifyWarmUpProgress(size_t done, size_t total)
+{
+	m_impl->NotifyWarmUpProgress(done, total);
+}
@@ -21,6 +21,8 @@ namespace sfh
 		SystemTray& operator=(const SystemTray&) = delete;
 		SystemTray& operator=(SystemTray&&) = delete;
 
+		void NotifyStartLoad();
 		void NotifyFinishLoad();
+		void NotifyWarmUpProgress(size_t done, size_t total);
 	};
 }
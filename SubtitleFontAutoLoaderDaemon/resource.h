@@ -8,13 +8,14 @@
 #define ID_TRAYICONMENU_EXIT            40001
 #define ID_TRAYICONMENULOADING_LOADING  40002
 #define ID_TRAYICONMENU_RELOAD          40003
+#define ID_TRAYICONMENU_APPLYUPDATES    40004
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        104
-#define _APS_NEXT_COMMAND_VALUE         40004
+#define _APS_NEXT_COMMAND_VALUE         40005
 #define _APS_NEXT_CONTROL_VALUE         1001
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
@@ -0,0 +1,212 @@
+#include "AsyncResolver.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+
+using namespace sfh;
+
+namespace
+{
+	using namespace std::chrono_literals;
+
+	// time only moves when the test advances it, waits poll it so an advance is noticed
+	class ManualClock
+	{
+	private:
+		std::atomic<int64_t> m_nowMs{0};
+
+	public:
+		SteadyTimer::time_point Now() const
+		{
+			return SteadyTimer::time_point(std::chrono::milliseconds(m_nowMs.load()));
+		}
+
+		void Advance(std::chrono::milliseconds amount)
+		{
+			m_nowMs += amount.count();
+		}
+	};
+
+	struct ManualTimer
+	{
+		using time_point = SteadyTimer::time_point;
+
+		ManualClock* m_clock;
+
+		time_point Now() const
+		{
+			return m_clock->Now();
+		}
+
+		template <typename Pred>
+		bool WaitUntil(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, time_point deadline,
+		               Pred&& pred) const
+		{
+			while (!pred())
+			{
+				if (Now() >= deadline)
+					return false;
+				cv.wait_for(lock, 1ms);
+			}
+			return true;
+		}
+	};
+
+	// blocks the work until the test opens it
+	class Gate
+	{
+	private:
+		std::promise<void> m_promise;
+		std::shared_future<void> m_future = m_promise.get_future().share();
+
+	public:
+		void Open()
+		{
+			m_promise.set_value();
+		}
+
+		void Wait() const
+		{
+			m_future.wait();
+		}
+	};
+
+	// true once the caller is parked in Resolve, real time passes but the manual clock does not
+	template <typename T>
+	bool IsWaiting(const std::future<T>& future)
+	{
+		return future.wait_for(50ms) == std::future_status::timeout;
+	}
+}
+
+class AsyncResolverTest : public testing::Test
+{
+protected:
+	ManualClock m_clock;
+	// outlives the jobs TearDown waits for
+	Gate m_gate;
+	BasicAsyncResolver<ManualTimer> m_resolver{ManualTimer{&m_clock}};
+
+	void TearDown() override
+	{
+		m_resolver.Shutdown();
+	}
+};
+
+TEST_F(AsyncResolverTest, FinishesBeforeDeadline)
+{
+	std::atomic<int> runs = 0;
+	EXPECT_TRUE(m_resolver.Resolve(L"key", [&]() { ++runs; }, 100ms));
+	EXPECT_EQ(runs, 1);
+}
+
+TEST_F(AsyncResolverTest, WaitsUntilTheClockPassesTheDeadline)
+{
+	auto result = std::async(std::launch::async, [&]()
+	{
+		return m_resolver.Resolve(L"key", [&]() { m_gate.Wait(); }, 100ms);
+	});
+	// the real clock running on does not time the caller out
+	EXPECT_TRUE(IsWaiting(result));
+	m_clock.Advance(99ms);
+	EXPECT_TRUE(IsWaiting(result));
+	m_clock.Advance(1ms);
+	EXPECT_FALSE(result.get());
+	m_gate.Open();
+}
+
+TEST_F(AsyncResolverTest, CompletionJustBeforeDeadlineIsReported)
+{
+	auto result = std::async(std::launch::async, [&]()
+	{
+		return m_resolver.Resolve(L"key", [&]() { m_gate.Wait(); }, 100ms);
+	});
+	m_clock.Advance(99ms);
+	EXPECT_TRUE(IsWaiting(result));
+	m_gate.Open();
+	EXPECT_TRUE(result.get());
+}
+
+TEST_F(AsyncResolverTest, LateCompletionStillFinishes)
+{
+	std::atomic<bool> finished = false;
+	EXPECT_FALSE(m_resolver.Resolve(L"key", [&]()
+	{
+		m_gate.Wait();
+		finished = true;
+	}, 0ms));
+	EXPECT_FALSE(finished);
+
+	m_gate.Open();
+	m_resolver.WaitIdle();
+	EXPECT_TRUE(finished);
+
+	// the late job left the pending set, the next call resolves again
+	std::atomic<int> runs = 0;
+	EXPECT_TRUE(m_resolver.Resolve(L"key", [&]() { ++runs; }, 100ms));
+	EXPECT_EQ(runs, 1);
+}
+
+TEST_F(AsyncResolverTest, CallersJoinTheRunningResolution)
+{
+	std::atomic<int> runs = 0;
+	auto work = [&]()
+	{
+		++runs;
+		m_gate.Wait();
+	};
+	EXPECT_FALSE(m_resolver.Resolve(L"key", work, 0ms));
+	auto joined = std::async(std::launch::async, [&]()
+	{
+		return m_resolver.Resolve(L"key", work, 100ms);
+	});
+	EXPECT_TRUE(IsWaiting(joined));
+
+	// another key does not wait for the first one
+	EXPECT_TRUE(m_resolver.Resolve(L"other", []() {}, 100ms));
+
+	m_gate.Open();
+	EXPECT_TRUE(joined.get());
+	EXPECT_EQ(runs, 1);
+}
+
+TEST_F(AsyncResolverTest, ThrowingWorkCountsAsFinished)
+{
+	EXPECT_TRUE(m_resolver.Resolve(L"key", []() { throw std::runtime_error("query failed"); }, 100ms));
+	EXPECT_TRUE(m_resolver.Resolve(L"key", []() {}, 100ms));
+}
+
+TEST_F(AsyncResolverTest, ShutdownWaitsAndRefusesNewWork)
+{
+	std::atomic<bool> finished = false;
+	EXPECT_FALSE(m_resolver.Resolve(L"key", [&]()
+	{
+		m_gate.Wait();
+		finished = true;
+	}, 0ms));
+	auto shutdown = std::async(std::launch::async, [&]() { m_resolver.Shutdown(); });
+	EXPECT_TRUE(IsWaiting(shutdown));
+
+	m_gate.Open();
+	shutdown.get();
+	EXPECT_TRUE(finished);
+
+	std::atomic<int> runs = 0;
+	EXPECT_FALSE(m_resolver.Resolve(L"key", [&]() { ++runs; }, 100ms));
+	EXPECT_EQ(runs, 0);
+}
+
+TEST(AsyncResolver, SteadyTimerTimesOut)
+{
+	AsyncResolver resolver;
+	Gate gate;
+	auto start = std::chrono::steady_clock::now();
+	EXPECT_FALSE(resolver.Resolve(L"key", [&]() { gate.Wait(); }, 20ms));
+	EXPECT_GE(std::chrono::steady_clock::now() - start, 20ms);
+	gate.Open();
+	resolver.Shutdown();
+}
@@ -0,0 +1,50 @@
+#include "CaseFold.h"
+
+#include <gtest/gtest.h>
+
+#include <clocale>
+#include <string>
+
+using namespace sfh;
+
+TEST(CaseFold, Ascii)
+{
+	EXPECT_EQ(FoldCase(L"Microsoft YaHei UI 123_"), L"microsoft yahei ui 123_");
+	for (wchar_t ch = 0; ch < 0x80; ++ch)
+		EXPECT_EQ(FoldCase(ch), ch >= L'A' && ch <= L'Z' ? ch + 0x20 : ch) << static_cast<int>(ch);
+}
+
+TEST(CaseFold, Scripts)
+{
+	EXPECT_EQ(FoldCase(L"É×Þß"), L"é×þß");
+	EXPECT_EQ(FoldCase(L"ĀāĹĺŸŽ"), L"āāĺĺÿž");
+	// turkish i has no locale independent pairing
+	EXPECT_EQ(FoldCase(L"İı"), L"İı");
+	EXPECT_EQ(FoldCase(L"ΑΣΩΆΏ"), L"ασωάώ");
+	EXPECT_EQ(FoldCase(L"ЁАЯѠ"), L"ёаяѡ");
+	EXPECT_EQ(FoldCase(L"ＡＺａ"), L"ａｚａ");
+	// cjk names are untouched
+	EXPECT_EQ(FoldCase(L"微软雅黑"), L"微软雅黑");
+}
+
+TEST(CaseFold, Idempotent)
+{
+	// names folded once, as stored in the index, must find themselves again
+	for (uint32_t cp = 0; cp < 0x10000; ++cp)
+	{
+		wchar_t folded = FoldCase(static_cast<wchar_t>(cp));
+		EXPECT_EQ(FoldCase(folded), folded) << cp;
+	}
+}
+
+TEST(CaseFold, IndependentOfLocale)
+{
+	std::wstring text = L"ÀАΑABC";
+	auto before = FoldCase(text);
+	if (std::setlocale(LC_ALL, "C.UTF-8") || std::setlocale(LC_ALL, "en_US.UTF-8"))
+	{
+		EXPECT_EQ(FoldCase(text), before);
+	}
+	std::setlocale(LC_ALL, "C");
+	EXPECT_EQ(before, L"àаαabc");
+}
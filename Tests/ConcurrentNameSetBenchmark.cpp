@@ -0,0 +1,198 @@
+// lookups per second of the interceptor's query cache with N reader threads and one writer
+// inserting and erasing names, ConcurrentNameSet against the mutex and unordered_set it
+// replaced. readers look a name up the way IsQueryNeeded does, family key first, then the
+// style key. on a machine with fewer cores than threads this measures the cost per lookup
+// under contention rather than scaling.
+// usage: ConcurrentNameSetBenchmark [max reader threads] [writer interval in us], defaults to 8 and 100
+#include "ConcurrentNameSet.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+using namespace sfh;
+
+namespace
+{
+	struct QueryStyle
+	{
+		int weight;
+		bool italic;
+		int charset;
+	};
+
+	// the cache before ConcurrentNameSet, every lookup locks and builds a string
+	class MutexNameSet
+	{
+	private:
+		std::unordered_set<std::wstring> m_cache;
+		std::mutex m_lock;
+
+		static std::wstring MakeStyleKey(std::wstring_view str, const QueryStyle& style)
+		{
+			std::wstring key(str);
+			key += L'\0';
+			key += std::to_wstring(style.weight);
+			key += style.italic ? L'i' : L'n';
+			key += std::to_wstring(style.charset);
+			return key;
+		}
+
+	public:
+		bool IsCached(std::wstring_view name, const QueryStyle& style)
+		{
+			std::lock_guard lg(m_lock);
+			if (m_cache.find(std::wstring(name)) != m_cache.end())
+				return true;
+			return m_cache.find(MakeStyleKey(name, style)) != m_cache.end();
+		}
+
+		void Insert(std::wstring_view name, const QueryStyle* style)
+		{
+			std::lock_guard lg(m_lock);
+			m_cache.emplace(style ? MakeStyleKey(name, *style) : std::wstring(name));
+		}
+
+		template <typename Pred>
+		void EraseIf(Pred&& pred)
+		{
+			std::lock_guard lg(m_lock);
+			std::erase_if(m_cache, pred);
+		}
+	};
+
+	// the same calls against ConcurrentNameSet as RpcClient makes them
+	class LockFreeNameSet
+	{
+	private:
+		ConcurrentNameSet m_cache;
+
+		static std::array<wchar_t, 4> MakeStyleSuffix(const QueryStyle& style)
+		{
+			return {
+				L'\0', static_cast<wchar_t>(style.weight), style.italic ? L'i' : L'n',
+				static_cast<wchar_t>(style.charset)
+			};
+		}
+
+	public:
+		bool IsCached(std::wstring_view name, const QueryStyle& style)
+		{
+			if (m_cache.Contains(name))
+				return true;
+			auto suffix = MakeStyleSuffix(style);
+			return m_cache.Contains(name, std::wstring_view(suffix.data(), suffix.size()));
+		}
+
+		void Insert(std::wstring_view name, const QueryStyle* style)
+		{
+			if (style)
+			{
+				auto suffix = MakeStyleSuffix(*style);
+				m_cache.Insert(name, std::wstring_view(suffix.data(), suffix.size()));
+			}
+			else
+			{
+				m_cache.Insert(name);
+			}
+		}
+
+		template <typename Pred>
+		void EraseIf(Pred&& pred)
+		{
+			m_cache.EraseIf(pred);
+		}
+	};
+
+	constexpr QueryStyle STYLE{400, false, 1};
+
+	// half the names are cached per family, the other half per style
+	std::vector<std::wstring> MakeNames()
+	{
+		std::vector<std::wstring> ret;
+		for (int i = 0; i < 500; ++i)
+			ret.push_back(L"Font Family Name " + std::to_wstring(i));
+		return ret;
+	}
+
+	// million lookups per second over all readers
+	template <typename Set>
+	double Measure(const std::vector<std::wstring>& names, int readerCount, std::chrono::microseconds writerInterval,
+	               size_t& sink)
+	{
+		Set set;
+		for (size_t i = 0; i < names.size(); ++i)
+			set.Insert(names[i], i % 2 ? &STYLE : nullptr);
+
+		std::atomic<bool> stop = false;
+		std::atomic<size_t> lookups = 0;
+		std::atomic<size_t> hits = 0;
+		std::vector<std::thread> readers;
+		for (int reader = 0; reader < readerCount; ++reader)
+		{
+			readers.emplace_back([&, reader]()
+			{
+				size_t count = 0, found = 0;
+				for (size_t i = reader; !stop.load(std::memory_order_relaxed); ++i)
+				{
+					found += set.IsCached(names[i % names.size()], STYLE);
+					++count;
+				}
+				lookups += count;
+				hits += found;
+			});
+		}
+		// a font gets loaded now and then, a delta drops what it touched
+		std::thread writer([&]()
+		{
+			for (int i = 0; !stop.load(std::memory_order_relaxed); ++i)
+			{
+				set.Insert(L"Loaded Later " + std::to_wstring(i), &STYLE);
+				if (i % 64 == 63)
+				{
+					set.EraseIf([](const std::wstring& key) { return key.starts_with(L"Loaded Later "); });
+				}
+				std::this_thread::sleep_for(writerInterval);
+			}
+		});
+
+		constexpr auto DURATION = std::chrono::milliseconds(500);
+		auto start = std::chrono::steady_clock::now();
+		std::this_thread::sleep_for(DURATION);
+		stop = true;
+		for (auto& reader : readers)
+			reader.join();
+		writer.join();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		sink += hits;
+		return static_cast<double>(lookups) / elapsed.count() / 1e6;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int maxReaders = argc > 1 ? atoi(argv[1]) : 8;
+	std::chrono::microseconds writerInterval(argc > 2 ? atoi(argv[2]) : 100);
+	auto names = MakeNames();
+
+	size_t sink = 0;
+	printf("%u cores, writer every %lld us\n", std::thread::hardware_concurrency(),
+	       static_cast<long long>(writerInterval.count()));
+	printf("%8s %18s %18s\n", "readers", "mutex M/s", "lock free M/s");
+	for (int readers = 1; readers <= maxReaders; readers *= 2)
+	{
+		double locked = Measure<MutexNameSet>(names, readers, writerInterval, sink);
+		double lockFree = Measure<LockFreeNameSet>(names, readers, writerInterval, sink);
+		printf("%8d %18.1f %18.1f\n", readers, locked, lockFree);
+	}
+	return sink == 0;
+}
@@ -0,0 +1,130 @@
+#include "ConcurrentNameSet.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sfh;
+
+TEST(ConcurrentNameSet, InsertAndFind)
+{
+	ConcurrentNameSet set(64, 1024);
+	EXPECT_FALSE(set.Contains(L"Arial"));
+	set.Insert(L"Arial");
+	set.Insert(L"SimSun", std::wstring_view(L"\0\x190", 2));
+	EXPECT_TRUE(set.Contains(L"Arial"));
+	EXPECT_FALSE(set.Contains(L"arial"));
+	EXPECT_FALSE(set.Contains(L"Aria"));
+	// a key is found however it is split between key and suffix
+	EXPECT_TRUE(set.Contains(L"SimSun", std::wstring_view(L"\0\x190", 2)));
+	EXPECT_TRUE(set.Contains(std::wstring_view(L"SimSun\0\x190", 8)));
+	EXPECT_TRUE(set.Contains(L"Sim", std::wstring_view(L"Sun\0\x190", 5)));
+	EXPECT_FALSE(set.Contains(L"SimSun"));
+	// empty keys are never stored
+	set.Insert(L"");
+	EXPECT_FALSE(set.Contains(L""));
+}
+
+TEST(ConcurrentNameSet, EraseIfAndClear)
+{
+	ConcurrentNameSet set(64, 1024);
+	for (auto name : {L"a1", L"a2", L"b1"})
+		set.Insert(name);
+	set.EraseIf([](const std::wstring& key) { return key.starts_with(L"a"); });
+	EXPECT_FALSE(set.Contains(L"a1"));
+	EXPECT_FALSE(set.Contains(L"a2"));
+	EXPECT_TRUE(set.Contains(L"b1"));
+	set.Clear();
+	EXPECT_FALSE(set.Contains(L"b1"));
+}
+
+TEST(ConcurrentNameSet, FullSetStartsOver)
+{
+	// at most 8 keys, half of the slots
+	ConcurrentNameSet set(16, 1024);
+	for (int i = 0; i < 8; ++i)
+		set.Insert(std::to_wstring(i));
+	for (int i = 0; i < 8; ++i)
+		EXPECT_TRUE(set.Contains(std::to_wstring(i))) << i;
+	set.Insert(L"8");
+	EXPECT_TRUE(set.Contains(L"8"));
+	EXPECT_FALSE(set.Contains(L"0"));
+
+	// the arena runs out the same way, keys larger than it are dropped
+	ConcurrentNameSet small(64, 8);
+	small.Insert(L"abcd");
+	small.Insert(L"efgh");
+	EXPECT_TRUE(small.Contains(L"abcd"));
+	small.Insert(L"ijkl");
+	EXPECT_FALSE(small.Contains(L"abcd"));
+	EXPECT_TRUE(small.Contains(L"ijkl"));
+	small.Insert(L"123456789");
+	EXPECT_FALSE(small.Contains(L"123456789"));
+	EXPECT_TRUE(small.Contains(L"ijkl"));
+}
+
+// readers racing inserts, rebuilds by EraseIf and clears, meant to be run under thread sanitizer
+// (-DSFH_SANITIZER=thread). pinned keys are never removed so must always be found, keys that are
+// never inserted must never be found, however the reads interleave with the writes
+TEST(ConcurrentNameSet, ConcurrentReadersAndWriters)
+{
+	constexpr int PINNED = 64;
+	constexpr int READERS = 4;
+	ConcurrentNameSet set(1024, 16 * 1024);
+	for (int i = 0; i < PINNED; ++i)
+		set.Insert(L"pinned " + std::to_wstring(i));
+
+	std::atomic<bool> stop = false;
+	std::atomic<uint64_t> reads = 0;
+	std::atomic<int> falseNegatives = 0;
+	std::atomic<int> falsePositives = 0;
+	std::vector<std::thread> threads;
+	for (int reader = 0; reader < READERS; ++reader)
+	{
+		threads.emplace_back([&, reader]()
+		{
+			std::wstring key;
+			uint64_t count = 0;
+			for (int i = reader; !stop.load(std::memory_order_relaxed); ++i)
+			{
+				key = L"pinned " + std::to_wstring(i % PINNED);
+				if (!set.Contains(key))
+					++falseNegatives;
+				// split differently from how it was inserted
+				if (!set.Contains(std::wstring_view(key).substr(0, 3), std::wstring_view(key).substr(3)))
+					++falseNegatives;
+				if (set.Contains(L"never " + std::to_wstring(i % 500)))
+					++falsePositives;
+				// churned keys may or may not be there, only the lookup itself is checked
+				set.Contains(L"churn ", std::to_wstring(i % 2000));
+				count += 4;
+			}
+			reads += count;
+		});
+	}
+	// one writer adding and dropping churn keys, the pinned ones survive every rebuild
+	threads.emplace_back([&]()
+	{
+		for (int round = 0; round < 200; ++round)
+		{
+			for (int i = 0; i < 200; ++i)
+				set.Insert(L"churn ", std::to_wstring(round * 200 + i));
+			set.EraseIf([](const std::wstring& key) { return key.starts_with(L"churn "); });
+		}
+		stop = true;
+	});
+	// a second writer racing the first on the write lock
+	threads.emplace_back([&]()
+	{
+		for (int i = 0; !stop.load(std::memory_order_relaxed); ++i)
+			set.Insert(L"pinned " + std::to_wstring(i % PINNED));
+	});
+	for (auto& thread : threads)
+		thread.join();
+	EXPECT_EQ(falseNegatives, 0);
+	EXPECT_EQ(falsePositives, 0);
+	EXPECT_GT(reads, 0u);
+}
@@ -0,0 +1,123 @@
+// what a client pays to get the bytes of a font file to GDI, mapping the daemon's shared blob
+// and copying it as AddFontMemResourceEx does against reading the file as AddFontResourceExW
+// does, with the file in the page cache and evicted from it. parsing by GDI costs the same
+// on both paths and is not measured.
+// usage: FontBlobBenchmark [font directory], defaults to /usr/share/fonts
+#include "FontBlobCache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace sfh;
+
+namespace
+{
+	std::vector<std::filesystem::path> FindFonts(const std::filesystem::path& directory)
+	{
+		std::vector<std::filesystem::path> ret;
+		std::error_code ec;
+		for (auto& entry : std::filesystem::recursive_directory_iterator(directory, ec))
+		{
+			auto extension = entry.path().extension().string();
+			if (extension == ".ttf" || extension == ".otf" || extension == ".ttc" || extension == ".otc")
+				ret.push_back(entry.path());
+		}
+		return ret;
+	}
+
+	size_t ReadFile(const std::filesystem::path& path, std::vector<char>& buffer)
+	{
+		std::ifstream input(path, std::ios::binary | std::ios::ate);
+		buffer.resize(static_cast<size_t>(input.tellg()));
+		input.seekg(0);
+		input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		return buffer.size();
+	}
+
+	// clean pages go without root, the next read comes from the disk
+	void EvictFromPageCache(const std::filesystem::path& path)
+	{
+		int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (file == -1)
+			return;
+		posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+		close(file);
+	}
+
+	template <typename Fn>
+	double Measure(int rounds, Fn&& fn)
+	{
+		std::chrono::duration<double, std::milli> elapsed{0};
+		for (int round = 0; round < rounds; ++round)
+			elapsed += fn();
+		return elapsed.count() / rounds;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	auto fonts = FindFonts(argc > 1 ? argv[1] : "/usr/share/fonts");
+	if (fonts.empty())
+	{
+		fprintf(stderr, "no fonts found\n");
+		return 1;
+	}
+
+	// what the daemon publishes
+	std::vector<std::unique_ptr<SharedBlob>> blobs;
+	std::vector<char> buffer;
+	size_t bytes = 0;
+	for (auto& font : fonts)
+	{
+		bytes += ReadFile(font, buffer);
+		blobs.push_back(SharedBlob::Create(L"FontBlobBenchmark" + std::to_wstring(blobs.size()), buffer.data(),
+		                                   buffer.size()));
+	}
+
+	constexpr int ROUNDS = 10;
+	size_t sink = 0;
+	auto timePass = [&](auto&& loadOne)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < fonts.size(); ++i)
+			sink += loadOne(i);
+		return std::chrono::steady_clock::now() - start;
+	};
+	double memory = Measure(ROUNDS, [&]()
+	{
+		return timePass([&](size_t i)
+		{
+			auto blob = SharedBlob::Open(blobs[i]->GetName(), blobs[i]->GetSize());
+			if (!blob)
+				return size_t{0};
+			buffer.resize(blob->GetSize());
+			memcpy(buffer.data(), blob->GetData(), blob->GetSize());
+			return buffer.size();
+		});
+	});
+	double warm = Measure(ROUNDS, [&]()
+	{
+		return timePass([&](size_t i) { return ReadFile(fonts[i], buffer); });
+	});
+	double cold = Measure(ROUNDS, [&]()
+	{
+		for (auto& font : fonts)
+			EvictFromPageCache(font);
+		return timePass([&](size_t i) { return ReadFile(fonts[i], buffer); });
+	});
+
+	double megabytes = static_cast<double>(bytes) / (1024 * 1024);
+	printf("%zu files, %.1f MB\n", fonts.size(), megabytes);
+	printf("shared blob %.2f ms per pass (%.0f MB/s)\n", memory, megabytes / memory * 1000);
+	printf("file, cached %.2f ms per pass (%.0f MB/s), %.1fx the blob\n", warm, megabytes / warm * 1000, warm / memory);
+	printf("file, evicted %.2f ms per pass (%.0f MB/s), %.1fx the blob\n", cold, megabytes / cold * 1000, cold / memory);
+	return sink == 0;
+}
@@ -0,0 +1,240 @@
+#include "FontBlobCache.h"
+
+#include <gtest/gtest.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+
+using namespace sfh;
+
+namespace
+{
+	std::unique_ptr<FontBlobCache> MakeCache(uint64_t budget)
+	{
+		return std::make_unique<FontBlobCache>(L"sfh-blob-test-", budget);
+	}
+
+	void InsertFilled(FontBlobCache& cache, const std::wstring& path, size_t size)
+	{
+		std::string content(size, static_cast<char>(path.back()));
+		cache.Insert(path, content.data(), content.size());
+	}
+
+	// the content of a blob as another process would map it
+	std::optional<std::string> MapBlob(const FontBlobCache::BlobInfo& info)
+	{
+		auto blob = SharedBlob::Open(info.m_name, static_cast<size_t>(info.m_size));
+		if (!blob)
+			return std::nullopt;
+		return std::string(static_cast<const char*>(blob->GetData()), blob->GetSize());
+	}
+
+	// font files under the temp directory, removed with the fixture
+	class FontBlobCacheTest : public testing::Test
+	{
+	protected:
+		std::filesystem::path m_root;
+
+		void SetUp() override
+		{
+			m_root = std::filesystem::temp_directory_path() /
+				(std::string("sfh-blobcache-") + testing::UnitTest::GetInstance()->current_test_info()->name());
+			std::filesystem::remove_all(m_root);
+			std::filesystem::create_directories(m_root);
+		}
+
+		void TearDown() override
+		{
+			std::error_code ec;
+			std::filesystem::remove_all(m_root, ec);
+		}
+
+		std::wstring MakeFile(const std::string& name, size_t size, char fill)
+		{
+			auto path = m_root / name;
+			std::ofstream output(path, std::ios::binary);
+			output << std::string(size, fill);
+			return path.wstring();
+		}
+	};
+
+	// files are read on the worker, waits for one to show up
+	std::optional<FontBlobCache::BlobInfo> WaitForBlob(FontBlobCache& cache, const std::wstring& path)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (std::chrono::steady_clock::now() < deadline)
+		{
+			if (auto info = cache.Find(path))
+				return info;
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		return std::nullopt;
+	}
+}
+
+TEST(FontBlobCache, InsertEvictsLeastRecentlyUsed)
+{
+	auto cache = MakeCache(300);
+	InsertFilled(*cache, L"a", 100);
+	InsertFilled(*cache, L"b", 100);
+	InsertFilled(*cache, L"c", 100);
+	EXPECT_EQ(cache->GetUsed(), 300u);
+
+	InsertFilled(*cache, L"d", 100);
+	EXPECT_EQ(cache->GetUsed(), 300u);
+	EXPECT_FALSE(cache->Find(L"a"));
+	EXPECT_TRUE(cache->Find(L"b"));
+	EXPECT_TRUE(cache->Find(L"c"));
+	EXPECT_TRUE(cache->Find(L"d"));
+
+	// one large file pushes out several
+	InsertFilled(*cache, L"e", 250);
+	EXPECT_EQ(cache->GetUsed(), 250u);
+	EXPECT_FALSE(cache->Find(L"d"));
+	auto info = cache->Find(L"e");
+	ASSERT_TRUE(info);
+	EXPECT_EQ(info->m_size, 250u);
+	EXPECT_EQ(MapBlob(*info), std::string(250, 'e'));
+}
+
+TEST(FontBlobCache, FindRefreshesRecency)
+{
+	auto cache = MakeCache(300);
+	InsertFilled(*cache, L"a", 100);
+	InsertFilled(*cache, L"b", 100);
+	InsertFilled(*cache, L"c", 100);
+	EXPECT_TRUE(cache->Find(L"a"));
+
+	InsertFilled(*cache, L"d", 100);
+	EXPECT_TRUE(cache->Find(L"a"));
+	EXPECT_FALSE(cache->Find(L"b"));
+}
+
+TEST(FontBlobCache, SetBudgetEvicts)
+{
+	auto cache = MakeCache(300);
+	InsertFilled(*cache, L"a", 100);
+	InsertFilled(*cache, L"b", 100);
+	InsertFilled(*cache, L"c", 100);
+
+	cache->SetBudget(150);
+	EXPECT_EQ(cache->GetUsed(), 100u);
+	EXPECT_TRUE(cache->Find(L"c"));
+	EXPECT_FALSE(cache->Find(L"b"));
+
+	// a budget of 0 empties and disables the cache
+	cache->SetBudget(0);
+	EXPECT_EQ(cache->GetUsed(), 0u);
+	InsertFilled(*cache, L"d", 1);
+	EXPECT_FALSE(cache->Find(L"d"));
+}
+
+TEST(FontBlobCache, RefusesFilesLargerThanBudget)
+{
+	auto cache = MakeCache(300);
+	InsertFilled(*cache, L"a", 100);
+	InsertFilled(*cache, L"b", 301);
+	EXPECT_FALSE(cache->Find(L"b"));
+	// nothing was evicted for it
+	EXPECT_TRUE(cache->Find(L"a"));
+	EXPECT_EQ(cache->GetUsed(), 100u);
+}
+
+TEST(FontBlobCache, InsertKeepsTheFirstCopy)
+{
+	auto cache = MakeCache(300);
+	InsertFilled(*cache, L"a", 100);
+	InsertFilled(*cache, L"a", 50);
+	EXPECT_EQ(cache->GetUsed(), 100u);
+	EXPECT_EQ(cache->Find(L"a")->m_size, 100u);
+}
+
+TEST_F(FontBlobCacheTest, WorkerReadsAdmittedFiles)
+{
+	auto cache = MakeCache(10000);
+	auto a = MakeFile("a.ttf", 3000, 'a');
+	auto b = MakeFile("b.ttf", 2000, 'b');
+	EXPECT_FALSE(cache->Find(a));
+	// admitted repeatedly, read and stored once
+	for (int i = 0; i < 10; ++i)
+		cache->Admit(a);
+	cache->Admit(b);
+
+	auto infoA = WaitForBlob(*cache, a);
+	auto infoB = WaitForBlob(*cache, b);
+	ASSERT_TRUE(infoA);
+	ASSERT_TRUE(infoB);
+	EXPECT_EQ(MapBlob(*infoA), std::string(3000, 'a'));
+	EXPECT_EQ(MapBlob(*infoB), std::string(2000, 'b'));
+	EXPECT_EQ(cache->GetUsed(), 5000u);
+
+	// already cached, admitting again changes nothing
+	cache->Admit(a);
+	auto again = WaitForBlob(*cache, a);
+	ASSERT_TRUE(again);
+	EXPECT_EQ(again->m_name, infoA->m_name);
+	EXPECT_EQ(cache->GetUsed(), 5000u);
+}
+
+TEST_F(FontBlobCacheTest, WorkerSkipsFilesLargerThanBudget)
+{
+	auto cache = MakeCache(1000);
+	auto large = MakeFile("large.ttf", 1001, 'l');
+	auto small = MakeFile("small.ttf", 10, 's');
+	cache->Admit(large);
+	cache->Admit(small);
+	// the queue is worked in order, once the small file is in the large one was handled
+	ASSERT_TRUE(WaitForBlob(*cache, small));
+	EXPECT_FALSE(cache->Find(large));
+	EXPECT_EQ(cache->GetUsed(), 10u);
+
+	// missing files are skipped as well
+	cache->Admit((m_root / "missing.ttf").wstring());
+	EXPECT_EQ(cache->GetUsed(), 10u);
+}
+
+TEST(SharedBlob, OpensThroughProcName)
+{
+	std::string content = "shared font bytes";
+	auto blob = SharedBlob::Create(L"sfh-blob-test", content.data(), content.size());
+	EXPECT_EQ(blob->GetName().rfind(L"/proc/" + std::to_wstring(getpid()) + L"/fd/", 0), 0u);
+
+	auto opened = SharedBlob::Open(blob->GetName(), content.size());
+	ASSERT_TRUE(opened);
+	EXPECT_EQ(std::string(static_cast<const char*>(opened->GetData()), opened->GetSize()), content);
+	// a prefix may be mapped, more than the blob holds may not
+	EXPECT_TRUE(SharedBlob::Open(blob->GetName(), 5));
+	EXPECT_FALSE(SharedBlob::Open(blob->GetName(), content.size() + 1));
+	EXPECT_FALSE(SharedBlob::Open(blob->GetName(), 0));
+	EXPECT_FALSE(SharedBlob::Open(L"/proc/self/fd/999999", 1));
+	EXPECT_THROW(SharedBlob::Create(L"empty", content.data(), 0), std::runtime_error);
+}
+
+TEST(SharedBlob, OpensFromAnotherProcess)
+{
+	std::string content(100000, 'x');
+	content[99999] = 'y';
+	auto blob = SharedBlob::Create(L"sfh-blob-test", content.data(), content.size());
+	pid_t child = fork();
+	ASSERT_NE(child, -1);
+	if (child == 0)
+	{
+		// the name still refers to the parent's descriptor
+		auto opened = SharedBlob::Open(blob->GetName(), content.size());
+		bool same = opened && memcmp(opened->GetData(), content.data(), content.size()) == 0;
+		_exit(same ? 0 : 1);
+	}
+	int status = 0;
+	ASSERT_EQ(waitpid(child, &status, 0), child);
+	ASSERT_TRUE(WIFEXITED(status));
+	EXPECT_EQ(WEXITSTATUS(status), 0);
+}
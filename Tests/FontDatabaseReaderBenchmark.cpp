@@ -0,0 +1,126 @@
+// parse throughput of the font database reader on a generated index in the current format
+// and in the legacy one with a path attribute per face, the document is in memory so only
+// parsing and interning are measured
+#include "FontDatabaseWriter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+
+using namespace sfh;
+
+namespace
+{
+	using NameElement = FontDatabase::FontFaceElement::NameElement;
+
+	// a library of font packs, a few hundred directories holding a few dozen files each
+	FontDatabase MakeDatabase(size_t faceCount)
+	{
+		std::mt19937 rng(1);
+		FontDatabase db;
+		for (size_t i = 0; i < faceCount; ++i)
+		{
+			auto& face = db.m_fonts.emplace_back();
+			std::wstring family = L"Family " + std::to_wstring(rng() % (faceCount / 4 + 1));
+			if (i % 10 == 0)
+				family += L" \u601d\u6e90\u9ed1\u4f53";
+			std::wstring path = L"D:\\Fonts\\Pack " + std::to_wstring(i / 40) + L"\\" + family + L" " + std::to_wstring(i) + L".ttf";
+			FontDatabase::SetPath(db.m_strings, face, path);
+			face.m_index = 0;
+			face.m_weight = 100 * (1 + rng() % 9);
+			face.m_oblique = rng() % 2;
+			face.m_psOutline = rng() % 2;
+			face.m_codePageRange1 = rng();
+			face.m_stableId = (static_cast<uint64_t>(rng()) << 32) | rng();
+			face.m_names.emplace_back(NameElement::Win32FamilyName, db.m_strings.Intern(family));
+			face.m_names.emplace_back(NameElement::FullName, db.m_strings.Intern(family + L" Bold"));
+			face.m_names.emplace_back(NameElement::PostScriptName, db.m_strings.Intern(L"Family-Bold" + std::to_wstring(i)));
+		}
+		return db;
+	}
+
+	std::string WriteToString(const FontDatabase& db)
+	{
+		auto path = std::filesystem::temp_directory_path() / "sfh-reader-benchmark.xml";
+		FontDatabase::WriteToFile(path.wstring(), db);
+		std::ifstream input(path, std::ios::binary);
+		std::string ret{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+		input.close();
+		std::filesystem::remove(path);
+		return ret;
+	}
+
+	// the same faces with the directory inlined into a path attribute
+	std::string MakeLegacy(const std::string& document)
+	{
+		std::vector<std::string> directories;
+		std::string ret;
+		size_t pos = 0;
+		for (;;)
+		{
+			size_t directory = document.find("<Directory id=\"", pos);
+			size_t face = document.find("<FontFace directory=\"", pos);
+			if (directory == std::string::npos && face == std::string::npos)
+				break;
+			if (directory < face)
+			{
+				size_t start = document.find('>', directory) + 1;
+				size_t end = document.find("</Directory>", start);
+				directories.push_back(document.substr(start, end - start));
+				ret.append(document, pos, directory - pos);
+				pos = document.find('\n', end) + 1;
+				continue;
+			}
+			size_t idStart = face + 21;
+			size_t idEnd = document.find('"', idStart);
+			size_t fileStart = document.find("file=\"", idEnd) + 6;
+			ret.append(document, pos, face - pos);
+			ret += "<FontFace path=\"";
+			ret += directories[std::stoul(document.substr(idStart, idEnd - idStart))];
+			pos = fileStart;
+		}
+		ret.append(document, pos);
+		return ret;
+	}
+
+	template <typename Fn>
+	double Measure(int rounds, Fn&& fn)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int round = 0; round < rounds; ++round)
+			fn();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / rounds;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t faceCount = argc > 1 ? std::stoul(argv[1]) : 200000;
+	auto current = WriteToString(MakeDatabase(faceCount));
+	auto legacy = MakeLegacy(current);
+	if (FontDatabase::ReadFromMemory(legacy.data(), legacy.size())->m_fonts.size() != faceCount)
+	{
+		fprintf(stderr, "legacy document is broken\n");
+		return 1;
+	}
+
+	constexpr int ROUNDS = 10;
+	size_t sink = 0;
+	for (auto [label, document] : {std::pair{"current", &current}, std::pair{"legacy path", &legacy}})
+	{
+		double seconds = Measure(ROUNDS, [&]()
+		{
+			sink += FontDatabase::ReadFromMemory(document->data(), document->size())->m_fonts.size();
+		});
+		printf("%-12s %6.1f MB, %7.1f ms, %6.0f MB/s, %5.2f M faces/s\n", label,
+		       static_cast<double>(document->size()) / (1024 * 1024), seconds * 1000,
+		       static_cast<double>(document->size()) / seconds / (1024 * 1024),
+		       static_cast<double>(faceCount) / seconds / 1e6);
+	}
+	return sink == 0;
+}
@@ -0,0 +1,179 @@
+#include "PersistantData.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace sfh;
+
+namespace
+{
+	std::unique_ptr<FontDatabase> Read(std::string_view document)
+	{
+		return FontDatabase::ReadFromMemory(document.data(), document.size());
+	}
+
+	std::wstring GetName(const FontDatabase& db, size_t face, size_t name)
+	{
+		return std::wstring(db.GetString(db.m_fonts[face].m_names[name].m_name));
+	}
+
+	constexpr const char* FACE_ATTRIBUTES = R"(directory="0" file="a.ttf" index="0" weight="400" oblique="0" psOutline="1")";
+
+	std::string WithFace(std::string_view face)
+	{
+		return std::string("<FontDatabase><Directory id=\"0\">C:\\</Directory>") + std::string(face) + "</FontDatabase>";
+	}
+}
+
+TEST(FontDatabaseReader, CurrentFormat)
+{
+	auto db = Read("\xef\xbb\xbf<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\r\n"
+		"<!-- written by hand -->\r\n"
+		"<FontDatabase>\r\n"
+		"\t<Directory id=\"0\">C:\\Fonts\\</Directory>\r\n"
+		"\t<Directory id='1'>D:\\&#x5b57;\\</Directory>\r\n"
+		"\t<FontFace directory=\"1\" file=\"x.ttc\" index=\"2\" weight=\"700\" oblique=\"1\" psOutline=\"0\""
+		" width=\"3\" codePageRange1=\"1\" codePageRange2=\"2\" stableId=\"18446744073709551615\" future=\"?\">\r\n"
+		"\t\t<Win32FamilyName>Family</Win32FamilyName>\r\n"
+		"\t\t<!-- between names -->\r\n"
+		"\t\t<FullName />\r\n"
+		"\t\t<TypographicSubfamilyName>Bold &amp; Wide</TypographicSubfamilyName>\r\n"
+		"\t</FontFace>\r\n"
+		"\t<RemovedFontFace directory=\"0\" file=\"old.ttf\" index=\"0\"/>\r\n"
+		"</FontDatabase>\r\n");
+	ASSERT_EQ(db->m_fonts.size(), 1u);
+	auto& face = db->m_fonts[0];
+	EXPECT_EQ(db->GetPath(face), L"D:\\\u5b57\\x.ttc");
+	EXPECT_EQ(face.m_index, 2u);
+	EXPECT_EQ(face.m_weight, 700u);
+	EXPECT_EQ(face.m_oblique, 1u);
+	EXPECT_EQ(face.m_psOutline, 0u);
+	EXPECT_EQ(face.m_width, 3u);
+	EXPECT_EQ(face.m_codePageRange1, 1u);
+	EXPECT_EQ(face.m_codePageRange2, 2u);
+	EXPECT_EQ(face.m_stableId, 18446744073709551615u);
+	ASSERT_EQ(face.m_names.size(), 3u);
+	EXPECT_EQ(face.m_names[0].m_type, FontDatabase::FontFaceElement::NameElement::Win32FamilyName);
+	EXPECT_EQ(GetName(*db, 0, 0), L"Family");
+	EXPECT_EQ(GetName(*db, 0, 1), L"");
+	EXPECT_EQ(GetName(*db, 0, 2), L"Bold & Wide");
+	ASSERT_EQ(db->m_removedFonts.size(), 1u);
+	EXPECT_EQ(db->GetPath(db->m_removedFonts[0]), L"C:\\Fonts\\old.ttf");
+}
+
+TEST(FontDatabaseReader, LegacyPathAttribute)
+{
+	// index files written before directories were pooled, without the optional attributes
+	auto db = Read("<?xml version=\"1.0\"?>\n"
+		"<FontDatabase>\n"
+		"<FontFace path=\"C:\\Fonts\\a.ttf\" index=\"0\" weight=\"400\" oblique=\"0\" psOutline=\"1\">\n"
+		"<Win32FamilyName>A</Win32FamilyName>\n"
+		"</FontFace>\n"
+		"<FontFace path=\"C:\\Fonts\\b.ttf\" index=\"1\" weight=\"400\" oblique=\"0\" psOutline=\"1\"/>\n"
+		"<FontFace path=\"nodirectory.otf\" index=\"0\" weight=\"400\" oblique=\"0\" psOutline=\"1\"/>\n"
+		"<RemovedFontFace path=\"C:\\Fonts\\c.ttf\" index=\"0\"/>\n"
+		"</FontDatabase>");
+	ASSERT_EQ(db->m_fonts.size(), 3u);
+	EXPECT_EQ(db->GetPath(db->m_fonts[0]), L"C:\\Fonts\\a.ttf");
+	EXPECT_EQ(db->GetPath(db->m_fonts[1]), L"C:\\Fonts\\b.ttf");
+	// the directory is pooled all the same
+	EXPECT_EQ(db->m_fonts[0].m_directory, db->m_fonts[1].m_directory);
+	EXPECT_EQ(db->GetPath(db->m_fonts[2]), L"nodirectory.otf");
+	EXPECT_EQ(db->m_fonts[0].m_width, 5u);
+	EXPECT_EQ(db->m_fonts[0].m_stableId, 0u);
+	EXPECT_EQ(GetName(*db, 0, 0), L"A");
+	ASSERT_EQ(db->m_removedFonts.size(), 1u);
+	EXPECT_EQ(db->GetPath(db->m_removedFonts[0]), L"C:\\Fonts\\c.ttf");
+}
+
+TEST(FontDatabaseReader, LineEnds)
+{
+	auto db = Read(WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + ">"
+		"<FullName>a\r\nb\rc&#13;d\te</FullName></FontFace>"));
+	EXPECT_EQ(GetName(*db, 0, 0), L"a\nb\nc\rd\te");
+
+	db = Read("<FontDatabase><FontFace path=\"C:\\a\r\nb\tc&#9;.ttf\" index=\"0\" weight=\"400\" oblique=\"0\" psOutline=\"1\"/></FontDatabase>");
+	EXPECT_EQ(db->GetPath(db->m_fonts[0]), L"C:\\a b c\t.ttf");
+}
+
+TEST(FontDatabaseReader, EmptyDatabase)
+{
+	EXPECT_TRUE(Read("<FontDatabase/>")->m_fonts.empty());
+	EXPECT_TRUE(Read("  <FontDatabase>\n</FontDatabase>\n  ")->m_fonts.empty());
+}
+
+TEST(FontDatabaseReader, MalformedInputThrows)
+{
+	const std::string FACE = std::string("<FontFace ") + FACE_ATTRIBUTES + "/>";
+	const std::string BAD[] = {
+		"",
+		"\xef\xbb\xbf",
+		"<FontDatabase>",
+		"<Other/>",
+		"<FontDatabase></Other>",
+		"<FontDatabase/><FontDatabase/>",
+		"<FontDatabase/>trailing",
+		"<!DOCTYPE FontDatabase><FontDatabase/>",
+		"<FontDatabase><!-- unterminated </FontDatabase>",
+		"<FontDatabase><Unknown/></FontDatabase>",
+		// directory ids out of order or undefined
+		"<FontDatabase><Directory id=\"1\">C:\\</Directory></FontDatabase>",
+		"<FontDatabase><Directory>C:\\</Directory></FontDatabase>",
+		"<FontDatabase><FontFace directory=\"0\" file=\"a\" index=\"0\" weight=\"1\" oblique=\"0\" psOutline=\"0\"/></FontDatabase>",
+		// required attributes
+		WithFace("<FontFace directory=\"0\" file=\"a.ttf\" index=\"0\" weight=\"400\" oblique=\"0\"/>"),
+		WithFace("<FontFace file=\"a.ttf\" index=\"0\" weight=\"400\" oblique=\"0\" psOutline=\"1\"/>"),
+		WithFace("<RemovedFontFace directory=\"0\" file=\"a.ttf\"/>"),
+		// numbers
+		WithFace("<FontFace directory=\"0\" file=\"a.ttf\" index=\"-1\" weight=\"400\" oblique=\"0\" psOutline=\"1\"/>"),
+		WithFace("<FontFace directory=\"0\" file=\"a.ttf\" index=\"4294967296\" weight=\"400\" oblique=\"0\" psOutline=\"1\"/>"),
+		WithFace("<FontFace directory=\"0\" file=\"a.ttf\" index=\"\" weight=\"400\" oblique=\"0\" psOutline=\"1\"/>"),
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + " stableId=\"18446744073709551616\"/>"),
+		// attribute syntax
+		WithFace("<FontFace directory=0 file=\"a.ttf\"/>"),
+		WithFace("<FontFace directory=\"0\" file=\"a<b.ttf\"/>"),
+		WithFace("<FontFace directory=\"0\" file=\"a.ttf"),
+		// references and encoding
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><FullName>&nbsp;</FullName></FontFace>"),
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><FullName>&amp</FullName></FontFace>"),
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><FullName>&#0;</FullName></FontFace>"),
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><FullName>&#xd800;</FullName></FontFace>"),
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><FullName>&#x110000;</FullName></FontFace>"),
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><FullName>&#12a;</FullName></FontFace>"),
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><FullName>\xc0\xaf</FullName></FontFace>"),
+		// names
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><Nickname>x</Nickname></FontFace>"),
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><FullName>x</Win32FamilyName></FontFace>"),
+		WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><FullName>x</FullName>"),
+	};
+	for (auto& bad : BAD)
+		EXPECT_THROW(Read(bad), std::runtime_error) << bad;
+	// the valid face used above does parse
+	EXPECT_NO_THROW(Read(WithFace(FACE)));
+}
+
+TEST(FontDatabaseReader, EveryTruncationThrows)
+{
+	std::string document = WithFace(std::string("<FontFace ") + FACE_ATTRIBUTES + "><FullName>a &amp; b</FullName></FontFace>");
+	for (size_t length = 0; length < document.size(); ++length)
+	{
+		// an exactly sized copy, reads past it show up under address sanitizer
+		std::vector<char> copy(document.begin(), document.begin() + static_cast<ptrdiff_t>(length));
+		EXPECT_THROW(FontDatabase::ReadFromMemory(copy.data(), copy.size()), std::runtime_error) << length;
+	}
+}
+
+TEST(FontDatabaseReader, ErrorsCarryOffset)
+{
+	try
+	{
+		Read("<FontDatabase><Unknown/></FontDatabase>");
+		FAIL();
+	}
+	catch (std::runtime_error& e)
+	{
+		EXPECT_NE(std::string(e.what()).find("unexpected element at offset 24"), std::string::npos) << e.what();
+	}
+}
@@ -0,0 +1,188 @@
+#include "FontDatabaseWriter.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+using namespace sfh;
+
+namespace
+{
+	using FontFaceElement = FontDatabase::FontFaceElement;
+	using NameElement = FontFaceElement::NameElement;
+
+	// a file in the temp directory removed with the fixture
+	class FontDatabaseWriterTest : public testing::Test
+	{
+	protected:
+		std::filesystem::path m_path;
+
+		void SetUp() override
+		{
+			auto name = std::string("sfh-writer-") + testing::UnitTest::GetInstance()->current_test_info()->name() + ".xml";
+			m_path = std::filesystem::temp_directory_path() / name;
+		}
+
+		void TearDown() override
+		{
+			std::error_code ec;
+			std::filesystem::remove(m_path, ec);
+		}
+
+		std::unique_ptr<FontDatabase> RoundTrip(const FontDatabase& db)
+		{
+			FontDatabase::WriteToFile(m_path.wstring(), db);
+			return FontDatabase::ReadFromFile(m_path.wstring());
+		}
+
+		std::string ReadRaw() const
+		{
+			std::ifstream input(m_path, std::ios::binary);
+			return {std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+		}
+	};
+
+	FontFaceElement& AddFace(FontDatabase& db, std::wstring_view path, std::initializer_list<std::wstring_view> names)
+	{
+		auto& face = db.m_fonts.emplace_back();
+		FontDatabase::SetPath(db.m_strings, face, path);
+		face.m_index = 0;
+		face.m_weight = 400;
+		face.m_oblique = 0;
+		face.m_psOutline = 1;
+		for (auto name : names)
+			face.m_names.emplace_back(NameElement::FullName, db.m_strings.Intern(name));
+		return face;
+	}
+
+	std::wstring GetName(const FontDatabase& db, size_t face, size_t name)
+	{
+		return std::wstring(db.GetString(db.m_fonts[face].m_names[name].m_name));
+	}
+}
+
+TEST_F(FontDatabaseWriterTest, AllFields)
+{
+	FontDatabase db;
+	auto& face = AddFace(db, L"C:\\Fonts\\a.ttc", {});
+	face.m_index = 3;
+	face.m_weight = 700;
+	face.m_oblique = 1;
+	face.m_psOutline = 0;
+	face.m_width = 7;
+	face.m_codePageRange1 = 0xffffffff;
+	face.m_codePageRange2 = 0x80000000;
+	face.m_stableId = 0xfedcba9876543210;
+	for (size_t type = 0; type < std::size(NameElement::TYPEMAP); ++type)
+		face.m_names.emplace_back(static_cast<NameElement::NameType>(type), db.m_strings.Intern(NameElement::TYPEMAP[type]));
+	AddFace(db, L"C:\\Fonts\\b.ttf", {L"B"});
+	auto& removed = db.m_removedFonts.emplace_back();
+	FontDatabase::SetPath(db.m_strings, removed, L"D:\\Old\\c.otf");
+	removed.m_index = 2;
+
+	auto read = RoundTrip(db);
+	ASSERT_EQ(read->m_fonts.size(), 2u);
+	auto& back = read->m_fonts[0];
+	EXPECT_EQ(read->GetPath(back), L"C:\\Fonts\\a.ttc");
+	EXPECT_EQ(back.m_index, 3u);
+	EXPECT_EQ(back.m_weight, 700u);
+	EXPECT_EQ(back.m_oblique, 1u);
+	EXPECT_EQ(back.m_psOutline, 0u);
+	EXPECT_EQ(back.m_width, 7u);
+	EXPECT_EQ(back.m_codePageRange1, 0xffffffffu);
+	EXPECT_EQ(back.m_codePageRange2, 0x80000000u);
+	EXPECT_EQ(back.m_stableId, 0xfedcba9876543210u);
+	ASSERT_EQ(back.m_names.size(), std::size(NameElement::TYPEMAP));
+	for (size_t i = 0; i < back.m_names.size(); ++i)
+	{
+		EXPECT_EQ(back.m_names[i].m_type, i);
+		EXPECT_EQ(read->GetString(back.m_names[i].m_name), NameElement::TYPEMAP[i]);
+	}
+	// both faces share the directory element
+	EXPECT_EQ(read->m_fonts[1].m_directory, back.m_directory);
+	ASSERT_EQ(read->m_removedFonts.size(), 1u);
+	EXPECT_EQ(read->GetPath(read->m_removedFonts[0]), L"D:\\Old\\c.otf");
+	EXPECT_EQ(read->m_removedFonts[0].m_index, 2u);
+}
+
+TEST_F(FontDatabaseWriterTest, Escaping)
+{
+	const std::wstring SPECIAL = L"<a & b> \"quoted\" 'single' &amp; ]]>";
+	FontDatabase db;
+	AddFace(db, L"C:\\R&D <new>\\\"x\" & 'y'.ttf", {SPECIAL});
+	auto read = RoundTrip(db);
+	EXPECT_EQ(read->GetPath(read->m_fonts[0]), L"C:\\R&D <new>\\\"x\" & 'y'.ttf");
+	EXPECT_EQ(GetName(*read, 0, 0), SPECIAL);
+}
+
+TEST_F(FontDatabaseWriterTest, Whitespace)
+{
+	// raw line ends in text would come back as \n, tabs and line ends in attributes as spaces
+	FontDatabase db;
+	AddFace(db, L"C:\\a\tb\r\nc\rd\ne.ttf", {L"cr\rlf\ncrlf\r\ntab\t end ", L"  \r\n  "});
+	auto read = RoundTrip(db);
+	EXPECT_EQ(read->GetPath(read->m_fonts[0]), L"C:\\a\tb\r\nc\rd\ne.ttf");
+	EXPECT_EQ(GetName(*read, 0, 0), L"cr\rlf\ncrlf\r\ntab\t end ");
+	EXPECT_EQ(GetName(*read, 0, 1), L"  \r\n  ");
+}
+
+TEST_F(FontDatabaseWriterTest, NonAscii)
+{
+	FontDatabase db;
+	AddFace(db, L"D:\\字体\\\U0001f600.ttf", {L"思源黑体 \U00020000\U0010ffff", L"\u00e9\u0800\uffff"});
+	auto read = RoundTrip(db);
+	EXPECT_EQ(read->GetPath(read->m_fonts[0]), L"D:\\字体\\\U0001f600.ttf");
+	EXPECT_EQ(GetName(*read, 0, 0), L"思源黑体 \U00020000\U0010ffff");
+	EXPECT_EQ(GetName(*read, 0, 1), L"\u00e9\u0800\uffff");
+	// written as utf-8, not as references
+	EXPECT_NE(ReadRaw().find("\xf0\x9f\x98\x80"), std::string::npos);
+}
+
+TEST_F(FontDatabaseWriterTest, ControlCharactersAreDropped)
+{
+	// not representable in XML 1.0, the rest of the string survives
+	FontDatabase db;
+	std::wstring name = L"a";
+	for (wchar_t ch = 1; ch < 0x20; ++ch)
+	{
+		if (ch != L'\t' && ch != L'\n' && ch != L'\r')
+			name += ch;
+	}
+	name += L"b";
+	AddFace(db, L"C:\\x\x01y\x1f.ttf", {name});
+	auto read = RoundTrip(db);
+	EXPECT_EQ(read->GetPath(read->m_fonts[0]), L"C:\\xy.ttf");
+	EXPECT_EQ(GetName(*read, 0, 0), L"ab");
+}
+
+TEST_F(FontDatabaseWriterTest, EmptyStrings)
+{
+	FontDatabase db;
+	AddFace(db, L"nodirectory.ttf", {L""});
+	FontDatabase empty;
+	auto read = RoundTrip(db);
+	EXPECT_EQ(read->GetPath(read->m_fonts[0]), L"nodirectory.ttf");
+	EXPECT_EQ(GetName(*read, 0, 0), L"");
+	EXPECT_TRUE(RoundTrip(empty)->m_fonts.empty());
+}
+
+TEST_F(FontDatabaseWriterTest, UnpairedSurrogateThrows)
+{
+	FontDatabase db;
+	std::wstring name = L"a";
+	if constexpr (sizeof(wchar_t) == 2)
+		name += static_cast<wchar_t>(0xd800);
+	else
+		name += static_cast<wchar_t>(0x110000);
+	AddFace(db, L"C:\\a.ttf", {name});
+	EXPECT_THROW(FontDatabase::WriteToFile(m_path.wstring(), db), std::runtime_error);
+}
+
+TEST_F(FontDatabaseWriterTest, UnwritablePathThrows)
+{
+	EXPECT_THROW(FontDatabaseWriter((m_path / "missing" / "x.xml").wstring()), std::runtime_error);
+}
@@ -0,0 +1,237 @@
+#include "InvalidationRing.h"
+
+#include <gtest/gtest.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace sfh;
+
+namespace
+{
+	struct ReadName
+	{
+		std::wstring m_name;
+		bool m_prefix;
+	};
+
+	// a shm name of its own per test, unlinked with the fixture
+	class InvalidationRingTest : public testing::Test
+	{
+	protected:
+		std::wstring m_name;
+
+		void SetUp() override
+		{
+			std::string testName = testing::UnitTest::GetInstance()->current_test_info()->name();
+			m_name = L"sfh-ring-test-" + std::to_wstring(getpid()) + L"-" + std::wstring(testName.begin(), testName.end());
+			shm_unlink(ShmName().c_str());
+		}
+
+		void TearDown() override
+		{
+			shm_unlink(ShmName().c_str());
+		}
+
+		std::string ShmName() const
+		{
+			return "/" + std::string(m_name.begin(), m_name.end());
+		}
+
+		std::unique_ptr<InvalidationRing> Open(bool writer)
+		{
+			return std::make_unique<InvalidationRing>(m_name, writer);
+		}
+
+		static bool Read(const InvalidationRing& ring, uint64_t& position, std::vector<ReadName>& names)
+		{
+			return ring.ReadSince(position, [&](std::wstring_view name, bool prefix)
+			{
+				names.push_back({std::wstring(name), prefix});
+			});
+		}
+	};
+}
+
+TEST_F(InvalidationRingTest, ReadsNamesInOrder)
+{
+	auto writer = Open(true);
+	auto reader = Open(false);
+	writer->Append(1, L"arial");
+	writer->Append(1, L"simhei");
+	EXPECT_EQ(writer->BumpVersion(), 1u);
+	EXPECT_EQ(reader->GetVersion(), 1u);
+
+	uint64_t position = 0;
+	std::vector<ReadName> names;
+	ASSERT_TRUE(Read(*reader, position, names));
+	EXPECT_EQ(position, 2u);
+	ASSERT_EQ(names.size(), 2u);
+	EXPECT_EQ(names[0].m_name, L"arial");
+	EXPECT_FALSE(names[0].m_prefix);
+	EXPECT_EQ(names[1].m_name, L"simhei");
+
+	// nothing new, nothing read
+	names.clear();
+	EXPECT_TRUE(Read(*reader, position, names));
+	EXPECT_TRUE(names.empty());
+
+	writer->Append(2, L"consolas");
+	writer->BumpVersion();
+	ASSERT_TRUE(Read(*reader, position, names));
+	ASSERT_EQ(names.size(), 1u);
+	EXPECT_EQ(names[0].m_name, L"consolas");
+}
+
+TEST_F(InvalidationRingTest, ReaderTooFarBehindDropsEverything)
+{
+	auto writer = Open(true);
+	auto reader = Open(false);
+	for (uint32_t i = 0; i <= InvalidationRing::CAPACITY; ++i)
+		writer->Append(1, L"font" + std::to_wstring(i));
+	writer->BumpVersion();
+
+	uint64_t position = 0;
+	std::vector<ReadName> names;
+	EXPECT_FALSE(Read(*reader, position, names));
+	EXPECT_TRUE(names.empty());
+	EXPECT_EQ(position, InvalidationRing::CAPACITY + 1u);
+
+	// exactly a ring behind is still readable
+	for (uint32_t i = 0; i < InvalidationRing::CAPACITY; ++i)
+		writer->Append(2, L"font" + std::to_wstring(i));
+	EXPECT_TRUE(Read(*reader, position, names));
+	EXPECT_EQ(names.size(), InvalidationRing::CAPACITY);
+	EXPECT_EQ(names.back().m_name, L"font" + std::to_wstring(InvalidationRing::CAPACITY - 1));
+}
+
+TEST_F(InvalidationRingTest, FlushStopsTheRead)
+{
+	auto writer = Open(true);
+	auto reader = Open(false);
+	writer->Append(1, L"arial");
+	writer->AppendFlush(1);
+	writer->Append(1, L"simhei");
+
+	uint64_t position = 0;
+	std::vector<ReadName> names;
+	EXPECT_FALSE(Read(*reader, position, names));
+	ASSERT_EQ(names.size(), 1u);
+	EXPECT_EQ(names[0].m_name, L"arial");
+	// the reader drops everything and continues after the flush
+	EXPECT_EQ(position, 3u);
+}
+
+TEST_F(InvalidationRingTest, LongNamesArriveAsPrefix)
+{
+	auto writer = Open(true);
+	auto reader = Open(false);
+	std::wstring exact(InvalidationRing::NAME_CAPACITY, L'x');
+	std::wstring longer = exact + L"yz";
+	writer->Append(1, exact);
+	writer->Append(1, longer);
+
+	uint64_t position = 0;
+	std::vector<ReadName> names;
+	ASSERT_TRUE(Read(*reader, position, names));
+	ASSERT_EQ(names.size(), 2u);
+	EXPECT_EQ(names[0].m_name, exact);
+	EXPECT_FALSE(names[0].m_prefix);
+	EXPECT_EQ(names[1].m_name, exact);
+	EXPECT_TRUE(names[1].m_prefix);
+}
+
+TEST_F(InvalidationRingTest, RingWithoutMagicReadsAsBehind)
+{
+	// only readers mapped it so far, the memory is still zero
+	auto reader = Open(false);
+	uint64_t position = 0;
+	std::vector<ReadName> names;
+	EXPECT_FALSE(Read(*reader, position, names));
+	EXPECT_EQ(reader->GetVersion(), 0u);
+
+	auto writer = Open(true);
+	EXPECT_TRUE(Read(*reader, position, names));
+}
+
+TEST_F(InvalidationRingTest, ConcurrentReaderNeverSeesTornNames)
+{
+	auto writer = Open(true);
+	auto reader = Open(false);
+	constexpr uint32_t APPENDS = 200000;
+	std::atomic<bool> done = false;
+	std::atomic<uint64_t> readerPosition = 0;
+
+	// the name appended at position i, lengths run past the capacity so prefixes are included
+	auto nameAt = [](uint64_t i)
+	{
+		size_t length = 1 + i % (InvalidationRing::NAME_CAPACITY + 8);
+		std::wstring ret(length, static_cast<wchar_t>(L'a' + i / 7 % 26));
+		ret[0] = static_cast<wchar_t>(L'A' + i % 26);
+		return ret;
+	};
+
+	// the first half stays well within the ring of the reader, the second half may get
+	// further ahead than the ring holds and overwrites entries while they are read
+	std::thread writerThread([&]()
+	{
+		for (uint32_t i = 0; i < APPENDS; ++i)
+		{
+			uint64_t window = i < APPENDS / 2 ? InvalidationRing::CAPACITY / 2 : InvalidationRing::CAPACITY * 3 / 2;
+			while (i - readerPosition > window)
+				std::this_thread::yield();
+			writer->Append(i, nameAt(i));
+			if (i % 64 == 0)
+				writer->BumpVersion();
+			// interleave with the reader on one core too, in bursts long enough to lap it
+			if (i % (i < APPENDS / 2 ? 256 : 3000) == 0)
+				std::this_thread::yield();
+		}
+		done = true;
+	});
+
+	// names come in ring order from where the read started, anything else is torn or stale
+	uint64_t position = 0;
+	uint64_t expected = 0;
+	size_t read = 0;
+	size_t fallBehind = 0;
+	size_t wrong = 0;
+	auto check = [&](std::wstring_view name, bool prefix)
+	{
+		// let the writer run in the middle of a read, on one core too
+		if (++read % 256 == 0)
+			std::this_thread::yield();
+		auto full = nameAt(expected++);
+		bool truncated = full.size() > InvalidationRing::NAME_CAPACITY;
+		if (prefix != truncated || name != std::wstring_view(full).substr(0, InvalidationRing::NAME_CAPACITY))
+			++wrong;
+	};
+	auto readOnce = [&]()
+	{
+		expected = position;
+		bool complete = reader->ReadSince(position, check);
+		if (!complete)
+			++fallBehind;
+		readerPosition = position;
+		return complete;
+	};
+	while (!done)
+		readOnce();
+	writerThread.join();
+	// the last read may still find the reader lapped, the one after it catches up
+	readOnce();
+	EXPECT_TRUE(readOnce());
+
+	EXPECT_EQ(wrong, 0u);
+	EXPECT_EQ(position, APPENDS);
+	EXPECT_GE(read, APPENDS / 2 - InvalidationRing::CAPACITY);
+	// a reader skipping parts of the ring reads less than everything
+	EXPECT_EQ(read == APPENDS, fallBehind == 0);
+}
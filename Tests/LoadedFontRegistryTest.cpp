@@ -0,0 +1,149 @@
+#include "LoadedFontRegistry.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace sfh;
+
+namespace
+{
+	// stands in for GDI, memory loads hand out increasing handles
+	struct FakeGdi
+	{
+		std::atomic<int> m_fileLoads = 0;
+		std::atomic<int> m_memoryLoads = 0;
+		std::atomic<uintptr_t> m_nextHandle = 1;
+		std::vector<std::pair<std::wstring, uintptr_t>> m_unloaded;
+
+		auto Loader(bool fromMemory, bool succeed = true)
+		{
+			return [this, fromMemory, succeed](const std::wstring&, uintptr_t& token)
+			{
+				if (!succeed)
+					return false;
+				if (fromMemory)
+				{
+					++m_memoryLoads;
+					token = m_nextHandle++;
+				}
+				else
+				{
+					++m_fileLoads;
+				}
+				return true;
+			};
+		}
+
+		auto Unloader()
+		{
+			return [this](const std::wstring& path, uintptr_t token) { m_unloaded.emplace_back(path, token); };
+		}
+	};
+}
+
+TEST(LoadedFontRegistry, LoadsOnce)
+{
+	LoadedFontRegistry registry;
+	FakeGdi gdi;
+	EXPECT_TRUE(registry.Acquire(L"C:\\Fonts\\A.ttf", false, gdi.Loader(false)));
+	EXPECT_TRUE(registry.Acquire(L"c:\\fonts\\a.TTF", false, gdi.Loader(false)));
+	EXPECT_TRUE(registry.Acquire(L"C:\\Fonts\\A.ttf", true, gdi.Loader(false)));
+	EXPECT_EQ(gdi.m_fileLoads, 1);
+
+	registry.ReleaseAll(gdi.Unloader());
+	ASSERT_EQ(gdi.m_unloaded.size(), 1u);
+	EXPECT_EQ(gdi.m_unloaded[0].first, L"C:\\Fonts\\A.ttf");
+	EXPECT_EQ(gdi.m_unloaded[0].second, 0u);
+}
+
+TEST(LoadedFontRegistry, EnumerationUpgradesMemoryLoad)
+{
+	LoadedFontRegistry registry;
+	FakeGdi gdi;
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", false, gdi.Loader(true)));
+	// memory serves another creation query but not enumeration
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", false, gdi.Loader(true)));
+	EXPECT_EQ(gdi.m_memoryLoads, 1);
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", true, gdi.Loader(false)));
+	EXPECT_EQ(gdi.m_fileLoads, 1);
+	// the file serves both from now on
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", true, gdi.Loader(false)));
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", false, gdi.Loader(true)));
+	EXPECT_EQ(gdi.m_fileLoads, 1);
+	EXPECT_EQ(gdi.m_memoryLoads, 1);
+
+	// both registrations are removed
+	registry.ReleaseAll(gdi.Unloader());
+	ASSERT_EQ(gdi.m_unloaded.size(), 2u);
+	EXPECT_EQ(gdi.m_unloaded[0].second, 1u);
+	EXPECT_EQ(gdi.m_unloaded[1].second, 0u);
+}
+
+TEST(LoadedFontRegistry, FileLoadServesMemoryRequests)
+{
+	LoadedFontRegistry registry;
+	FakeGdi gdi;
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", true, gdi.Loader(false)));
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", false, gdi.Loader(true)));
+	EXPECT_EQ(gdi.m_memoryLoads, 0);
+}
+
+TEST(LoadedFontRegistry, FailedLoadsAreRetried)
+{
+	LoadedFontRegistry registry;
+	FakeGdi gdi;
+	EXPECT_FALSE(registry.Acquire(L"A.ttf", false, gdi.Loader(false, false)));
+	EXPECT_THROW(registry.Acquire(L"A.ttf", false, [](const std::wstring&, uintptr_t&) -> bool
+	{
+		throw std::runtime_error("load failed");
+	}), std::runtime_error);
+	registry.ReleaseAll(gdi.Unloader());
+	EXPECT_TRUE(gdi.m_unloaded.empty());
+
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", false, gdi.Loader(false)));
+	EXPECT_EQ(gdi.m_fileLoads, 1);
+}
+
+TEST(LoadedFontRegistry, FailedUpgradeKeepsMemoryLoad)
+{
+	LoadedFontRegistry registry;
+	FakeGdi gdi;
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", false, gdi.Loader(true)));
+	EXPECT_FALSE(registry.Acquire(L"A.ttf", true, gdi.Loader(false, false)));
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", false, gdi.Loader(true)));
+	EXPECT_EQ(gdi.m_memoryLoads, 1);
+
+	// the upgrade is retried
+	EXPECT_TRUE(registry.Acquire(L"A.ttf", true, gdi.Loader(false)));
+	EXPECT_EQ(gdi.m_fileLoads, 1);
+}
+
+TEST(LoadedFontRegistry, ConcurrentRequestsLoadOnce)
+{
+	LoadedFontRegistry registry;
+	FakeGdi gdi;
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 8; ++i)
+	{
+		threads.emplace_back([&, i]()
+		{
+			for (int round = 0; round < 200; ++round)
+			{
+				auto path = L"Font" + std::to_wstring(round % 20) + L".ttf";
+				bool enumerable = (i + round) % 3 == 0;
+				EXPECT_TRUE(registry.Acquire(path, enumerable, gdi.Loader(!enumerable)));
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	// one file load per path, at most one memory load before it
+	EXPECT_EQ(gdi.m_fileLoads, 20);
+	EXPECT_LE(gdi.m_memoryLoads, 20);
+}
@@ -0,0 +1,272 @@
+#include "LocalFontCache.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace sfh;
+
+namespace
+{
+	constexpr uint64_t MB = 1024 * 1024;
+
+	// origin and cache directories under the temp directory, removed with the fixture
+	class LocalFontCacheTest : public testing::Test
+	{
+	protected:
+		std::filesystem::path m_root;
+		std::filesystem::path m_originDirectory;
+		std::filesystem::path m_cacheDirectory;
+
+		void SetUp() override
+		{
+			m_root = std::filesystem::temp_directory_path() /
+				(std::string("sfh-localcache-") + testing::UnitTest::GetInstance()->current_test_info()->name());
+			std::filesystem::remove_all(m_root);
+			m_originDirectory = m_root / "origin";
+			m_cacheDirectory = m_root / "cache";
+			std::filesystem::create_directories(m_originDirectory);
+		}
+
+		void TearDown() override
+		{
+			std::error_code ec;
+			std::filesystem::remove_all(m_root, ec);
+		}
+
+		std::wstring MakeOrigin(const std::string& name, size_t size, char fill)
+		{
+			auto path = m_originDirectory / name;
+			std::ofstream output(path, std::ios::binary);
+			std::string content(size, fill);
+			for (size_t i = 0; i < size; i += 4096)
+				content[i] = static_cast<char>(i / 4096);
+			output << content;
+			return path.wstring();
+		}
+
+		std::unique_ptr<LocalFontCache> MakeCache(uint64_t budget, uint64_t bandwidth = 0,
+		                                          std::chrono::steady_clock::duration recheckInterval =
+			                                          std::chrono::minutes(10))
+		{
+			return std::make_unique<LocalFontCache>(m_cacheDirectory, budget, bandwidth, recheckInterval);
+		}
+
+		// files in the cache directory other than the manifest
+		size_t CountCopies() const
+		{
+			size_t ret = 0;
+			std::error_code ec;
+			for (auto& entry : std::filesystem::directory_iterator(m_cacheDirectory, ec))
+				ret += entry.path().filename() != "manifest.txt";
+			return ret;
+		}
+	};
+
+	std::string ReadFile(const std::filesystem::path& path)
+	{
+		std::ifstream input(path, std::ios::binary);
+		return {std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+	}
+
+	// copies are made on the worker, waits for one to show up
+	std::optional<std::wstring> WaitForCopy(LocalFontCache& cache, const std::wstring& origin)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (std::chrono::steady_clock::now() < deadline)
+		{
+			if (auto local = cache.Find(origin))
+				return local;
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		return std::nullopt;
+	}
+
+	// rechecks run on the worker, waits for the copy to be dropped
+	bool WaitForDrop(LocalFontCache& cache, const std::wstring& origin)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (std::chrono::steady_clock::now() < deadline)
+		{
+			if (!cache.Find(origin))
+				return true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		return false;
+	}
+
+	void Touch(const std::wstring& path)
+	{
+		auto time = std::filesystem::last_write_time(path);
+		std::filesystem::last_write_time(path, time + std::chrono::hours(1));
+	}
+}
+
+TEST_F(LocalFontCacheTest, CopiesAdmittedOrigins)
+{
+	auto cache = MakeCache(10 * MB);
+	auto origin = MakeOrigin("a.ttf", 300000, 'a');
+	EXPECT_FALSE(cache->Find(origin));
+	cache->Admit(origin);
+	auto local = WaitForCopy(*cache, origin);
+	ASSERT_TRUE(local);
+	EXPECT_NE(*local, origin);
+	EXPECT_EQ(std::filesystem::path(*local).parent_path(), m_cacheDirectory);
+	EXPECT_EQ(std::filesystem::path(*local).extension(), ".ttf");
+	EXPECT_EQ(ReadFile(*local), ReadFile(origin));
+	EXPECT_EQ(cache->GetOrigin(*local), origin);
+	EXPECT_EQ(cache->GetOrigin(origin), origin);
+	EXPECT_EQ(cache->GetUsed(), 300000u);
+}
+
+TEST_F(LocalFontCacheTest, ChangedOriginIsNotServed)
+{
+	auto cache = MakeCache(10 * MB);
+	auto origin = MakeOrigin("a.ttf", 1000, 'a');
+	cache->Admit(origin);
+	auto local = WaitForCopy(*cache, origin);
+	ASSERT_TRUE(local);
+	Touch(origin);
+	// Find doesn't look at the origin
+	EXPECT_EQ(cache->Find(origin), local);
+	cache->Recheck(origin);
+	EXPECT_TRUE(WaitForDrop(*cache, origin));
+	EXPECT_EQ(cache->GetUsed(), 0u);
+	EXPECT_FALSE(std::filesystem::exists(*local));
+	// admitted again it is copied afresh
+	cache->Admit(origin);
+	EXPECT_TRUE(WaitForCopy(*cache, origin));
+}
+
+TEST_F(LocalFontCacheTest, ChangedOriginIsDroppedByPeriodicRecheck)
+{
+	auto cache = MakeCache(10 * MB, 0, std::chrono::milliseconds(20));
+	auto changed = MakeOrigin("a.ttf", 1000, 'a');
+	auto unchanged = MakeOrigin("b.ttf", 1000, 'b');
+	cache->Admit(changed);
+	cache->Admit(unchanged);
+	ASSERT_TRUE(WaitForCopy(*cache, changed));
+	ASSERT_TRUE(WaitForCopy(*cache, unchanged));
+	Touch(changed);
+	EXPECT_TRUE(WaitForDrop(*cache, changed));
+	EXPECT_TRUE(cache->Find(unchanged));
+	EXPECT_EQ(cache->GetUsed(), 1000u);
+}
+
+TEST_F(LocalFontCacheTest, OriginChangedWhileCopyingIsDropped)
+{
+	// two chunks at 2 MB/s, the second is read half a second in
+	auto cache = MakeCache(10 * MB, 2 * MB);
+	auto origin = MakeOrigin("a.ttf", 2 * MB, 'a');
+	cache->Admit(origin);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	Touch(origin);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+	EXPECT_FALSE(cache->Find(origin));
+	EXPECT_EQ(cache->GetUsed(), 0u);
+	// the temporary copy is gone too
+	EXPECT_EQ(CountCopies(), 0u);
+}
+
+TEST_F(LocalFontCacheTest, EvictsLeastRecentlyUsed)
+{
+	auto cache = MakeCache(350000);
+	auto a = MakeOrigin("a.ttf", 100000, 'a');
+	auto b = MakeOrigin("b.ttf", 100000, 'b');
+	auto c = MakeOrigin("c.ttf", 100000, 'c');
+	auto d = MakeOrigin("d.ttf", 100000, 'd');
+	for (auto& origin : {a, b, c})
+	{
+		cache->Admit(origin);
+		ASSERT_TRUE(WaitForCopy(*cache, origin));
+	}
+	auto localB = *cache->Find(b);
+	// a is used again, b is the oldest now
+	EXPECT_TRUE(cache->Find(c));
+	EXPECT_TRUE(cache->Find(a));
+	cache->Admit(d);
+	ASSERT_TRUE(WaitForCopy(*cache, d));
+	EXPECT_FALSE(cache->Find(b));
+	EXPECT_FALSE(std::filesystem::exists(localB));
+	EXPECT_TRUE(cache->Find(a));
+	EXPECT_TRUE(cache->Find(c));
+	EXPECT_EQ(cache->GetUsed(), 300000u);
+
+	// larger than the whole budget
+	auto large = MakeOrigin("large.ttf", 400000, 'l');
+	cache->Admit(large);
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	EXPECT_FALSE(cache->Find(large));
+
+	cache->SetLimits(150000, 0);
+	EXPECT_EQ(cache->GetUsed(), 100000u);
+	EXPECT_EQ(CountCopies(), 1u);
+}
+
+TEST_F(LocalFontCacheTest, ManifestReload)
+{
+	auto a = MakeOrigin("a.ttf", 1000, 'a');
+	auto b = MakeOrigin("b.otf", 2000, 'b');
+	auto c = MakeOrigin("c.ttf", 3000, 'c');
+	std::wstring localA;
+	{
+		auto cache = MakeCache(10 * MB);
+		for (auto& origin : {a, b, c})
+		{
+			cache->Admit(origin);
+			ASSERT_TRUE(WaitForCopy(*cache, origin));
+		}
+		localA = *cache->Find(a);
+	}
+	// changed while the daemon wasn't running
+	Touch(b);
+	{
+		auto cache = MakeCache(10 * MB);
+		auto local = WaitForCopy(*cache, a);
+		ASSERT_TRUE(local);
+		EXPECT_EQ(*local, localA);
+		EXPECT_EQ(cache->GetOrigin(*local), a);
+		EXPECT_FALSE(cache->Find(b));
+		EXPECT_TRUE(cache->Find(c));
+		EXPECT_EQ(cache->GetUsed(), 4000u);
+	}
+	// the stale copy of b was swept on load
+	EXPECT_EQ(CountCopies(), 2u);
+}
+
+TEST_F(LocalFontCacheTest, SweepOnlyRemovesOwnFiles)
+{
+	std::filesystem::create_directories(m_cacheDirectory);
+	for (auto name : {"notes.txt", "0123456789abcdef.ttf", "0123456789ABCDEF-0123456789abcdef.ttf",
+	                  "0123456789abcdef-0123456789abcdef.ttf.bak"})
+		std::ofstream(m_cacheDirectory / name) << "keep";
+	for (auto name : {"0123456789abcdef-0123456789abcdef.ttf", "0123456789abcdef-0123456789abcdef",
+	                  "0123456789abcdef.tmp", "manifest.txt.tmp"})
+		std::ofstream(m_cacheDirectory / name) << "stray";
+	// the manifest is loaded before the worker looks at the exit flag
+	MakeCache(10 * MB).reset();
+	EXPECT_EQ(CountCopies(), 4u);
+	EXPECT_TRUE(std::filesystem::exists(m_cacheDirectory / "notes.txt"));
+	EXPECT_FALSE(std::filesystem::exists(m_cacheDirectory / "0123456789abcdef-0123456789abcdef.ttf"));
+}
+
+TEST_F(LocalFontCacheTest, DisabledCacheLeavesDirectoryAlone)
+{
+	std::filesystem::create_directories(m_cacheDirectory);
+	std::ofstream(m_cacheDirectory / "0123456789abcdef-0123456789abcdef.ttf") << "stray";
+	std::ofstream(m_cacheDirectory / "notes.txt") << "keep";
+	{
+		auto cache = MakeCache(0);
+		auto origin = MakeOrigin("a.ttf", 1000, 'a');
+		cache->Admit(origin);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		EXPECT_FALSE(cache->Find(origin));
+	}
+	EXPECT_EQ(CountCopies(), 2u);
+}
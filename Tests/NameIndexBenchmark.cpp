@@ -0,0 +1,290 @@
+// build time, memory per key and lookup time of NameIndex against the radix trie exact lookups
+// used before it and a plain unordered_map of normalized names, on generated font names.
+// memory is the growth of live allocations while a structure is built, as glibc reports it
+#include "NameIndex.h"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace sfh;
+
+namespace
+{
+	// the exact lookup part of the trie QueryService used before NameIndex
+	class QueryTrie
+	{
+	private:
+		struct TrieNode
+		{
+			std::vector<std::pair<std::wstring, std::unique_ptr<TrieNode>>> m_branch;
+			std::vector<uint32_t> m_data;
+
+			void SortList()
+			{
+				std::sort(m_branch.begin(), m_branch.end());
+			}
+
+			std::pair<std::wstring, std::unique_ptr<TrieNode>>* SearchPrefix(wchar_t leading)
+			{
+				auto iter = std::lower_bound(m_branch.begin(), m_branch.end(), leading, [](auto& branch, wchar_t ch)
+				{
+					return branch.first[0] < ch;
+				});
+				if (iter == m_branch.end() || iter->first[0] != leading)
+					return nullptr;
+				return &*iter;
+			}
+		};
+
+		TrieNode m_rootNode;
+
+	public:
+		void AddEntry(const wchar_t* key, uint32_t value)
+		{
+			if (*key == 0)
+				return;
+			const wchar_t* keyPointer = key;
+			TrieNode* node = &m_rootNode;
+			for (;;)
+			{
+				auto result = node->SearchPrefix(*keyPointer);
+				if (result == nullptr)
+				{
+					auto newNode = std::make_unique<TrieNode>();
+					newNode->m_data.push_back(value);
+					node->m_branch.emplace_back(keyPointer, std::move(newNode));
+					node->SortList();
+					return;
+				}
+				auto arcPointer = result->first.c_str();
+				while (*keyPointer && *arcPointer && *keyPointer == *arcPointer)
+				{
+					++arcPointer;
+					++keyPointer;
+				}
+				if (*arcPointer == 0 && *keyPointer == 0)
+				{
+					result->second->m_data.push_back(value);
+					return;
+				}
+				if (*arcPointer == 0)
+				{
+					node = result->second.get();
+					continue;
+				}
+				auto keyLength = arcPointer - result->first.c_str();
+				auto newNode = std::make_unique<TrieNode>();
+				newNode->m_data.push_back(value);
+				if (*keyPointer == 0)
+				{
+					newNode->m_branch.emplace_back(arcPointer, std::move(result->second));
+					result->first.resize(keyLength);
+					result->second = std::move(newNode);
+				}
+				else
+				{
+					auto intermediateNode = std::make_unique<TrieNode>();
+					intermediateNode->m_branch.emplace_back(arcPointer, std::move(result->second));
+					intermediateNode->m_branch.emplace_back(keyPointer, std::move(newNode));
+					intermediateNode->SortList();
+					result->first.resize(keyLength);
+					result->second = std::move(intermediateNode);
+				}
+				node->SortList();
+				return;
+			}
+		}
+
+		const std::vector<uint32_t>* QueryEntry(const wchar_t* key) const
+		{
+			if (*key == 0)
+				return nullptr;
+			const wchar_t* keyPointer = key;
+			const TrieNode* node = &m_rootNode;
+			for (;;)
+			{
+				auto result = const_cast<TrieNode*>(node)->SearchPrefix(*keyPointer);
+				if (result == nullptr)
+					return nullptr;
+				auto arcPointer = result->first.c_str();
+				while (*keyPointer && *arcPointer && *keyPointer == *arcPointer)
+				{
+					++arcPointer;
+					++keyPointer;
+				}
+				if (*arcPointer == 0 && *keyPointer == 0)
+					return &result->second->m_data;
+				if (*arcPointer != 0)
+					return nullptr;
+				node = result->second.get();
+			}
+		}
+	};
+
+	struct Name
+	{
+		std::wstring m_name;
+		uint32_t m_ns;
+		uint32_t m_faceId;
+	};
+
+	// families of a few faces each, family, full and postscript names like real collections
+	std::vector<Name> MakeNames(uint32_t faceCount)
+	{
+		static const wchar_t* WORDS[] = {
+			L"Source", L"Han", L"Sans", L"Serif", L"Noto", L"CJK", L"Mincho", L"Gothic", L"Hei", L"Kai", L"Song",
+			L"Round", L"Pro", L"Std", L"Display", L"Text", L"Mono", L"UI", L"Rounded", L"Condensed"
+		};
+		static const wchar_t* STYLES[] = {L"Regular", L"Bold", L"Light", L"Medium", L"Heavy", L"Italic"};
+		std::mt19937 rng(7);
+		std::vector<Name> ret;
+		std::wstring family;
+		for (uint32_t faceId = 0; faceId < faceCount; ++faceId)
+		{
+			uint32_t style = faceId % std::size(STYLES);
+			if (style == 0)
+			{
+				family.clear();
+				for (int i = 0, words = 2 + rng() % 3; i < words; ++i)
+				{
+					family += WORDS[rng() % std::size(WORDS)];
+					family += L' ';
+				}
+				family += std::to_wstring(faceId / std::size(STYLES));
+			}
+			std::wstring postScript = family + L'-' + STYLES[style];
+			std::erase(postScript, L' ');
+			ret.push_back({family, 0, faceId});
+			ret.push_back({family + L' ' + STYLES[style], 1, faceId});
+			ret.push_back({postScript, 2, faceId});
+		}
+		return ret;
+	}
+
+	size_t HeapInUse()
+	{
+		// large tables are mapped directly rather than carved from the heap
+		auto info = mallinfo2();
+		return info.uordblks + info.hblkhd;
+	}
+
+	template <typename Fn>
+	double MeasureMs(Fn&& fn)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count();
+	}
+
+	template <typename Fn>
+	double MeasureNsPerOp(const std::vector<std::wstring>& queries, Fn&& lookup)
+	{
+		constexpr int ROUNDS = 20;
+		auto start = std::chrono::steady_clock::now();
+		for (int round = 0; round < ROUNDS; ++round)
+		{
+			for (auto& query : queries)
+				lookup(query);
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / (static_cast<double>(queries.size()) * ROUNDS);
+	}
+}
+
+int main()
+{
+	constexpr uint32_t FACE_COUNT = 60000;
+	constexpr uint32_t NAMESPACE_COUNT = 3;
+	auto names = MakeNames(FACE_COUNT);
+
+	// half the queries hit with the case of the name, half miss
+	std::mt19937 rng(11);
+	std::vector<std::wstring> queries;
+	for (int i = 0; i < 100000; ++i)
+	{
+		auto& name = names[rng() % names.size()].m_name;
+		queries.push_back(i % 2 ? name : name + L" X");
+	}
+
+	size_t sink = 0;
+	size_t heap = HeapInUse();
+	NameIndex index;
+	double indexBuild = MeasureMs([&]()
+	{
+		NameIndex::Builder builder(NAMESPACE_COUNT, 1);
+		for (auto& name : names)
+			builder.Add(name.m_name, name.m_ns, name.m_faceId);
+		index = builder.Build();
+	});
+	size_t indexMemory = HeapInUse() - heap;
+	size_t keyCount = index.GetKeyCount();
+
+	heap = HeapInUse();
+	QueryTrie tries[NAMESPACE_COUNT];
+	double trieBuild = MeasureMs([&]()
+	{
+		for (auto& name : names)
+			tries[name.m_ns].AddEntry(name.m_name.c_str(), name.m_faceId);
+	});
+	size_t trieMemory = HeapInUse() - heap;
+
+	heap = HeapInUse();
+	std::unordered_map<std::wstring, std::vector<std::pair<uint32_t, uint32_t>>> map;
+	double mapBuild = MeasureMs([&]()
+	{
+		std::wstring normalized;
+		for (auto& name : names)
+		{
+			NormalizeName(name.m_name, normalized);
+			map[normalized].emplace_back(name.m_ns, name.m_faceId);
+		}
+	});
+	size_t mapMemory = HeapInUse() - heap;
+
+	// every lookup normalizes the query first as QueryService does, the trie was case sensitive
+	std::wstring normalized;
+	double indexLookup = MeasureNsPerOp(queries, [&](const std::wstring& query)
+	{
+		NormalizeName(query, normalized);
+		if (auto match = index.Find(normalized))
+			sink += match[0].size() + match[1].size() + match[2].size();
+	});
+	double trieLookup = MeasureNsPerOp(queries, [&](const std::wstring& query)
+	{
+		for (auto& trie : tries)
+		{
+			if (auto ids = trie.QueryEntry(query.c_str()))
+				sink += ids->size();
+		}
+	});
+	double mapLookup = MeasureNsPerOp(queries, [&](const std::wstring& query)
+	{
+		NormalizeName(query, normalized);
+		auto iter = map.find(normalized);
+		if (iter != map.end())
+			sink += iter->second.size();
+	});
+
+	printf("%u faces, %zu names, %zu keys\n", FACE_COUNT, names.size(), keyCount);
+	printf("%-14s %10s %14s %12s\n", "", "build ms", "bytes per key", "lookup ns");
+	auto row = [&](const char* label, double build, size_t memory, double lookup)
+	{
+		printf("%-14s %10.1f %14.1f %12.1f\n", label, build, static_cast<double>(memory) / keyCount, lookup);
+	};
+	row("NameIndex", indexBuild, indexMemory, indexLookup);
+	row("trie", trieBuild, trieMemory, trieLookup);
+	row("unordered_map", mapBuild, mapMemory, mapLookup);
+	printf("NameIndex reports %.1f bytes per key\n", static_cast<double>(index.GetMemoryUsage()) / keyCount);
+	return sink == 0;
+}
@@ -0,0 +1,147 @@
+#include "NameIndex.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace sfh;
+
+namespace
+{
+	constexpr uint32_t NAMESPACE_COUNT = 3;
+
+	std::vector<uint32_t> Ids(const NameIndex::Match& match, uint32_t ns)
+	{
+		auto ids = match[ns];
+		return {ids.begin(), ids.end()};
+	}
+
+	std::wstring Normalized(std::wstring_view name)
+	{
+		std::wstring ret;
+		NormalizeName(name, ret);
+		return ret;
+	}
+
+	// a few hundred names so every bucket size shows up
+	NameIndex MakeIndex()
+	{
+		NameIndex::Builder builder(NAMESPACE_COUNT, 1);
+		for (uint32_t i = 0; i < 500; ++i)
+		{
+			builder.Add(L"Family " + std::to_wstring(i / 4), 0, i);
+			builder.Add(L"Family " + std::to_wstring(i / 4) + L" Face " + std::to_wstring(i), 1, i);
+			builder.Add(L"PS-" + std::to_wstring(i), 2, i);
+		}
+		return builder.Build();
+	}
+
+	void ExpectSameIndex(const NameIndex& lhs, const NameIndex& rhs)
+	{
+		ASSERT_EQ(lhs.GetKeyCount(), rhs.GetKeyCount());
+		for (uint32_t i = 0; i < 500; ++i)
+		{
+			for (auto& name : {L"family " + std::to_wstring(i / 4), L"ps-" + std::to_wstring(i)})
+			{
+				auto left = lhs.Find(name);
+				auto right = rhs.Find(name);
+				ASSERT_TRUE(left);
+				ASSERT_TRUE(right);
+				for (uint32_t ns = 0; ns < NAMESPACE_COUNT; ++ns)
+					EXPECT_EQ(Ids(left, ns), Ids(right, ns)) << i;
+			}
+		}
+	}
+}
+
+TEST(NameIndex, FindsNamesPerNamespace)
+{
+	auto index = MakeIndex();
+	EXPECT_EQ(index.GetKeyCount(), 125u + 500u + 500u);
+	EXPECT_GT(index.GetMemoryUsage(), 0u);
+
+	auto family = index.Find(Normalized(L"FAMILY 7"));
+	ASSERT_TRUE(family);
+	EXPECT_EQ(Ids(family, 0), (std::vector<uint32_t>{28, 29, 30, 31}));
+	EXPECT_TRUE(Ids(family, 1).empty());
+
+	auto ps = index.Find(L"ps-42");
+	ASSERT_TRUE(ps);
+	EXPECT_EQ(Ids(ps, 2), std::vector<uint32_t>{42});
+
+	EXPECT_FALSE(index.Find(L"family 500"));
+	EXPECT_FALSE(index.Find(L""));
+	EXPECT_FALSE(NameIndex().Find(L"family 1"));
+}
+
+TEST(NameIndex, DuplicatesOnlyWhereAllowed)
+{
+	NameIndex::Builder builder(2, 1);
+	EXPECT_TRUE(builder.Add(L"Arial", 0, 1));
+	EXPECT_TRUE(builder.Add(L"ARIAL", 0, 2));
+	EXPECT_TRUE(builder.Add(L"Arial", 1, 3));
+	EXPECT_FALSE(builder.Add(L"arial", 1, 4));
+	EXPECT_FALSE(builder.Add(L"", 0, 5));
+	auto index = builder.Build();
+	auto match = index.Find(L"arial");
+	EXPECT_EQ(Ids(match, 0), (std::vector<uint32_t>{1, 2}));
+	EXPECT_EQ(Ids(match, 1), std::vector<uint32_t>{3});
+}
+
+TEST(NameIndex, SerializeRoundTrip)
+{
+	auto index = MakeIndex();
+	std::string blob;
+	index.Serialize(blob);
+	auto loaded = NameIndex::Deserialize(blob.data(), blob.size());
+	ExpectSameIndex(index, loaded);
+
+	std::string empty;
+	NameIndex::Builder(NAMESPACE_COUNT, 0).Build().Serialize(empty);
+	EXPECT_EQ(NameIndex::Deserialize(empty.data(), empty.size()).GetKeyCount(), 0u);
+}
+
+TEST(NameIndex, TruncatedBlobsAreRejected)
+{
+	std::string blob;
+	MakeIndex().Serialize(blob);
+	for (size_t length = 0; length < blob.size(); ++length)
+	{
+		std::string truncated = blob.substr(0, length);
+		EXPECT_THROW(NameIndex::Deserialize(truncated.data(), truncated.size()), std::runtime_error) << length;
+	}
+}
+
+TEST(NameIndex, CorruptedBlobsStayInBounds)
+{
+	std::string blob;
+	NameIndex::Builder builder(2, 0);
+	for (uint32_t i = 0; i < 10; ++i)
+		builder.Add(L"n" + std::to_wstring(i), i % 2, i);
+	builder.Build().Serialize(blob);
+
+	for (size_t offset = 0; offset < blob.size(); ++offset)
+	{
+		for (char value : {'\x00', '\x7f', '\xff'})
+		{
+			std::string corrupted = blob;
+			corrupted[offset] = value;
+			try
+			{
+				// anything that loads must answer lookups from its own tables
+				auto index = NameIndex::Deserialize(corrupted.data(), corrupted.size());
+				for (uint32_t i = 0; i < 12; ++i)
+				{
+					auto match = index.Find(L"n" + std::to_wstring(i));
+					for (uint32_t ns = 0; ns < 2; ++ns)
+						EXPECT_LE(match[ns].size(), 10u);
+				}
+			}
+			catch (std::runtime_error&)
+			{
+			}
+		}
+	}
+}
@@ -0,0 +1,137 @@
+// time to read names, OS/2 and head of every face with SfntReader against opening it with FreeType,
+// the files are read into memory first so only parsing is measured.
+// usage: SfntReaderBenchmark [font directory], defaults to /usr/share/fonts
+#include "SfntReader.h"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_SFNT_NAMES_H
+#include FT_TRUETYPE_TABLES_H
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+	std::vector<std::vector<uint8_t>> LoadFonts(const std::filesystem::path& directory)
+	{
+		std::vector<std::vector<uint8_t>> ret;
+		std::error_code ec;
+		for (auto& entry : std::filesystem::recursive_directory_iterator(directory, ec))
+		{
+			auto extension = entry.path().extension().string();
+			if (extension != ".ttf" && extension != ".otf" && extension != ".ttc" && extension != ".otc")
+				continue;
+			std::ifstream input(entry.path(), std::ios::binary);
+			ret.emplace_back(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+		}
+		return ret;
+	}
+
+	size_t ReadWithSfntReader(const std::vector<uint8_t>& font)
+	{
+		size_t items = 0;
+		try
+		{
+			SfntReader reader(font.data(), font.size());
+			std::vector<SfntFace::NameRecord> names;
+			for (uint32_t i = 0; i < reader.GetFaceCount(); ++i)
+			{
+				auto face = reader.GetFace(i);
+				SfntFace::OS2Info os2;
+				SfntFace::HeadInfo head;
+				items += face.ReadOS2(os2) ? os2.weightClass : 0;
+				items += face.ReadHead(head) ? head.macStyle : 0;
+				names.clear();
+				face.ReadNames(names);
+				for (auto& name : names)
+					items += name.length;
+			}
+		}
+		catch (SfntFormatError&)
+		{
+		}
+		return items;
+	}
+
+	size_t ReadWithFreeType(FT_Library library, const std::vector<uint8_t>& font)
+	{
+		size_t items = 0;
+		FT_Long faceCount = 1;
+		for (FT_Long i = 0; i < faceCount; ++i)
+		{
+			FT_Face face;
+			if (FT_New_Memory_Face(library, font.data(), static_cast<FT_Long>(font.size()), i, &face) != 0)
+				break;
+			faceCount = face->num_faces;
+			if (auto os2 = static_cast<TT_OS2*>(FT_Get_Sfnt_Table(face, FT_SFNT_OS2)))
+				items += os2->usWeightClass;
+			if (auto head = static_cast<TT_Header*>(FT_Get_Sfnt_Table(face, FT_SFNT_HEAD)))
+				items += head->Mac_Style;
+			FT_UInt nameCount = FT_Get_Sfnt_Name_Count(face);
+			for (FT_UInt j = 0; j < nameCount; ++j)
+			{
+				FT_SfntName name;
+				if (FT_Get_Sfnt_Name(face, j, &name) == 0)
+					items += name.string_len;
+			}
+			FT_Done_Face(face);
+		}
+		return items;
+	}
+
+	template <typename Fn>
+	double Measure(int rounds, Fn&& fn)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int round = 0; round < rounds; ++round)
+			fn();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / rounds;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	auto fonts = LoadFonts(argc > 1 ? argv[1] : "/usr/share/fonts");
+	if (fonts.empty())
+	{
+		fprintf(stderr, "no fonts found\n");
+		return 1;
+	}
+	size_t bytes = 0;
+	for (auto& font : fonts)
+		bytes += font.size();
+
+	FT_Library library;
+	if (FT_Init_FreeType(&library) != 0)
+		return 1;
+
+	constexpr int ROUNDS = 200;
+	size_t sfntItems = 0;
+	size_t freeTypeItems = 0;
+	double sfnt = Measure(ROUNDS, [&]()
+	{
+		sfntItems = 0;
+		for (auto& font : fonts)
+			sfntItems += ReadWithSfntReader(font);
+	});
+	double freeType = Measure(ROUNDS, [&]()
+	{
+		freeTypeItems = 0;
+		for (auto& font : fonts)
+			freeTypeItems += ReadWithFreeType(library, font);
+	});
+	FT_Done_FreeType(library);
+
+	printf("%zu files, %.1f MB\n", fonts.size(), static_cast<double>(bytes) / (1024 * 1024));
+	printf("SfntReader %.3f ms per pass, FreeType %.3f ms per pass, %.1fx\n", sfnt, freeType, freeType / sfnt);
+	if (sfntItems != freeTypeItems)
+		printf("warning: readers disagree (%zu vs %zu)\n", sfntItems, freeTypeItems);
+	return 0;
+}
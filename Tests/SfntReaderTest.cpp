@@ -0,0 +1,295 @@
+#include "SfntReader.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	void PutU16(std::vector<uint8_t>& out, size_t offset, uint16_t value)
+	{
+		out[offset] = static_cast<uint8_t>(value >> 8);
+		out[offset + 1] = static_cast<uint8_t>(value);
+	}
+
+	void PutU32(std::vector<uint8_t>& out, size_t offset, uint32_t value)
+	{
+		PutU16(out, offset, static_cast<uint16_t>(value >> 16));
+		PutU16(out, offset + 2, static_cast<uint16_t>(value));
+	}
+
+	struct TableSpec
+	{
+		uint32_t tag;
+		std::vector<uint8_t> data;
+	};
+
+	// a face at faceOffset of out, table offsets are absolute as in collections
+	void AppendFace(std::vector<uint8_t>& out, const std::vector<TableSpec>& tables)
+	{
+		size_t faceOffset = out.size();
+		size_t dataOffset = faceOffset + 12 + tables.size() * 16;
+		out.resize(dataOffset);
+		PutU32(out, faceOffset, 0x00010000);
+		PutU16(out, faceOffset + 4, static_cast<uint16_t>(tables.size()));
+		for (size_t i = 0; i < tables.size(); ++i)
+		{
+			size_t record = faceOffset + 12 + i * 16;
+			PutU32(out, record, tables[i].tag);
+			PutU32(out, record + 8, static_cast<uint32_t>(out.size()));
+			PutU32(out, record + 12, static_cast<uint32_t>(tables[i].data.size()));
+			out.insert(out.end(), tables[i].data.begin(), tables[i].data.end());
+		}
+	}
+
+	std::vector<uint8_t> MakeOS2(uint16_t version, uint16_t weight, uint16_t width, uint16_t fsSelection)
+	{
+		std::vector<uint8_t> ret(version >= 1 ? 86 : 78);
+		PutU16(ret, 0, version);
+		PutU16(ret, 4, weight);
+		PutU16(ret, 6, width);
+		PutU16(ret, 62, fsSelection);
+		if (version >= 1)
+		{
+			PutU32(ret, 78, 0x00040001);
+			PutU32(ret, 82, 0x80000000);
+		}
+		return ret;
+	}
+
+	std::vector<uint8_t> MakeHead(uint16_t macStyle)
+	{
+		std::vector<uint8_t> ret(54);
+		PutU16(ret, 44, macStyle);
+		return ret;
+	}
+
+	// windows unicode names as utf-16be
+	std::vector<uint8_t> MakeName(const std::vector<std::pair<uint16_t, std::u16string>>& names)
+	{
+		std::vector<uint8_t> ret(6 + names.size() * 12);
+		PutU16(ret, 2, static_cast<uint16_t>(names.size()));
+		PutU16(ret, 4, static_cast<uint16_t>(ret.size()));
+		std::vector<uint8_t> strings;
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			size_t record = 6 + i * 12;
+			PutU16(ret, record, 3);
+			PutU16(ret, record + 2, 1);
+			PutU16(ret, record + 4, 0x409);
+			PutU16(ret, record + 6, names[i].first);
+			PutU16(ret, record + 8, static_cast<uint16_t>(names[i].second.size() * 2));
+			PutU16(ret, record + 10, static_cast<uint16_t>(strings.size()));
+			for (char16_t ch : names[i].second)
+			{
+				strings.push_back(static_cast<uint8_t>(ch >> 8));
+				strings.push_back(static_cast<uint8_t>(ch));
+			}
+		}
+		ret.insert(ret.end(), strings.begin(), strings.end());
+		return ret;
+	}
+
+	std::vector<uint8_t> MakeFont()
+	{
+		std::vector<uint8_t> ret;
+		AppendFace(ret, {
+			           {SfntFace::TAG_OS2, MakeOS2(4, 700, 5, 0x21)},
+			           {SfntFace::TAG_HEAD, MakeHead(1)},
+			           {SfntFace::TAG_NAME, MakeName({{1, u"Test Sans"}, {4, u"Test Sans Bold"}})},
+		           });
+		return ret;
+	}
+
+	// reads everything a face offers, the way FontAnalyzer does
+	size_t ReadAll(const uint8_t* data, size_t length)
+	{
+		SfntReader reader(data, length);
+		size_t items = 0;
+		for (uint32_t i = 0; i < reader.GetFaceCount(); ++i)
+		{
+			try
+			{
+				auto face = reader.GetFace(i);
+				SfntFace::OS2Info os2;
+				SfntFace::HeadInfo head;
+				items += face.ReadOS2(os2);
+				items += face.ReadHead(head);
+				std::vector<SfntFace::NameRecord> names;
+				face.ReadNames(names);
+				for (auto& name : names)
+				{
+					// every byte of every record must be inside the buffer
+					EXPECT_GE(name.string, data);
+					EXPECT_LE(name.string + name.length, data + length);
+				}
+				items += names.size();
+			}
+			catch (SfntFormatError&)
+			{
+			}
+		}
+		return items;
+	}
+
+	// an exactly sized heap copy, reads past it show up under address sanitizer
+	size_t ReadAllCopy(const std::vector<uint8_t>& bytes, size_t length)
+	{
+		auto copy = std::make_unique<uint8_t[]>(length ? length : 1);
+		memcpy(copy.get(), bytes.data(), length);
+		try
+		{
+			return ReadAll(copy.get(), length);
+		}
+		catch (SfntFormatError&)
+		{
+			return 0;
+		}
+	}
+}
+
+TEST(SfntReader, ReadsTables)
+{
+	auto font = MakeFont();
+	SfntReader reader(font.data(), font.size());
+	ASSERT_EQ(reader.GetFaceCount(), 1u);
+	auto face = reader.GetFace(0);
+
+	SfntFace::OS2Info os2;
+	ASSERT_TRUE(face.ReadOS2(os2));
+	EXPECT_EQ(os2.version, 4);
+	EXPECT_EQ(os2.weightClass, 700);
+	EXPECT_EQ(os2.widthClass, 5);
+	EXPECT_EQ(os2.fsSelection, 0x21);
+	EXPECT_EQ(os2.codePageRange1, 0x00040001u);
+	EXPECT_EQ(os2.codePageRange2, 0x80000000u);
+
+	SfntFace::HeadInfo head;
+	ASSERT_TRUE(face.ReadHead(head));
+	EXPECT_EQ(head.macStyle, 1);
+
+	std::vector<SfntFace::NameRecord> names;
+	face.ReadNames(names);
+	ASSERT_EQ(names.size(), 2u);
+	EXPECT_EQ(names[1].nameId, 4);
+	EXPECT_EQ(names[1].length, 28u);
+	EXPECT_EQ(names[1].string[1], 'T');
+	EXPECT_FALSE(face.FindTable(SfntFace::TAG_GLYF));
+}
+
+TEST(SfntReader, OS2VersionZeroHasNoCodePages)
+{
+	std::vector<uint8_t> font;
+	AppendFace(font, {{SfntFace::TAG_OS2, MakeOS2(0, 400, 5, 0x40)}});
+	SfntFace::OS2Info os2;
+	ASSERT_TRUE(SfntReader(font.data(), font.size()).GetFace(0).ReadOS2(os2));
+	EXPECT_EQ(os2.codePageRange1, 0u);
+	EXPECT_EQ(os2.codePageRange2, 0u);
+}
+
+TEST(SfntReader, Collection)
+{
+	std::vector<uint8_t> font(12 + 2 * 4);
+	PutU32(font, 0, MakeSfntTag('t', 't', 'c', 'f'));
+	PutU32(font, 4, 0x00010000);
+	PutU32(font, 8, 2);
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		PutU32(font, 12 + i * 4, static_cast<uint32_t>(font.size()));
+		AppendFace(font, {{SfntFace::TAG_HEAD, MakeHead(static_cast<uint16_t>(i))}});
+	}
+	SfntReader reader(font.data(), font.size());
+	ASSERT_EQ(reader.GetFaceCount(), 2u);
+	SfntFace::HeadInfo head;
+	ASSERT_TRUE(reader.GetFace(1).ReadHead(head));
+	EXPECT_EQ(head.macStyle, 1);
+	EXPECT_THROW(reader.GetFace(2), std::out_of_range);
+}
+
+TEST(SfntReader, RejectsNonSfnt)
+{
+	std::vector<uint8_t> data(64, 'x');
+	EXPECT_THROW(SfntReader(data.data(), data.size()), SfntFormatError);
+	EXPECT_THROW(SfntReader(data.data(), 4), SfntFormatError);
+}
+
+TEST(SfntReader, EveryTruncationIsSafe)
+{
+	auto font = MakeFont();
+	size_t complete = ReadAllCopy(font, font.size());
+	EXPECT_EQ(complete, 4u);
+	for (size_t length = 0; length < font.size(); ++length)
+		EXPECT_LE(ReadAllCopy(font, length), complete) << length;
+}
+
+TEST(SfntReader, EveryByteCorruptedIsSafe)
+{
+	auto font = MakeFont();
+	for (size_t offset = 0; offset < font.size(); ++offset)
+	{
+		for (uint8_t value : {uint8_t{0x00}, uint8_t{0x7f}, uint8_t{0xff}})
+		{
+			auto corrupted = font;
+			corrupted[offset] = value;
+			ReadAllCopy(corrupted, corrupted.size());
+		}
+	}
+}
+
+TEST(SfntReader, TableOutOfBounds)
+{
+	auto font = MakeFont();
+	// the first table record is the OS/2 table, point it past the end in ways that overflow 32 bits
+	for (auto [offset, length] : {std::pair<uint32_t, uint32_t>{0xfffffff0, 0x20},
+	                              {static_cast<uint32_t>(font.size()), 1},
+	                              {12, 0xffffffff}})
+	{
+		auto corrupted = font;
+		PutU32(corrupted, 12 + 8, offset);
+		PutU32(corrupted, 12 + 12, length);
+		SfntFace::OS2Info os2;
+		EXPECT_FALSE(SfntReader(corrupted.data(), corrupted.size()).GetFace(0).ReadOS2(os2));
+	}
+}
+
+TEST(SfntReader, HugeDirectoryAndCollectionCounts)
+{
+	auto font = MakeFont();
+	PutU16(font, 4, 0xffff);
+	EXPECT_THROW(SfntReader(font.data(), font.size()).GetFace(0), SfntFormatError);
+
+	std::vector<uint8_t> collection(16);
+	PutU32(collection, 0, MakeSfntTag('t', 't', 'c', 'f'));
+	PutU32(collection, 8, 0xffffffff);
+	EXPECT_THROW(SfntReader(collection.data(), collection.size()), SfntFormatError);
+
+	// a face offset pointing outside the file
+	PutU32(collection, 8, 1);
+	PutU32(collection, 12, 0xfffffff0);
+	SfntReader reader(collection.data(), collection.size());
+	EXPECT_THROW(reader.GetFace(0), SfntFormatError);
+}
+
+TEST(SfntReader, NameRecordsOutOfBoundsAreSkipped)
+{
+	std::vector<uint8_t> font;
+	auto name = MakeName({{1, u"Good"}, {4, u"Bad"}});
+	// second record claims a string running past the table
+	PutU16(name, 6 + 12 + 8, 0xfff0);
+	AppendFace(font, {{SfntFace::TAG_NAME, name}});
+	std::vector<SfntFace::NameRecord> names;
+	SfntReader(font.data(), font.size()).GetFace(0).ReadNames(names);
+	ASSERT_EQ(names.size(), 1u);
+	EXPECT_EQ(names[0].nameId, 1);
+
+	// record count larger than the table
+	PutU16(name, 2, 0x1000);
+	font.clear();
+	AppendFace(font, {{SfntFace::TAG_NAME, name}});
+	names.clear();
+	SfntReader(font.data(), font.size()).GetFace(0).ReadNames(names);
+	EXPECT_TRUE(names.empty());
+}
@@ -0,0 +1,239 @@
+#include "TinyLfuCache.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <set>
+
+using namespace sfh;
+
+namespace
+{
+	// what the owner of the cache thinks is loaded, checked against every callback
+	struct LoadTracker
+	{
+		std::set<int> m_loaded;
+		size_t m_loads = 0;
+		size_t m_evictions = 0;
+
+		auto OnEvict()
+		{
+			return [this](const int& key)
+			{
+				EXPECT_EQ(m_loaded.erase(key), 1u) << "evicted without being loaded: " << key;
+				++m_evictions;
+			};
+		}
+
+		auto OnLoad()
+		{
+			return [this](const int& key)
+			{
+				EXPECT_TRUE(m_loaded.insert(key).second) << "loaded twice: " << key;
+				++m_loads;
+			};
+		}
+
+		// Restore wants to know whether loading worked
+		template <typename Before = void (*)()>
+		auto OnRestore(bool success = true, Before before = []() {})
+		{
+			return [this, success, before](const int& key)
+			{
+				before();
+				if (success)
+					OnLoad()(key);
+				return success;
+			};
+		}
+	};
+
+	std::set<int> GetKeys(TinyLfuCache<int>& cache)
+	{
+		auto keys = cache.GetVector(SIZE_MAX);
+		return {keys.begin(), keys.end()};
+	}
+}
+
+TEST(TinyLfuCache, LoadsNewKeysOnce)
+{
+	LoadTracker tracker;
+	TinyLfuCache<int> cache(1000, 100, tracker.OnEvict());
+	EXPECT_TRUE(cache.Access(1, 10, tracker.OnLoad()));
+	EXPECT_FALSE(cache.Access(1, 10, tracker.OnLoad()));
+	EXPECT_TRUE(cache.Access(2, 10, tracker.OnLoad()));
+	EXPECT_EQ(tracker.m_loads, 2u);
+	EXPECT_EQ(cache.GetUsed(), 20u);
+	EXPECT_EQ(GetKeys(cache), (std::set<int>{1, 2}));
+}
+
+TEST(TinyLfuCache, ZeroBudgetLoadsNothing)
+{
+	LoadTracker tracker;
+	TinyLfuCache<int> cache(0, 100, tracker.OnEvict());
+	EXPECT_FALSE(cache.Access(1, 10, tracker.OnLoad()));
+	EXPECT_EQ(tracker.m_loads, 0u);
+	EXPECT_EQ(cache.GetUsed(), 0u);
+}
+
+TEST(TinyLfuCache, OversizedEntryIsNeitherLoadedNorEvicted)
+{
+	LoadTracker tracker;
+	TinyLfuCache<int> cache(1000, 100, tracker.OnEvict());
+	cache.Access(1, 10, tracker.OnLoad());
+	// larger than the main cache, it leaves the window in the same call
+	EXPECT_FALSE(cache.Access(2, 950, tracker.OnLoad()));
+	EXPECT_FALSE(cache.Access(3, 5000, tracker.OnLoad()));
+	EXPECT_EQ(tracker.m_loads, 1u);
+	EXPECT_EQ(tracker.m_evictions, 0u);
+	EXPECT_EQ(GetKeys(cache), std::set<int>{1});
+	// larger than the window but fitting the main cache is admitted directly
+	EXPECT_TRUE(cache.Access(4, 500, tracker.OnLoad()));
+	EXPECT_EQ(tracker.m_loaded, (std::set<int>{1, 4}));
+}
+
+TEST(TinyLfuCache, OneOffDoesNotFlushPopularKeys)
+{
+	LoadTracker tracker;
+	TinyLfuCache<int> cache(1000, 100, tracker.OnEvict());
+	for (int round = 0; round < 5; ++round)
+	{
+		for (int key = 0; key < 9; ++key)
+			cache.Access(key, 100, tracker.OnLoad());
+	}
+	auto popular = GetKeys(cache);
+	ASSERT_EQ(popular.size(), 9u);
+	// asked for once, as large as most of the cache
+	cache.Access(100, 800, tracker.OnLoad());
+	cache.Access(101, 100, tracker.OnLoad());
+	cache.Access(102, 100, tracker.OnLoad());
+	auto keys = GetKeys(cache);
+	// at most the one in the window made way for the newcomers
+	EXPECT_GE(std::count_if(popular.begin(), popular.end(), [&](int key) { return keys.contains(key); }), 8);
+	EXPECT_FALSE(GetKeys(cache).contains(100));
+	EXPECT_LE(cache.GetUsed(), 1000u);
+}
+
+TEST(TinyLfuCache, FrequentCandidateReplacesColdEntry)
+{
+	LoadTracker tracker;
+	TinyLfuCache<int> cache(1000, 100, tracker.OnEvict());
+	// fill the main cache with keys seen once
+	for (int key = 0; key < 10; ++key)
+		cache.Access(key, 100, tracker.OnLoad());
+	// a key asked for repeatedly while passing through the window gets in
+	for (int round = 0; round < 4; ++round)
+	{
+		cache.Access(50, 100, tracker.OnLoad());
+		// push it out of the window
+		cache.Access(1000 + round, 100, tracker.OnLoad());
+	}
+	EXPECT_TRUE(GetKeys(cache).contains(50));
+	EXPECT_LE(cache.GetUsed(), 1000u);
+	EXPECT_EQ(tracker.m_loaded, GetKeys(cache));
+}
+
+TEST(TinyLfuCache, LowerBudgetEvicts)
+{
+	LoadTracker tracker;
+	TinyLfuCache<int> cache(1000, 100, tracker.OnEvict());
+	for (int key = 0; key < 10; ++key)
+		cache.Access(key, 100, tracker.OnLoad());
+	cache.SetBudget(300);
+	EXPECT_LE(cache.GetUsed(), 300u);
+	EXPECT_EQ(tracker.m_loaded, GetKeys(cache));
+	cache.SetBudget(0);
+	EXPECT_EQ(cache.GetUsed(), 0u);
+	EXPECT_TRUE(tracker.m_loaded.empty());
+}
+
+TEST(TinyLfuCache, RestoreUntilFull)
+{
+	LoadTracker tracker;
+	TinyLfuCache<int> cache(1000, 100, tracker.OnEvict());
+	cache.Access(1, 100, tracker.OnLoad());
+	EXPECT_FALSE(cache.Restore(1, 100, tracker.OnRestore()));
+	// the main cache gets 90% of the budget
+	EXPECT_TRUE(cache.Restore(2, 400, tracker.OnRestore()));
+	EXPECT_TRUE(cache.Restore(3, 400, tracker.OnRestore()));
+	EXPECT_FALSE(cache.Restore(4, 400, tracker.OnRestore()));
+	EXPECT_EQ(tracker.m_loaded, (std::set<int>{1, 2, 3}));
+	// restored keys rank behind what was used in this run
+	EXPECT_EQ(cache.GetVector(1), std::vector<int>{2});
+}
+
+TEST(TinyLfuCache, RestoreFailureRollsBack)
+{
+	LoadTracker tracker;
+	TinyLfuCache<int> cache(1000, 100, tracker.OnEvict());
+	EXPECT_FALSE(cache.Restore(1, 400, tracker.OnRestore(false)));
+	EXPECT_EQ(cache.GetUsed(), 0u);
+	EXPECT_TRUE(GetKeys(cache).empty());
+	EXPECT_EQ(tracker.m_evictions, 0u);
+	// the reservation is gone, the key can be restored again
+	EXPECT_TRUE(cache.Restore(1, 400, tracker.OnRestore()));
+	EXPECT_EQ(cache.GetUsed(), 400u);
+}
+
+TEST(TinyLfuCache, RestoreLoadsWithoutTheLock)
+{
+	LoadTracker tracker;
+	TinyLfuCache<int> cache(1000, 100, tracker.OnEvict());
+	// would deadlock if the load ran under the cache lock
+	EXPECT_TRUE(cache.Restore(1, 100, tracker.OnRestore(true, [&]()
+	{
+		EXPECT_EQ(cache.GetUsed(), 100u);
+		EXPECT_TRUE(cache.Access(2, 100, tracker.OnLoad()));
+		// reserved, asking for it isn't a reason to load it again
+		EXPECT_FALSE(cache.Access(1, 100, tracker.OnLoad()));
+	})));
+	EXPECT_EQ(tracker.m_loaded, (std::set<int>{1, 2}));
+	EXPECT_EQ(tracker.m_loaded, GetKeys(cache));
+}
+
+TEST(TinyLfuCache, RestoreEvictedWhileLoadingUnloads)
+{
+	LoadTracker tracker;
+	TinyLfuCache<int> cache(1000, 100, tracker.OnEvict());
+	EXPECT_FALSE(cache.Restore(1, 100, tracker.OnRestore(true, [&]() { cache.SetBudget(0); })));
+	EXPECT_EQ(tracker.m_loads, 1u);
+	EXPECT_EQ(tracker.m_evictions, 1u);
+	EXPECT_TRUE(tracker.m_loaded.empty());
+	EXPECT_EQ(cache.GetUsed(), 0u);
+
+	// evicted and put in again through Access meanwhile, each load is undone once
+	cache.SetBudget(1000);
+	EXPECT_FALSE(cache.Restore(2, 100, tracker.OnRestore(true, [&]()
+	{
+		cache.SetBudget(0);
+		cache.SetBudget(1000);
+		// not tracked, the tracker only sees the load of Restore and its undoing
+		EXPECT_TRUE(cache.Access(2, 100, [](const int&) {}));
+	})));
+	EXPECT_EQ(tracker.m_evictions, 2u);
+	EXPECT_EQ(GetKeys(cache), std::set<int>{2});
+}
+
+TEST(TinyLfuCache, RandomTraceKeepsCallbacksBalanced)
+{
+	LoadTracker tracker;
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<int> key(0, 300);
+	std::uniform_int_distribution<uint64_t> size(1, 400);
+	TinyLfuCache<int> cache(2000, 100, tracker.OnEvict());
+	std::vector<uint64_t> sizes(301);
+	for (auto& item : sizes)
+		item = size(rng);
+	for (int i = 0; i < 50000; ++i)
+	{
+		// skewed towards low keys
+		int k = std::min(key(rng), key(rng));
+		cache.Access(k, sizes[k], tracker.OnLoad());
+		ASSERT_LE(cache.GetUsed(), 2000u);
+		if (i % 5000 == 0)
+			cache.SetBudget(i % 10000 == 0 ? 1000 : 2000);
+	}
+	EXPECT_EQ(tracker.m_loaded, GetKeys(cache));
+	EXPECT_EQ(tracker.m_loads - tracker.m_evictions, tracker.m_loaded.size());
+}
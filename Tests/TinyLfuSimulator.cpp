@@ -0,0 +1,200 @@
+// replays a synthetic prefetch trace against the old entry counted lru (lruSize = 100), a byte
+// budgeted lru and TinyLfuCache, and prints hit ratios and hits per megabyte kept loaded.
+// the trace mixes zipf popularity over a font library with episodes, a release group's set of
+// fonts asked for again and again while a series is watched.
+// usage: TinyLfuSimulator [seed]
+#include "TinyLfuCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <list>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	constexpr int FONT_COUNT = 5000;
+	constexpr uint64_t MAX_FONT_SIZE = 60 * 1024 * 1024;
+	constexpr uint64_t MB = 1024 * 1024;
+
+	struct Trace
+	{
+		std::vector<uint64_t> m_sizes;
+		std::vector<int> m_accesses;
+	};
+
+	Trace MakeTrace(uint64_t seed)
+	{
+		std::mt19937_64 rng(seed);
+		Trace ret;
+		// median 3 MB, a long tail of large cjk fonts
+		std::lognormal_distribution<double> size(std::log(3e6), 1.2);
+		for (int i = 0; i < FONT_COUNT; ++i)
+			ret.m_sizes.push_back(std::min(static_cast<uint64_t>(size(rng)), MAX_FONT_SIZE));
+		std::vector<double> weights(FONT_COUNT);
+		for (int i = 0; i < FONT_COUNT; ++i)
+			weights[i] = 1.0 / std::pow(i + 1, 0.9);
+		std::discrete_distribution<int> zipf(weights.begin(), weights.end());
+		std::uniform_int_distribution<int> any(0, FONT_COUNT - 1);
+		for (int episode = 0; episode < 400; ++episode)
+		{
+			std::vector<int> episodeFonts;
+			for (int i = 0; i < 8; ++i)
+				episodeFonts.push_back(any(rng));
+			for (int file = 0; file < 6; ++file)
+			{
+				for (int i = 0; i < 12; ++i)
+					ret.m_accesses.push_back(zipf(rng));
+				for (int font : episodeFonts)
+				{
+					if (rng() % 2)
+						ret.m_accesses.push_back(font);
+				}
+			}
+		}
+		return ret;
+	}
+
+	// the prefetch before TinyLfuCache, at most a number of entries whatever their size
+	class CountLru
+	{
+	private:
+		size_t m_capacity;
+		const std::vector<uint64_t>& m_sizes;
+		std::list<int> m_list;
+		std::unordered_map<int, std::list<int>::iterator> m_index;
+		uint64_t m_used = 0;
+	public:
+		uint64_t m_peak = 0;
+
+		CountLru(size_t capacity, const std::vector<uint64_t>& sizes)
+			: m_capacity(capacity), m_sizes(sizes)
+		{
+		}
+
+		bool Access(int key)
+		{
+			auto iter = m_index.find(key);
+			if (iter != m_index.end())
+			{
+				m_list.splice(m_list.begin(), m_list, iter->second);
+				return true;
+			}
+			m_list.push_front(key);
+			m_index.emplace(key, m_list.begin());
+			m_used += m_sizes[key];
+			if (m_list.size() > m_capacity)
+			{
+				m_used -= m_sizes[m_list.back()];
+				m_index.erase(m_list.back());
+				m_list.pop_back();
+			}
+			m_peak = std::max(m_peak, m_used);
+			return false;
+		}
+	};
+
+	class ByteLru
+	{
+	private:
+		uint64_t m_budget;
+		const std::vector<uint64_t>& m_sizes;
+		std::list<int> m_list;
+		std::unordered_map<int, std::list<int>::iterator> m_index;
+		uint64_t m_used = 0;
+	public:
+		ByteLru(uint64_t budget, const std::vector<uint64_t>& sizes)
+			: m_budget(budget), m_sizes(sizes)
+		{
+		}
+
+		bool Access(int key)
+		{
+			auto iter = m_index.find(key);
+			if (iter != m_index.end())
+			{
+				m_list.splice(m_list.begin(), m_list, iter->second);
+				return true;
+			}
+			if (m_sizes[key] > m_budget)
+				return false;
+			m_list.push_front(key);
+			m_index.emplace(key, m_list.begin());
+			m_used += m_sizes[key];
+			while (m_used > m_budget)
+			{
+				m_used -= m_sizes[m_list.back()];
+				m_index.erase(m_list.back());
+				m_list.pop_back();
+			}
+			return false;
+		}
+	};
+
+	struct Result
+	{
+		uint64_t m_hits = 0;
+		uint64_t m_hitBytes = 0;
+	};
+
+	void Print(const char* label, const Result& result, const Trace& trace, uint64_t totalBytes, uint64_t memory)
+	{
+		double hitRatio = static_cast<double>(result.m_hits) / trace.m_accesses.size();
+		printf("  %-22s %5.0f MB  hit %.3f  byte hit %.3f  hit per GB %.3f\n", label,
+		       static_cast<double>(memory) / MB, hitRatio,
+		       static_cast<double>(result.m_hitBytes) / totalBytes, hitRatio / (static_cast<double>(memory) / (1024 * MB)));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	auto trace = MakeTrace(argc > 1 ? std::stoull(argv[1]) : 42);
+	uint64_t totalBytes = 0;
+	for (int key : trace.m_accesses)
+		totalBytes += trace.m_sizes[key];
+	printf("%zu accesses over %d fonts\n", trace.m_accesses.size(), FONT_COUNT);
+
+	CountLru countLru(100, trace.m_sizes);
+	Result countResult;
+	for (int key : trace.m_accesses)
+	{
+		if (countLru.Access(key))
+		{
+			++countResult.m_hits;
+			countResult.m_hitBytes += trace.m_sizes[key];
+		}
+	}
+	// the old cache is charged for the most it ever held
+	Print("lru, 100 entries", countResult, trace, totalBytes, countLru.m_peak);
+
+	for (uint64_t budget : {128 * MB, 256 * MB, 512 * MB})
+	{
+		ByteLru byteLru(budget, trace.m_sizes);
+		Result byteResult;
+		std::vector<char> loaded(FONT_COUNT, 0);
+		sfh::TinyLfuCache<int> tinyLfu(budget, 100, [&](const int& key) { loaded[key] = 0; });
+		Result tinyLfuResult;
+		for (int key : trace.m_accesses)
+		{
+			if (byteLru.Access(key))
+			{
+				++byteResult.m_hits;
+				byteResult.m_hitBytes += trace.m_sizes[key];
+			}
+			// the prefetch counts a hit when the font was loaded before it was asked for
+			if (loaded[key])
+			{
+				++tinyLfuResult.m_hits;
+				tinyLfuResult.m_hitBytes += trace.m_sizes[key];
+			}
+			tinyLfu.Access(key, trace.m_sizes[key], [&](const int& newKey) { loaded[newKey] = 1; });
+		}
+		printf("budget %llu MB\n", static_cast<unsigned long long>(budget / MB));
+		Print("lru by bytes", byteResult, trace, totalBytes, budget);
+		Print("TinyLfuCache", tinyLfuResult, trace, totalBytes, budget);
+	}
+	return 0;
+}
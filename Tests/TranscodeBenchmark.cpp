@@ -0,0 +1,145 @@
+// throughput of the transcoding kernels against a plain scalar loop on font name like text
+#include "Transcode.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace sfh;
+
+namespace
+{
+	bool ScalarUtf16ToUtf8(const std::u16string& src, std::string& out)
+	{
+		out.clear();
+		for (size_t i = 0; i < src.size(); ++i)
+		{
+			char32_t cp = src[i];
+			if (cp >= 0xd800 && cp <= 0xdbff)
+			{
+				if (i + 1 >= src.size() || src[i + 1] < 0xdc00 || src[i + 1] > 0xdfff)
+					return false;
+				cp = 0x10000 + ((cp - 0xd800) << 10) + (src[i + 1] - 0xdc00);
+				++i;
+			}
+			else if (cp >= 0xdc00 && cp <= 0xdfff)
+			{
+				return false;
+			}
+			char buffer[4];
+			out.append(buffer, Transcode::Detail::EncodeUtf8(cp, buffer));
+		}
+		return true;
+	}
+
+	bool ScalarUtf8ToUtf16(const std::string& src, std::u16string& out)
+	{
+		out.clear();
+		auto bytes = reinterpret_cast<const uint8_t*>(src.data());
+		for (size_t i = 0; i < src.size();)
+		{
+			char32_t cp;
+			size_t consumed = Transcode::Detail::DecodeUtf8(bytes + i, src.size() - i, cp);
+			if (consumed == 0)
+				return false;
+			if (cp >= 0x10000)
+			{
+				out.push_back(static_cast<char16_t>(0xd800 + ((cp - 0x10000) >> 10)));
+				out.push_back(static_cast<char16_t>(0xdc00 + ((cp - 0x10000) & 0x3ff)));
+			}
+			else
+			{
+				out.push_back(static_cast<char16_t>(cp));
+			}
+			i += consumed;
+		}
+		return true;
+	}
+
+	// paths and names, mostly ascii, every tenth one cjk
+	std::vector<std::u16string> MakeCorpus()
+	{
+		std::mt19937 rng(1);
+		std::vector<std::u16string> ret;
+		for (int i = 0; i < 20000; ++i)
+		{
+			std::u16string text = u"D:\\Fonts\\Collection\\";
+			size_t length = 8 + rng() % 40;
+			bool cjk = i % 10 == 0;
+			for (size_t j = 0; j < length; ++j)
+				text.push_back(cjk ? static_cast<char16_t>(0x4e00 + rng() % 0x5000) : static_cast<char16_t>('a' + rng() % 26));
+			text += u".ttf";
+			ret.push_back(std::move(text));
+		}
+		return ret;
+	}
+
+	template <typename Fn>
+	double Measure(size_t bytes, Fn&& fn)
+	{
+		constexpr int ROUNDS = 50;
+		auto start = std::chrono::steady_clock::now();
+		for (int round = 0; round < ROUNDS; ++round)
+			fn();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return static_cast<double>(bytes) * ROUNDS / elapsed.count() / (1024 * 1024);
+	}
+}
+
+int main()
+{
+	auto corpus = MakeCorpus();
+	std::vector<std::string> utf8Corpus;
+	size_t utf16Bytes = 0;
+	size_t utf8Bytes = 0;
+	for (auto& text : corpus)
+	{
+		std::string utf8;
+		ScalarUtf16ToUtf8(text, utf8);
+		utf16Bytes += text.size() * 2;
+		utf8Bytes += utf8.size();
+		utf8Corpus.push_back(std::move(utf8));
+	}
+
+	std::string utf8Out;
+	std::u16string utf16Out;
+	size_t sink = 0;
+	double vectorTo8 = Measure(utf16Bytes, [&]()
+	{
+		for (auto& text : corpus)
+		{
+			Transcode::Utf16ToUtf8(reinterpret_cast<const uint16_t*>(text.data()), text.size(), utf8Out);
+			sink += utf8Out.size();
+		}
+	});
+	double scalarTo8 = Measure(utf16Bytes, [&]()
+	{
+		for (auto& text : corpus)
+		{
+			ScalarUtf16ToUtf8(text, utf8Out);
+			sink += utf8Out.size();
+		}
+	});
+	double vectorTo16 = Measure(utf8Bytes, [&]()
+	{
+		for (auto& text : utf8Corpus)
+		{
+			Transcode::Utf8ToUtf16(text.data(), text.size(), utf16Out);
+			sink += utf16Out.size();
+		}
+	});
+	double scalarTo16 = Measure(utf8Bytes, [&]()
+	{
+		for (auto& text : utf8Corpus)
+		{
+			ScalarUtf8ToUtf16(text, utf16Out);
+			sink += utf16Out.size();
+		}
+	});
+
+	printf("utf-16 to utf-8: vector %.0f MB/s, scalar %.0f MB/s\n", vectorTo8, scalarTo8);
+	printf("utf-8 to utf-16: vector %.0f MB/s, scalar %.0f MB/s\n", vectorTo16, scalarTo16);
+	return sink == 0;
+}
@@ -0,0 +1,211 @@
+#include "Transcode.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace sfh;
+
+namespace
+{
+	// plain scalar conversions the vector paths are checked against
+	std::string ReferenceUtf8(const std::u32string& codePoints)
+	{
+		std::string ret;
+		for (char32_t cp : codePoints)
+		{
+			char buffer[4];
+			ret.append(buffer, Transcode::Detail::EncodeUtf8(cp, buffer));
+		}
+		return ret;
+	}
+
+	std::u16string ReferenceUtf16(const std::u32string& codePoints)
+	{
+		std::u16string ret;
+		for (char32_t cp : codePoints)
+		{
+			if (cp >= 0x10000)
+			{
+				ret.push_back(static_cast<char16_t>(0xd800 + ((cp - 0x10000) >> 10)));
+				ret.push_back(static_cast<char16_t>(0xdc00 + ((cp - 0x10000) & 0x3ff)));
+			}
+			else
+			{
+				ret.push_back(static_cast<char16_t>(cp));
+			}
+		}
+		return ret;
+	}
+
+	std::string ToUtf8(const std::u16string& str, bool& success)
+	{
+		std::string ret;
+		success = Transcode::Utf16ToUtf8(reinterpret_cast<const uint16_t*>(str.data()), str.size(), ret);
+		return ret;
+	}
+
+	std::u16string ToUtf16(const std::string& str, bool& success)
+	{
+		std::u16string ret;
+		success = Transcode::Utf8ToUtf16(str.data(), str.size(), ret);
+		return ret;
+	}
+
+	// ascii runs long enough for both vector widths with a few other code points mixed in
+	std::u32string RandomText(std::mt19937& rng, size_t length)
+	{
+		static const char32_t OTHERS[] = {0xe9, 0x7ff, 0x800, 0x5b8b, 0xfffd, 0x10000, 0x1f600, 0x10ffff};
+		std::uniform_int_distribution<int> pick(0, 99);
+		std::uniform_int_distribution<size_t> other(0, std::size(OTHERS) - 1);
+		std::u32string ret;
+		for (size_t i = 0; i < length; ++i)
+			ret.push_back(pick(rng) < 90 ? static_cast<char32_t>(0x20 + pick(rng)) : OTHERS[other(rng)]);
+		return ret;
+	}
+}
+
+TEST(Transcode, AsciiEveryLength)
+{
+	// every tail length of the 8, 16 and 32 unit loops
+	for (size_t length = 0; length <= 100; ++length)
+	{
+		std::u32string text;
+		for (size_t i = 0; i < length; ++i)
+			text.push_back(U'a' + i % 26);
+		bool success;
+		EXPECT_EQ(ToUtf8(ReferenceUtf16(text), success), ReferenceUtf8(text));
+		EXPECT_TRUE(success);
+		EXPECT_EQ(ToUtf16(ReferenceUtf8(text), success), ReferenceUtf16(text));
+		EXPECT_TRUE(success);
+	}
+}
+
+TEST(Transcode, NonAsciiAtEveryPosition)
+{
+	for (char32_t cp : {U'\u00e9', U'\u4e2d', U'\U0001f600'})
+	{
+		for (size_t position = 0; position < 70; ++position)
+		{
+			std::u32string text(70, U'x');
+			text[position] = cp;
+			bool success;
+			EXPECT_EQ(ToUtf8(ReferenceUtf16(text), success), ReferenceUtf8(text)) << position;
+			EXPECT_TRUE(success);
+			EXPECT_EQ(ToUtf16(ReferenceUtf8(text), success), ReferenceUtf16(text)) << position;
+			EXPECT_TRUE(success);
+		}
+	}
+}
+
+TEST(Transcode, SurrogatePairAcrossScalarBlock)
+{
+	// the scalar loop stops every 16 units, a pair may start on the last one
+	for (size_t prefix = 0; prefix < 40; ++prefix)
+	{
+		std::u32string text(prefix, U'a');
+		text.push_back(0x1f600);
+		text.append(20, U'b');
+		bool success;
+		EXPECT_EQ(ToUtf8(ReferenceUtf16(text), success), ReferenceUtf8(text)) << prefix;
+		EXPECT_TRUE(success);
+	}
+}
+
+TEST(Transcode, RandomRoundTrip)
+{
+	std::mt19937 rng(42);
+	for (int round = 0; round < 2000; ++round)
+	{
+		auto text = RandomText(rng, rng() % 200);
+		bool success;
+		auto utf8 = ToUtf8(ReferenceUtf16(text), success);
+		ASSERT_TRUE(success);
+		ASSERT_EQ(utf8, ReferenceUtf8(text));
+		ASSERT_EQ(ToUtf16(utf8, success), ReferenceUtf16(text));
+		ASSERT_TRUE(success);
+	}
+}
+
+TEST(Transcode, UnpairedSurrogatesFailWithEmptyOutput)
+{
+	std::vector<std::u16string> inputs;
+	for (size_t prefix : {0, 5, 15, 16, 40})
+	{
+		std::u16string base(prefix, u'a');
+		inputs.push_back(base + u'\xd800');
+		inputs.push_back(base + u'\xd800' + u'a');
+		inputs.push_back(base + u'\xdc00' + u"tail");
+		inputs.push_back(base + u'\xd800' + u'\xd800' + u'\xdc00');
+	}
+	for (auto& input : inputs)
+	{
+		bool success;
+		EXPECT_TRUE(ToUtf8(input, success).empty());
+		EXPECT_FALSE(success);
+	}
+}
+
+TEST(Transcode, MalformedUtf8FailsWithEmptyOutput)
+{
+	const std::string BAD[] = {
+		"\x80",             // stray continuation
+		"\xc0\xaf",         // overlong
+		"\xe0\x80\xaf",     // overlong
+		"\xed\xa0\x80",     // encoded surrogate
+		"\xf4\x90\x80\x80", // past U+10FFFF
+		"\xe4\xb8",         // truncated
+		"\xf8\x88\x80\x80\x80",
+		"\xff",
+	};
+	for (auto& bad : BAD)
+	{
+		for (size_t prefix : {0, 31, 32, 33, 64})
+		{
+			std::string input = std::string(prefix, 'a') + bad + "zz";
+			bool success;
+			EXPECT_TRUE(ToUtf16(input, success).empty());
+			EXPECT_FALSE(success);
+			std::wstring wide;
+			EXPECT_FALSE(Transcode::Utf8ToWide(input, wide));
+			EXPECT_TRUE(wide.empty());
+		}
+	}
+}
+
+TEST(Transcode, WideRoundTrip)
+{
+	std::wstring wide = L"C:\\Fonts\\\u601d\u6e90\u9ed1\u4f53 \U0001f600.ttc";
+	std::string utf8;
+	ASSERT_TRUE(Transcode::WideToUtf8(wide, utf8));
+	std::wstring back;
+	ASSERT_TRUE(Transcode::Utf8ToWide(utf8, back));
+	EXPECT_EQ(back, wide);
+
+	std::wstring invalid = L"abc";
+	invalid.push_back(static_cast<wchar_t>(0xdc00));
+	utf8 = "left over";
+	EXPECT_FALSE(Transcode::WideToUtf8(invalid, utf8));
+	EXPECT_TRUE(utf8.empty());
+}
+
+TEST(Transcode, Utf16BigEndian)
+{
+	for (size_t count = 0; count < 50; ++count)
+	{
+		std::vector<uint8_t> bytes;
+		std::vector<uint16_t> expected;
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint16_t unit = static_cast<uint16_t>(0x4e00 + i * 7);
+			bytes.push_back(static_cast<uint8_t>(unit >> 8));
+			bytes.push_back(static_cast<uint8_t>(unit));
+			expected.push_back(unit);
+		}
+		std::vector<uint16_t> result(count);
+		Transcode::Utf16BEToUtf16(bytes.data(), count, result.data());
+		EXPECT_EQ(result, expected);
+	}
+}